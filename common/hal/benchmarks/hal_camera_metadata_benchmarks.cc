@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "HalCameraMetadataBenchmarks"
+#include <log/log.h>
+
+#include <benchmark/benchmark.h>
+#include <system/camera_metadata.h>
+
+#include <memory>
+#include <vector>
+
+#include "hal_camera_metadata.h"
+
+namespace android {
+namespace google_camera_hal {
+
+// Metadata with one value for each built-in tag, about the number of entries
+// of static characteristics.
+struct TaggedMetadata {
+  std::unique_ptr<HalCameraMetadata> metadata;
+  std::vector<uint32_t> tags;
+};
+
+static TaggedMetadata CreateTaggedMetadata(bool frozen) {
+  // Large enough for a value of any type.
+  static constexpr uint8_t kValue[8] = {};
+
+  TaggedMetadata tagged_metadata;
+  tagged_metadata.metadata = HalCameraMetadata::Create(0, 0);
+  for (uint32_t section = 0; section < ANDROID_SECTION_COUNT; section++) {
+    for (uint32_t tag = camera_metadata_section_bounds[section][0];
+         tag < camera_metadata_section_bounds[section][1]; tag++) {
+      int32_t type = get_camera_metadata_tag_type(tag);
+      if (type < 0) {
+        continue;
+      }
+
+      camera_metadata_ro_entry entry = {};
+      entry.tag = tag;
+      entry.type = type;
+      entry.count = 1;
+      entry.data.u8 = kValue;
+      if (tagged_metadata.metadata->Set(entry) == OK) {
+        tagged_metadata.tags.push_back(tag);
+      }
+    }
+  }
+
+  if (frozen && tagged_metadata.metadata->Freeze() != OK) {
+    tagged_metadata.tags.clear();
+  }
+
+  return tagged_metadata;
+}
+
+// Looks up all tags of a metadata shared by all threads, like the static
+// characteristics read by the request and result paths of a session.
+template <bool frozen>
+static void BM_GetSharedMetadata(benchmark::State& state) {
+  static const TaggedMetadata tagged_metadata = CreateTaggedMetadata(frozen);
+  const HalCameraMetadata* metadata = tagged_metadata.metadata.get();
+  const std::vector<uint32_t>& tags = tagged_metadata.tags;
+  if (tags.empty()) {
+    state.SkipWithError("No tags were set");
+    return;
+  }
+
+  size_t tag_index = 0;
+  camera_metadata_ro_entry entry;
+  for (auto _ : state) {
+    if (metadata->Get(tags[tag_index], &entry) != OK) {
+      state.SkipWithError("Getting a tag failed");
+      break;
+    }
+    benchmark::DoNotOptimize(entry);
+    tag_index = (tag_index + 1) % tags.size();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["entries"] =
+      benchmark::Counter(tags.size(), benchmark::Counter::kAvgThreads);
+}
+BENCHMARK_TEMPLATE(BM_GetSharedMetadata, false)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_GetSharedMetadata, true)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ResultDispatcherBenchmarks"
+#include <log/log.h>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include "frame_number_ring.h"
+#include "hal_types.h"
+#include "result_dispatcher.h"
+
+namespace android {
+namespace google_camera_hal {
+
+// The ordered map based storage that ResultDispatcher used for its pending
+// shutters, result metadata and buffers, with the interface of
+// FrameNumberRing.
+template <typename T>
+class FrameNumberMap {
+ public:
+  explicit FrameNumberMap(size_t /*capacity*/) {
+  }
+
+  bool Insert(uint32_t frame_number, T value) {
+    return map_.emplace(frame_number, std::move(value)).second;
+  }
+
+  T* Find(uint32_t frame_number) {
+    auto it = map_.find(frame_number);
+    return it != map_.end() ? &it->second : nullptr;
+  }
+
+  void Erase(uint32_t frame_number) {
+    map_.erase(frame_number);
+  }
+
+  T* Front(uint32_t* frame_number) {
+    auto it = map_.begin();
+    if (it == map_.end()) {
+      return nullptr;
+    }
+
+    *frame_number = it->first;
+    return &it->second;
+  }
+
+  void PopFront() {
+    if (!map_.empty()) {
+      map_.erase(map_.begin());
+    }
+  }
+
+ private:
+  std::map<uint32_t, T> map_;
+};
+
+// Mirrors the pending state of ResultDispatcher.
+template <template <typename> class Container>
+class PendingState {
+ public:
+  static constexpr size_t kCapacity = 32;
+
+  struct PendingShutter {
+    int64_t timestamp_ns = 0;
+    bool ready = false;
+  };
+
+  struct PendingBuffer {
+    StreamBuffer buffer = {};
+    bool ready = false;
+  };
+
+  struct PendingFinalResultMetadata {
+    std::unique_ptr<HalCameraMetadata> metadata;
+    bool ready = false;
+  };
+
+  // ResultDispatcher::AddPendingRequest()
+  void AddPendingRequest(uint32_t frame_number, uint32_t num_streams) {
+    shutters_.Insert(frame_number, PendingShutter());
+    final_metadata_.Insert(frame_number, PendingFinalResultMetadata());
+    for (uint32_t stream_id = 0; stream_id < num_streams; stream_id++) {
+      buffers_.try_emplace(stream_id, kCapacity)
+          .first->second.Insert(frame_number, PendingBuffer());
+    }
+  }
+
+  // ResultDispatcher::AddShutter() and AddResult()
+  void AddResult(uint32_t frame_number, uint32_t num_streams) {
+    shutters_.Find(frame_number)->ready = true;
+    final_metadata_.Find(frame_number)->ready = true;
+    for (uint32_t stream_id = 0; stream_id < num_streams; stream_id++) {
+      buffers_.find(stream_id)->second.Find(frame_number)->ready = true;
+    }
+  }
+
+  // ResultDispatcher::NotifyCallbackThreadLoop(), returns the number of
+  // delivered items.
+  size_t Notify() {
+    size_t delivered = 0;
+    uint32_t frame_number;
+    PendingShutter* shutter;
+    while ((shutter = shutters_.Front(&frame_number)) != nullptr &&
+           shutter->ready) {
+      shutters_.PopFront();
+      delivered++;
+    }
+
+    PendingFinalResultMetadata* metadata;
+    while ((metadata = final_metadata_.Front(&frame_number)) != nullptr &&
+           metadata->ready) {
+      final_metadata_.PopFront();
+      delivered++;
+    }
+
+    for (auto& [stream_id, buffers] : buffers_) {
+      PendingBuffer* buffer;
+      while ((buffer = buffers.Front(&frame_number)) != nullptr &&
+             buffer->ready) {
+        buffers.PopFront();
+        delivered++;
+      }
+    }
+
+    return delivered;
+  }
+
+ private:
+  Container<PendingShutter> shutters_{kCapacity};
+  Container<PendingFinalResultMetadata> final_metadata_{kCapacity};
+  std::map<uint32_t, Container<PendingBuffer>> buffers_;
+};
+
+// Runs the pending state bookkeeping of ResultDispatcher for a stream of
+// frames, each one added 'in_flight' frames ahead of its results.
+// Args: streams, number of output buffers per frame. in_flight, number of
+// pending requests.
+template <template <typename> class Container>
+static void BM_PendingState(benchmark::State& state) {
+  uint32_t num_streams = state.range(0);
+  uint32_t in_flight = state.range(1);
+  PendingState<Container> pending_state;
+  for (uint32_t frame_number = 0; frame_number < in_flight; frame_number++) {
+    pending_state.AddPendingRequest(frame_number, num_streams);
+  }
+
+  uint32_t frame_number = 0;
+  size_t delivered = 0;
+  for (auto _ : state) {
+    pending_state.AddPendingRequest(frame_number + in_flight, num_streams);
+    pending_state.AddResult(frame_number, num_streams);
+    delivered += pending_state.Notify();
+    frame_number++;
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["items_per_frame"] =
+      benchmark::Counter(delivered, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK_TEMPLATE(BM_PendingState, FrameNumberMap)
+    ->ArgNames({"streams", "in_flight"})
+    ->ArgsProduct({{1, 4}, {4, 16}});
+BENCHMARK_TEMPLATE(BM_PendingState, FrameNumberRing)
+    ->ArgNames({"streams", "in_flight"})
+    ->ArgsProduct({{1, 4}, {4, 16}});
+
+// Feeds requests, shutters, result metadata and buffers through a
+// ResultDispatcher, including its callback thread.
+// Args: streams, number of output buffers per frame. in_flight, number of
+// pending requests.
+static void BM_ResultDispatcher(benchmark::State& state) {
+  static constexpr uint32_t kPartialResultCount = 1;
+  static constexpr uint32_t kNumEntries = 8;
+  static constexpr uint32_t kDataBytes = 64;
+
+  uint32_t num_streams = state.range(0);
+  uint32_t in_flight = state.range(1);
+  std::atomic<uint32_t> delivered_frames = 0;
+  auto dispatcher = ResultDispatcher::Create(
+      kPartialResultCount,
+      [&](std::unique_ptr<CaptureResult> result) {
+        if (result->result_metadata != nullptr) {
+          delivered_frames++;
+        }
+      },
+      [](const NotifyMessage& /*message*/) {});
+  if (dispatcher == nullptr) {
+    state.SkipWithError("Creating ResultDispatcher failed");
+    return;
+  }
+
+  auto add_pending_request = [&](uint32_t frame_number) {
+    CaptureRequest request = {.frame_number = frame_number};
+    for (uint32_t stream_id = 0; stream_id < num_streams; stream_id++) {
+      request.output_buffers.push_back(
+          {.stream_id = static_cast<int32_t>(stream_id)});
+    }
+    return dispatcher->AddPendingRequest(request);
+  };
+
+  for (uint32_t frame_number = 0; frame_number < in_flight; frame_number++) {
+    add_pending_request(frame_number);
+  }
+
+  uint32_t frame_number = 0;
+  for (auto _ : state) {
+    auto result = std::make_unique<CaptureResult>(CaptureResult({}));
+    result->frame_number = frame_number;
+    result->partial_result = kPartialResultCount;
+    result->result_metadata =
+        HalCameraMetadata::Create(kNumEntries, kDataBytes);
+    for (uint32_t stream_id = 0; stream_id < num_streams; stream_id++) {
+      result->output_buffers.push_back(
+          {.stream_id = static_cast<int32_t>(stream_id)});
+    }
+
+    if ((add_pending_request(frame_number + in_flight) != OK) ||
+        (dispatcher->AddShutter(frame_number, frame_number) != OK) ||
+        (dispatcher->AddResult(std::move(result)) != OK)) {
+      state.SkipWithError("Dispatching results failed");
+      break;
+    }
+    frame_number++;
+  }
+
+  // Let the callback thread deliver the remaining results before the
+  // dispatcher goes away.
+  while (delivered_frames < frame_number) {
+    std::this_thread::yield();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ResultDispatcher)
+    ->ArgNames({"streams", "in_flight"})
+    ->ArgsProduct({{1, 4}, {4, 16}})
+    ->UseRealTime();
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -365,6 +365,10 @@ struct BufferReturn {
 using ProcessCaptureResultFunc =
     std::function<void(std::unique_ptr<CaptureResult> /*result*/)>;
 
+// Callback function invoked to process a batch of capture results.
+using ProcessBatchCaptureResultFunc = std::function<void(
+    std::vector<std::unique_ptr<CaptureResult>> /*results*/)>;
+
 // Callback function invoked to notify messages.
 using NotifyFunc = std::function<void(const NotifyMessage& /*message*/)>;
 
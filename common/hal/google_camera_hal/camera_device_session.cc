@@ -372,6 +372,12 @@ status_t CameraDeviceSession::Initialize(
 
   InitializeCallbacks();
 
+  metadata_arena_ = HalCameraMetadataArena::Create();
+  if (metadata_arena_ == nullptr) {
+    ALOGE("%s: Creating metadata arena failed.", __FUNCTION__);
+    return NO_MEMORY;
+  }
+
   std::unique_ptr<google_camera_hal::HalCameraMetadata> characteristics;
   res = device_session_hwl_->GetCameraCharacteristics(&characteristics);
   if (res != OK) {
@@ -758,11 +764,14 @@ status_t CameraDeviceSession::CreateCaptureRequestLocked(
   }
 
   if (request.settings != nullptr) {
-    last_request_settings_ = HalCameraMetadata::Clone(request.settings.get());
+    last_request_settings_ = HalCameraMetadata::Clone(
+        request.settings.get(), settings_capacity_hint_, metadata_arena_);
   }
 
   updated_request->frame_number = request.frame_number;
-  updated_request->settings = HalCameraMetadata::Clone(request.settings.get());
+  // Leave room for the values added below, as learned from previous requests.
+  updated_request->settings = HalCameraMetadata::Clone(
+      request.settings.get(), settings_capacity_hint_, metadata_arena_);
   updated_request->input_buffers = request.input_buffers;
   updated_request->input_buffer_metadata.clear();
   updated_request->output_buffers = request.output_buffers;
@@ -772,8 +781,9 @@ status_t CameraDeviceSession::CreateCaptureRequestLocked(
     // Create settings to set thermal throttling key if needed.
     if (thermal_throttling_ && !thermal_throttling_notified_ &&
         updated_request->settings == nullptr) {
-      updated_request->settings =
-          HalCameraMetadata::Clone(last_request_settings_.get());
+      updated_request->settings = HalCameraMetadata::Clone(
+          last_request_settings_.get(), settings_capacity_hint_,
+          metadata_arena_);
       thermal_throttling_notified_ = true;
     }
 
@@ -812,6 +822,7 @@ status_t CameraDeviceSession::CreateCaptureRequestLocked(
   }
 
   zoom_ratio_mapper_.UpdateCaptureRequest(updated_request);
+  settings_capacity_hint_.Update(updated_request->settings.get());
 
   return OK;
 }
@@ -1297,6 +1308,8 @@ status_t CameraDeviceSession::AddImportedBufferHandlesLocked(
 void CameraDeviceSession::RemoveBufferCache(
     const std::vector<BufferCache>& buffer_caches) {
   ATRACE_CALL();
+  device_session_hwl_->RemoveBufferCache(buffer_caches);
+
   std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
 
   for (auto& buffer_cache : buffer_caches) {
@@ -344,6 +344,12 @@ class CameraDeviceSession {
   // Last valid settings in capture request. Must be protected by session_lock_.
   std::unique_ptr<HalCameraMetadata> last_request_settings_;
 
+  // Recycles the buffers of the request settings copied by this session.
+  std::shared_ptr<HalCameraMetadataArena> metadata_arena_;
+
+  // Capacity of the request settings after the session added its values.
+  MetadataCapacityHint settings_capacity_hint_;
+
   // If thermal status has become >= ThrottlingSeverity::Severe since stream
   // configuration.
   // Must be protected by session_lock_.
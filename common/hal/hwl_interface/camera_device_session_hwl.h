@@ -114,6 +114,13 @@ class CameraDeviceSessionHwl {
   // Flush all pending requests.
   virtual status_t Flush() = 0;
 
+  // Remove the buffer caches the HWL may keep for the given stream buffers.
+  // The framework won't send these buffers again, unless it reuses the buffer
+  // id of a removed buffer for a new buffer.
+  virtual void RemoveBufferCache(
+      const std::vector<BufferCache>& /*buffer_caches*/) {
+  }
+
   // Return the camera ID that this camera device session is associated with.
   virtual uint32_t GetCameraId() const = 0;
 
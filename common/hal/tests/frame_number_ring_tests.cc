@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameNumberRingTests"
+#include <log/log.h>
+
+#include <frame_number_ring.h>
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr size_t kRingCapacity = 4;
+
+// Drain 'ring' and return the frame numbers in the order they were popped.
+static std::vector<uint32_t> DrainFrameNumbers(FrameNumberRing<int>* ring) {
+  std::vector<uint32_t> frame_numbers;
+  uint32_t frame_number;
+  while (ring->Front(&frame_number) != nullptr) {
+    frame_numbers.push_back(frame_number);
+    ring->PopFront();
+  }
+
+  return frame_numbers;
+}
+
+TEST(FrameNumberRingTests, InsertAndFind) {
+  FrameNumberRing<int> ring(kRingCapacity);
+  EXPECT_TRUE(ring.Empty());
+
+  EXPECT_TRUE(ring.Insert(10, 100));
+  EXPECT_TRUE(ring.Insert(11, 110));
+  EXPECT_FALSE(ring.Insert(10, 101)) << "Duplicated frame number inserted.";
+
+  ASSERT_NE(ring.Find(10), nullptr);
+  EXPECT_EQ(*ring.Find(10), 100);
+  ASSERT_NE(ring.Find(11), nullptr);
+  EXPECT_EQ(*ring.Find(11), 110);
+  EXPECT_EQ(ring.Find(12), nullptr);
+  EXPECT_EQ(ring.Size(), 2u);
+  EXPECT_EQ(ring.OverflowSize(), 0u);
+
+  ring.Erase(10);
+  EXPECT_EQ(ring.Find(10), nullptr);
+  EXPECT_EQ(ring.Size(), 1u);
+}
+
+TEST(FrameNumberRingTests, FrontFollowsFrameNumbers) {
+  FrameNumberRing<int> ring(kRingCapacity);
+  for (uint32_t frame_number : {3, 1, 2, 4}) {
+    ASSERT_TRUE(ring.Insert(frame_number, frame_number));
+  }
+
+  // Frames 1 and 2 are older than the ring head and fall back to the overflow
+  // map.
+  EXPECT_EQ(ring.OverflowSize(), 2u);
+  EXPECT_EQ(DrainFrameNumbers(&ring), std::vector<uint32_t>({1, 2, 3, 4}));
+  EXPECT_TRUE(ring.Empty());
+}
+
+TEST(FrameNumberRingTests, OverflowBeyondCapacity) {
+  FrameNumberRing<int> ring(kRingCapacity);
+  for (uint32_t frame_number = 0; frame_number < 3 * kRingCapacity;
+       frame_number++) {
+    ASSERT_TRUE(ring.Insert(frame_number, frame_number));
+  }
+
+  EXPECT_EQ(ring.Size(), 3 * kRingCapacity);
+  EXPECT_EQ(ring.OverflowSize(), 2 * kRingCapacity);
+  for (uint32_t frame_number = 0; frame_number < 3 * kRingCapacity;
+       frame_number++) {
+    ASSERT_NE(ring.Find(frame_number), nullptr);
+    EXPECT_EQ(*ring.Find(frame_number), static_cast<int>(frame_number));
+  }
+
+  std::vector<uint32_t> expected_frame_numbers;
+  ring.ForEach([&](uint32_t frame_number, int) {
+    expected_frame_numbers.push_back(frame_number);
+  });
+  EXPECT_EQ(DrainFrameNumbers(&ring), expected_frame_numbers);
+  EXPECT_EQ(expected_frame_numbers.size(), 3 * kRingCapacity);
+}
+
+TEST(FrameNumberRingTests, SustainedOverflow) {
+  static constexpr uint32_t kInFlight = 32;
+  static constexpr uint32_t kNumFrames = 1000;
+
+  FrameNumberRing<int> ring(kRingCapacity);
+  uint32_t next_frame_number = 0;
+  for (; next_frame_number < kInFlight; next_frame_number++) {
+    ASSERT_TRUE(ring.Insert(next_frame_number, next_frame_number));
+  }
+
+  // Completing the oldest frame moves the next one from the overflow map into
+  // the ring, which stays full.
+  for (uint32_t front_frame_number = 0; front_frame_number < kNumFrames;
+       front_frame_number++) {
+    uint32_t frame_number;
+    ASSERT_NE(ring.Front(&frame_number), nullptr);
+    ASSERT_EQ(frame_number, front_frame_number);
+    ring.PopFront();
+    ASSERT_TRUE(ring.Insert(next_frame_number, next_frame_number));
+    next_frame_number++;
+
+    ASSERT_EQ(ring.Size(), kInFlight);
+    ASSERT_EQ(ring.OverflowSize(), kInFlight - kRingCapacity)
+        << "Frame " << front_frame_number << " left the ring underused.";
+  }
+
+  std::vector<uint32_t> expected_frame_numbers;
+  for (uint32_t frame_number = kNumFrames; frame_number < next_frame_number;
+       frame_number++) {
+    expected_frame_numbers.push_back(frame_number);
+  }
+  EXPECT_EQ(DrainFrameNumbers(&ring), expected_frame_numbers);
+}
+
+TEST(FrameNumberRingTests, HeadSkipsErasedFrames) {
+  FrameNumberRing<int> ring(kRingCapacity);
+  for (uint32_t frame_number = 0; frame_number < kRingCapacity;
+       frame_number++) {
+    ASSERT_TRUE(ring.Insert(frame_number, frame_number));
+  }
+
+  ring.Erase(1);
+  ring.Erase(0);
+  uint32_t frame_number;
+  ASSERT_NE(ring.Front(&frame_number), nullptr);
+  EXPECT_EQ(frame_number, 2u);
+
+  // The window moved past the erased frames, new frames fit in the ring.
+  ASSERT_TRUE(ring.Insert(kRingCapacity, kRingCapacity));
+  ASSERT_TRUE(ring.Insert(kRingCapacity + 1, kRingCapacity + 1));
+  EXPECT_EQ(ring.OverflowSize(), 0u);
+  EXPECT_EQ(DrainFrameNumbers(&ring),
+            std::vector<uint32_t>({2, 3, kRingCapacity, kRingCapacity + 1}));
+}
+
+TEST(FrameNumberRingTests, MovesValues) {
+  FrameNumberRing<std::unique_ptr<int>> ring(kRingCapacity);
+  ASSERT_TRUE(ring.Insert(0, std::make_unique<int>(7)));
+
+  uint32_t frame_number;
+  auto value = ring.Front(&frame_number);
+  ASSERT_NE(value, nullptr);
+  ASSERT_NE(*value, nullptr);
+  EXPECT_EQ(**value, 7);
+
+  ring.PopFront();
+  EXPECT_TRUE(ring.Empty());
+}
+
+TEST(FrameNumberRingTests, MatchesOrderedMap) {
+  static constexpr uint32_t kNumOperations = 10000;
+  static constexpr uint32_t kMaxInFlight = 2 * kRingCapacity;
+
+  FrameNumberRing<int> ring(kRingCapacity);
+  std::map<uint32_t, int> reference;
+  std::mt19937 random_engine(1);
+  uint32_t next_frame_number = 0;
+
+  for (uint32_t i = 0; i < kNumOperations; i++) {
+    switch (random_engine() % 3) {
+      case 0:
+        if (reference.size() < kMaxInFlight) {
+          // Mostly increasing frame numbers, with some going backwards.
+          uint32_t frame_number = next_frame_number++;
+          if (random_engine() % 8 == 0 && frame_number > kMaxInFlight) {
+            frame_number -= random_engine() % kMaxInFlight;
+          }
+          bool inserted = reference.emplace(frame_number, i).second;
+          ASSERT_EQ(ring.Insert(frame_number, i), inserted);
+        }
+        break;
+      case 1:
+        if (!reference.empty()) {
+          auto it = reference.begin();
+          std::advance(it, random_engine() % reference.size());
+          ring.Erase(it->first);
+          reference.erase(it);
+        }
+        break;
+      default:
+        ring.PopFront();
+        if (!reference.empty()) {
+          reference.erase(reference.begin());
+        }
+        break;
+    }
+
+    ASSERT_EQ(ring.Size(), reference.size());
+    uint32_t frame_number;
+    int* value = ring.Front(&frame_number);
+    if (reference.empty()) {
+      ASSERT_EQ(value, nullptr);
+    } else {
+      ASSERT_NE(value, nullptr);
+      ASSERT_EQ(frame_number, reference.begin()->first);
+      ASSERT_EQ(*value, reference.begin()->second);
+    }
+  }
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
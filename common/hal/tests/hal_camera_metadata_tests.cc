@@ -21,6 +21,11 @@
 #include <hal_camera_metadata.h>
 #include <system/camera_metadata.h>
 
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
 namespace android {
 namespace google_camera_hal {
 
@@ -355,5 +360,186 @@ TEST(HalCameraMetadataTests, GetByEntryIndex) {
   ASSERT_NE(res, OK) << "Get invalid index 1 failed";
 }
 
+// Set the values of a frame's result metadata, including a lens shading map
+// that doesn't fit into a small metadata.
+static void SetFrameMetadata(HalCameraMetadata* hal_metadata,
+                             uint32_t frame_number) {
+  static constexpr uint32_t kShadingMapSize = 4 * 17 * 13;
+
+  int64_t exposure_time_ns = 1000000 + frame_number;
+  ASSERT_EQ(
+      hal_metadata->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time_ns, 1),
+      OK);
+  int32_t sensitivity = 100;
+  ASSERT_EQ(hal_metadata->Set(ANDROID_SENSOR_SENSITIVITY, &sensitivity, 1), OK);
+  std::vector<float> shading_map(kShadingMapSize, 1.0f);
+  ASSERT_EQ(hal_metadata->Set(ANDROID_STATISTICS_LENS_SHADING_MAP,
+                              shading_map.data(), shading_map.size()),
+            OK);
+}
+
+// Counts the camera_metadata buffers the arena allocates per frame. The
+// HalCameraMetadata objects themselves are not counted.
+TEST(HalCameraMetadataTests, ArenaAllocationsPerFrame) {
+  static constexpr uint32_t kNumFrames = 10;
+
+  auto arena = HalCameraMetadataArena::Create();
+  ASSERT_NE(arena, nullptr) << "Creating arena failed.";
+  MetadataCapacityHint hint;
+  std::vector<uint64_t> allocations_per_frame;
+
+  for (uint32_t frame_number = 0; frame_number < kNumFrames; frame_number++) {
+    uint64_t allocations = arena->GetStatistics().allocations;
+    auto hal_metadata = HalCameraMetadata::Create(hint, arena);
+    ASSERT_NE(hal_metadata, nullptr) << "Creating hal_metadata failed.";
+    const camera_metadata_t* metadata = hal_metadata->GetRawCameraMetadata();
+
+    SetFrameMetadata(hal_metadata.get(), frame_number);
+    if (frame_number > 0) {
+      // The hint already covers the values of the frame.
+      EXPECT_EQ(hal_metadata->GetRawCameraMetadata(), metadata)
+          << "Frame " << frame_number << " needed a larger metadata.";
+    }
+
+    hint.Update(hal_metadata.get());
+    hal_metadata = nullptr;
+    allocations_per_frame.push_back(arena->GetStatistics().allocations -
+                                    allocations);
+  }
+
+  // The first frame grows from an empty metadata and the second one allocates
+  // a buffer of the size class learned by the hint. Later frames only recycle
+  // buffers.
+  EXPECT_GT(allocations_per_frame[0], 1u);
+  EXPECT_LE(allocations_per_frame[1], 1u);
+  for (uint32_t frame_number = 2; frame_number < kNumFrames; frame_number++) {
+    EXPECT_EQ(allocations_per_frame[frame_number], 0u)
+        << "Frame " << frame_number << " allocated a metadata buffer.";
+  }
+  EXPECT_EQ(arena->GetStatistics().frees, 0u);
+}
+
+TEST(HalCameraMetadataTests, CloneWithCapacityHint) {
+  auto arena = HalCameraMetadataArena::Create();
+  ASSERT_NE(arena, nullptr) << "Creating arena failed.";
+  MetadataCapacityHint hint;
+
+  auto frame_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  ASSERT_NE(frame_metadata, nullptr) << "Creating frame_metadata failed.";
+  SetFrameMetadata(frame_metadata.get(), /*frame_number=*/0);
+  hint.Update(frame_metadata.get());
+  EXPECT_EQ(hint.GetEntryCapacity(), frame_metadata->GetEntryCount());
+  EXPECT_EQ(hint.GetDataCapacity(), frame_metadata->GetDataCount());
+
+  auto settings = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  ASSERT_NE(settings, nullptr) << "Creating settings failed.";
+  int64_t exposure_time_ns = 1000000;
+  ASSERT_EQ(settings->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time_ns, 1),
+            OK);
+
+  auto hal_metadata = HalCameraMetadata::Clone(settings.get(), hint, arena);
+  ASSERT_NE(hal_metadata, nullptr) << "Cloning hal_metadata failed.";
+  camera_metadata_ro_entry entry;
+  ASSERT_EQ(hal_metadata->Get(ANDROID_SENSOR_EXPOSURE_TIME, &entry), OK);
+  EXPECT_EQ(*entry.data.i64, exposure_time_ns);
+
+  const camera_metadata_t* metadata = hal_metadata->GetRawCameraMetadata();
+  SetFrameMetadata(hal_metadata.get(), /*frame_number=*/1);
+  EXPECT_EQ(hal_metadata->GetRawCameraMetadata(), metadata)
+      << "Cloned metadata needed a larger metadata.";
+
+  // Metadata released from an arena is still freed by the caller.
+  camera_metadata_t* released_metadata = hal_metadata->ReleaseCameraMetadata();
+  ASSERT_NE(released_metadata, nullptr);
+  free_camera_metadata(released_metadata);
+}
+
+TEST(HalCameraMetadataTests, FreezeMetadata) {
+  auto hal_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  ASSERT_NE(hal_metadata, nullptr) << "Creating hal_metadata failed.";
+  SetFrameMetadata(hal_metadata.get(), /*frame_number=*/0);
+
+  // ANDROID_COLOR_CORRECTION_MODE is tag 0.
+  uint8_t color_correction_mode = ANDROID_COLOR_CORRECTION_MODE_FAST;
+  ASSERT_EQ(hal_metadata->Set(ANDROID_COLOR_CORRECTION_MODE,
+                              &color_correction_mode, 1),
+            OK);
+  size_t entry_count = hal_metadata->GetEntryCount();
+  size_t data_count = hal_metadata->GetDataCount();
+
+  EXPECT_FALSE(hal_metadata->IsFrozen());
+  ASSERT_EQ(hal_metadata->Freeze(), OK);
+  EXPECT_TRUE(hal_metadata->IsFrozen());
+  EXPECT_EQ(hal_metadata->Freeze(), OK) << "Freezing twice failed.";
+
+  // Reads of a frozen metadata.
+  camera_metadata_ro_entry entry;
+  ASSERT_EQ(hal_metadata->Get(ANDROID_SENSOR_EXPOSURE_TIME, &entry), OK);
+  EXPECT_EQ(*entry.data.i64, 1000000);
+  ASSERT_EQ(hal_metadata->Get(ANDROID_COLOR_CORRECTION_MODE, &entry), OK);
+  EXPECT_EQ(*entry.data.u8, color_correction_mode);
+  EXPECT_EQ(hal_metadata->Get(ANDROID_JPEG_QUALITY, &entry), NAME_NOT_FOUND);
+  for (size_t i = 0; i < entry_count; i++) {
+    ASSERT_EQ(hal_metadata->GetByIndex(&entry, i), OK);
+    camera_metadata_ro_entry tag_entry;
+    ASSERT_EQ(hal_metadata->Get(entry.tag, &tag_entry), OK);
+    EXPECT_EQ(tag_entry.index, i);
+  }
+  EXPECT_NE(hal_metadata->GetByIndex(&entry, entry_count), OK);
+  EXPECT_EQ(hal_metadata->GetEntryCount(), entry_count);
+  EXPECT_EQ(hal_metadata->GetDataCount(), data_count);
+
+  // Modifications of a frozen metadata.
+  int32_t sensitivity = 200;
+  EXPECT_EQ(hal_metadata->Set(ANDROID_SENSOR_SENSITIVITY, &sensitivity, 1),
+            INVALID_OPERATION);
+  EXPECT_EQ(hal_metadata->Erase(ANDROID_SENSOR_SENSITIVITY),
+            INVALID_OPERATION);
+  EXPECT_EQ(hal_metadata->Erase(std::unordered_set<uint32_t>(
+                {ANDROID_SENSOR_SENSITIVITY})),
+            INVALID_OPERATION);
+  auto other_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  ASSERT_NE(other_metadata, nullptr) << "Creating other_metadata failed.";
+  EXPECT_EQ(hal_metadata->Append(std::move(other_metadata)),
+            INVALID_OPERATION);
+  EXPECT_EQ(hal_metadata->GetEntryCount(), entry_count);
+
+  // A clone of a frozen metadata can be modified.
+  auto cloned_metadata = HalCameraMetadata::Clone(hal_metadata.get());
+  ASSERT_NE(cloned_metadata, nullptr) << "Cloning hal_metadata failed.";
+  EXPECT_FALSE(cloned_metadata->IsFrozen());
+  EXPECT_EQ(cloned_metadata->Set(ANDROID_SENSOR_SENSITIVITY, &sensitivity, 1),
+            OK);
+}
+
+TEST(HalCameraMetadataTests, ConcurrentReadsOfFrozenMetadata) {
+  static constexpr uint32_t kNumThreads = 4;
+  static constexpr uint32_t kNumReads = 1000;
+
+  auto hal_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  ASSERT_NE(hal_metadata, nullptr) << "Creating hal_metadata failed.";
+  SetFrameMetadata(hal_metadata.get(), /*frame_number=*/0);
+  ASSERT_EQ(hal_metadata->Freeze(), OK);
+
+  std::atomic<uint32_t> failed_reads = 0;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&] {
+      camera_metadata_ro_entry entry;
+      for (uint32_t read = 0; read < kNumReads; read++) {
+        if (hal_metadata->Get(ANDROID_SENSOR_SENSITIVITY, &entry) != OK ||
+            *entry.data.i32 != 100) {
+          failed_reads++;
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failed_reads, 0u);
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
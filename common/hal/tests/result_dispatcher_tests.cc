@@ -33,6 +33,11 @@ class ResultDispatcherTests : public ::testing::Test {
   // TODO(b/143902331): Test partial results.
   static constexpr uint32_t kPartialResult = 1;
   static constexpr uint32_t kResultWaitTimeMs = 30;
+  // Batches wait for the callback thread to be released from the notify gate.
+  static constexpr uint32_t kBatchWaitTimeMs = 1000;
+  // Many watchdog periods of ResultDispatcher, the wait ends as soon as the
+  // stall is reported.
+  static constexpr uint32_t kStallWaitTimeMs = 10000;
 
   // Defined a result metadata received from the result dispatcher.
   struct ReceivedResultMetadata {
@@ -70,8 +75,60 @@ class ResultDispatcherTests : public ::testing::Test {
         << "Creating ResultDispatcher failed";
   }
 
+  // Stop the callback thread before the received results are destroyed.
+  void TearDown() override {
+    result_dispatcher_ = nullptr;
+  }
+
+  // Replace the result dispatcher with one in batching mode.
+  void CreateBatchResultDispatcher() {
+    result_dispatcher_ = ResultDispatcher::Create(
+        kPartialResult,
+        [this](std::unique_ptr<CaptureResult> result) {
+          ProcessCaptureResult(std::move(result));
+        },
+        [this](const NotifyMessage& message) { Notify(message); },
+        [this](std::vector<std::unique_ptr<CaptureResult>> results) {
+          ProcessBatchCaptureResult(std::move(results));
+        });
+
+    ASSERT_NE(result_dispatcher_, nullptr)
+        << "Creating ResultDispatcher failed";
+  }
+
+  // Block the callback thread in the next shutter notification until
+  // OpenNotifyGate() is called.
+  void CloseNotifyGate() {
+    std::lock_guard<std::mutex> lock(gate_lock_);
+    gate_closed_ = true;
+  }
+
+  void OpenNotifyGate() {
+    std::lock_guard<std::mutex> lock(gate_lock_);
+    gate_closed_ = false;
+    gate_condition_.notify_all();
+  }
+
+  status_t WaitForNotifyGateBlocked() {
+    std::unique_lock<std::mutex> lock(gate_lock_);
+    bool blocked = gate_condition_.wait_for(
+        lock, std::chrono::milliseconds(kResultWaitTimeMs),
+        [&] { return gate_blocked_; });
+    return blocked ? OK : TIMED_OUT;
+  }
+
   // Invoked when receiving a shutter from the result dispatcher.
   void Notify(const NotifyMessage& message) {
+    {
+      std::unique_lock<std::mutex> lock(gate_lock_);
+      if (gate_closed_) {
+        gate_blocked_ = true;
+        gate_condition_.notify_all();
+        gate_condition_.wait(lock, [&] { return !gate_closed_; });
+        gate_blocked_ = false;
+      }
+    }
+
     if (message.type != MessageType::kShutter) {
       EXPECT_EQ(message.type, MessageType::kShutter)
           << "Received a non-shutter message.";
@@ -113,6 +170,25 @@ class ResultDispatcherTests : public ::testing::Test {
     callback_condition_.notify_one();
   }
 
+  // Invoked when receiving a batch of capture results from the result
+  // dispatcher.
+  void ProcessBatchCaptureResult(
+      std::vector<std::unique_ptr<CaptureResult>> results) {
+    std::vector<uint32_t> frame_numbers;
+    for (auto& result : results) {
+      ASSERT_NE(result, nullptr);
+      frame_numbers.push_back(result->frame_number);
+    }
+
+    for (auto& result : results) {
+      ProcessCaptureResult(std::move(result));
+    }
+
+    std::lock_guard<std::mutex> lock(callback_lock_);
+    received_batches_.push_back(frame_numbers);
+    callback_condition_.notify_one();
+  }
+
   // Add a bufffer to the received buffer queue.
   void ProcessReceivedBuffer(uint32_t frame_number, const StreamBuffer& buffer) {
     auto buffers_it = stream_received_buffers_map_.find(buffer.stream_id);
@@ -193,6 +269,31 @@ class ResultDispatcherTests : public ::testing::Test {
     return received ? OK : TIMED_OUT;
   }
 
+  status_t WaitForBatches(size_t num_frames) {
+    std::unique_lock<std::mutex> lock(callback_lock_);
+    bool received = callback_condition_.wait_for(
+        lock, std::chrono::milliseconds(kBatchWaitTimeMs), [&] {
+          size_t received_frames = 0;
+          for (auto& batch : received_batches_) {
+            received_frames += batch.size();
+          }
+          return received_frames >= num_frames;
+        });
+
+    return received ? OK : TIMED_OUT;
+  }
+
+  // Verify results within a batch are sorted by frame numbers and no frame is
+  // split across results of the same batch.
+  void VerifyBatchesOrder() {
+    std::lock_guard<std::mutex> lock(callback_lock_);
+    for (auto& batch : received_batches_) {
+      for (size_t i = 1; i < batch.size(); i++) {
+        EXPECT_LT(batch[i - 1], batch[i]);
+      }
+    }
+  }
+
   // Verify received shutters are sorted by frame numbers.
   void VerifyShuttersOrder() {
     std::lock_guard<std::mutex> lock(callback_lock_);
@@ -305,6 +406,17 @@ class ResultDispatcherTests : public ::testing::Test {
   // Protected by callback_lock_.
   std::unordered_map<int32_t, std::vector<ReceivedBuffer>>
       stream_received_buffers_map_;
+
+  // Frame numbers of the results in each received batch.
+  // Protected by callback_lock_.
+  std::vector<std::vector<uint32_t>> received_batches_;
+
+  std::mutex gate_lock_;
+  std::condition_variable gate_condition_;
+
+  // Protected by gate_lock_.
+  bool gate_closed_ = false;
+  bool gate_blocked_ = false;
 };
 
 TEST_F(ResultDispatcherTests, ShutterOrder) {
@@ -425,6 +537,154 @@ TEST_F(ResultDispatcherTests, ShutterOrderWithRemovePengingRequest) {
   VerifyShuttersOrder();
 }
 
+TEST_F(ResultDispatcherTests, BatchOutputBufferOrder) {
+  static constexpr int32_t kStreamIds[] = {5, 6};
+
+  CreateBatchResultDispatcher();
+
+  std::vector<uint32_t> unordered_frame_numbers = {3, 1, 4, 2, 5, 6};
+  std::vector<std::vector<StreamBuffer>> output_buffers;
+
+  for (uint32_t i = 0; i < unordered_frame_numbers.size(); i++) {
+    std::vector<StreamBuffer> buffers;
+    for (auto stream_id : kStreamIds) {
+      buffers.push_back({.stream_id = stream_id, .buffer_id = i});
+    }
+    output_buffers.push_back(buffers);
+  }
+
+  AddPendingRequestsToDispatcher(unordered_frame_numbers, output_buffers);
+
+  // Add unordered output buffers to dispatcher, one stream at a time.
+  for (auto stream_id : kStreamIds) {
+    for (uint32_t i = 0; i < unordered_frame_numbers.size(); i++) {
+      auto result = std::make_unique<CaptureResult>();
+      result->frame_number = unordered_frame_numbers[i];
+      result->partial_result = 0;
+      for (auto& buffer : output_buffers[i]) {
+        if (buffer.stream_id == stream_id) {
+          result->output_buffers.push_back(buffer);
+        }
+      }
+
+      EXPECT_EQ(result_dispatcher_->AddResult(std::move(result)), OK);
+    }
+  }
+
+  // Wait for all output buffers to be notified.
+  for (auto stream_id : kStreamIds) {
+    for (auto& frame_number : unordered_frame_numbers) {
+      EXPECT_EQ(WaitForOuptutBuffer(frame_number, stream_id), OK)
+          << "Waiting for output buffers of stream " << stream_id
+          << " for frame " << frame_number << " timed out.";
+    }
+  }
+
+  // Verify the buffers are received in the order of frame numbers.
+  VerifyBuffersOrder();
+  VerifyBatchesOrder();
+}
+
+TEST_F(ResultDispatcherTests, BatchMergesReadyResults) {
+  static constexpr uint64_t kFrameDurationNs = 100;
+  static constexpr int32_t kStreamIds[] = {5, 6};
+  static constexpr uint32_t kNumEntries = 10;
+  static constexpr uint32_t kDataBytes = 256;
+
+  CreateBatchResultDispatcher();
+
+  std::vector<uint32_t> unordered_frame_numbers = {4, 2, 1, 3, 6, 5};
+  std::vector<std::vector<StreamBuffer>> output_buffers;
+
+  for (uint32_t i = 0; i < unordered_frame_numbers.size(); i++) {
+    std::vector<StreamBuffer> buffers;
+    for (auto stream_id : kStreamIds) {
+      buffers.push_back({.stream_id = stream_id, .buffer_id = i});
+    }
+    output_buffers.push_back(buffers);
+  }
+
+  AddPendingRequestsToDispatcher(unordered_frame_numbers, output_buffers);
+
+  // Hold the callback thread in the first shutter so that all results below
+  // are ready by the next pass.
+  CloseNotifyGate();
+  ASSERT_EQ(result_dispatcher_->AddShutter(1, kFrameDurationNs), OK);
+  ASSERT_EQ(WaitForNotifyGateBlocked(), OK);
+
+  for (uint32_t i = 0; i < unordered_frame_numbers.size(); i++) {
+    auto result = std::make_unique<CaptureResult>();
+    result->frame_number = unordered_frame_numbers[i];
+    result->partial_result = kPartialResult;
+    result->result_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+    result->output_buffers = output_buffers[i];
+
+    EXPECT_EQ(result_dispatcher_->AddResult(std::move(result)), OK);
+  }
+
+  OpenNotifyGate();
+  ASSERT_EQ(WaitForBatches(unordered_frame_numbers.size()), OK);
+
+  // All frames are delivered in a single batch, one result per frame.
+  {
+    std::lock_guard<std::mutex> lock(callback_lock_);
+    ASSERT_EQ(received_batches_.size(), 1u);
+    EXPECT_EQ(received_batches_[0].size(), unordered_frame_numbers.size());
+    EXPECT_EQ(received_result_metadata_.size(), unordered_frame_numbers.size());
+    for (auto stream_id : kStreamIds) {
+      EXPECT_EQ(stream_received_buffers_map_[stream_id].size(),
+                unordered_frame_numbers.size());
+    }
+  }
+
+  VerifyResultMetadataOrder();
+  VerifyBuffersOrder();
+  VerifyBatchesOrder();
+}
+
+TEST_F(ResultDispatcherTests, WakeUpOnlyForDeliverableResults) {
+  static constexpr uint64_t kFrameDurationNs = 100;
+
+  std::vector<uint32_t> frame_numbers = {1, 2, 3};
+  AddPendingRequestsToDispatcher(frame_numbers);
+
+  // Shutters behind the oldest pending one must not wake up the callback
+  // thread.
+  ASSERT_EQ(result_dispatcher_->AddShutter(3, 3 * kFrameDurationNs), OK);
+  ASSERT_EQ(result_dispatcher_->AddShutter(2, 2 * kFrameDurationNs), OK);
+  std::this_thread::sleep_for(std::chrono::milliseconds(kResultWaitTimeMs));
+  EXPECT_EQ(result_dispatcher_->GetStatistics().wakeups, 0u);
+
+  ASSERT_EQ(result_dispatcher_->AddShutter(1, kFrameDurationNs), OK);
+  for (auto frame_number : frame_numbers) {
+    EXPECT_EQ(WaitForShutter(frame_number, frame_number * kFrameDurationNs), OK)
+        << "Waiting for shutter for frame " << frame_number << " timed out.";
+  }
+
+  // All shutters are delivered in a single wakeup.
+  ResultDispatcher::Statistics statistics = result_dispatcher_->GetStatistics();
+  EXPECT_EQ(statistics.wakeups, 1u);
+  EXPECT_EQ(statistics.empty_wakeups, 0u);
+  EXPECT_EQ(statistics.shutter_latency.count, frame_numbers.size());
+  VerifyShuttersOrder();
+}
+
+TEST_F(ResultDispatcherTests, WatchdogReportsStalls) {
+  AddPendingRequestsToDispatcher({1});
+
+  // The pending request never receives its results.
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(kStallWaitTimeMs);
+  while (result_dispatcher_->GetStatistics().stalls == 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kResultWaitTimeMs));
+  }
+
+  ResultDispatcher::Statistics statistics = result_dispatcher_->GetStatistics();
+  EXPECT_GE(statistics.stalls, 1u);
+  EXPECT_EQ(statistics.wakeups, 0u);
+}
+
 // TODO(b/138960498): Test errors like adding repeated pending requests and
 // repeated results.
 
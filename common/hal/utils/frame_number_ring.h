@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_FRAME_NUMBER_RING_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_FRAME_NUMBER_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+// FrameNumberRing maps frame numbers to values and keeps them sorted by frame
+// number, like std::map<uint32_t, T>. Frame numbers of in-flight requests are
+// dense and increasing, so values are stored in a fixed ring of slots indexed
+// by frame number modulo capacity, covering the window of 'capacity' frame
+// numbers that starts at the oldest value. Frame numbers outside of the
+// window fall back to an ordered map, so any sequence of frame numbers is
+// accepted. Values in the map move into the ring once the window reaches
+// them. The ring never allocates after construction. The capacity is rounded
+// up to a power of two.
+//
+// Not thread safe.
+template <typename T>
+class FrameNumberRing {
+ public:
+  explicit FrameNumberRing(size_t capacity) {
+    size_t slot_count = 1;
+    while (slot_count < capacity) {
+      slot_count <<= 1;
+    }
+    slots_.resize(slot_count);
+  }
+
+  // Returns false in case a value for 'frame_number' already exists.
+  bool Insert(uint32_t frame_number, T value) {
+    if (Find(frame_number) != nullptr) {
+      return false;
+    }
+
+    if (ring_size_ == 0) {
+      head_ = frame_number;
+    }
+
+    if (IsInWindow(frame_number)) {
+      FillSlot(frame_number, std::move(value));
+    } else {
+      overflow_.emplace(frame_number, std::move(value));
+    }
+
+    return true;
+  }
+
+  // Returns nullptr in case there is no value for 'frame_number'.
+  T* Find(uint32_t frame_number) {
+    if (IsInWindow(frame_number)) {
+      Slot& slot = GetSlot(frame_number);
+      if (slot.used && slot.frame_number == frame_number) {
+        return &slot.value;
+      }
+    }
+
+    auto it = overflow_.find(frame_number);
+    return it != overflow_.end() ? &it->second : nullptr;
+  }
+
+  void Erase(uint32_t frame_number) {
+    if (IsInWindow(frame_number)) {
+      Slot& slot = GetSlot(frame_number);
+      if (slot.used && slot.frame_number == frame_number) {
+        ReleaseSlot(&slot);
+        return;
+      }
+    }
+
+    overflow_.erase(frame_number);
+  }
+
+  // Returns the value with the smallest frame number or nullptr in case the
+  // ring is empty.
+  T* Front(uint32_t* frame_number /*out*/) {
+    Slot* slot = ring_size_ > 0 ? &GetSlot(head_) : nullptr;
+    auto it = overflow_.begin();
+    if (it != overflow_.end() &&
+        (slot == nullptr || it->first < slot->frame_number)) {
+      *frame_number = it->first;
+      return &it->second;
+    }
+
+    if (slot == nullptr) {
+      return nullptr;
+    }
+
+    *frame_number = slot->frame_number;
+    return &slot->value;
+  }
+
+  // Returns true in case 'frame_number' is the smallest frame number.
+  bool IsFront(uint32_t frame_number) {
+    uint32_t front_frame_number;
+    return (Front(&front_frame_number) != nullptr) &&
+           (front_frame_number == frame_number);
+  }
+
+  // Removes the value with the smallest frame number.
+  void PopFront() {
+    uint32_t frame_number;
+    if (Front(&frame_number) != nullptr) {
+      Erase(frame_number);
+    }
+  }
+
+  // Invokes 'visitor(frame_number, value)' for all values in the order of
+  // frame numbers.
+  template <typename Visitor>
+  void ForEach(Visitor visitor) {
+    auto it = overflow_.begin();
+    for (size_t i = 0, visited = 0; visited < ring_size_; i++) {
+      Slot& slot = GetSlot(head_ + i);
+      if (!slot.used) {
+        continue;
+      }
+
+      for (; it != overflow_.end() && it->first < slot.frame_number; it++) {
+        visitor(it->first, it->second);
+      }
+      visitor(slot.frame_number, slot.value);
+      visited++;
+    }
+
+    for (; it != overflow_.end(); it++) {
+      visitor(it->first, it->second);
+    }
+  }
+
+  bool Empty() const {
+    return Size() == 0;
+  }
+
+  size_t Size() const {
+    return ring_size_ + overflow_.size();
+  }
+
+  // Number of values that did not fit in the ring.
+  size_t OverflowSize() const {
+    return overflow_.size();
+  }
+
+ private:
+  struct Slot {
+    T value = {};
+    uint32_t frame_number = 0;
+    bool used = false;
+  };
+
+  Slot& GetSlot(uint32_t frame_number) {
+    return slots_[frame_number & (slots_.size() - 1)];
+  }
+
+  bool IsInWindow(uint32_t frame_number) const {
+    return (frame_number >= head_) &&
+           (frame_number - head_ < static_cast<uint64_t>(slots_.size()));
+  }
+
+  void FillSlot(uint32_t frame_number, T value) {
+    Slot& slot = GetSlot(frame_number);
+    slot.value = std::move(value);
+    slot.frame_number = frame_number;
+    slot.used = true;
+    ring_size_++;
+  }
+
+  // Resets 'slot' and moves the head to the next used slot.
+  void ReleaseSlot(Slot* slot) {
+    *slot = Slot();
+    ring_size_--;
+    while (ring_size_ > 0 && !GetSlot(head_).used) {
+      head_++;
+    }
+
+    MigrateOverflow();
+  }
+
+  // Moves the values of the overflow map that are in the window into the ring.
+  // An empty ring restarts at the smallest frame number of the map, so the
+  // ring only stays empty together with the map.
+  void MigrateOverflow() {
+    if (overflow_.empty()) {
+      return;
+    }
+
+    if (ring_size_ == 0) {
+      head_ = overflow_.begin()->first;
+    }
+
+    auto it = overflow_.lower_bound(head_);
+    while (it != overflow_.end() && IsInWindow(it->first)) {
+      FillSlot(it->first, std::move(it->second));
+      it = overflow_.erase(it);
+    }
+  }
+
+  std::vector<Slot> slots_;
+
+  // Smallest frame number stored in the ring, only valid when ring_size_ is
+  // larger than 0.
+  uint32_t head_ = 0;
+  size_t ring_size_ = 0;
+
+  // Values with frame numbers outside of the ring window.
+  std::map<uint32_t, T> overflow_;
+
+  FrameNumberRing(const FrameNumberRing&) = delete;
+  FrameNumberRing& operator=(const FrameNumberRing&) = delete;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_FRAME_NUMBER_RING_H_
@@ -21,6 +21,7 @@
 #include <utils/Trace.h>
 
 #include <inttypes.h>
+#include <algorithm>
 
 #include "hal_camera_metadata.h"
 
@@ -62,6 +63,36 @@ std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Create(
   return hal_metadata;
 }
 
+std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Create(
+    size_t entry_capacity, size_t data_capacity,
+    std::shared_ptr<HalCameraMetadataArena> arena) {
+  if (arena == nullptr) {
+    return Create(entry_capacity, data_capacity);
+  }
+
+  camera_metadata_t* metadata = arena->Allocate(entry_capacity, data_capacity);
+  if (metadata == nullptr) {
+    ALOGE("%s: Allocating camera metadata failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  auto hal_metadata = std::unique_ptr<HalCameraMetadata>(
+      new HalCameraMetadata(metadata, arena));
+  if (hal_metadata == nullptr) {
+    ALOGE("%s: Creating HalCameraMetadata failed.", __FUNCTION__);
+    arena->Recycle(metadata);
+    return nullptr;
+  }
+
+  return hal_metadata;
+}
+
+std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Create(
+    const MetadataCapacityHint& hint,
+    std::shared_ptr<HalCameraMetadataArena> arena) {
+  return Create(hint.GetEntryCapacity(), hint.GetDataCapacity(), arena);
+}
+
 std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Clone(
     const camera_metadata_t* metadata) {
   if (metadata == nullptr) {
@@ -93,16 +124,67 @@ std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Clone(
   return Clone(hal_metadata->metadata_);
 }
 
+std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Clone(
+    const HalCameraMetadata* hal_metadata, const MetadataCapacityHint& hint,
+    std::shared_ptr<HalCameraMetadataArena> arena) {
+  if (hal_metadata == nullptr) {
+    return nullptr;
+  }
+
+  const camera_metadata_t* metadata = hal_metadata->metadata_;
+  if (metadata == nullptr) {
+    ALOGE("%s: metadata cannot be nullptr.", __FUNCTION__);
+    return nullptr;
+  }
+
+  size_t entry_capacity = std::max(get_camera_metadata_entry_count(metadata),
+                                   hint.GetEntryCapacity());
+  size_t data_capacity = std::max(get_camera_metadata_data_count(metadata),
+                                  hint.GetDataCapacity());
+  auto cloned_metadata = Create(entry_capacity, data_capacity, arena);
+  if (cloned_metadata == nullptr) {
+    ALOGE("%s: Cloning camera metadata failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  status_t res = cloned_metadata->AppendMetadata(metadata);
+  if (res != OK) {
+    ALOGE("%s: Copying camera metadata failed: %s (%d)", __FUNCTION__,
+          strerror(-res), res);
+    return nullptr;
+  }
+
+  return cloned_metadata;
+}
+
 HalCameraMetadata::~HalCameraMetadata() {
   std::unique_lock<std::mutex> lock(metadata_lock_);
 
   if (metadata_ != nullptr) {
-    free_camera_metadata(metadata_);
+    FreeMetadata(metadata_);
+  }
+}
+
+HalCameraMetadata::HalCameraMetadata(
+    camera_metadata_t* metadata, std::shared_ptr<HalCameraMetadataArena> arena)
+    : metadata_(metadata), arena_(arena) {
+}
+
+camera_metadata_t* HalCameraMetadata::AllocateMetadata(
+    size_t entry_capacity, size_t data_capacity) const {
+  if (arena_ != nullptr) {
+    return arena_->Allocate(entry_capacity, data_capacity);
   }
+
+  return allocate_camera_metadata(entry_capacity, data_capacity);
 }
 
-HalCameraMetadata::HalCameraMetadata(camera_metadata_t* metadata)
-    : metadata_(metadata) {
+void HalCameraMetadata::FreeMetadata(camera_metadata_t* metadata) const {
+  if (arena_ != nullptr) {
+    arena_->Recycle(metadata);
+  } else {
+    free_camera_metadata(metadata);
+  }
 }
 
 camera_metadata_t* HalCameraMetadata::ReleaseCameraMetadata() {
@@ -110,6 +192,8 @@ camera_metadata_t* HalCameraMetadata::ReleaseCameraMetadata() {
 
   camera_metadata_t* metadata = metadata_;
   metadata_ = nullptr;
+  frozen_.store(false, std::memory_order_relaxed);
+  tag_index_.clear();
 
   return metadata;
 }
@@ -119,6 +203,10 @@ const camera_metadata_t* HalCameraMetadata::GetRawCameraMetadata() const {
 }
 
 size_t HalCameraMetadata::GetCameraMetadataSize() const {
+  if (IsFrozen()) {
+    return get_camera_metadata_size(metadata_);
+  }
+
   std::unique_lock<std::mutex> lock(metadata_lock_);
 
   if (metadata_ == nullptr) {
@@ -153,14 +241,14 @@ status_t HalCameraMetadata::ResizeIfNeeded(size_t extra_entries,
 
   if (resize) {
     camera_metadata_t* metadata = metadata_;
-    metadata_ = allocate_camera_metadata(new_entry_count, new_data_count);
+    metadata_ = AllocateMetadata(new_entry_count, new_data_count);
     if (metadata_ == nullptr) {
       ALOGE("%s: Can't allocate larger metadata buffer", __FUNCTION__);
       metadata_ = metadata;
       return NO_MEMORY;
     }
     append_camera_metadata(metadata_, metadata);
-    free_camera_metadata(metadata);
+    FreeMetadata(metadata);
   }
 
   return OK;
@@ -168,7 +256,11 @@ status_t HalCameraMetadata::ResizeIfNeeded(size_t extra_entries,
 
 status_t HalCameraMetadata::SetMetadataRaw(uint32_t tag, const void* data,
                                            size_t data_count) {
-  status_t res;
+  status_t res = CheckNotFrozen(__FUNCTION__);
+  if (res != OK) {
+    return res;
+  }
+
   int type = get_camera_metadata_tag_type(tag);
   if (type == -1) {
     ALOGE("%s: Tag %d not found", __FUNCTION__, tag);
@@ -358,6 +450,14 @@ status_t HalCameraMetadata::Get(uint32_t tag,
     return BAD_VALUE;
   }
 
+  if (IsFrozen()) {
+    uint32_t entry_index = FindEntryIndex(tag);
+    if (entry_index == kInvalidEntryIndex) {
+      return NAME_NOT_FOUND;
+    }
+    return get_camera_metadata_ro_entry(metadata_, entry_index, entry);
+  }
+
   std::unique_lock<std::mutex> lock(metadata_lock_);
   return find_camera_metadata_ro_entry(metadata_, tag, entry);
 }
@@ -369,7 +469,10 @@ status_t HalCameraMetadata::GetByIndex(camera_metadata_ro_entry* entry,
     return BAD_VALUE;
   }
 
-  std::unique_lock<std::mutex> lock(metadata_lock_);
+  std::unique_lock<std::mutex> lock(metadata_lock_, std::defer_lock);
+  if (!IsFrozen()) {
+    lock.lock();
+  }
   size_t entry_count = get_camera_metadata_entry_count(metadata_);
   if (entry_index >= entry_count) {
     ALOGE("%s: entry_index (%zu) >= entry_count(%zu)", __FUNCTION__,
@@ -383,7 +486,10 @@ status_t HalCameraMetadata::GetByIndex(camera_metadata_ro_entry* entry,
 status_t HalCameraMetadata::Erase(const std::unordered_set<uint32_t>& tags) {
   std::unique_lock<std::mutex> lock(metadata_lock_);
   camera_metadata_ro_entry_t entry;
-  status_t res;
+  status_t res = CheckNotFrozen(__FUNCTION__);
+  if (res != OK) {
+    return res;
+  }
 
   // Metadata entries to copy over; entries whose tag IDs aren't in 'tags'
   std::vector<size_t> entry_indices;
@@ -426,7 +532,7 @@ status_t HalCameraMetadata::Erase(const std::unordered_set<uint32_t>& tags) {
 
   // Allocate a new buffer with the smaller size
   camera_metadata_t* orig_metadata = metadata_;
-  metadata_ = allocate_camera_metadata(entry_capacity, data_capacity);
+  metadata_ = AllocateMetadata(entry_capacity, data_capacity);
   if (metadata_ == nullptr) {
     ALOGE("%s: Can't allocate new metadata buffer", __FUNCTION__);
     metadata_ = orig_metadata;
@@ -450,20 +556,25 @@ status_t HalCameraMetadata::Erase(const std::unordered_set<uint32_t>& tags) {
     if (res != OK) {
       ALOGE("%s: Error adding entry at index %zu failed: %s %d", __FUNCTION__,
             entry_index, strerror(-res), res);
-      free_camera_metadata(metadata_);
+      FreeMetadata(metadata_);
       metadata_ = orig_metadata;
       return res;
     }
   }
 
-  free_camera_metadata(orig_metadata);
+  FreeMetadata(orig_metadata);
   return OK;
 }
 
 status_t HalCameraMetadata::Erase(uint32_t tag) {
   std::unique_lock<std::mutex> lock(metadata_lock_);
+  status_t res = CheckNotFrozen(__FUNCTION__);
+  if (res != OK) {
+    return res;
+  }
+
   camera_metadata_entry_t entry;
-  status_t res = find_camera_metadata_entry(metadata_, tag, &entry);
+  res = find_camera_metadata_entry(metadata_, tag, &entry);
   if (res == NAME_NOT_FOUND) {
     return OK;
   } else if (res != OK) {
@@ -619,18 +730,29 @@ status_t HalCameraMetadata::Append(
     return BAD_VALUE;
   }
 
-  return Append(hal_metadata->ReleaseCameraMetadata());
+  // hal_metadata still owns its camera metadata and frees or recycles it when
+  // going out of scope.
+  return AppendMetadata(hal_metadata->GetRawCameraMetadata());
 }
 
 status_t HalCameraMetadata::Append(camera_metadata_t* metadata) {
+  return AppendMetadata(metadata);
+}
+
+status_t HalCameraMetadata::AppendMetadata(const camera_metadata_t* metadata) {
   if (metadata == nullptr) {
     ALOGE("%s: metadata is nullptr", __FUNCTION__);
     return BAD_VALUE;
   }
   std::unique_lock<std::mutex> lock(metadata_lock_);
+  status_t res = CheckNotFrozen(__FUNCTION__);
+  if (res != OK) {
+    return res;
+  }
+
   size_t extra_entries = get_camera_metadata_entry_count(metadata);
   size_t extra_data = get_camera_metadata_data_count(metadata);
-  status_t res = ResizeIfNeeded(extra_entries, extra_data);
+  res = ResizeIfNeeded(extra_entries, extra_data);
   if (res != OK) {
     ALOGE("%s: Resize fail", __FUNCTION__);
     return res;
@@ -640,10 +762,104 @@ status_t HalCameraMetadata::Append(camera_metadata_t* metadata) {
 }
 
 size_t HalCameraMetadata::GetEntryCount() const {
+  if (IsFrozen()) {
+    return get_camera_metadata_entry_count(metadata_);
+  }
+
   std::unique_lock<std::mutex> lock(metadata_lock_);
   return (metadata_ == nullptr) ? 0 : get_camera_metadata_entry_count(metadata_);
 }
 
+size_t HalCameraMetadata::GetDataCount() const {
+  if (IsFrozen()) {
+    return get_camera_metadata_data_count(metadata_);
+  }
+
+  std::unique_lock<std::mutex> lock(metadata_lock_);
+  return (metadata_ == nullptr) ? 0 : get_camera_metadata_data_count(metadata_);
+}
+
+status_t HalCameraMetadata::Freeze() {
+  ATRACE_CALL();
+  std::unique_lock<std::mutex> lock(metadata_lock_);
+  if (metadata_ == nullptr) {
+    ALOGE("%s: metadata_ is nullptr", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+
+  if (IsFrozen()) {
+    return OK;
+  }
+
+  BuildTagIndexLocked();
+  frozen_.store(true, std::memory_order_release);
+  return OK;
+}
+
+bool HalCameraMetadata::IsFrozen() const {
+  return frozen_.load(std::memory_order_acquire);
+}
+
+status_t HalCameraMetadata::CheckNotFrozen(const char* function_name) const {
+  if (IsFrozen()) {
+    ALOGE("%s: metadata is frozen and cannot be modified", function_name);
+    return INVALID_OPERATION;
+  }
+
+  return OK;
+}
+
+// Multiplicative hash of a tag. The top bits are well mixed.
+static uint32_t HashTag(uint32_t tag) {
+  return tag * 0x9E3779B1u;
+}
+
+void HalCameraMetadata::BuildTagIndexLocked() {
+  size_t entry_count = get_camera_metadata_entry_count(metadata_);
+
+  // Keep the load factor at or below 1/2 to keep probe sequences short.
+  uint32_t index_bits = 1;
+  while ((static_cast<size_t>(1) << index_bits) < entry_count * 2) {
+    index_bits++;
+  }
+  tag_index_.assign(static_cast<size_t>(1) << index_bits, TagIndexSlot());
+  tag_index_shift_ = 32 - index_bits;
+
+  size_t mask = tag_index_.size() - 1;
+  for (size_t i = 0; i < entry_count; i++) {
+    camera_metadata_ro_entry_t entry;
+    if (get_camera_metadata_ro_entry(metadata_, i, &entry) != OK) {
+      ALOGE("%s: Getting entry %zu failed", __FUNCTION__, i);
+      continue;
+    }
+
+    size_t slot = HashTag(entry.tag) >> tag_index_shift_;
+    while (tag_index_[slot].entry_index != kInvalidEntryIndex &&
+           tag_index_[slot].tag != entry.tag) {
+      slot = (slot + 1) & mask;
+    }
+
+    // Keep the first entry of a tag, like find_camera_metadata_ro_entry().
+    if (tag_index_[slot].entry_index == kInvalidEntryIndex) {
+      tag_index_[slot].tag = entry.tag;
+      tag_index_[slot].entry_index = i;
+    }
+  }
+}
+
+uint32_t HalCameraMetadata::FindEntryIndex(uint32_t tag) const {
+  size_t mask = tag_index_.size() - 1;
+  size_t slot = HashTag(tag) >> tag_index_shift_;
+  while (tag_index_[slot].entry_index != kInvalidEntryIndex) {
+    if (tag_index_[slot].tag == tag) {
+      return tag_index_[slot].entry_index;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return kInvalidEntryIndex;
+}
+
 status_t HalCameraMetadata::CopyEntry(const camera_metadata_t* src,
                                       camera_metadata_t* dest,
                                       size_t entry_index) const {
@@ -667,5 +883,32 @@ status_t HalCameraMetadata::CopyEntry(const camera_metadata_t* src,
 
   return OK;
 }
+
+// Raise 'capacity' to 'count' unless another thread raised it further.
+static void RaiseCapacity(std::atomic<size_t>* capacity, size_t count) {
+  size_t current = capacity->load(std::memory_order_relaxed);
+  while (current < count &&
+         !capacity->compare_exchange_weak(current, count,
+                                          std::memory_order_relaxed)) {
+  }
+}
+
+void MetadataCapacityHint::Update(const HalCameraMetadata* metadata) {
+  if (metadata == nullptr) {
+    return;
+  }
+
+  RaiseCapacity(&entry_capacity_, metadata->GetEntryCount());
+  RaiseCapacity(&data_capacity_, metadata->GetDataCount());
+}
+
+size_t MetadataCapacityHint::GetEntryCapacity() const {
+  return entry_capacity_.load(std::memory_order_relaxed);
+}
+
+size_t MetadataCapacityHint::GetDataCapacity() const {
+  return data_capacity_.load(std::memory_order_relaxed);
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
\ No newline at end of file
@@ -19,11 +19,14 @@
 
 #include <system/camera_metadata.h>
 #include <utils/Errors.h>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <unordered_set>
 #include <vector>
 
+#include "hal_camera_metadata_arena.h"
+
 namespace android {
 namespace google_camera_hal {
 
@@ -38,6 +41,8 @@ enum class MetadataDumpVerbosity : uint32_t {
   kAllInformation,
 };
 
+class MetadataCapacityHint;
+
 class HalCameraMetadata {
  public:
   // Create a HalCameraMetadata and allocate camera_metadata.
@@ -46,6 +51,20 @@ class HalCameraMetadata {
   static std::unique_ptr<HalCameraMetadata> Create(size_t entry_capacity,
                                                    size_t data_capacity);
 
+  // Create a HalCameraMetadata and allocate camera_metadata from arena.
+  // The camera_metadata is recycled to arena when this HalCameraMetadata is
+  // destroyed. If arena is nullptr, camera_metadata is allocated from the
+  // heap.
+  static std::unique_ptr<HalCameraMetadata> Create(
+      size_t entry_capacity, size_t data_capacity,
+      std::shared_ptr<HalCameraMetadataArena> arena);
+
+  // Create a HalCameraMetadata with the capacity recorded by hint, so that
+  // metadata built like the previous ones doesn't need to grow.
+  static std::unique_ptr<HalCameraMetadata> Create(
+      const MetadataCapacityHint& hint,
+      std::shared_ptr<HalCameraMetadataArena> arena = nullptr);
+
   // Create a HalCameraMetadata to own camera_metadata.
   // metadata will be owned by this HalCameraMetadata.
   // This will return nullptr if metadata is nullptr.
@@ -64,6 +83,14 @@ class HalCameraMetadata {
   static std::unique_ptr<HalCameraMetadata> Clone(
       const HalCameraMetadata* hal_metadata);
 
+  // Create a HalCameraMetadata and clone the metadata with at least the
+  // capacity recorded by hint.
+  // hal_metadata will be cloned and still owned by the caller.
+  // This will return nullptr if metadata is nullptr.
+  static std::unique_ptr<HalCameraMetadata> Clone(
+      const HalCameraMetadata* hal_metadata, const MetadataCapacityHint& hint,
+      std::shared_ptr<HalCameraMetadataArena> arena = nullptr);
+
   virtual ~HalCameraMetadata();
 
   // Return the camera_metadata owned by this HalCameraMetadata and transfer
@@ -126,8 +153,24 @@ class HalCameraMetadata {
   // Get metadata entry size
   size_t GetEntryCount() const;
 
+  // Get the number of data bytes used by the entries
+  size_t GetDataCount() const;
+
+  // Freeze the metadata once it is complete, e.g. static characteristics or
+  // final result metadata. Set(), Erase() and Append() of a frozen metadata
+  // fail with INVALID_OPERATION. Get(), GetByIndex() and the size getters of
+  // a frozen metadata don't take metadata_lock_, and Get() finds tags through
+  // a precomputed index, so that many threads can read it concurrently.
+  // Clone a frozen metadata to modify it. ReleaseCameraMetadata() unfreezes
+  // the metadata and must not race with readers.
+  status_t Freeze();
+
+  // Return if the metadata is frozen.
+  bool IsFrozen() const;
+
  protected:
-  HalCameraMetadata(camera_metadata_t* metadata);
+  HalCameraMetadata(camera_metadata_t* metadata,
+                    std::shared_ptr<HalCameraMetadataArena> arena = nullptr);
 
  private:
   // For dump metadata
@@ -141,6 +184,33 @@ class HalCameraMetadata {
 
   status_t ResizeIfNeeded(size_t extra_entries, size_t extra_data);
 
+  // Allocate and free camera metadata from arena_, or from the heap if
+  // arena_ is nullptr.
+  camera_metadata_t* AllocateMetadata(size_t entry_capacity,
+                                      size_t data_capacity) const;
+  void FreeMetadata(camera_metadata_t* metadata) const;
+
+  // Append the entries of metadata, which is still owned by the caller.
+  status_t AppendMetadata(const camera_metadata_t* metadata);
+
+  // Return INVALID_OPERATION if the metadata is frozen and can't be modified.
+  status_t CheckNotFrozen(const char* function_name) const;
+
+  // Build tag_index_ for metadata_. Must be protected by metadata_lock_.
+  void BuildTagIndexLocked();
+
+  // Return the index of the entry of tag in a frozen metadata, or
+  // kInvalidEntryIndex if tag does not exist.
+  uint32_t FindEntryIndex(uint32_t tag) const;
+
+  static constexpr uint32_t kInvalidEntryIndex = UINT32_MAX;
+
+  // A slot of tag_index_.
+  struct TagIndexSlot {
+    uint32_t tag = 0;
+    uint32_t entry_index = kInvalidEntryIndex;
+  };
+
   // Copy entry at the given index from source buffer to destination buffer
   status_t CopyEntry(const camera_metadata_t* src, camera_metadata_t* dest,
                      size_t entry_index) const;
@@ -148,6 +218,36 @@ class HalCameraMetadata {
   // Camera metadata owned by this HalCameraMetadata.
   mutable std::mutex metadata_lock_;
   camera_metadata_t* metadata_ = nullptr;
+
+  // Arena that metadata_ is allocated from, or nullptr if metadata_ is
+  // allocated from the heap.
+  std::shared_ptr<HalCameraMetadataArena> arena_;
+
+  // Set by Freeze(). metadata_ and tag_index_ don't change while it is set.
+  std::atomic<bool> frozen_ = false;
+
+  // Open addressing hash table from tags to entry indices of a frozen
+  // metadata. The size is a power of two and slots are picked by the top
+  // tag_index_shift_ bits of a multiplicative hash of the tag.
+  std::vector<TagIndexSlot> tag_index_;
+  uint32_t tag_index_shift_ = 0;
+};
+
+// MetadataCapacityHint learns the capacity of the metadata built by a
+// pipeline, such as the request settings or the results of a session, from
+// the previous frames. It records the largest entry and data counts seen so
+// far. Thread safe.
+class MetadataCapacityHint {
+ public:
+  // Record the entry and data counts of a complete metadata.
+  void Update(const HalCameraMetadata* metadata);
+
+  size_t GetEntryCapacity() const;
+  size_t GetDataCapacity() const;
+
+ private:
+  std::atomic<size_t> entry_capacity_ = 0;
+  std::atomic<size_t> data_capacity_ = 0;
 };
 
 }  // namespace google_camera_hal
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_HalCameraMetadataArena"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <stdlib.h>
+
+#include "hal_camera_metadata_arena.h"
+
+namespace android {
+namespace google_camera_hal {
+
+std::shared_ptr<HalCameraMetadataArena> HalCameraMetadataArena::Create(
+    size_t max_buffers_per_class) {
+  auto arena = std::shared_ptr<HalCameraMetadataArena>(
+      new HalCameraMetadataArena(max_buffers_per_class));
+  if (arena == nullptr) {
+    ALOGE("%s: Creating HalCameraMetadataArena failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  return arena;
+}
+
+HalCameraMetadataArena::HalCameraMetadataArena(size_t max_buffers_per_class)
+    : max_buffers_per_class_(max_buffers_per_class) {
+  // Recycling must not allocate.
+  for (auto& free_buffers : free_buffers_) {
+    free_buffers.reserve(max_buffers_per_class_);
+  }
+}
+
+HalCameraMetadataArena::~HalCameraMetadataArena() {
+  std::lock_guard<std::mutex> lock(arena_lock_);
+  for (auto& free_buffers : free_buffers_) {
+    for (auto buffer : free_buffers) {
+      free(buffer);
+    }
+  }
+}
+
+size_t HalCameraMetadataArena::GetSizeClass(size_t size) {
+  for (size_t shift = kMinSizeClassShift; shift <= kMaxSizeClassShift;
+       shift++) {
+    if (size <= (static_cast<size_t>(1) << shift)) {
+      return shift - kMinSizeClassShift;
+    }
+  }
+
+  return kNumSizeClasses;
+}
+
+camera_metadata_t* HalCameraMetadataArena::Allocate(size_t entry_capacity,
+                                                    size_t data_capacity) {
+  ATRACE_CALL();
+  size_t size_class = GetSizeClass(
+      calculate_camera_metadata_size(entry_capacity, data_capacity));
+  void* buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(arena_lock_);
+    if (size_class < kNumSizeClasses && !free_buffers_[size_class].empty()) {
+      buffer = free_buffers_[size_class].back();
+      free_buffers_[size_class].pop_back();
+      statistics_.reuses++;
+    } else {
+      statistics_.allocations++;
+    }
+  }
+
+  if (size_class == kNumSizeClasses) {
+    return allocate_camera_metadata(entry_capacity, data_capacity);
+  }
+
+  size_t buffer_size = static_cast<size_t>(1)
+                       << (size_class + kMinSizeClassShift);
+  if (buffer == nullptr) {
+    buffer = malloc(buffer_size);
+    if (buffer == nullptr) {
+      ALOGE("%s: Allocating %zu bytes failed.", __FUNCTION__, buffer_size);
+      return nullptr;
+    }
+  }
+
+  // Hand the rest of the size class out as data capacity, so that values
+  // added later on don't need a larger buffer.
+  size_t extended_data_capacity =
+      buffer_size - calculate_camera_metadata_size(entry_capacity, 0);
+  if (calculate_camera_metadata_size(entry_capacity, extended_data_capacity) <=
+      buffer_size) {
+    data_capacity = extended_data_capacity;
+  }
+
+  camera_metadata_t* metadata = place_camera_metadata(
+      buffer, buffer_size, entry_capacity, data_capacity);
+  if (metadata == nullptr) {
+    ALOGE("%s: Placing camera metadata (%zu entries, %zu bytes) failed.",
+          __FUNCTION__, entry_capacity, data_capacity);
+    free(buffer);
+    return nullptr;
+  }
+
+  return metadata;
+}
+
+void HalCameraMetadataArena::Recycle(camera_metadata_t* metadata) {
+  if (metadata == nullptr) {
+    return;
+  }
+
+  // The size of a camera_metadata placed by Allocate() maps back to the size
+  // class of its buffer.
+  size_t size_class = GetSizeClass(get_camera_metadata_size(metadata));
+  {
+    std::lock_guard<std::mutex> lock(arena_lock_);
+    if (size_class < kNumSizeClasses &&
+        free_buffers_[size_class].size() < max_buffers_per_class_) {
+      free_buffers_[size_class].push_back(metadata);
+      return;
+    }
+    statistics_.frees++;
+  }
+
+  free_camera_metadata(metadata);
+}
+
+HalCameraMetadataArena::Statistics HalCameraMetadataArena::GetStatistics() {
+  std::lock_guard<std::mutex> lock(arena_lock_);
+  return statistics_;
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
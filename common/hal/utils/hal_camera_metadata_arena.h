@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_HAL_CAMERA_METADATA_ARENA_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_HAL_CAMERA_METADATA_ARENA_H_
+
+#include <system/camera_metadata.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+// HalCameraMetadataArena recycles camera_metadata buffers of a session.
+// Buffers are grouped in power-of-two size classes and the capacity of a
+// camera_metadata is extended to fill its whole size class. A freed buffer is
+// kept for the next camera_metadata of the same size class, so that metadata
+// created once per frame stops allocating camera_metadata buffers after the
+// first frames. The HalCameraMetadata objects are still allocated per frame.
+//
+// Buffers are allocated with malloc() and remain valid for
+// free_camera_metadata(), so a camera_metadata allocated by the arena can be
+// handed out of the session. Thread safe.
+class HalCameraMetadataArena {
+ public:
+  struct Statistics {
+    // camera_metadata buffers allocated with malloc().
+    uint64_t allocations = 0;
+    // camera_metadata buffers served from the recycled buffers.
+    uint64_t reuses = 0;
+    // Buffers freed because their size class was full or too large.
+    uint64_t frees = 0;
+  };
+
+  // Create a HalCameraMetadataArena.
+  // max_buffers_per_class is the number of freed buffers kept per size class.
+  static std::shared_ptr<HalCameraMetadataArena> Create(
+      size_t max_buffers_per_class = kDefaultMaxBuffersPerClass);
+
+  virtual ~HalCameraMetadataArena();
+
+  // Allocate a camera_metadata with at least entry_capacity entries and
+  // data_capacity bytes of data. Returns nullptr if the allocation failed.
+  camera_metadata_t* Allocate(size_t entry_capacity, size_t data_capacity);
+
+  // Recycle a camera_metadata returned by Allocate(). The arena takes over
+  // the ownership of metadata.
+  void Recycle(camera_metadata_t* metadata);
+
+  Statistics GetStatistics();
+
+ protected:
+  HalCameraMetadataArena(size_t max_buffers_per_class);
+
+ private:
+  static constexpr size_t kDefaultMaxBuffersPerClass = 8;
+
+  // Size classes from 1 KB to 1 MB. Larger camera_metadata are allocated and
+  // freed directly.
+  static constexpr size_t kMinSizeClassShift = 10;
+  static constexpr size_t kMaxSizeClassShift = 20;
+  static constexpr size_t kNumSizeClasses =
+      kMaxSizeClassShift - kMinSizeClassShift + 1;
+
+  // Return the index of the smallest size class that fits size bytes, or
+  // kNumSizeClasses if size is larger than the largest size class.
+  static size_t GetSizeClass(size_t size);
+
+  const size_t max_buffers_per_class_;
+
+  std::mutex arena_lock_;
+
+  // Freed buffers of each size class. Protected by arena_lock_.
+  std::vector<void*> free_buffers_[kNumSizeClasses];
+
+  // Protected by arena_lock_.
+  Statistics statistics_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_HAL_CAMERA_METADATA_ARENA_H_
@@ -28,12 +28,36 @@
 namespace android {
 namespace google_camera_hal {
 
+// Delivery latencies from within a wakeup up to a few frames
+const int64_t ResultDispatcher::LatencyHistogram::kBucketLimitsNs[] = {
+    10000,   50000,    100000,   500000,
+    1000000, 5000000, 10000000, 50000000};
+
+void ResultDispatcher::LatencyHistogram::Add(int64_t latency_ns) {
+  const int64_t* limits_end = kBucketLimitsNs + kBucketCount - 1;
+  auto bucket = std::upper_bound(kBucketLimitsNs, limits_end, latency_ns) -
+                kBucketLimitsNs;
+  buckets[bucket]++;
+  count++;
+  total_ns += latency_ns;
+  max_ns = std::max(max_ns, latency_ns);
+}
+
+// Nanoseconds between 'ready_time' and 'now'.
+static int64_t GetLatencyNs(std::chrono::steady_clock::time_point ready_time,
+                            std::chrono::steady_clock::time_point now) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now - ready_time)
+      .count();
+}
+
 std::unique_ptr<ResultDispatcher> ResultDispatcher::Create(
     uint32_t partial_result_count,
-    ProcessCaptureResultFunc process_capture_result, NotifyFunc notify) {
+    ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
+    ProcessBatchCaptureResultFunc process_batch_capture_result) {
   ATRACE_CALL();
-  auto dispatcher = std::unique_ptr<ResultDispatcher>(new ResultDispatcher(
-      partial_result_count, process_capture_result, notify));
+  auto dispatcher = std::unique_ptr<ResultDispatcher>(
+      new ResultDispatcher(partial_result_count, process_capture_result, notify,
+                           process_batch_capture_result));
   if (dispatcher == nullptr) {
     ALOGE("%s: Creating ResultDispatcher failed.", __FUNCTION__);
     return nullptr;
@@ -44,10 +68,12 @@ std::unique_ptr<ResultDispatcher> ResultDispatcher::Create(
 
 ResultDispatcher::ResultDispatcher(
     uint32_t partial_result_count,
-    ProcessCaptureResultFunc process_capture_result, NotifyFunc notify)
+    ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
+    ProcessBatchCaptureResultFunc process_batch_capture_result)
     : kPartialResultCount(partial_result_count),
       process_capture_result_(process_capture_result),
-      notify_(notify) {
+      notify_(notify),
+      process_batch_capture_result_(process_batch_capture_result) {
   ATRACE_CALL();
   notify_callback_thread_ =
       std::thread([this] { this->NotifyCallbackThreadLoop(); });
@@ -61,6 +87,10 @@ ResultDispatcher::ResultDispatcher(
       ALOGI("%s: SetRealtimeThread OK", __FUNCTION__);
     }
   }
+
+  // Runs at the default priority, it takes result_lock_ which has no priority
+  // inheritance.
+  watchdog_thread_ = std::thread([this] { this->WatchdogThreadLoop(); });
 }
 
 ResultDispatcher::~ResultDispatcher() {
@@ -71,13 +101,74 @@ ResultDispatcher::~ResultDispatcher() {
   }
 
   notify_callback_condition_.notify_one();
+  watchdog_condition_.notify_one();
   notify_callback_thread_.join();
+  watchdog_thread_.join();
+}
+
+ResultDispatcher::Statistics ResultDispatcher::GetStatistics() {
+  Statistics statistics = {
+      .wakeups = wakeup_count_,
+      .empty_wakeups = empty_wakeup_count_,
+      .stalls = stall_count_,
+  };
+
+  std::lock_guard<std::mutex> lock(result_lock_);
+  statistics.shutter_latency = shutter_latency_;
+  statistics.final_metadata_latency = final_metadata_latency_;
+  statistics.buffer_latency = buffer_latency_;
+  return statistics;
+}
+
+void ResultDispatcher::WakeUpCallbackThread() {
+  {
+    std::lock_guard<std::mutex> lock(notify_callback_lock);
+    if (results_deliverable_) {
+      // The callback thread has not picked up the previous wakeup yet.
+      return;
+    }
+    results_deliverable_ = true;
+  }
+
+  notify_callback_condition_.notify_one();
+}
+
+bool ResultDispatcher::HasDeliverableLocked() {
+  uint32_t frame_number;
+  PendingShutter* shutter = pending_shutters_.Front(&frame_number);
+  if (shutter != nullptr && shutter->ready) {
+    return true;
+  }
+
+  PendingFinalResultMetadata* pending_metadata =
+      pending_final_metadata_.Front(&frame_number);
+  if (pending_metadata != nullptr && pending_metadata->ready) {
+    return true;
+  }
+
+  for (auto& pending_buffers : stream_pending_buffers_map_) {
+    PendingBuffer* pending_buffer = pending_buffers.second.Front(&frame_number);
+    if (pending_buffer != nullptr && pending_buffer->ready) {
+      return true;
+    }
+  }
+
+  return false;
 }
 
 void ResultDispatcher::RemovePendingRequest(uint32_t frame_number) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(result_lock_);
-  RemovePendingRequestLocked(frame_number);
+  bool deliverable;
+  {
+    std::lock_guard<std::mutex> lock(result_lock_);
+    RemovePendingRequestLocked(frame_number);
+    // Results of the following frames may have been waiting for this one.
+    deliverable = HasDeliverableLocked();
+  }
+
+  if (deliverable) {
+    WakeUpCallbackThread();
+  }
 }
 
 status_t ResultDispatcher::AddPendingRequest(
@@ -138,27 +229,25 @@ status_t ResultDispatcher::AddPendingRequestLocked(
 
 status_t ResultDispatcher::AddPendingShutterLocked(uint32_t frame_number) {
   ATRACE_CALL();
-  if (pending_shutters_.find(frame_number) != pending_shutters_.end()) {
+  if (!pending_shutters_.Insert(frame_number, PendingShutter())) {
     ALOGE("%s: Pending shutter for frame %u already exists.", __FUNCTION__,
           frame_number);
     return ALREADY_EXISTS;
   }
 
-  pending_shutters_[frame_number] = PendingShutter();
   return OK;
 }
 
 status_t ResultDispatcher::AddPendingFinalResultMetadataLocked(
     uint32_t frame_number) {
   ATRACE_CALL();
-  if (pending_final_metadata_.find(frame_number) !=
-      pending_final_metadata_.end()) {
+  if (!pending_final_metadata_.Insert(frame_number,
+                                      PendingFinalResultMetadata())) {
     ALOGE("%s: Pending final result metadata for frame %u already exists.",
           __FUNCTION__, frame_number);
     return ALREADY_EXISTS;
   }
 
-  pending_final_metadata_[frame_number] = PendingFinalResultMetadata();
   return OK;
 }
 
@@ -167,30 +256,27 @@ status_t ResultDispatcher::AddPendingBufferLocked(uint32_t frame_number,
                                                   bool is_input) {
   ATRACE_CALL();
   uint32_t stream_id = buffer.stream_id;
-  if (stream_pending_buffers_map_.find(stream_id) ==
-      stream_pending_buffers_map_.end()) {
-    stream_pending_buffers_map_[stream_id] = std::map<uint32_t, PendingBuffer>();
-  }
+  auto& pending_buffers =
+      stream_pending_buffers_map_.try_emplace(stream_id, kPendingFrameCapacity)
+          .first->second;
 
-  if (stream_pending_buffers_map_[stream_id].find(frame_number) !=
-      stream_pending_buffers_map_[stream_id].end()) {
+  PendingBuffer pending_buffer = {.is_input = is_input};
+  if (!pending_buffers.Insert(frame_number, pending_buffer)) {
     ALOGE("%s: Pending buffer of stream %u for frame %u already exists.",
           __FUNCTION__, stream_id, frame_number);
     return ALREADY_EXISTS;
   }
 
-  PendingBuffer pending_buffer = {.is_input = is_input};
-  stream_pending_buffers_map_[stream_id][frame_number] = pending_buffer;
   return OK;
 }
 
 void ResultDispatcher::RemovePendingRequestLocked(uint32_t frame_number) {
   ATRACE_CALL();
-  pending_shutters_.erase(frame_number);
-  pending_final_metadata_.erase(frame_number);
+  pending_shutters_.Erase(frame_number);
+  pending_final_metadata_.Erase(frame_number);
 
   for (auto& pending_buffers : stream_pending_buffers_map_) {
-    pending_buffers.second.erase(frame_number);
+    pending_buffers.second.Erase(frame_number);
   }
 }
 
@@ -198,12 +284,13 @@ status_t ResultDispatcher::AddResult(std::unique_ptr<CaptureResult> result) {
   ATRACE_CALL();
   status_t res;
   bool failed = false;
+  bool deliverable = false;
   uint32_t frame_number = result->frame_number;
 
   if (result->result_metadata != nullptr) {
     res = AddResultMetadata(frame_number, std::move(result->result_metadata),
                             std::move(result->physical_metadata),
-                            result->partial_result);
+                            result->partial_result, &deliverable);
     if (res != OK) {
       ALOGE("%s: Adding result metadata failed: %s (%d)", __FUNCTION__,
             strerror(-res), res);
@@ -212,7 +299,7 @@ status_t ResultDispatcher::AddResult(std::unique_ptr<CaptureResult> result) {
   }
 
   for (auto& buffer : result->output_buffers) {
-    res = AddBuffer(frame_number, buffer);
+    res = AddBuffer(frame_number, buffer, &deliverable);
     if (res != OK) {
       ALOGE("%s: Adding an output buffer failed: %s (%d)", __FUNCTION__,
             strerror(-res), res);
@@ -221,7 +308,7 @@ status_t ResultDispatcher::AddResult(std::unique_ptr<CaptureResult> result) {
   }
 
   for (auto& buffer : result->input_buffers) {
-    res = AddBuffer(frame_number, buffer);
+    res = AddBuffer(frame_number, buffer, &deliverable);
     if (res != OK) {
       ALOGE("%s: Adding an input buffer failed: %s (%d)", __FUNCTION__,
             strerror(-res), res);
@@ -229,35 +316,43 @@ status_t ResultDispatcher::AddResult(std::unique_ptr<CaptureResult> result) {
     }
   }
 
-  notify_callback_condition_.notify_one();
+  if (deliverable) {
+    WakeUpCallbackThread();
+  }
   return failed ? UNKNOWN_ERROR : OK;
 }
 
 status_t ResultDispatcher::AddShutter(uint32_t frame_number,
                                       int64_t timestamp_ns) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(result_lock_);
+  {
+    std::lock_guard<std::mutex> lock(result_lock_);
 
-  auto shutter_it = pending_shutters_.find(frame_number);
-  if (shutter_it == pending_shutters_.end()) {
-    ALOGE("%s: Cannot find the pending shutter for frame %u", __FUNCTION__,
-          frame_number);
-    return NAME_NOT_FOUND;
-  }
+    PendingShutter* shutter = pending_shutters_.Find(frame_number);
+    if (shutter == nullptr) {
+      ALOGE("%s: Cannot find the pending shutter for frame %u", __FUNCTION__,
+            frame_number);
+      return NAME_NOT_FOUND;
+    }
 
-  if (shutter_it->second.ready) {
-    ALOGE("%s: Already received shutter (%" PRId64
-          ") for frame %u. New "
-          "timestamp %" PRId64,
-          __FUNCTION__, shutter_it->second.timestamp_ns, frame_number,
-          timestamp_ns);
-    return ALREADY_EXISTS;
-  }
+    if (shutter->ready) {
+      ALOGE("%s: Already received shutter (%" PRId64
+            ") for frame %u. New "
+            "timestamp %" PRId64,
+            __FUNCTION__, shutter->timestamp_ns, frame_number, timestamp_ns);
+      return ALREADY_EXISTS;
+    }
 
-  shutter_it->second.timestamp_ns = timestamp_ns;
-  shutter_it->second.ready = true;
+    shutter->timestamp_ns = timestamp_ns;
+    shutter->ready = true;
+    shutter->ready_time = std::chrono::steady_clock::now();
+    if (!pending_shutters_.IsFront(frame_number)) {
+      // Delivered along with the older shutters once they are ready.
+      return OK;
+    }
+  }
 
-  notify_callback_condition_.notify_one();
+  WakeUpCallbackThread();
   return OK;
 }
 
@@ -266,10 +361,10 @@ status_t ResultDispatcher::AddError(const ErrorMessage& error) {
   std::lock_guard<std::mutex> lock(result_lock_);
   uint32_t frame_number = error.frame_number;
   // No need to deliver the shutter message on an error
-  pending_shutters_.erase(frame_number);
+  pending_shutters_.Erase(frame_number);
   // No need to deliver the result metadata on a result metadata error
   if (error.error_code == ErrorCode::kErrorResult) {
-    pending_final_metadata_.erase(frame_number);
+    pending_final_metadata_.Erase(frame_number);
   }
 
   NotifyMessage message = {.type = MessageType::kError, .message.error = error};
@@ -277,6 +372,11 @@ status_t ResultDispatcher::AddError(const ErrorMessage& error) {
         error.error_code, frame_number, error.error_stream_id);
   notify_(message);
 
+  // Results of the following frames may have been waiting for this one.
+  if (HasDeliverableLocked()) {
+    WakeUpCallbackThread();
+  }
+
   return OK;
 }
 
@@ -296,33 +396,38 @@ void ResultDispatcher::NotifyResultMetadata(
 
 status_t ResultDispatcher::AddFinalResultMetadata(
     uint32_t frame_number, std::unique_ptr<HalCameraMetadata> final_metadata,
-    std::vector<PhysicalCameraMetadata> physical_metadata) {
+    std::vector<PhysicalCameraMetadata> physical_metadata, bool* deliverable) {
   ATRACE_CALL();
   std::lock_guard<std::mutex> lock(result_lock_);
 
-  auto metadata_it = pending_final_metadata_.find(frame_number);
-  if (metadata_it == pending_final_metadata_.end()) {
+  PendingFinalResultMetadata* pending_metadata =
+      pending_final_metadata_.Find(frame_number);
+  if (pending_metadata == nullptr) {
     ALOGE("%s: Cannot find the pending result metadata for frame %u",
           __FUNCTION__, frame_number);
     return NAME_NOT_FOUND;
   }
 
-  if (metadata_it->second.ready) {
+  if (pending_metadata->ready) {
     ALOGE("%s: Already received final result metadata for frame %u.",
           __FUNCTION__, frame_number);
     return ALREADY_EXISTS;
   }
 
-  metadata_it->second.metadata = std::move(final_metadata);
-  metadata_it->second.physical_metadata = std::move(physical_metadata);
-  metadata_it->second.ready = true;
+  pending_metadata->metadata = std::move(final_metadata);
+  pending_metadata->physical_metadata = std::move(physical_metadata);
+  pending_metadata->ready = true;
+  pending_metadata->ready_time = std::chrono::steady_clock::now();
+  if (pending_final_metadata_.IsFront(frame_number)) {
+    *deliverable = true;
+  }
   return OK;
 }
 
 status_t ResultDispatcher::AddResultMetadata(
     uint32_t frame_number, std::unique_ptr<HalCameraMetadata> metadata,
     std::vector<PhysicalCameraMetadata> physical_metadata,
-    uint32_t partial_result) {
+    uint32_t partial_result, bool* deliverable) {
   ATRACE_CALL();
   if (metadata == nullptr) {
     ALOGE("%s: metadata is nullptr.", __FUNCTION__);
@@ -343,11 +448,11 @@ status_t ResultDispatcher::AddResultMetadata(
   }
 
   return AddFinalResultMetadata(frame_number, std::move(metadata),
-                                std::move(physical_metadata));
+                                std::move(physical_metadata), deliverable);
 }
 
 status_t ResultDispatcher::AddBuffer(uint32_t frame_number,
-                                     StreamBuffer buffer) {
+                                     StreamBuffer buffer, bool* deliverable) {
   ATRACE_CALL();
   std::lock_guard<std::mutex> lock(result_lock_);
 
@@ -359,61 +464,130 @@ status_t ResultDispatcher::AddBuffer(uint32_t frame_number,
     return NAME_NOT_FOUND;
   }
 
-  auto pending_buffer_it = pending_buffers_it->second.find(frame_number);
-  if (pending_buffer_it == pending_buffers_it->second.end()) {
+  PendingBuffer* pending_buffer = pending_buffers_it->second.Find(frame_number);
+  if (pending_buffer == nullptr) {
     ALOGE("%s: Cannot find the pending buffer for stream %u for frame %u",
           __FUNCTION__, stream_id, frame_number);
     return NAME_NOT_FOUND;
   }
 
-  if (pending_buffer_it->second.ready) {
+  if (pending_buffer->ready) {
     ALOGE("%s: Already received a buffer for stream %u for frame %u",
           __FUNCTION__, stream_id, frame_number);
     return ALREADY_EXISTS;
   }
 
-  pending_buffer_it->second.buffer = std::move(buffer);
-  pending_buffer_it->second.ready = true;
+  pending_buffer->buffer = std::move(buffer);
+  pending_buffer->ready = true;
+  pending_buffer->ready_time = std::chrono::steady_clock::now();
+  if (pending_buffers_it->second.IsFront(frame_number)) {
+    *deliverable = true;
+  }
 
   return OK;
 }
 
 void ResultDispatcher::NotifyCallbackThreadLoop() {
   while (1) {
-    NotifyShutters();
-    NotifyFinalResultMetadata();
-    NotifyBuffers();
+    bool exiting;
+    {
+      std::unique_lock<std::mutex> lock(notify_callback_lock);
+      notify_callback_condition_.wait(lock, [this] {
+        return notify_callback_thread_exiting || results_deliverable_;
+      });
+      exiting = notify_callback_thread_exiting;
+      results_deliverable_ = false;
+    }
 
-    std::unique_lock<std::mutex> lock(notify_callback_lock);
-    if (notify_callback_thread_exiting) {
+    wakeup_count_++;
+    size_t delivered;
+    if (process_batch_capture_result_ != nullptr) {
+      delivered = NotifyBatch();
+    } else {
+      delivered = NotifyShutters();
+      delivered += NotifyFinalResultMetadata();
+      delivered += NotifyBuffers();
+    }
+
+    if (delivered == 0) {
+      empty_wakeup_count_++;
+    }
+    delivered_count_ += delivered;
+
+    if (exiting) {
       ALOGV("%s: NotifyCallbackThreadLoop exits.", __FUNCTION__);
       return;
     }
+  }
+}
 
-    if (notify_callback_condition_.wait_for(
-            lock, std::chrono::milliseconds(kCallbackThreadTimeoutMs)) ==
-        std::cv_status::timeout) {
-      PrintTimeoutMessages();
+void ResultDispatcher::WatchdogThreadLoop() {
+  uint64_t last_delivered_count = delivered_count_;
+  std::unique_lock<std::mutex> lock(notify_callback_lock);
+  while (!watchdog_condition_.wait_for(
+      lock, std::chrono::milliseconds(kCallbackThreadTimeoutMs),
+      [this] { return notify_callback_thread_exiting; })) {
+    uint64_t delivered_count = delivered_count_;
+    if (delivered_count != last_delivered_count) {
+      last_delivered_count = delivered_count;
+      continue;
     }
+
+    // Don't block adding results and the callback thread on the logging.
+    lock.unlock();
+    std::vector<PendingEntry> entries = GetPendingEntries();
+    if (!entries.empty()) {
+      stall_count_++;
+      PrintTimeoutMessages(entries);
+    }
+    lock.lock();
   }
+
+  ALOGV("%s: WatchdogThreadLoop exits.", __FUNCTION__);
 }
 
-void ResultDispatcher::PrintTimeoutMessages() {
+std::vector<ResultDispatcher::PendingEntry>
+ResultDispatcher::GetPendingEntries() {
+  std::vector<PendingEntry> entries;
   std::lock_guard<std::mutex> lock(result_lock_);
-  for (auto& [frame_number, shutter] : pending_shutters_) {
-    ALOGW("%s: pending shutter for frame %u ready %d", __FUNCTION__,
-          frame_number, shutter.ready);
-  }
+  pending_shutters_.ForEach(
+      [&](uint32_t frame_number, const PendingShutter& shutter) {
+        entries.push_back({.type = "shutter",
+                           .frame_number = frame_number,
+                           .ready = shutter.ready});
+      });
+
+  pending_final_metadata_.ForEach(
+      [&](uint32_t frame_number,
+          const PendingFinalResultMetadata& final_metadata) {
+        entries.push_back({.type = "final result metadata",
+                           .frame_number = frame_number,
+                           .ready = final_metadata.ready});
+      });
 
-  for (auto& [frame_number, final_metadata] : pending_final_metadata_) {
-    ALOGW("%s: pending final result metadaata for frame %u ready %d",
-          __FUNCTION__, frame_number, final_metadata.ready);
+  for (auto& [stream_id, pending_buffers] : stream_pending_buffers_map_) {
+    pending_buffers.ForEach([&, stream_id = stream_id](
+                                uint32_t frame_number,
+                                const PendingBuffer& pending_buffer) {
+      entries.push_back({.type = "buffer",
+                         .stream_id = static_cast<int32_t>(stream_id),
+                         .frame_number = frame_number,
+                         .ready = pending_buffer.ready});
+    });
   }
 
-  for (auto& [stream_id, pending_buffers] : stream_pending_buffers_map_) {
-    for (auto& [frame_number, pending_buffer] : pending_buffers) {
-      ALOGW("%s: pending buffer of stream %d for frame %u ready %d",
-            __FUNCTION__, stream_id, frame_number, pending_buffer.ready);
+  return entries;
+}
+
+void ResultDispatcher::PrintTimeoutMessages(
+    const std::vector<PendingEntry>& entries) {
+  for (auto& entry : entries) {
+    if (entry.stream_id >= 0) {
+      ALOGW("%s: pending %s of stream %d for frame %u ready %d", __FUNCTION__,
+            entry.type, entry.stream_id, entry.frame_number, entry.ready);
+    } else {
+      ALOGW("%s: pending %s for frame %u ready %d", __FUNCTION__, entry.type,
+            entry.frame_number, entry.ready);
     }
   }
 }
@@ -427,30 +601,37 @@ status_t ResultDispatcher::GetReadyShutterMessage(NotifyMessage* message) {
 
   std::lock_guard<std::mutex> lock(result_lock_);
 
-  auto shutter_it = pending_shutters_.begin();
-  if (shutter_it == pending_shutters_.end() || !shutter_it->second.ready) {
+  uint32_t frame_number;
+  PendingShutter* shutter = pending_shutters_.Front(&frame_number);
+  if (shutter == nullptr || !shutter->ready) {
     // The first pending shutter is not ready.
     return NAME_NOT_FOUND;
   }
 
   message->type = MessageType::kShutter;
-  message->message.shutter.frame_number = shutter_it->first;
-  message->message.shutter.timestamp_ns = shutter_it->second.timestamp_ns;
-  pending_shutters_.erase(shutter_it);
+  message->message.shutter.frame_number = frame_number;
+  message->message.shutter.timestamp_ns = shutter->timestamp_ns;
+  shutter_latency_.Add(
+      GetLatencyNs(shutter->ready_time, std::chrono::steady_clock::now()));
+  pending_shutters_.PopFront();
 
   return OK;
 }
 
-void ResultDispatcher::NotifyShutters() {
+size_t ResultDispatcher::NotifyShutters() {
   ATRACE_CALL();
   NotifyMessage message = {};
+  size_t notified = 0;
 
   while (GetReadyShutterMessage(&message) == OK) {
     ALOGV("%s: Notify shutter for frame %u timestamp %" PRIu64, __FUNCTION__,
           message.message.shutter.frame_number,
           message.message.shutter.timestamp_ns);
     notify_(message);
+    notified++;
   }
+
+  return notified;
 }
 
 status_t ResultDispatcher::GetReadyFinalMetadata(
@@ -465,33 +646,38 @@ status_t ResultDispatcher::GetReadyFinalMetadata(
 
   std::lock_guard<std::mutex> lock(result_lock_);
 
-  auto final_metadata_it = pending_final_metadata_.begin();
-  if (final_metadata_it == pending_final_metadata_.end() ||
-      !final_metadata_it->second.ready) {
+  PendingFinalResultMetadata* pending_metadata =
+      pending_final_metadata_.Front(frame_number);
+  if (pending_metadata == nullptr || !pending_metadata->ready) {
     // The first pending final metadata is not ready.
     return NAME_NOT_FOUND;
   }
 
-  *frame_number = final_metadata_it->first;
-  *final_metadata = std::move(final_metadata_it->second.metadata);
-  *physical_metadata = std::move(final_metadata_it->second.physical_metadata);
-  pending_final_metadata_.erase(final_metadata_it);
+  *final_metadata = std::move(pending_metadata->metadata);
+  *physical_metadata = std::move(pending_metadata->physical_metadata);
+  final_metadata_latency_.Add(GetLatencyNs(pending_metadata->ready_time,
+                                           std::chrono::steady_clock::now()));
+  pending_final_metadata_.PopFront();
 
   return OK;
 }
 
-void ResultDispatcher::NotifyFinalResultMetadata() {
+size_t ResultDispatcher::NotifyFinalResultMetadata() {
   ATRACE_CALL();
   uint32_t frame_number;
   std::unique_ptr<HalCameraMetadata> final_metadata;
   std::vector<PhysicalCameraMetadata> physical_metadata;
+  size_t notified = 0;
 
   while (GetReadyFinalMetadata(&frame_number, &final_metadata,
                                &physical_metadata) == OK) {
     ALOGV("%s: Notify final metadata for frame %u", __FUNCTION__, frame_number);
     NotifyResultMetadata(frame_number, std::move(final_metadata),
                          std::move(physical_metadata), kPartialResultCount);
+    notified++;
   }
+
+  return notified;
 }
 
 status_t ResultDispatcher::GetReadyBufferResult(
@@ -506,42 +692,144 @@ status_t ResultDispatcher::GetReadyBufferResult(
   *result = nullptr;
 
   for (auto& pending_buffers : stream_pending_buffers_map_) {
-    auto buffer_it = pending_buffers.second.begin();
-    while (buffer_it != pending_buffers.second.end()) {
-      if (!buffer_it->second.ready) {
-        // No more buffer ready.
-        break;
-      }
-
-      auto buffer_result = std::make_unique<CaptureResult>(CaptureResult({}));
+    uint32_t frame_number;
+    PendingBuffer* pending_buffer = pending_buffers.second.Front(&frame_number);
+    if (pending_buffer == nullptr || !pending_buffer->ready) {
+      // No buffer ready.
+      continue;
+    }
 
-      buffer_result->frame_number = buffer_it->first;
-      if (buffer_it->second.is_input) {
-        buffer_result->input_buffers.push_back(buffer_it->second.buffer);
-      } else {
-        buffer_result->output_buffers.push_back(buffer_it->second.buffer);
-      }
+    auto buffer_result = std::make_unique<CaptureResult>(CaptureResult({}));
 
-      pending_buffers.second.erase(buffer_it);
-      *result = std::move(buffer_result);
-      return OK;
+    buffer_result->frame_number = frame_number;
+    if (pending_buffer->is_input) {
+      buffer_result->input_buffers.push_back(pending_buffer->buffer);
+    } else {
+      buffer_result->output_buffers.push_back(pending_buffer->buffer);
     }
+
+    buffer_latency_.Add(GetLatencyNs(pending_buffer->ready_time,
+                                     std::chrono::steady_clock::now()));
+    pending_buffers.second.PopFront();
+    *result = std::move(buffer_result);
+    return OK;
   }
 
   return NAME_NOT_FOUND;
 }
 
-void ResultDispatcher::NotifyBuffers() {
+size_t ResultDispatcher::NotifyBuffers() {
   ATRACE_CALL();
   std::unique_ptr<CaptureResult> result;
+  size_t notified = 0;
 
   while (GetReadyBufferResult(&result) == OK) {
     if (result == nullptr) {
       ALOGE("%s: result is nullptr", __FUNCTION__);
-      return;
+      break;
     }
     process_capture_result_(std::move(result));
+    notified++;
   }
+
+  return notified;
+}
+
+size_t ResultDispatcher::GetReadyResultsLocked(
+    std::vector<NotifyMessage>* shutters,
+    std::vector<std::unique_ptr<CaptureResult>>* results) {
+  ATRACE_CALL();
+  auto now = std::chrono::steady_clock::now();
+  size_t ready_count = 0;
+  uint32_t frame_number;
+  PendingShutter* shutter;
+  while ((shutter = pending_shutters_.Front(&frame_number)) != nullptr &&
+         shutter->ready) {
+    NotifyMessage message = {.type = MessageType::kShutter};
+    message.message.shutter.frame_number = frame_number;
+    message.message.shutter.timestamp_ns = shutter->timestamp_ns;
+    shutters->push_back(message);
+    shutter_latency_.Add(GetLatencyNs(shutter->ready_time, now));
+    pending_shutters_.PopFront();
+    ready_count++;
+  }
+
+  // Maps from frame numbers to the merged results.
+  std::map<uint32_t, std::unique_ptr<CaptureResult>> ready_results;
+  auto get_result = [&ready_results](uint32_t frame_number) {
+    auto& result = ready_results[frame_number];
+    if (result == nullptr) {
+      result = std::make_unique<CaptureResult>(CaptureResult({}));
+      result->frame_number = frame_number;
+    }
+    return result.get();
+  };
+
+  PendingFinalResultMetadata* pending_metadata;
+  while ((pending_metadata = pending_final_metadata_.Front(&frame_number)) !=
+             nullptr &&
+         pending_metadata->ready) {
+    CaptureResult* result = get_result(frame_number);
+    result->result_metadata = std::move(pending_metadata->metadata);
+    result->physical_metadata = std::move(pending_metadata->physical_metadata);
+    result->partial_result = kPartialResultCount;
+    final_metadata_latency_.Add(
+        GetLatencyNs(pending_metadata->ready_time, now));
+    pending_final_metadata_.PopFront();
+    ready_count++;
+  }
+
+  // Each stream only drains its ready buffers up to the first pending one, so
+  // the buffers of a stream stay in the order of frame numbers.
+  for (auto& [stream_id, pending_buffers] : stream_pending_buffers_map_) {
+    PendingBuffer* pending_buffer;
+    while ((pending_buffer = pending_buffers.Front(&frame_number)) != nullptr &&
+           pending_buffer->ready) {
+      CaptureResult* result = get_result(frame_number);
+      if (pending_buffer->is_input) {
+        result->input_buffers.push_back(pending_buffer->buffer);
+      } else {
+        result->output_buffers.push_back(pending_buffer->buffer);
+      }
+      buffer_latency_.Add(GetLatencyNs(pending_buffer->ready_time, now));
+      pending_buffers.PopFront();
+      ready_count++;
+    }
+  }
+
+  results->reserve(ready_results.size());
+  for (auto& [frame_number, result] : ready_results) {
+    results->push_back(std::move(result));
+  }
+
+  return ready_count;
+}
+
+size_t ResultDispatcher::NotifyBatch() {
+  ATRACE_CALL();
+  std::vector<std::unique_ptr<CaptureResult>> results;
+  size_t notified;
+  batch_shutters_.clear();
+  {
+    std::lock_guard<std::mutex> lock(result_lock_);
+    notified = GetReadyResultsLocked(&batch_shutters_, &results);
+  }
+
+  for (auto& message : batch_shutters_) {
+    ALOGV("%s: Notify shutter for frame %u timestamp %" PRIu64, __FUNCTION__,
+          message.message.shutter.frame_number,
+          message.message.shutter.timestamp_ns);
+    notify_(message);
+  }
+
+  if (!results.empty()) {
+    ALOGV("%s: Notify %zu results for frames %u to %u", __FUNCTION__,
+          results.size(), results.front()->frame_number,
+          results.back()->frame_number);
+    process_batch_capture_result_(std::move(results));
+  }
+
+  return notified;
 }
 
 }  // namespace google_camera_hal
@@ -17,9 +17,13 @@
 #ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_RESULT_DISPATCHER_H_
 #define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_RESULT_DISPATCHER_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <map>
 #include <thread>
 
+#include "frame_number_ring.h"
 #include "hal_types.h"
 
 namespace android {
@@ -32,15 +36,58 @@ namespace google_camera_hal {
 // any order. ResultDispatcher will invoke ProcessCaptureResultFunc and
 // NotifyFunc to notify result metadata, shutters, and stream buffers in the
 // in the order of increasing frame numbers.
+//
+// When a ProcessBatchCaptureResultFunc is provided, every shutter, final result
+// metadata and buffer that is ready is collected in one pass. Shutters are
+// notified first, then the final result metadata and buffers of the same frame
+// are merged into one CaptureResult and the results are delivered through one
+// ProcessBatchCaptureResultFunc call, sorted by frame number. Partial results
+// are still delivered right away via ProcessCaptureResultFunc. Batching only
+// pays off for clients that forward the whole batch at once, the capture
+// sessions deliver one result at a time and don't enable it.
+//
+// The callback thread only wakes up when the oldest pending shutter, final
+// result metadata or buffer of a stream becomes ready. A watchdog thread logs
+// the pending state when nothing was delivered for kCallbackThreadTimeoutMs.
 class ResultDispatcher {
  public:
+  // Distribution of the time between a shutter, final result metadata or
+  // buffer becoming ready and its delivery.
+  struct LatencyHistogram {
+    static constexpr size_t kBucketCount = 9;
+    // Upper bucket limits, the last bucket is open ended.
+    static const int64_t kBucketLimitsNs[kBucketCount - 1];
+
+    uint64_t buckets[kBucketCount] = {};
+    uint64_t count = 0;
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+
+    void Add(int64_t latency_ns);
+  };
+
+  struct Statistics {
+    // Wakeups of the callback thread and the ones that found nothing to
+    // deliver.
+    uint64_t wakeups = 0;
+    uint64_t empty_wakeups = 0;
+    // Periods of kCallbackThreadTimeoutMs without any delivery while results
+    // were pending.
+    uint64_t stalls = 0;
+    LatencyHistogram shutter_latency;
+    LatencyHistogram final_metadata_latency;
+    LatencyHistogram buffer_latency;
+  };
+
   // Create a ResultDispatcher.
   // partial_result_count is the partial result count.
   // process_capture_result is the function to notify capture results.
   // notify is the function to notify shutter messages.
+  // process_batch_capture_result is optional and enables the batching mode.
   static std::unique_ptr<ResultDispatcher> Create(
       uint32_t partial_result_count,
-      ProcessCaptureResultFunc process_capture_result, NotifyFunc notify);
+      ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
+      ProcessBatchCaptureResultFunc process_batch_capture_result = nullptr);
 
   virtual ~ResultDispatcher();
 
@@ -65,13 +112,19 @@ class ResultDispatcher {
   // Remove a pending request.
   void RemovePendingRequest(uint32_t frame_number);
 
+  Statistics GetStatistics();
+
  protected:
   ResultDispatcher(uint32_t partial_result_count,
                    ProcessCaptureResultFunc process_capture_result,
-                   NotifyFunc notify);
+                   NotifyFunc notify,
+                   ProcessBatchCaptureResultFunc process_batch_capture_result);
 
  private:
   static constexpr uint32_t kCallbackThreadTimeoutMs = 500;
+  // Number of pending frames kept in the rings of pending shutters, result
+  // metadata and buffers before falling back to ordered maps.
+  static constexpr size_t kPendingFrameCapacity = 32;
   const uint32_t kPartialResultCount;
 
   // Define a pending shutter that will be ready later when AddShutter() is
@@ -79,6 +132,7 @@ class ResultDispatcher {
   struct PendingShutter {
     int64_t timestamp_ns = 0;
     bool ready = false;
+    std::chrono::steady_clock::time_point ready_time;
   };
 
   // Define a pending buffer that will be ready later when AddResult() is called.
@@ -86,6 +140,7 @@ class ResultDispatcher {
     StreamBuffer buffer = {};
     bool is_input = false;
     bool ready = false;
+    std::chrono::steady_clock::time_point ready_time;
   };
 
   // Define a pending final result metadata that will be ready later when
@@ -94,6 +149,7 @@ class ResultDispatcher {
     std::unique_ptr<HalCameraMetadata> metadata;
     std::vector<PhysicalCameraMetadata> physical_metadata;
     bool ready = false;
+    std::chrono::steady_clock::time_point ready_time;
   };
 
   // Add a pending request for a frame. Must be protected with result_lock_.
@@ -119,16 +175,26 @@ class ResultDispatcher {
                             std::vector<PhysicalCameraMetadata> physical_metadata,
                             uint32_t partial_result);
 
+  // deliverable is set to true in case the added final result metadata or
+  // buffer is the oldest pending one and can be delivered right away.
   status_t AddFinalResultMetadata(
       uint32_t frame_number, std::unique_ptr<HalCameraMetadata> final_metadata,
-      std::vector<PhysicalCameraMetadata> physical_metadata);
+      std::vector<PhysicalCameraMetadata> physical_metadata, bool* deliverable);
 
   status_t AddResultMetadata(
       uint32_t frame_number, std::unique_ptr<HalCameraMetadata> metadata,
       std::vector<PhysicalCameraMetadata> physical_metadata,
-      uint32_t partial_result);
+      uint32_t partial_result, bool* deliverable);
+
+  status_t AddBuffer(uint32_t frame_number, StreamBuffer buffer,
+                     bool* deliverable);
+
+  // Whether the oldest pending shutter, final result metadata or buffer of a
+  // stream is ready. Must be protected with result_lock_.
+  bool HasDeliverableLocked();
 
-  status_t AddBuffer(uint32_t frame_number, StreamBuffer buffer);
+  // Wake up notify_callback_thread_ to deliver the ready results.
+  void WakeUpCallbackThread();
 
   // Get a shutter message that is ready to be notified via notify_.
   status_t GetReadyShutterMessage(NotifyMessage* message);
@@ -144,37 +210,82 @@ class ResultDispatcher {
   status_t GetReadyBufferResult(std::unique_ptr<CaptureResult>* result);
 
   // Check all pending shutters and invoke notify_ with shutters that are ready.
-  void NotifyShutters();
+  // Returns the number of notified shutters.
+  size_t NotifyShutters();
 
   // Check all pending final result metadata and invoke process_capture_result_
-  // with final result metadata that are ready.
-  void NotifyFinalResultMetadata();
+  // with final result metadata that are ready. Returns the number of notified
+  // final result metadata.
+  size_t NotifyFinalResultMetadata();
 
   // Check all pending buffers and invoke notify_ with buffers that are ready.
-  void NotifyBuffers();
+  // Returns the number of notified buffers.
+  size_t NotifyBuffers();
+
+  // Collect all shutters, final result metadata and buffers that are ready in
+  // one pass. Final result metadata and buffers of the same frame are merged
+  // into one result, results are sorted by frame number. Returns the number of
+  // collected shutters, final result metadata and buffers. Must be protected
+  // with result_lock_.
+  size_t GetReadyResultsLocked(
+      std::vector<NotifyMessage>* shutters,
+      std::vector<std::unique_ptr<CaptureResult>>* results);
+
+  // Notify all ready shutters via notify_ and all ready final result metadata
+  // and buffers via process_batch_capture_result_. Returns the number of
+  // notified shutters, final result metadata and buffers.
+  size_t NotifyBatch();
 
   // Thread loop to check pending shutters, result metadata, and buffers. It
   // notifies the client when one is ready.
   void NotifyCallbackThreadLoop();
 
-  void PrintTimeoutMessages();
+  // Thread loop to print the pending state when nothing was delivered for
+  // kCallbackThreadTimeoutMs.
+  void WatchdogThreadLoop();
+
+  // A pending shutter, final result metadata or buffer as logged by the
+  // watchdog.
+  struct PendingEntry {
+    const char* type = nullptr;
+    int32_t stream_id = -1;
+    uint32_t frame_number = 0;
+    bool ready = false;
+  };
+
+  // Copy the pending state, so it can be logged without holding result_lock_.
+  std::vector<PendingEntry> GetPendingEntries();
+
+  void PrintTimeoutMessages(const std::vector<PendingEntry>& entries);
 
   std::mutex result_lock_;
 
   // Maps from frame numbers to pending shutters.
   // Protected by result_lock_.
-  std::map<uint32_t, PendingShutter> pending_shutters_;
+  FrameNumberRing<PendingShutter> pending_shutters_{kPendingFrameCapacity};
+
+  // Maps from a stream ID to "a ring from a frame number to a pending buffer."
+  // Protected by result_lock_.
+  std::map<uint32_t, FrameNumberRing<PendingBuffer>>
+      stream_pending_buffers_map_;
 
-  // Maps from a stream ID to "a map from a frame number to a pending buffer."
+  // Maps from frame numbers to pending result metadata.
   // Protected by result_lock_.
-  std::map<uint32_t, std::map<uint32_t, PendingBuffer>> stream_pending_buffers_map_;
+  FrameNumberRing<PendingFinalResultMetadata> pending_final_metadata_{
+      kPendingFrameCapacity};
 
-  // Maps from a stream ID to pending result metadata.
   // Protected by result_lock_.
-  std::map<uint32_t, PendingFinalResultMetadata> pending_final_metadata_;
+  LatencyHistogram shutter_latency_;
+  LatencyHistogram final_metadata_latency_;
+  LatencyHistogram buffer_latency_;
 
   ProcessCaptureResultFunc process_capture_result_;
   NotifyFunc notify_;
+  ProcessBatchCaptureResultFunc process_batch_capture_result_;
+
+  // Only accessed by notify_callback_thread_ in NotifyBatch(), kept to reuse
+  // the allocation across passes.
+  std::vector<NotifyMessage> batch_shutters_;
 
   // A thread to run NotifyCallbackThreadLoop().
   std::thread notify_callback_thread_;
@@ -186,6 +297,22 @@ class ResultDispatcher {
 
   // Protected by notify_callback_lock.
   bool notify_callback_thread_exiting = false;
+
+  // Set when the oldest pending shutter, final result metadata or buffer of a
+  // stream becomes ready. Protected by notify_callback_lock.
+  bool results_deliverable_ = false;
+
+  // A thread to run WatchdogThreadLoop().
+  std::thread watchdog_thread_;
+
+  // Condition to wake up watchdog_thread_ when exiting. Used with
+  // notify_callback_lock.
+  std::condition_variable watchdog_condition_;
+
+  std::atomic<uint64_t> wakeup_count_ = 0;
+  std::atomic<uint64_t> empty_wakeup_count_ = 0;
+  std::atomic<uint64_t> delivered_count_ = 0;
+  std::atomic<uint64_t> stall_count_ = 0;
 };
 
 }  // namespace google_camera_hal
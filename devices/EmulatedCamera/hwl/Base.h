@@ -23,6 +23,7 @@
 
 #include "HandleImporter.h"
 #include "hwl_types.h"
+#include "utils/ImportedBufferCache.h"
 
 namespace android {
 
@@ -54,6 +55,8 @@ struct SensorBuffer {
   android_dataspace_t dataSpace;
   StreamBuffer stream_buffer;
   HandleImporter importer;
+  // Keeps the import of 'stream_buffer' alive if it came from a cache
+  std::shared_ptr<ImportedBufferCache::ImportedBuffer> imported_buffer;
   HwlPipelineCallback callback;
   int acquire_fence_fd;
   bool is_input;
@@ -98,7 +101,9 @@ struct std::default_delete<android::SensorBuffer> {
     if (buffer != nullptr) {
       if (buffer->stream_buffer.buffer != nullptr) {
         buffer->importer.unlock(buffer->stream_buffer.buffer);
-        buffer->importer.freeBuffer(buffer->stream_buffer.buffer);
+        if (buffer->imported_buffer.get() == nullptr) {
+          buffer->importer.freeBuffer(buffer->stream_buffer.buffer);
+        }
       }
 
       if (buffer->acquire_fence_fd >= 0) {
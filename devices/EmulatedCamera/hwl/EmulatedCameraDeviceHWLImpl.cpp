@@ -18,14 +18,43 @@
 #define LOG_TAG "EmulatedCameraDeviceHwlImpl"
 #include "EmulatedCameraDeviceHWLImpl.h"
 
+#include <cutils/properties.h>
 #include <hardware/camera_common.h>
 #include <log/log.h>
+#include <stdio.h>
+
+#include <algorithm>
 
 #include "EmulatedCameraDeviceSessionHWLImpl.h"
 #include "utils/HWLUtils.h"
 
 namespace android {
 
+// Render cache capacity in MiB, zero disables caching
+const char* EmulatedCameraDeviceHwlImpl::kRenderCacheSizeProperty =
+    "persist.vendor.camera.emulated.render_cache_size";
+const int32_t EmulatedCameraDeviceHwlImpl::kDefaultRenderCacheSizeMiB = 16;
+
+void EmulatedSessionRegistry::Register(
+    EmulatedCameraDeviceSessionHwlImpl* session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sessions_.push_back(session);
+}
+
+void EmulatedSessionRegistry::Unregister(
+    EmulatedCameraDeviceSessionHwlImpl* session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sessions_.erase(std::remove(sessions_.begin(), sessions_.end(), session),
+                  sessions_.end());
+}
+
+void EmulatedSessionRegistry::DumpState(int fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto session : sessions_) {
+    session->DumpState(fd);
+  }
+}
+
 std::unique_ptr<CameraDeviceHwl> EmulatedCameraDeviceHwlImpl::Create(
     uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta,
     PhysicalDeviceMapPtr physical_devices,
@@ -67,7 +96,15 @@ uint32_t EmulatedCameraDeviceHwlImpl::GetCameraId() const {
 }
 
 status_t EmulatedCameraDeviceHwlImpl::Initialize() {
-  auto ret = GetSensorCharacteristics(static_metadata_.get(), &sensor_chars_);
+  // Static characteristics don't change, let readers skip the metadata lock.
+  auto ret = static_metadata_->Freeze();
+  if (ret != OK) {
+    ALOGE("%s: Unable to freeze static metadata %s (%d)", __FUNCTION__,
+          strerror(-ret), ret);
+    return ret;
+  }
+
+  ret = GetSensorCharacteristics(static_metadata_.get(), &sensor_chars_);
   if (ret != OK) {
     ALOGE("%s: Unable to extract sensor characteristics %s (%d)", __FUNCTION__,
           strerror(-ret), ret);
@@ -77,6 +114,13 @@ status_t EmulatedCameraDeviceHwlImpl::Initialize() {
   stream_coniguration_map_ =
       std::make_unique<StreamConfigurationMap>(*static_metadata_);
 
+  int32_t render_cache_size = property_get_int32(kRenderCacheSizeProperty,
+                                                 kDefaultRenderCacheSizeMiB);
+  if (render_cache_size > 0) {
+    render_cache_ = std::make_shared<RenderCache>(
+        static_cast<size_t>(render_cache_size) * 1024 * 1024);
+  }
+
   return OK;
 }
 
@@ -132,7 +176,15 @@ status_t EmulatedCameraDeviceHwlImpl::SetTorchMode(TorchMode mode) {
   return torch_state_->SetTorchMode(mode);
 }
 
-status_t EmulatedCameraDeviceHwlImpl::DumpState(int /*fd*/) {
+status_t EmulatedCameraDeviceHwlImpl::DumpState(int fd) {
+  dprintf(fd, "Emulated camera %u:\n", camera_id_);
+  if (render_cache_.get() != nullptr) {
+    render_cache_->Dump(fd);
+  } else {
+    dprintf(fd, "  Render cache: disabled\n");
+  }
+  session_registry_->DumpState(fd);
+
   return OK;
 }
 
@@ -148,7 +200,7 @@ status_t EmulatedCameraDeviceHwlImpl::CreateCameraDeviceSessionHwl(
       HalCameraMetadata::Clone(static_metadata_.get());
   *session = EmulatedCameraDeviceSessionHwlImpl::Create(
       camera_id_, std::move(meta), ClonePhysicalDeviceMap(physical_device_map_),
-      torch_state_);
+      torch_state_, render_cache_, session_registry_);
   if (*session == nullptr) {
     ALOGE("%s: Cannot create EmulatedCameraDeviceSessionHWlImpl.", __FUNCTION__);
     return BAD_VALUE;
@@ -20,9 +20,13 @@
 #include <camera_device_hwl.h>
 #include <hal_types.h>
 
+#include <mutex>
+#include <vector>
+
 #include "EmulatedSensor.h"
 #include "EmulatedTorchState.h"
 #include "utils/HWLUtils.h"
+#include "utils/RenderCache.h"
 #include "utils/StreamConfigurationMap.h"
 
 namespace android {
@@ -35,6 +39,22 @@ using google_camera_hal::HalCameraMetadata;
 using google_camera_hal::StreamConfiguration;
 using google_camera_hal::TorchMode;
 
+class EmulatedCameraDeviceSessionHwlImpl;
+
+// Sessions of a device that are alive, so that the device can dump their
+// state. Sessions register once they are initialized and unregister before
+// they are torn down, which waits for an ongoing dump.
+class EmulatedSessionRegistry {
+ public:
+  void Register(EmulatedCameraDeviceSessionHwlImpl* session);
+  void Unregister(EmulatedCameraDeviceSessionHwlImpl* session);
+  void DumpState(int fd);
+
+ private:
+  std::mutex mutex_;
+  std::vector<EmulatedCameraDeviceSessionHwlImpl*> sessions_;
+};
+
 class EmulatedCameraDeviceHwlImpl : public CameraDeviceHwl {
  public:
   static std::unique_ptr<CameraDeviceHwl> Create(
@@ -83,7 +103,14 @@ class EmulatedCameraDeviceHwlImpl : public CameraDeviceHwl {
   std::unique_ptr<StreamConfigurationMap> stream_coniguration_map_;
   PhysicalDeviceMapPtr physical_device_map_;
   std::shared_ptr<EmulatedTorchState> torch_state_;
+  // Shared by all sessions of this device
+  std::shared_ptr<RenderCache> render_cache_;
+  std::shared_ptr<EmulatedSessionRegistry> session_registry_ =
+      std::make_shared<EmulatedSessionRegistry>();
   SensorCharacteristics sensor_chars_;
+
+  static const char* kRenderCacheSizeProperty;
+  static const int32_t kDefaultRenderCacheSizeMiB;
 };
 
 }  // namespace android
@@ -21,6 +21,7 @@
 #include <hardware/gralloc.h>
 #include <inttypes.h>
 #include <log/log.h>
+#include <stdio.h>
 #include <utils/Trace.h>
 
 #include "EmulatedSensor.h"
@@ -32,15 +33,18 @@ std::unique_ptr<EmulatedCameraDeviceSessionHwlImpl>
 EmulatedCameraDeviceSessionHwlImpl::Create(
     uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta,
     PhysicalDeviceMapPtr physical_devices,
-    std::shared_ptr<EmulatedTorchState> torch_state) {
+    std::shared_ptr<EmulatedTorchState> torch_state,
+    std::shared_ptr<RenderCache> render_cache,
+    std::shared_ptr<EmulatedSessionRegistry> session_registry) {
   ATRACE_CALL();
   if (static_meta.get() == nullptr) {
     return nullptr;
   }
 
   auto session = std::unique_ptr<EmulatedCameraDeviceSessionHwlImpl>(
-      new EmulatedCameraDeviceSessionHwlImpl(std::move(physical_devices),
-                                             torch_state));
+      new EmulatedCameraDeviceSessionHwlImpl(
+          std::move(physical_devices), torch_state, render_cache,
+          session_registry));
   if (session == nullptr) {
     ALOGE("%s: Creating EmulatedCameraDeviceSessionHwlImpl failed",
           __FUNCTION__);
@@ -54,6 +58,10 @@ EmulatedCameraDeviceSessionHwlImpl::Create(
     return nullptr;
   }
 
+  if (session->session_registry_.get() != nullptr) {
+    session->session_registry_->Register(session.get());
+  }
+
   return session;
 }
 
@@ -61,10 +69,17 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Initialize(
     uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta) {
   camera_id_ = camera_id;
   static_metadata_ = std::move(static_meta);
+  auto ret = static_metadata_->Freeze();
+  if (ret != OK) {
+    ALOGE("%s: Unable to freeze static metadata %s (%d)", __FUNCTION__,
+          strerror(-ret), ret);
+    return ret;
+  }
+
   stream_coniguration_map_ =
       std::make_unique<StreamConfigurationMap>(*static_metadata_);
   camera_metadata_ro_entry_t entry;
-  auto ret = static_metadata_->Get(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &entry);
+  ret = static_metadata_->Get(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &entry);
   if (ret != OK) {
     ALOGE("%s: Unable to extract ANDROID_REQUEST_PIPELINE_MAX_DEPTH, %s (%d)",
           __FUNCTION__, strerror(-ret), ret);
@@ -94,7 +109,8 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Initialize(
     }
   }
   sp<EmulatedSensor> emulated_sensor = new EmulatedSensor();
-  ret = emulated_sensor->StartUp(camera_id_, std::move(logical_chars));
+  ret = emulated_sensor->StartUp(camera_id_, std::move(logical_chars),
+                                 render_cache_);
   if (ret != OK) {
     ALOGE("%s: Failed on sensor start up %s (%d)", __FUNCTION__, strerror(-ret),
           ret);
@@ -110,11 +126,18 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Initialize(
 }
 
 EmulatedCameraDeviceSessionHwlImpl::~EmulatedCameraDeviceSessionHwlImpl() {
+  if (session_registry_.get() != nullptr) {
+    session_registry_->Unregister(this);
+  }
   if (torch_state_.get() != nullptr) {
     torch_state_->ReleaseFlashHw();
   }
 }
 
+void EmulatedCameraDeviceSessionHwlImpl::DumpState(int fd) {
+  request_processor_->DumpState(fd);
+}
+
 status_t EmulatedCameraDeviceSessionHwlImpl::ConstructDefaultRequestSettings(
     RequestTemplate type, std::unique_ptr<HalCameraMetadata>* default_settings) {
   ATRACE_CALL();
@@ -146,6 +169,13 @@ status_t EmulatedCameraDeviceSessionHwlImpl::ConfigurePipeline(
     return BAD_VALUE;
   }
 
+  uint32_t high_speed_batch_size = 0;
+  if (request_config.operation_mode ==
+      google_camera_hal::StreamConfigurationMode::kConstrainedHighSpeed) {
+    high_speed_batch_size =
+        EmulatedSensor::GetHighSpeedBatchSize(request_config, sensor_chars_);
+  }
+
   if ((physical_camera_id != camera_id_) &&
       (physical_device_map_.get() != nullptr)) {
     if (physical_device_map_->find(physical_camera_id) ==
@@ -186,6 +216,7 @@ status_t EmulatedCameraDeviceSessionHwlImpl::ConfigurePipeline(
   }
 
   pipelines_.push_back(emulated_pipeline);
+  request_processor_->SetHighSpeedMode(high_speed_batch_size);
 
   return OK;
 }
@@ -245,6 +276,8 @@ void EmulatedCameraDeviceSessionHwlImpl::DestroyPipelines() {
 
   pipelines_built_ = false;
   pipelines_.clear();
+  request_processor_->ClearBufferCache();
+  request_processor_->SetHighSpeedMode(/*batch_size*/ 0);
 }
 
 status_t EmulatedCameraDeviceSessionHwlImpl::SubmitRequests(
@@ -294,6 +327,13 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Flush() {
   return request_processor_->Flush();
 }
 
+void EmulatedCameraDeviceSessionHwlImpl::RemoveBufferCache(
+    const std::vector<BufferCache>& buffer_caches) {
+  ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(api_mutex_);
+  request_processor_->RemoveBufferCache(buffer_caches);
+}
+
 uint32_t EmulatedCameraDeviceSessionHwlImpl::GetCameraId() const {
   return camera_id_;
 }
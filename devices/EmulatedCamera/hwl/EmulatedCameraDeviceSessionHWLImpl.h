@@ -29,6 +29,7 @@
 
 namespace android {
 
+using google_camera_hal::BufferCache;
 using google_camera_hal::CameraDeviceHwl;
 using google_camera_hal::CameraDeviceSessionHwl;
 using google_camera_hal::HalStream;
@@ -49,10 +50,15 @@ class EmulatedCameraDeviceSessionHwlImpl : public CameraDeviceSessionHwl {
   static std::unique_ptr<EmulatedCameraDeviceSessionHwlImpl> Create(
       uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta,
       PhysicalDeviceMapPtr physical_devices,
-      std::shared_ptr<EmulatedTorchState> torch_state);
+      std::shared_ptr<EmulatedTorchState> torch_state,
+      std::shared_ptr<RenderCache> render_cache,
+      std::shared_ptr<EmulatedSessionRegistry> session_registry);
 
   virtual ~EmulatedCameraDeviceSessionHwlImpl();
 
+  // Dumps the sensor and request processing statistics of the session
+  void DumpState(int fd);
+
   // Override functions in CameraDeviceSessionHwl
   status_t ConstructDefaultRequestSettings(
       RequestTemplate type,
@@ -94,6 +100,9 @@ class EmulatedCameraDeviceSessionHwlImpl : public CameraDeviceSessionHwl {
 
   status_t Flush() override;
 
+  void RemoveBufferCache(
+      const std::vector<BufferCache>& buffer_caches) override;
+
   uint32_t GetCameraId() const override;
 
   std::vector<uint32_t> GetPhysicalCameraIds() const override;
@@ -152,8 +161,12 @@ class EmulatedCameraDeviceSessionHwlImpl : public CameraDeviceSessionHwl {
 
   EmulatedCameraDeviceSessionHwlImpl(
       PhysicalDeviceMapPtr physical_devices,
-      std::shared_ptr<EmulatedTorchState> torch_state)
+      std::shared_ptr<EmulatedTorchState> torch_state,
+      std::shared_ptr<RenderCache> render_cache,
+      std::shared_ptr<EmulatedSessionRegistry> session_registry)
       : torch_state_(torch_state),
+        render_cache_(render_cache),
+        session_registry_(session_registry),
         physical_device_map_(std::move(physical_devices)) {
   }
 
@@ -170,6 +183,9 @@ class EmulatedCameraDeviceSessionHwlImpl : public CameraDeviceSessionHwl {
   std::unique_ptr<StreamConfigurationMap> stream_coniguration_map_;
   SensorCharacteristics sensor_chars_;
   std::shared_ptr<EmulatedTorchState> torch_state_;
+  std::shared_ptr<RenderCache> render_cache_;
+  // Lets the device dump the state of this session
+  std::shared_ptr<EmulatedSessionRegistry> session_registry_;
   PhysicalDeviceMapPtr physical_device_map_;
 };
 
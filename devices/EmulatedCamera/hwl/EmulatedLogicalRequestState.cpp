@@ -118,8 +118,15 @@ EmulatedLogicalRequestState::InitializeLogicalResult(uint32_t pipeline_id,
   return ret;
 }
 
+void EmulatedLogicalRequestState::SetHighSpeedMode(bool enabled) {
+  logical_request_state_->SetHighSpeedMode(enabled);
+  for (auto& it : physical_request_states_) {
+    it.second->SetHighSpeedMode(enabled);
+  }
+}
+
 status_t EmulatedLogicalRequestState::InitializeLogicalSettings(
-    std::unique_ptr<HalCameraMetadata> request_settings,
+    std::shared_ptr<const HalCameraMetadata> request_settings,
     std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids,
     EmulatedSensor::LogicalCameraSettings* logical_settings /*out*/) {
   if (logical_settings == nullptr) {
@@ -137,15 +144,33 @@ status_t EmulatedLogicalRequestState::InitializeLogicalSettings(
   if (is_logical_device_) {
     std::swap(physical_camera_output_ids_, physical_camera_output_ids);
 
+    // The logical and physical request states share the same request
+    // validator layout, parse the settings only once for all of them. The
+    // device specific capabilities and limits are still applied by each
+    // request state.
+    auto ret = logical_request_state_->ParseSettings(request_settings,
+                                                     &parsed_settings_);
+    if (ret != OK) {
+      ALOGE("%s: Failed to parse request settings: %d, (%s)", __FUNCTION__,
+            ret, strerror(-ret));
+      return ret;
+    }
+
     for (const auto& physical_request_state : physical_request_states_) {
-      // All physical devices will receive requests and will keep
-      // updating their respective request state.
-      // However only physical devices referenced by client need to propagate
-      // and apply their settings.
+      // Only physical devices referenced by client need to propagate and
+      // apply their settings. The 3A state of the remaining devices is
+      // updated lazily once they get referenced again, triggers are the
+      // exception as they must not get lost.
+      bool referenced =
+          physical_camera_output_ids_->find(physical_request_state.first) !=
+          physical_camera_output_ids_->end();
+      if (!referenced && !parsed_settings_.has_triggers) {
+        continue;
+      }
+
       EmulatedSensor::SensorSettings physical_sensor_settings;
-      auto ret = physical_request_state.second->InitializeSensorSettings(
-          HalCameraMetadata::Clone(request_settings.get()),
-          &physical_sensor_settings);
+      ret = physical_request_state.second->InitializeSensorSettings(
+          parsed_settings_, &physical_sensor_settings);
       if (ret != OK) {
         ALOGE(
             "%s: Initialization of physical sensor settings for device id: %u  "
@@ -154,8 +179,7 @@ status_t EmulatedLogicalRequestState::InitializeLogicalSettings(
         return ret;
       }
 
-      if (physical_camera_output_ids_->find(physical_request_state.first) !=
-          physical_camera_output_ids_->end()) {
+      if (referenced) {
         logical_settings->emplace(physical_request_state.first,
                                   physical_sensor_settings);
         if (max_frame_duration < physical_sensor_settings.exposure_time) {
@@ -181,8 +205,11 @@ status_t EmulatedLogicalRequestState::InitializeLogicalSettings(
   }
 
   EmulatedSensor::SensorSettings sensor_settings;
-  auto ret = logical_request_state_->InitializeSensorSettings(
-      std::move(request_settings), &sensor_settings);
+  auto ret = is_logical_device_
+                 ? logical_request_state_->InitializeSensorSettings(
+                       parsed_settings_, &sensor_settings)
+                 : logical_request_state_->InitializeSensorSettings(
+                       std::move(request_settings), &sensor_settings);
   logical_settings->emplace(logical_camera_id_, sensor_settings);
   if (max_frame_duration < sensor_settings.exposure_time) {
     max_frame_duration = sensor_settings.exposure_time;
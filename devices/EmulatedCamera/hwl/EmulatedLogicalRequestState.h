@@ -41,10 +41,13 @@ class EmulatedLogicalRequestState {
       uint32_t pipeline_id, uint32_t frame_number);
 
   status_t InitializeLogicalSettings(
-      std::unique_ptr<HalCameraMetadata> request_settings,
+      std::shared_ptr<const HalCameraMetadata> request_settings,
       std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids,
       EmulatedSensor::LogicalCameraSettings* logical_settings /*out*/);
 
+  // See 'EmulatedRequestState::SetHighSpeedMode()'
+  void SetHighSpeedMode(bool enabled);
+
   static std::unique_ptr<HalCameraMetadata> AdaptLogicalCharacteristics(
       std::unique_ptr<HalCameraMetadata> logical_chars,
       PhysicalDeviceMapPtr physical_devices);
@@ -61,6 +64,8 @@ class EmulatedLogicalRequestState {
   // Maps particular focal length to physical device id
   std::unordered_map<float, uint32_t> physical_focal_length_map_;
   float current_focal_length_ = 0.f;
+  // Settings of the current request shared by all request states
+  EmulatedRequestState::ParsedSettings parsed_settings_;
 
   EmulatedLogicalRequestState(const EmulatedLogicalRequestState&) = delete;
   EmulatedLogicalRequestState& operator=(const EmulatedLogicalRequestState&) =
@@ -22,10 +22,13 @@
 #include <HandleImporter.h>
 #include <hardware/gralloc.h>
 #include <log/log.h>
-#include <sync/sync.h>
+#include <stdio.h>
 #include <utils/Timers.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
+#include <cinttypes>
+
 namespace android {
 
 using android::hardware::camera::common::V1_0::helper::HandleImporter;
@@ -40,13 +43,18 @@ EmulatedRequestProcessor::EmulatedRequestProcessor(uint32_t camera_id,
       sensor_(sensor),
       request_state_(std::make_unique<EmulatedLogicalRequestState>(camera_id)) {
   ATRACE_CALL();
-  request_thread_ = std::thread([this] { this->RequestProcessorLoop(); });
 }
 
 EmulatedRequestProcessor::~EmulatedRequestProcessor() {
   ATRACE_CALL();
   processor_done_ = true;
-  request_thread_.join();
+  fence_waiter_.Wake();
+  if (fence_thread_.joinable()) {
+    fence_thread_.join();
+  }
+  if (request_thread_.joinable()) {
+    request_thread_.join();
+  }
 
   auto ret = sensor_->ShutDown();
   if (ret != OK) {
@@ -69,7 +77,7 @@ status_t EmulatedRequestProcessor::ProcessPipelineRequests(
       return BAD_VALUE;
     }
 
-    while (pending_requests_.size() > EmulatedSensor::kPipelineDepth) {
+    while (queued_requests_ >= pipeline_depth_) {
       auto result = request_condition_.wait_for(
           lock, std::chrono::nanoseconds(
                     EmulatedSensor::kSupportedFrameDurationRange[1]));
@@ -88,10 +96,14 @@ status_t EmulatedRequestProcessor::ProcessPipelineRequests(
         pipelines[request.pipeline_id].streams, request.pipeline_id,
         pipelines[request.pipeline_id].cb);
 
-    pending_requests_.push(
+    // Cannot fail, the request slots cover the whole pipeline depth
+    pending_requests_.Push(
         {.settings = HalCameraMetadata::Clone(request.settings.get()),
          .input_buffers = std::move(input_buffers),
-         .output_buffers = std::move(output_buffers)});
+         .output_buffers = std::move(output_buffers),
+         .arrival_time = systemTime()});
+    queued_requests_++;
+    fence_waiter_.Wake();
   }
 
   return OK;
@@ -137,17 +149,27 @@ void EmulatedRequestProcessor::NotifyFailedRequest(const PendingRequest& request
 }
 
 status_t EmulatedRequestProcessor::Flush() {
-  std::lock_guard<std::mutex> lock(process_mutex_);
+  std::unique_lock<std::mutex> lock(process_mutex_);
   // First flush in-flight requests
   auto ret = sensor_->Flush();
 
-  // Then the rest of the pending requests
-  while (!pending_requests_.empty()) {
-    const auto& request = pending_requests_.front();
-    NotifyFailedRequest(request);
-    pending_requests_.pop();
+  // Buffers may be reallocated after a flush
+  buffer_cache_.Clear();
+
+  // Then the requests that are ready for the sensor
+  while (!ready_requests_.Empty()) {
+    NotifyFailedRequest(ready_requests_.Front());
+    ready_requests_.Pop();
+    queued_requests_--;
   }
 
+  // The fence thread fails the remaining requests in order. It is only
+  // blocked in poll() which the wakeup interrupts.
+  flush_requested_ = true;
+  fence_waiter_.Wake();
+  flush_condition_.wait(lock, [this] { return !flush_requested_; });
+  request_condition_.notify_all();
+
   return ret;
 }
 
@@ -287,7 +309,11 @@ std::unique_ptr<SensorBuffer> EmulatedRequestProcessor::CreateSensorBuffer(
   // In case buffer processing is successful, flip this flag accordingly
   buffer->stream_buffer.status = BufferStatus::kError;
 
-  if (!buffer->importer.importBuffer(buffer->stream_buffer.buffer)) {
+  buffer->imported_buffer = buffer_cache_.Import(
+      stream_buffer.stream_id, stream_buffer.buffer_id, stream_buffer.buffer);
+  if (buffer->imported_buffer.get() != nullptr) {
+    buffer->stream_buffer.buffer = buffer->imported_buffer->handle();
+  } else {
     ALOGE("%s: Failed importing stream buffer!", __FUNCTION__);
     buffer.release();
     buffer = nullptr;
@@ -325,17 +351,9 @@ std::unique_ptr<Buffers> EmulatedRequestProcessor::AcquireBuffers(
   acquired_buffers->reserve(buffers->size());
   auto output_buffer = buffers->begin();
   while (output_buffer != buffers->end()) {
-    status_t ret = OK;
-    if ((*output_buffer)->acquire_fence_fd >= 0) {
-      ret = sync_wait((*output_buffer)->acquire_fence_fd,
-                      ns2ms(EmulatedSensor::kSupportedFrameDurationRange[1]));
-      if (ret != OK) {
-        ALOGE("%s: Fence sync failed: %s, (%d)", __FUNCTION__, strerror(-ret),
-              ret);
-      }
-    }
-
-    if (ret == OK) {
+    // The fence thread closes every acquire fence that signals, any fence
+    // still open at this point has failed or timed out.
+    if ((*output_buffer)->acquire_fence_fd < 0) {
       acquired_buffers->push_back(std::move(*output_buffer));
     }
 
@@ -345,16 +363,220 @@ std::unique_ptr<Buffers> EmulatedRequestProcessor::AcquireBuffers(
   return acquired_buffers;
 }
 
+EmulatedRequestProcessor::FenceRequest
+EmulatedRequestProcessor::CreateFenceRequest(PendingRequest request) {
+  FenceRequest fence_request = {.request = std::move(request)};
+  for (auto buffers : {fence_request.request.input_buffers.get(),
+                       fence_request.request.output_buffers.get()}) {
+    if (buffers == nullptr) {
+      continue;
+    }
+    for (auto& buffer : *buffers) {
+      if (buffer->acquire_fence_fd >= 0) {
+        fence_request.pending_fences.push_back(buffer.get());
+      }
+    }
+  }
+
+  return fence_request;
+}
+
+nsecs_t EmulatedRequestProcessor::CollectFences(
+    const RingQueue<FenceRequest>& requests, std::vector<int>* fences) {
+  nsecs_t timeout = -1;
+  nsecs_t now = systemTime();
+  fences->clear();
+  for (size_t i = 0; i < requests.Size(); i++) {
+    const auto& request = requests[i];
+    if (request.pending_fences.empty()) {
+      continue;
+    }
+    for (const auto buffer : request.pending_fences) {
+      fences->push_back(buffer->acquire_fence_fd);
+    }
+    nsecs_t deadline = request.request.arrival_time +
+                       EmulatedSensor::kSupportedFrameDurationRange[1];
+    nsecs_t remaining = std::max<nsecs_t>(deadline - now, 0);
+    timeout = (timeout < 0) ? remaining : std::min(timeout, remaining);
+  }
+
+  return timeout;
+}
+
+void EmulatedRequestProcessor::UpdateFences(
+    const std::vector<FenceWaiter::FenceStatus>& fence_status,
+    RingQueue<FenceRequest>* requests) {
+  nsecs_t now = systemTime();
+  size_t fence_idx = 0;
+  for (size_t i = 0; i < requests->Size(); i++) {
+    auto& request = (*requests)[i];
+    bool expired = now - request.request.arrival_time >=
+                   EmulatedSensor::kSupportedFrameDurationRange[1];
+    auto buffer = request.pending_fences.begin();
+    while (buffer != request.pending_fences.end()) {
+      auto status = fence_status[fence_idx++];
+      if ((status == FenceWaiter::FENCE_PENDING) && !expired) {
+        buffer++;
+        continue;
+      }
+
+      bool signaled = status == FenceWaiter::FENCE_SIGNALED;
+      if (signaled) {
+        (*buffer)->importer.closeFence((*buffer)->acquire_fence_fd);
+        (*buffer)->acquire_fence_fd = -1;
+      } else {
+        ALOGE("%s: Acquire fence of frame %u stream %d %s", __FUNCTION__,
+              (*buffer)->frame_number, (*buffer)->stream_buffer.stream_id,
+              (status == FenceWaiter::FENCE_ERROR) ? "failed" : "timed out");
+      }
+      RecordFenceWait((*buffer)->stream_buffer.stream_id,
+                      now - request.request.arrival_time, signaled);
+      buffer = request.pending_fences.erase(buffer);
+    }
+  }
+}
+
+void EmulatedRequestProcessor::RecordFenceWait(int32_t stream_id,
+                                               nsecs_t wait, bool signaled) {
+  std::lock_guard<std::mutex> lock(fence_stats_mutex_);
+  auto& stats = fence_stats_[stream_id];
+  stats.fences++;
+  stats.failures += signaled ? 0 : 1;
+  stats.total_wait += wait;
+  stats.max_wait = std::max(stats.max_wait, wait);
+}
+
+std::unordered_map<int32_t, FenceWaitStatistics>
+EmulatedRequestProcessor::GetFenceWaitStatistics() const {
+  std::lock_guard<std::mutex> lock(fence_stats_mutex_);
+  return fence_stats_;
+}
+
+void EmulatedRequestProcessor::ClearBufferCache() {
+  buffer_cache_.Clear();
+}
+
+void EmulatedRequestProcessor::RemoveBufferCache(
+    const std::vector<BufferCache>& buffer_caches) {
+  for (const auto& buffer_cache : buffer_caches) {
+    buffer_cache_.Remove(buffer_cache.stream_id, buffer_cache.buffer_id);
+  }
+}
+
+void EmulatedRequestProcessor::SetHighSpeedMode(uint32_t batch_size) {
+  std::lock_guard<std::mutex> lock(process_mutex_);
+  request_state_->SetHighSpeedMode(batch_size > 0);
+  sensor_->SetHighSpeedMode(batch_size);
+}
+
+std::unordered_map<int32_t, ImportedBufferCache::Statistics>
+EmulatedRequestProcessor::GetBufferCacheStatistics() const {
+  return buffer_cache_.GetStatistics();
+}
+
+void EmulatedRequestProcessor::DumpState(int fd) const {
+  sensor_->DumpFrameTiming(fd);
+  for (const auto& it : GetFenceWaitStatistics()) {
+    const auto& stats = it.second;
+    dprintf(fd,
+            "  Stream %d acquire fences: %" PRIu64 " failures: %" PRIu64
+            " average wait: %" PRId64 " us max wait: %" PRId64 " us\n",
+            it.first, stats.fences, stats.failures,
+            ns2us(stats.total_wait / std::max<uint64_t>(stats.fences, 1)),
+            ns2us(stats.max_wait));
+  }
+}
+
+void EmulatedRequestProcessor::FenceWaitLoop() {
+  ATRACE_CALL();
+
+  // 'fence_requests_' is owned by this thread, which keeps the fence fds
+  // valid while polling outside of process_mutex_.
+  std::vector<int> fences;
+  std::vector<FenceWaiter::FenceStatus> fence_status;
+  while (!processor_done_) {
+    {
+      std::lock_guard<std::mutex> lock(process_mutex_);
+      if (flush_requested_) {
+        while (!fence_requests_.Empty()) {
+          NotifyFailedRequest(fence_requests_.Front().request);
+          fence_requests_.Pop();
+          queued_requests_--;
+        }
+        while (!pending_requests_.Empty()) {
+          NotifyFailedRequest(pending_requests_.Front());
+          pending_requests_.Pop();
+          queued_requests_--;
+        }
+        flush_requested_ = false;
+        flush_condition_.notify_all();
+      }
+
+      while (!pending_requests_.Empty()) {
+        fence_requests_.Push(
+            CreateFenceRequest(std::move(pending_requests_.Front())));
+        pending_requests_.Pop();
+      }
+
+      // Requests are promoted strictly in order
+      while (!fence_requests_.Empty() &&
+             fence_requests_.Front().pending_fences.empty()) {
+        ready_requests_.Push(std::move(fence_requests_.Front().request));
+        fence_requests_.Pop();
+      }
+    }
+
+    auto timeout = CollectFences(fence_requests_, &fences);
+    auto ret = fence_waiter_.Wait(fences, timeout, &fence_status);
+    if (ret != OK) {
+      // Keep waiting until the fence deadlines pass
+      fence_status.assign(fences.size(), FenceWaiter::FENCE_PENDING);
+    }
+    UpdateFences(fence_status, &fence_requests_);
+  }
+}
+
+status_t EmulatedRequestProcessor::InitializeSensorRequestLocked(
+    const PendingRequest& request, const Buffers& output_buffers,
+    uint32_t pipeline_id, uint32_t frame_number,
+    EmulatedSensor::LogicalCameraSettings* logical_settings,
+    std::unique_ptr<HwlPipelineResult>* result) {
+  std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids =
+      std::make_unique<std::set<uint32_t>>();
+  for (const auto& it : output_buffers) {
+    if (it->camera_id != camera_id_) {
+      physical_camera_output_ids->emplace(it->camera_id);
+    }
+  }
+
+  // Repeating requests usually include valid settings only during the
+  // initial call. Afterwards an invalid settings pointer means that there
+  // are no changes in the parameters and Hal should re-use the last valid
+  // values.
+  // TODO: Add support for individual physical camera requests.
+  if (request.settings.get() != nullptr) {
+    last_settings_ = request.settings;
+  }
+  auto ret = request_state_->InitializeLogicalSettings(
+      last_settings_, std::move(physical_camera_output_ids), logical_settings);
+  if (ret != OK) {
+    return ret;
+  }
+
+  *result = request_state_->InitializeLogicalResult(pipeline_id, frame_number);
+
+  return OK;
+}
+
 void EmulatedRequestProcessor::RequestProcessorLoop() {
   ATRACE_CALL();
 
-  bool vsync_status_ = true;
-  while (!processor_done_ && vsync_status_) {
+  while (!processor_done_) {
     {
       std::lock_guard<std::mutex> lock(process_mutex_);
-      if (!pending_requests_.empty()) {
+      if (!ready_requests_.Empty()) {
         status_t ret;
-        const auto& request = pending_requests_.front();
+        const auto& request = ready_requests_.Front();
         auto frame_number = request.output_buffers->at(0)->frame_number;
         auto notify_callback = request.output_buffers->at(0)->callback;
         auto pipeline_id = request.output_buffers->at(0)->pipeline_id;
@@ -364,34 +586,11 @@ void EmulatedRequestProcessor::RequestProcessorLoop() {
         if (!output_buffers->empty()) {
           std::unique_ptr<EmulatedSensor::LogicalCameraSettings> logical_settings =
               std::make_unique<EmulatedSensor::LogicalCameraSettings>();
-
-          std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids =
-              std::make_unique<std::set<uint32_t>>();
-          for (const auto& it : *output_buffers) {
-            if (it->camera_id != camera_id_) {
-              physical_camera_output_ids->emplace(it->camera_id);
-            }
-          }
-
-          // Repeating requests usually include valid settings only during the
-          // initial call. Afterwards an invalid settings pointer means that
-          // there are no changes in the parameters and Hal should re-use the
-          // last valid values.
-          // TODO: Add support for individual physical camera requests.
-          if (request.settings.get() != nullptr) {
-            ret = request_state_->InitializeLogicalSettings(
-                HalCameraMetadata::Clone(request.settings.get()),
-                std::move(physical_camera_output_ids), logical_settings.get());
-            last_settings_ = HalCameraMetadata::Clone(request.settings.get());
-          } else {
-            ret = request_state_->InitializeLogicalSettings(
-                HalCameraMetadata::Clone(last_settings_.get()),
-                std::move(physical_camera_output_ids), logical_settings.get());
-          }
-
+          std::unique_ptr<HwlPipelineResult> result;
+          ret = InitializeSensorRequestLocked(request, *output_buffers,
+                                              pipeline_id, frame_number,
+                                              logical_settings.get(), &result);
           if (ret == OK) {
-            auto result = request_state_->InitializeLogicalResult(pipeline_id,
-                                                                  frame_number);
             sensor_->SetCurrentRequest(
                 std::move(logical_settings), std::move(result),
                 std::move(input_buffers), std::move(output_buffers));
@@ -418,13 +617,18 @@ void EmulatedRequestProcessor::RequestProcessorLoop() {
           notify_callback.notify(pipeline_id, msg);
         }
 
-        pending_requests_.pop();
+        ready_requests_.Pop();
+        queued_requests_--;
         request_condition_.notify_one();
       }
     }
 
-    vsync_status_ =
-        sensor_->WaitForVSync(EmulatedSensor::kSupportedFrameDurationRange[1]);
+    // Frames of the longest supported duration can overrun the wait, the
+    // next request is simply picked up on the following VSync
+    if (!sensor_->WaitForVSync(
+            EmulatedSensor::kSupportedFrameDurationRange[1])) {
+      ALOGW("%s: Timed out waiting for VSync", __FUNCTION__);
+    }
   }
 }
 
@@ -432,8 +636,31 @@ status_t EmulatedRequestProcessor::Initialize(
     std::unique_ptr<HalCameraMetadata> static_meta,
     PhysicalDeviceMapPtr physical_devices) {
   std::lock_guard<std::mutex> lock(process_mutex_);
-  return request_state_->Initialize(std::move(static_meta),
-                                    std::move(physical_devices));
+  camera_metadata_ro_entry_t entry;
+  auto ret = static_meta->Get(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &entry);
+  if ((ret == OK) && (entry.count == 1)) {
+    pipeline_depth_ = std::max<size_t>(entry.data.u8[0], 1);
+  } else {
+    ALOGW("%s: Maximum pipeline depth absent, using default: %zu",
+          __FUNCTION__, pipeline_depth_);
+  }
+
+  ret = request_state_->Initialize(std::move(static_meta),
+                                   std::move(physical_devices));
+  if (ret != OK) {
+    return ret;
+  }
+
+  // The request slots are sized before the processing threads start
+  if (!request_thread_.joinable()) {
+    pending_requests_.Reset(pipeline_depth_);
+    fence_requests_.Reset(pipeline_depth_);
+    ready_requests_.Reset(pipeline_depth_);
+    request_thread_ = std::thread([this] { this->RequestProcessorLoop(); });
+    fence_thread_ = std::thread([this] { this->FenceWaitLoop(); });
+  }
+
+  return OK;
 }
 
 status_t EmulatedRequestProcessor::GetDefaultRequest(
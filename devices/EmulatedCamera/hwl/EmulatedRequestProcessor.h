@@ -19,15 +19,18 @@
 
 #include <condition_variable>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <unordered_map>
 
 #include "EmulatedLogicalRequestState.h"
 #include "EmulatedSensor.h"
 #include "hwl_types.h"
+#include "utils/FenceWaiter.h"
+#include "utils/RingQueue.h"
 
 namespace android {
 
+using google_camera_hal::BufferCache;
 using google_camera_hal::HalCameraMetadata;
 using google_camera_hal::HalStream;
 using google_camera_hal::HwlPipelineCallback;
@@ -49,9 +52,19 @@ struct EmulatedPipeline {
 };
 
 struct PendingRequest {
-  std::unique_ptr<HalCameraMetadata> settings;
+  // Immutable snapshot shared by all consumers of the request
+  std::shared_ptr<const HalCameraMetadata> settings;
   std::unique_ptr<Buffers> input_buffers;
   std::unique_ptr<Buffers> output_buffers;
+  // Time the request was queued, the acquire fence deadlines start here
+  nsecs_t arrival_time = 0;
+};
+
+struct FenceWaitStatistics {
+  uint64_t fences = 0;    // Acquire fences waited on
+  uint64_t failures = 0;  // Fences that timed out or reported an error
+  nsecs_t total_wait = 0;
+  nsecs_t max_wait = 0;
 };
 
 class EmulatedRequestProcessor {
@@ -74,10 +87,50 @@ class EmulatedRequestProcessor {
   status_t Initialize(std::unique_ptr<HalCameraMetadata> static_meta,
                       PhysicalDeviceMapPtr physical_devices);
 
+  // Acquire fence wait times indexed by stream id, measured from the time the
+  // request was queued
+  std::unordered_map<int32_t, FenceWaitStatistics> GetFenceWaitStatistics()
+      const;
+
+  // Releases the cached buffer imports of the current stream configuration
+  void ClearBufferCache();
+
+  // Releases the cached buffer imports of buffers the framework removed
+  void RemoveBufferCache(const std::vector<BufferCache>& buffer_caches);
+
+  // See 'EmulatedSensor::SetHighSpeedMode()' and
+  // 'EmulatedRequestState::SetHighSpeedMode()'
+  void SetHighSpeedMode(uint32_t batch_size);
+
+  std::unordered_map<int32_t, ImportedBufferCache::Statistics>
+  GetBufferCacheStatistics() const;
+
+  void DumpState(int fd) const;
+
  private:
+  // Request owned by the fence thread until all of its acquire fences have
+  // signaled, failed or timed out.
+  struct FenceRequest {
+    PendingRequest request;
+    // Input and output buffers with unsignaled acquire fences
+    std::vector<SensorBuffer*> pending_fences;
+  };
+
   void RequestProcessorLoop();
+  void FenceWaitLoop();
+
+  // Turns the settings of a request into the sensor settings of every camera
+  // with an output buffer and the initial result of the frame. Requests
+  // without settings repeat the last valid ones. Must be called with
+  // 'process_mutex_' held.
+  status_t InitializeSensorRequestLocked(
+      const PendingRequest& request, const Buffers& output_buffers,
+      uint32_t pipeline_id, uint32_t frame_number,
+      EmulatedSensor::LogicalCameraSettings* logical_settings /*out*/,
+      std::unique_ptr<HwlPipelineResult>* result /*out*/);
 
   std::thread request_thread_;
+  std::thread fence_thread_;
   std::atomic_bool processor_done_ = false;
 
   // helper methods
@@ -104,18 +157,45 @@ class EmulatedRequestProcessor {
                                                    StreamBuffer stream_buffer);
   std::unique_ptr<Buffers> AcquireBuffers(Buffers* buffers);
   void NotifyFailedRequest(const PendingRequest& request);
+  static FenceRequest CreateFenceRequest(PendingRequest request);
+  // Returns the time left until the earliest fence deadline, or -1 if there
+  // is nothing to wait for.
+  static nsecs_t CollectFences(const RingQueue<FenceRequest>& requests,
+                               std::vector<int>* fences /*out*/);
+  void UpdateFences(const std::vector<FenceWaiter::FenceStatus>& fence_status,
+                    RingQueue<FenceRequest>* requests /*inout*/);
+  void RecordFenceWait(int32_t stream_id, nsecs_t wait, bool signaled);
 
   std::mutex process_mutex_;
   std::condition_variable request_condition_;
-  std::queue<PendingRequest> pending_requests_;
+  std::condition_variable flush_condition_;
+  // Maximum number of queued requests, follows the advertised
+  // ANDROID_REQUEST_PIPELINE_MAX_DEPTH. Every request queue below has a slot
+  // for each of them.
+  size_t pipeline_depth_ = EmulatedSensor::kPipelineDepth;
+  // Requests waiting to be picked up by the fence thread
+  RingQueue<PendingRequest> pending_requests_;
+  // Requests owned by the fence thread
+  RingQueue<FenceRequest> fence_requests_;
+  // Requests with all acquire fences resolved, in submission order
+  RingQueue<PendingRequest> ready_requests_;
+  // Pending, fence waiting and ready requests
+  size_t queued_requests_ = 0;
+  bool flush_requested_ = false;
+  FenceWaiter fence_waiter_;
+  ImportedBufferCache buffer_cache_;
+  mutable std::mutex fence_stats_mutex_;
+  std::unordered_map<int32_t, FenceWaitStatistics> fence_stats_;
   uint32_t camera_id_;
   sp<EmulatedSensor> sensor_;
   std::unique_ptr<EmulatedLogicalRequestState>
       request_state_;  // Stores and handles 3A and related camera states.
-  std::unique_ptr<HalCameraMetadata> last_settings_;
+  std::shared_ptr<const HalCameraMetadata> last_settings_;
 
   EmulatedRequestProcessor(const EmulatedRequestProcessor&) = delete;
   EmulatedRequestProcessor& operator=(const EmulatedRequestProcessor&) = delete;
+
+  friend class EmulatedRequestStateBenchmarks;
 };
 
 }  // namespace android
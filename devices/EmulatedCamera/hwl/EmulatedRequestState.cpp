@@ -23,6 +23,8 @@
 #include <log/log.h>
 #include <utils/HWLUtils.h>
 
+#include <algorithm>
+
 #include "EmulatedRequestProcessor.h"
 
 namespace android {
@@ -40,6 +42,7 @@ const std::set<uint8_t> EmulatedRequestState::kSupportedCapabilites = {
     ANDROID_REQUEST_AVAILABLE_CAPABILITIES_PRIVATE_REPROCESSING,
     ANDROID_REQUEST_AVAILABLE_CAPABILITIES_YUV_REPROCESSING,
     ANDROID_REQUEST_AVAILABLE_CAPABILITIES_LOGICAL_MULTI_CAMERA,
+    ANDROID_REQUEST_AVAILABLE_CAPABILITIES_CONSTRAINED_HIGH_SPEED_VIDEO,
 };
 
 const std::set<uint8_t> EmulatedRequestState::kSupportedHWLevels = {
@@ -48,6 +51,31 @@ const std::set<uint8_t> EmulatedRequestState::kSupportedHWLevels = {
     ANDROID_INFO_SUPPORTED_HARDWARE_LEVEL_3,
 };
 
+// Sensor results, noise profile, color point and the active physical camera
+const size_t EmulatedRequestState::kResultSpareEntries = 10;
+const size_t EmulatedRequestState::kResultSpareData = 256;
+
+const std::vector<uint32_t> EmulatedRequestState::kRequestSettingsTags = {
+    ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
+    ANDROID_CONTROL_AE_LOCK,
+    ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER,
+    ANDROID_CONTROL_AE_REGIONS,
+    ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+    ANDROID_CONTROL_AF_REGIONS,
+    ANDROID_CONTROL_AF_TRIGGER,
+    ANDROID_CONTROL_AWB_LOCK,
+    ANDROID_CONTROL_AWB_REGIONS,
+    ANDROID_CONTROL_CAPTURE_INTENT,
+    ANDROID_CONTROL_EXTENDED_SCENE_MODE,
+    ANDROID_CONTROL_ZOOM_RATIO,
+    ANDROID_FLASH_MODE,
+    ANDROID_LENS_FOCUS_DISTANCE,
+    ANDROID_SCALER_CROP_REGION,
+    ANDROID_SENSOR_EXPOSURE_TIME,
+    ANDROID_SENSOR_FRAME_DURATION,
+    ANDROID_SENSOR_SENSITIVITY,
+};
+
 template <typename T>
 T GetClosestValue(T val, T min, T max) {
   if ((min > max) || ((val >= min) && (val <= max))) {
@@ -59,8 +87,20 @@ T GetClosestValue(T val, T min, T max) {
   }
 }
 
-status_t EmulatedRequestState::Update3AMeteringRegion(
-    uint32_t tag, const HalCameraMetadata& settings, int32_t* region /*out*/) {
+status_t EmulatedRequestState::GetRequestEntry(
+    uint32_t tag, camera_metadata_ro_entry_t* entry) {
+  // Entries parsed by another request state with a different layout are
+  // rejected as well.
+  auto ret = request_validator_.Get(request_entries_, tag, entry);
+  if (ret != BAD_VALUE) {
+    return ret;
+  }
+
+  return request_settings_->Get(tag, entry);
+}
+
+status_t EmulatedRequestState::Update3AMeteringRegion(uint32_t tag,
+                                                      int32_t* region /*out*/) {
   if ((region == nullptr) || ((tag != ANDROID_CONTROL_AE_REGIONS) &&
                               (tag != ANDROID_CONTROL_AF_REGIONS) &&
                               (tag != ANDROID_CONTROL_AWB_REGIONS))) {
@@ -68,14 +108,14 @@ status_t EmulatedRequestState::Update3AMeteringRegion(
   }
 
   camera_metadata_ro_entry_t entry;
-  auto ret = settings.Get(ANDROID_SCALER_CROP_REGION, &entry);
+  auto ret = GetRequestEntry(ANDROID_SCALER_CROP_REGION, &entry);
   if ((ret == OK) && (entry.count > 0)) {
     int32_t crop_region[4];
     crop_region[0] = entry.data.i32[0];
     crop_region[1] = entry.data.i32[1];
     crop_region[2] = entry.data.i32[2] + crop_region[0];
     crop_region[3] = entry.data.i32[3] + crop_region[1];
-    ret = settings.Get(tag, &entry);
+    ret = GetRequestEntry(tag, &entry);
     if ((ret == OK) && (entry.count > 0)) {
       const int32_t* a_region = entry.data.i32;
       // calculate the intersection of 3A and CROP regions
@@ -100,8 +140,7 @@ status_t EmulatedRequestState::CompensateAE() {
   }
 
   camera_metadata_ro_entry_t entry;
-  auto ret =
-      request_settings_->Get(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION, &entry);
+  auto ret = GetRequestEntry(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION, &entry);
   if ((ret == OK) && (entry.count == 1)) {
     exposure_compensation_ = entry.data.i32[0];
   } else {
@@ -123,7 +162,7 @@ status_t EmulatedRequestState::CompensateAE() {
 
 status_t EmulatedRequestState::DoFakeAE() {
   camera_metadata_ro_entry_t entry;
-  auto ret = request_settings_->Get(ANDROID_CONTROL_AE_LOCK, &entry);
+  auto ret = GetRequestEntry(ANDROID_CONTROL_AE_LOCK, &entry);
   if ((ret == OK) && (entry.count == 1)) {
     ae_lock_ = entry.data.u8[0];
   } else {
@@ -135,10 +174,14 @@ status_t EmulatedRequestState::DoFakeAE() {
     return OK;
   }
 
+  const auto& fps_ranges =
+      (high_speed_mode_ && !high_speed_fps_ranges_.empty())
+          ? high_speed_fps_ranges_
+          : available_fps_ranges_;
   FPSRange fps_range;
-  ret = request_settings_->Get(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry);
+  ret = GetRequestEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry);
   if ((ret == OK) && (entry.count == 2)) {
-    for (const auto& it : available_fps_ranges_) {
+    for (const auto& it : fps_ranges) {
       if ((it.min_fps == entry.data.i32[0]) &&
           (it.max_fps == entry.data.i32[1])) {
         fps_range = {entry.data.i32[0], entry.data.i32[1]};
@@ -151,10 +194,10 @@ status_t EmulatedRequestState::DoFakeAE() {
       return BAD_VALUE;
     }
   } else {
-    fps_range = *available_fps_ranges_.begin();
+    fps_range = *fps_ranges.begin();
   }
 
-  ret = request_settings_->Get(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &entry);
+  ret = GetRequestEntry(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &entry);
   if ((ret == OK) && (entry.count == 1)) {
     ae_trigger_ = entry.data.u8[0];
   } else {
@@ -162,12 +205,10 @@ status_t EmulatedRequestState::DoFakeAE() {
   }
 
   nsecs_t min_frame_duration =
-      GetClosestValue(ms2ns(1000 / fps_range.max_fps),
-                      EmulatedSensor::kSupportedFrameDurationRange[0],
+      GetClosestValue(s2ns(1) / fps_range.max_fps, GetMinFrameDuration(),
                       sensor_max_frame_duration_);
   nsecs_t max_frame_duration =
-      GetClosestValue(ms2ns(1000 / fps_range.min_fps),
-                      EmulatedSensor::kSupportedFrameDurationRange[0],
+      GetClosestValue(s2ns(1) / fps_range.min_fps, GetMinFrameDuration(),
                       sensor_max_frame_duration_);
   sensor_frame_duration_ = (max_frame_duration + min_frame_duration) / 2;
 
@@ -265,7 +306,7 @@ status_t EmulatedRequestState::DoFakeAE() {
 status_t EmulatedRequestState::ProcessAWB() {
   if (max_awb_regions_ > 0) {
     auto ret = Update3AMeteringRegion(ANDROID_CONTROL_AWB_REGIONS,
-                                      *request_settings_, awb_metering_region_);
+                                      awb_metering_region_);
     if (ret != OK) {
       return ret;
     }
@@ -276,7 +317,7 @@ status_t EmulatedRequestState::ProcessAWB() {
     // TODO: Add actual manual support
   } else if (is_backward_compatible_) {
     camera_metadata_ro_entry_t entry;
-    auto ret = request_settings_->Get(ANDROID_CONTROL_AWB_LOCK, &entry);
+    auto ret = GetRequestEntry(ANDROID_CONTROL_AWB_LOCK, &entry);
     if ((ret == OK) && (entry.count == 1)) {
       awb_lock_ = entry.data.u8[0];
     } else {
@@ -300,14 +341,14 @@ status_t EmulatedRequestState::ProcessAF() {
 
   if (max_af_regions_ > 0) {
     auto ret = Update3AMeteringRegion(ANDROID_CONTROL_AF_REGIONS,
-                                      *request_settings_, af_metering_region_);
+                                      af_metering_region_);
     if (ret != OK) {
       return ret;
     }
   }
   if (af_mode_ == ANDROID_CONTROL_AF_MODE_OFF) {
     camera_metadata_ro_entry_t entry;
-    auto ret = request_settings_->Get(ANDROID_LENS_FOCUS_DISTANCE, &entry);
+    auto ret = GetRequestEntry(ANDROID_LENS_FOCUS_DISTANCE, &entry);
     if ((ret == OK) && (entry.count == 1)) {
       if ((entry.data.f[0] >= 0.f) &&
           (entry.data.f[0] <= minimum_focus_distance_)) {
@@ -324,7 +365,7 @@ status_t EmulatedRequestState::ProcessAF() {
     return OK;
   }
 
-  auto ret = request_settings_->Get(ANDROID_CONTROL_AF_TRIGGER, &entry);
+  auto ret = GetRequestEntry(ANDROID_CONTROL_AF_TRIGGER, &entry);
   if ((ret == OK) && (entry.count == 1)) {
     af_trigger_ = entry.data.u8[0];
   } else {
@@ -476,7 +517,7 @@ status_t EmulatedRequestState::ProcessAF() {
 status_t EmulatedRequestState::ProcessAE() {
   if (max_ae_regions_ > 0) {
     auto ret = Update3AMeteringRegion(ANDROID_CONTROL_AE_REGIONS,
-                                      *request_settings_, ae_metering_region_);
+                                      ae_metering_region_);
     if (ret != OK) {
       ALOGE("%s: Failed updating the 3A metering regions: %d, (%s)",
             __FUNCTION__, ret, strerror(-ret));
@@ -498,7 +539,7 @@ status_t EmulatedRequestState::ProcessAE() {
   if (((ae_mode_ == ANDROID_CONTROL_AE_MODE_OFF) ||
        (control_mode_ == ANDROID_CONTROL_MODE_OFF)) &&
       supports_manual_sensor_) {
-    auto ret = request_settings_->Get(ANDROID_SENSOR_EXPOSURE_TIME, &entry);
+    auto ret = GetRequestEntry(ANDROID_SENSOR_EXPOSURE_TIME, &entry);
     if ((ret == OK) && (entry.count == 1)) {
       if ((entry.data.i64[0] >= sensor_exposure_time_range_.first) &&
           (entry.data.i64[0] <= sensor_exposure_time_range_.second)) {
@@ -513,18 +554,16 @@ status_t EmulatedRequestState::ProcessAE() {
       }
     }
 
-    ret = request_settings_->Get(ANDROID_SENSOR_FRAME_DURATION, &entry);
+    ret = GetRequestEntry(ANDROID_SENSOR_FRAME_DURATION, &entry);
     if ((ret == OK) && (entry.count == 1)) {
-      if ((entry.data.i64[0] >=
-           EmulatedSensor::kSupportedFrameDurationRange[0]) &&
+      if ((entry.data.i64[0] >= GetMinFrameDuration()) &&
           (entry.data.i64[0] <= sensor_max_frame_duration_)) {
         sensor_frame_duration_ = entry.data.i64[0];
       } else {
         ALOGE(
             "%s: Sensor frame duration "
             " not within supported range[%" PRId64 ", %" PRId64 "]",
-            __FUNCTION__, EmulatedSensor::kSupportedFrameDurationRange[0],
-            sensor_max_frame_duration_);
+            __FUNCTION__, GetMinFrameDuration(), sensor_max_frame_duration_);
         // Use last valid value
       }
     }
@@ -533,7 +572,7 @@ status_t EmulatedRequestState::ProcessAE() {
       sensor_frame_duration_ = sensor_exposure_time_;
     }
 
-    ret = request_settings_->Get(ANDROID_SENSOR_SENSITIVITY, &entry);
+    ret = GetRequestEntry(ANDROID_SENSOR_SENSITIVITY, &entry);
     if ((ret == OK) && (entry.count == 1)) {
       if ((entry.data.i32[0] >= sensor_sensitivity_range_.first) &&
           (entry.data.i32[0] <= sensor_sensitivity_range_.second)) {
@@ -570,7 +609,7 @@ status_t EmulatedRequestState::ProcessAE() {
     // and the appropriate AE mode is set or during still capture with auto
     // flash AE modes.
     bool manual_flash_mode = false;
-    auto ret = request_settings_->Get(ANDROID_FLASH_MODE, &entry);
+    auto ret = GetRequestEntry(ANDROID_FLASH_MODE, &entry);
     if ((ret == OK) && (entry.count == 1)) {
       if ((entry.data.u8[0] == ANDROID_FLASH_MODE_SINGLE) ||
           (entry.data.u8[0] == ANDROID_FLASH_MODE_TORCH)) {
@@ -581,7 +620,7 @@ status_t EmulatedRequestState::ProcessAE() {
       flash_state_ = ANDROID_FLASH_STATE_FIRED;
     } else {
       bool is_still_capture = false;
-      ret = request_settings_->Get(ANDROID_CONTROL_CAPTURE_INTENT, &entry);
+      ret = GetRequestEntry(ANDROID_CONTROL_CAPTURE_INTENT, &entry);
       if ((ret == OK) && (entry.count == 1)) {
         if (entry.data.u8[0] == ANDROID_CONTROL_CAPTURE_INTENT_STILL_CAPTURE) {
           is_still_capture = true;
@@ -598,8 +637,35 @@ status_t EmulatedRequestState::ProcessAE() {
   return OK;
 }
 
+status_t EmulatedRequestState::ParseSettings(
+    std::shared_ptr<const HalCameraMetadata> request_settings,
+    ParsedSettings* parsed_settings /*out*/) const {
+  if ((parsed_settings == nullptr) || (request_settings.get() == nullptr)) {
+    return BAD_VALUE;
+  }
+
+  request_validator_.Parse(*request_settings, &parsed_settings->entries);
+  parsed_settings->settings = std::move(request_settings);
+  parsed_settings->has_triggers = false;
+  camera_metadata_ro_entry_t entry;
+  auto ret = request_validator_.Get(parsed_settings->entries,
+                                    ANDROID_CONTROL_AF_TRIGGER, &entry);
+  if ((ret == OK) && (entry.count == 1) &&
+      (entry.data.u8[0] != ANDROID_CONTROL_AF_TRIGGER_IDLE)) {
+    parsed_settings->has_triggers = true;
+  }
+  ret = request_validator_.Get(parsed_settings->entries,
+                               ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &entry);
+  if ((ret == OK) && (entry.count == 1) &&
+      (entry.data.u8[0] != ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER_IDLE)) {
+    parsed_settings->has_triggers = true;
+  }
+
+  return OK;
+}
+
 status_t EmulatedRequestState::InitializeSensorSettings(
-    std::unique_ptr<HalCameraMetadata> request_settings,
+    std::shared_ptr<const HalCameraMetadata> request_settings,
     EmulatedSensor::SensorSettings* sensor_settings /*out*/) {
   if ((sensor_settings == nullptr) || (request_settings.get() == nullptr)) {
     return BAD_VALUE;
@@ -607,11 +673,43 @@ status_t EmulatedRequestState::InitializeSensorSettings(
 
   std::lock_guard<std::mutex> lock(request_state_mutex_);
   request_settings_ = std::move(request_settings);
+  request_validator_.Parse(*request_settings_, &request_entries_);
+
+  return ApplySensorSettings(sensor_settings);
+}
+
+status_t EmulatedRequestState::InitializeSensorSettings(
+    const ParsedSettings& parsed_settings,
+    EmulatedSensor::SensorSettings* sensor_settings /*out*/) {
+  if ((sensor_settings == nullptr) ||
+      (parsed_settings.settings.get() == nullptr)) {
+    return BAD_VALUE;
+  }
+
+  std::lock_guard<std::mutex> lock(request_state_mutex_);
+  request_settings_ = parsed_settings.settings;
+  request_entries_ = parsed_settings.entries;
+
+  return ApplySensorSettings(sensor_settings);
+}
+
+void EmulatedRequestState::SetHighSpeedMode(bool enabled) {
+  std::lock_guard<std::mutex> lock(request_state_mutex_);
+  high_speed_mode_ = enabled;
+}
+
+nsecs_t EmulatedRequestState::GetMinFrameDuration() const {
+  return high_speed_mode_ ? EmulatedSensor::kMinHighSpeedFrameDuration
+                          : EmulatedSensor::kSupportedFrameDurationRange[0];
+}
+
+status_t EmulatedRequestState::ApplySensorSettings(
+    EmulatedSensor::SensorSettings* sensor_settings /*out*/) {
   camera_metadata_ro_entry_t entry;
-  auto ret = request_settings_->Get(ANDROID_CONTROL_MODE, &entry);
+  auto ret = GetRequestEntry(ANDROID_CONTROL_MODE, &entry);
   if ((ret == OK) && (entry.count == 1)) {
-    if (available_control_modes_.find(entry.data.u8[0]) !=
-        available_control_modes_.end()) {
+    if (request_validator_.IsSupported(ANDROID_CONTROL_MODE,
+                                       entry.data.u8[0])) {
       control_mode_ = entry.data.u8[0];
     } else {
       ALOGE("%s: Unsupported control mode!", __FUNCTION__);
@@ -619,11 +717,12 @@ status_t EmulatedRequestState::InitializeSensorSettings(
     }
   }
 
-  ret = request_settings_->Get(ANDROID_CONTROL_SCENE_MODE, &entry);
+  ret = GetRequestEntry(ANDROID_CONTROL_SCENE_MODE, &entry);
   if ((ret == OK) && (entry.count == 1)) {
-    // Disabled scene is not expected to be among the available scene list
-    if ((entry.data.u8[0] == ANDROID_CONTROL_SCENE_MODE_DISABLED) ||
-        (available_scenes_.find(entry.data.u8[0]) != available_scenes_.end())) {
+    // Disabled scene is part of the validated scene modes, see
+    // InitializeRequestValidator()
+    if (request_validator_.IsSupported(ANDROID_CONTROL_SCENE_MODE,
+                                       entry.data.u8[0])) {
       scene_mode_ = entry.data.u8[0];
     } else {
       ALOGE("%s: Unsupported scene mode!", __FUNCTION__);
@@ -632,7 +731,7 @@ status_t EmulatedRequestState::InitializeSensorSettings(
   }
 
   float min_zoom = min_zoom_, max_zoom = max_zoom_;
-  ret = request_settings_->Get(ANDROID_CONTROL_EXTENDED_SCENE_MODE, &entry);
+  ret = GetRequestEntry(ANDROID_CONTROL_EXTENDED_SCENE_MODE, &entry);
   if ((ret == OK) && (entry.count == 1)) {
     bool extended_scene_mode_valid = false;
     for (const auto& cap : available_extended_scene_mode_caps_) {
@@ -655,16 +754,16 @@ status_t EmulatedRequestState::InitializeSensorSettings(
   }
 
   // Check zoom ratio range and override to supported range
-  ret = request_settings_->Get(ANDROID_CONTROL_ZOOM_RATIO, &entry);
+  ret = GetRequestEntry(ANDROID_CONTROL_ZOOM_RATIO, &entry);
   if ((ret == OK) && (entry.count == 1)) {
     zoom_ratio_ = std::min(std::max(entry.data.f[0], min_zoom), max_zoom);
   }
 
   // Check rotate_and_crop setting
-  ret = request_settings_->Get(ANDROID_SCALER_ROTATE_AND_CROP, &entry);
+  ret = GetRequestEntry(ANDROID_SCALER_ROTATE_AND_CROP, &entry);
   if ((ret == OK) && (entry.count == 1)) {
-    if (available_rotate_crop_modes_.find(entry.data.u8[0]) !=
-        available_rotate_crop_modes_.end()) {
+    if (request_validator_.IsSupported(ANDROID_SCALER_ROTATE_AND_CROP,
+                                       entry.data.u8[0])) {
       rotate_and_crop_ = entry.data.u8[0];
     } else {
       ALOGE("%s: Unsupported rotate and crop mode: %u", __FUNCTION__, entry.data.u8[0]);
@@ -674,10 +773,10 @@ status_t EmulatedRequestState::InitializeSensorSettings(
 
   // Check video stabilization parameter
   uint8_t vstab_mode = ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF;
-  ret = request_settings_->Get(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, &entry);
+  ret = GetRequestEntry(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, &entry);
   if ((ret == OK) && (entry.count == 1)) {
-    if (available_vstab_modes_.find(entry.data.u8[0]) !=
-      available_vstab_modes_.end()) {
+    if (request_validator_.IsSupported(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE,
+                                       entry.data.u8[0])) {
       vstab_mode = entry.data.u8[0];
     } else {
       ALOGE("%s: Unsupported video stabilization mode: %u! Video stabilization will be disabled!",
@@ -687,10 +786,9 @@ status_t EmulatedRequestState::InitializeSensorSettings(
 
   // Check video stabilization parameter
   uint8_t edge_mode = ANDROID_EDGE_MODE_OFF;
-  ret = request_settings_->Get(ANDROID_EDGE_MODE, &entry);
+  ret = GetRequestEntry(ANDROID_EDGE_MODE, &entry);
   if ((ret == OK) && (entry.count == 1)) {
-    if (available_edge_modes_.find(entry.data.u8[0]) !=
-      available_edge_modes_.end()) {
+    if (request_validator_.IsSupported(ANDROID_EDGE_MODE, entry.data.u8[0])) {
       edge_mode = entry.data.u8[0];
     } else {
       ALOGE("%s: Unsupported edge mode: %u", __FUNCTION__, entry.data.u8[0]);
@@ -703,30 +801,30 @@ status_t EmulatedRequestState::InitializeSensorSettings(
   if ((scene_mode_ == ANDROID_CONTROL_SCENE_MODE_DISABLED) ||
       (scene_mode_ == ANDROID_CONTROL_SCENE_MODE_FACE_PRIORITY) ||
       (control_mode_ != ANDROID_CONTROL_MODE_USE_SCENE_MODE)) {
-    ret = request_settings_->Get(ANDROID_CONTROL_AE_MODE, &entry);
+    ret = GetRequestEntry(ANDROID_CONTROL_AE_MODE, &entry);
     if ((ret == OK) && (entry.count == 1)) {
-      if (available_ae_modes_.find(entry.data.u8[0]) !=
-          available_ae_modes_.end()) {
+      if (request_validator_.IsSupported(ANDROID_CONTROL_AE_MODE,
+                                         entry.data.u8[0])) {
         ae_mode_ = entry.data.u8[0];
       } else {
         ALOGE("%s: Unsupported AE mode! Using last valid mode!", __FUNCTION__);
       }
     }
 
-    ret = request_settings_->Get(ANDROID_CONTROL_AWB_MODE, &entry);
+    ret = GetRequestEntry(ANDROID_CONTROL_AWB_MODE, &entry);
     if ((ret == OK) && (entry.count == 1)) {
-      if (available_awb_modes_.find(entry.data.u8[0]) !=
-          available_awb_modes_.end()) {
+      if (request_validator_.IsSupported(ANDROID_CONTROL_AWB_MODE,
+                                         entry.data.u8[0])) {
         awb_mode_ = entry.data.u8[0];
       } else {
         ALOGE("%s: Unsupported AWB mode! Using last valid mode!", __FUNCTION__);
       }
     }
 
-    ret = request_settings_->Get(ANDROID_CONTROL_AF_MODE, &entry);
+    ret = GetRequestEntry(ANDROID_CONTROL_AF_MODE, &entry);
     if ((ret == OK) && (entry.count == 1)) {
-      if (available_af_modes_.find(entry.data.u8[0]) !=
-          available_af_modes_.end()) {
+      if (request_validator_.IsSupported(ANDROID_CONTROL_AF_MODE,
+                                         entry.data.u8[0])) {
         af_mode_changed_ = af_mode_ != entry.data.u8[0];
         af_mode_ = entry.data.u8[0];
       } else {
@@ -763,10 +861,10 @@ status_t EmulatedRequestState::InitializeSensorSettings(
     return ret;
   }
 
-  ret = request_settings_->Get(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, &entry);
+  ret = GetRequestEntry(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, &entry);
   if ((ret == OK) && (entry.count == 1)) {
-    if (available_lens_shading_map_modes_.find(entry.data.u8[0]) !=
-        available_lens_shading_map_modes_.end()) {
+    if (request_validator_.IsSupported(
+            ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, entry.data.u8[0])) {
       sensor_settings->lens_shading_map_mode = entry.data.u8[0];
     } else {
       ALOGE("%s: Unsupported lens shading map mode!", __FUNCTION__);
@@ -797,134 +895,128 @@ std::unique_ptr<HwlPipelineResult> EmulatedRequestState::InitializeResult(
   result->camera_id = camera_id_;
   result->pipeline_id = pipeline_id;
   result->frame_number = frame_number;
-  result->result_metadata = HalCameraMetadata::Clone(request_settings_.get());
   result->partial_result = partial_result_count_;
+  result_builder_.Begin(request_settings_);
 
   // Results supported on all emulated devices
-  result->result_metadata->Set(ANDROID_REQUEST_PIPELINE_DEPTH,
-                               &max_pipeline_depth_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_MODE, &control_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AF_MODE, &af_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AF_STATE, &af_state_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AWB_MODE, &awb_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AWB_STATE, &awb_state_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AE_MODE, &ae_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AE_STATE, &ae_state_, 1);
+  result_builder_.Set(ANDROID_REQUEST_PIPELINE_DEPTH, &max_pipeline_depth_, 1);
+  result_builder_.Set(ANDROID_CONTROL_MODE, &control_mode_, 1);
+  result_builder_.Set(ANDROID_CONTROL_AF_MODE, &af_mode_, 1);
+  result_builder_.Set(ANDROID_CONTROL_AF_STATE, &af_state_, 1);
+  result_builder_.Set(ANDROID_CONTROL_AWB_MODE, &awb_mode_, 1);
+  result_builder_.Set(ANDROID_CONTROL_AWB_STATE, &awb_state_, 1);
+  result_builder_.Set(ANDROID_CONTROL_AE_MODE, &ae_mode_, 1);
+  result_builder_.Set(ANDROID_CONTROL_AE_STATE, &ae_state_, 1);
   int32_t fps_range[] = {ae_target_fps_.min_fps, ae_target_fps_.max_fps};
-  result->result_metadata->Set(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, fps_range,
-                               ARRAY_SIZE(fps_range));
-  result->result_metadata->Set(ANDROID_FLASH_STATE, &flash_state_, 1);
-  result->result_metadata->Set(ANDROID_LENS_STATE, &lens_state_, 1);
+  result_builder_.Set(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, fps_range,
+                      ARRAY_SIZE(fps_range));
+  result_builder_.Set(ANDROID_FLASH_STATE, &flash_state_, 1);
+  result_builder_.Set(ANDROID_LENS_STATE, &lens_state_, 1);
 
   // Results depending on device capability and features
   if (is_backward_compatible_) {
-    result->result_metadata->Set(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER,
-                                 &ae_trigger_, 1);
-    result->result_metadata->Set(ANDROID_CONTROL_AF_TRIGGER, &af_trigger_, 1);
+    result_builder_.Set(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &ae_trigger_, 1);
+    result_builder_.Set(ANDROID_CONTROL_AF_TRIGGER, &af_trigger_, 1);
     uint8_t vstab_mode = ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF;
-    result->result_metadata->Set(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE,
-                                 &vstab_mode, 1);
+    result_builder_.Set(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, &vstab_mode,
+                        1);
     if (exposure_compensation_supported_) {
-      result->result_metadata->Set(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
-                                   &exposure_compensation_, 1);
+      result_builder_.Set(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
+                          &exposure_compensation_, 1);
     }
   }
   if (ae_lock_available_ && report_ae_lock_) {
-    result->result_metadata->Set(ANDROID_CONTROL_AE_LOCK, &ae_lock_, 1);
+    result_builder_.Set(ANDROID_CONTROL_AE_LOCK, &ae_lock_, 1);
   }
   if (awb_lock_available_ && report_awb_lock_) {
-    result->result_metadata->Set(ANDROID_CONTROL_AWB_LOCK, &awb_lock_, 1);
+    result_builder_.Set(ANDROID_CONTROL_AWB_LOCK, &awb_lock_, 1);
   }
   if (scenes_supported_) {
-    result->result_metadata->Set(ANDROID_CONTROL_SCENE_MODE, &scene_mode_, 1);
+    result_builder_.Set(ANDROID_CONTROL_SCENE_MODE, &scene_mode_, 1);
   }
   if (max_ae_regions_ > 0) {
-    result->result_metadata->Set(ANDROID_CONTROL_AE_REGIONS, ae_metering_region_,
-                                 ARRAY_SIZE(ae_metering_region_));
+    result_builder_.Set(ANDROID_CONTROL_AE_REGIONS, ae_metering_region_,
+                        ARRAY_SIZE(ae_metering_region_));
   }
   if (max_awb_regions_ > 0) {
-    result->result_metadata->Set(ANDROID_CONTROL_AWB_REGIONS,
-                                 awb_metering_region_,
-                                 ARRAY_SIZE(awb_metering_region_));
+    result_builder_.Set(ANDROID_CONTROL_AWB_REGIONS, awb_metering_region_,
+                        ARRAY_SIZE(awb_metering_region_));
   }
   if (max_af_regions_ > 0) {
-    result->result_metadata->Set(ANDROID_CONTROL_AF_REGIONS, af_metering_region_,
-                                 ARRAY_SIZE(af_metering_region_));
+    result_builder_.Set(ANDROID_CONTROL_AF_REGIONS, af_metering_region_,
+                        ARRAY_SIZE(af_metering_region_));
   }
   if (report_exposure_time_) {
-    result->result_metadata->Set(ANDROID_SENSOR_EXPOSURE_TIME,
-                                 &sensor_exposure_time_, 1);
+    result_builder_.Set(ANDROID_SENSOR_EXPOSURE_TIME, &sensor_exposure_time_,
+                        1);
   }
   if (report_frame_duration_) {
-    result->result_metadata->Set(ANDROID_SENSOR_FRAME_DURATION,
-                                 &sensor_frame_duration_, 1);
+    result_builder_.Set(ANDROID_SENSOR_FRAME_DURATION, &sensor_frame_duration_,
+                        1);
   }
   if (report_sensitivity_) {
-    result->result_metadata->Set(ANDROID_SENSOR_SENSITIVITY,
-                                 &sensor_sensitivity_, 1);
+    result_builder_.Set(ANDROID_SENSOR_SENSITIVITY, &sensor_sensitivity_, 1);
   }
   if (report_rolling_shutter_skew_) {
-    result->result_metadata->Set(
-        ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
-        &EmulatedSensor::kSupportedFrameDurationRange[0], 1);
+    // The readout must fit into the shortest frame duration of the session
+    nsecs_t rolling_shutter_skew = GetMinFrameDuration();
+    result_builder_.Set(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
+                        &rolling_shutter_skew, 1);
   }
   if (report_post_raw_boost_) {
-    result->result_metadata->Set(ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST,
-                                 &post_raw_boost_, 1);
+    result_builder_.Set(ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST,
+                        &post_raw_boost_, 1);
   }
   if (report_focus_distance_) {
-    result->result_metadata->Set(ANDROID_LENS_FOCUS_DISTANCE, &focus_distance_,
-                                 1);
+    result_builder_.Set(ANDROID_LENS_FOCUS_DISTANCE, &focus_distance_, 1);
   }
   if (report_focus_range_) {
     float focus_range[2] = {0.f};
     if (minimum_focus_distance_ > .0f) {
       focus_range[0] = 1 / minimum_focus_distance_;
     }
-    result->result_metadata->Set(ANDROID_LENS_FOCUS_RANGE, focus_range,
-                                 ARRAY_SIZE(focus_range));
+    result_builder_.Set(ANDROID_LENS_FOCUS_RANGE, focus_range,
+                        ARRAY_SIZE(focus_range));
   }
   if (report_filter_density_) {
-    result->result_metadata->Set(ANDROID_LENS_FILTER_DENSITY, &filter_density_,
-                                 1);
+    result_builder_.Set(ANDROID_LENS_FILTER_DENSITY, &filter_density_, 1);
   }
   if (report_ois_mode_) {
-    result->result_metadata->Set(ANDROID_LENS_OPTICAL_STABILIZATION_MODE,
-                                 &ois_mode_, 1);
+    result_builder_.Set(ANDROID_LENS_OPTICAL_STABILIZATION_MODE, &ois_mode_, 1);
   }
   if (report_pose_rotation_) {
-    result->result_metadata->Set(ANDROID_LENS_POSE_ROTATION, pose_rotation_,
-                                 ARRAY_SIZE(pose_rotation_));
+    result_builder_.Set(ANDROID_LENS_POSE_ROTATION, pose_rotation_,
+                        ARRAY_SIZE(pose_rotation_));
   }
   if (report_pose_translation_) {
-    result->result_metadata->Set(ANDROID_LENS_POSE_TRANSLATION,
-                                 pose_translation_,
-                                 ARRAY_SIZE(pose_translation_));
+    result_builder_.Set(ANDROID_LENS_POSE_TRANSLATION, pose_translation_,
+                        ARRAY_SIZE(pose_translation_));
   }
   if (report_intrinsic_calibration_) {
-    result->result_metadata->Set(ANDROID_LENS_INTRINSIC_CALIBRATION,
-                                 intrinsic_calibration_,
-                                 ARRAY_SIZE(intrinsic_calibration_));
+    result_builder_.Set(ANDROID_LENS_INTRINSIC_CALIBRATION,
+                        intrinsic_calibration_,
+                        ARRAY_SIZE(intrinsic_calibration_));
   }
   if (report_distortion_) {
-    result->result_metadata->Set(ANDROID_LENS_DISTORTION, distortion_,
-                                 ARRAY_SIZE(distortion_));
+    result_builder_.Set(ANDROID_LENS_DISTORTION, distortion_,
+                        ARRAY_SIZE(distortion_));
   }
   if (report_black_level_lock_) {
-    result->result_metadata->Set(ANDROID_BLACK_LEVEL_LOCK, &black_level_lock_,
-                                 1);
+    result_builder_.Set(ANDROID_BLACK_LEVEL_LOCK, &black_level_lock_, 1);
   }
   if (report_scene_flicker_) {
-    result->result_metadata->Set(ANDROID_STATISTICS_SCENE_FLICKER,
-                                 &current_scene_flicker_, 1);
+    result_builder_.Set(ANDROID_STATISTICS_SCENE_FLICKER,
+                        &current_scene_flicker_, 1);
   }
   if (zoom_ratio_supported_) {
-    result->result_metadata->Set(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio_, 1);
+    result_builder_.Set(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio_, 1);
   }
   if (report_extended_scene_mode_) {
-    result->result_metadata->Set(ANDROID_CONTROL_EXTENDED_SCENE_MODE,
-                                 &extended_scene_mode_, 1);
+    result_builder_.Set(ANDROID_CONTROL_EXTENDED_SCENE_MODE,
+                        &extended_scene_mode_, 1);
   }
+  result->result_metadata = result_builder_.Finish();
+
   return result;
 }
 
@@ -1609,6 +1701,24 @@ status_t EmulatedRequestState::InitializeControlDefaults() {
     return BAD_VALUE;
   }
 
+  // Constrained high speed sessions run at the framerate ranges of the high
+  // speed video configurations.
+  std::vector<HighSpeedVideoConfig> high_speed_configs;
+  ret = GetHighSpeedVideoConfigs(static_metadata_.get(), &high_speed_configs);
+  if (ret != OK) {
+    return ret;
+  }
+  for (const auto& config : high_speed_configs) {
+    auto it = std::find_if(high_speed_fps_ranges_.begin(),
+                           high_speed_fps_ranges_.end(), [&config](auto range) {
+                             return (range.min_fps == config.min_fps) &&
+                                    (range.max_fps == config.max_fps);
+                           });
+    if (it == high_speed_fps_ranges_.end()) {
+      high_speed_fps_ranges_.emplace_back(config.min_fps, config.max_fps);
+    }
+  }
+
   if (available_requests_.find(ANDROID_CONTROL_AE_TARGET_FPS_RANGE) ==
       available_requests_.end()) {
     ALOGE("%s: Clients must be able to set the target framerate range!",
@@ -2772,12 +2882,82 @@ status_t EmulatedRequestState::InitializeRequestDefaults() {
   return InitializeInfoDefaults();
 }
 
+status_t EmulatedRequestState::InitializeRequestValidator() {
+  request_validator_.Clear();
+  request_entries_.clear();
+
+  // The disabled scene is not expected to be among the available scenes
+  auto scenes = available_scenes_;
+  scenes.insert(ANDROID_CONTROL_SCENE_MODE_DISABLED);
+  std::pair<uint32_t, const std::set<uint8_t>*> validated_tags[] = {
+      {ANDROID_CONTROL_MODE, &available_control_modes_},
+      {ANDROID_CONTROL_SCENE_MODE, &scenes},
+      {ANDROID_SCALER_ROTATE_AND_CROP, &available_rotate_crop_modes_},
+      {ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, &available_vstab_modes_},
+      {ANDROID_EDGE_MODE, &available_edge_modes_},
+      {ANDROID_CONTROL_AE_MODE, &available_ae_modes_},
+      {ANDROID_CONTROL_AWB_MODE, &available_awb_modes_},
+      {ANDROID_CONTROL_AF_MODE, &available_af_modes_},
+      {ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
+       &available_lens_shading_map_modes_}};
+  for (const auto& it : validated_tags) {
+    auto ret = request_validator_.AddTag(it.first, *it.second);
+    if (ret != OK) {
+      ALOGE("%s: Failed to add validated tag 0x%x: %d, (%s)", __FUNCTION__,
+            it.first, ret, strerror(-ret));
+      return ret;
+    }
+  }
+
+  for (auto tag : kRequestSettingsTags) {
+    auto ret = request_validator_.AddTag(tag);
+    if (ret != OK) {
+      ALOGE("%s: Failed to add tag 0x%x: %d, (%s)", __FUNCTION__, tag, ret,
+            strerror(-ret));
+      return ret;
+    }
+  }
+
+  return OK;
+}
+
 status_t EmulatedRequestState::Initialize(
     std::unique_ptr<HalCameraMetadata> staticMeta) {
   std::lock_guard<std::mutex> lock(request_state_mutex_);
   static_metadata_ = std::move(staticMeta);
 
-  return InitializeRequestDefaults();
+  // The static metadata is read for every request and result.
+  auto ret = static_metadata_->Freeze();
+  if (ret != OK) {
+    ALOGE("%s: Unable to freeze static metadata %s (%d)", __FUNCTION__,
+          strerror(-ret), ret);
+    return ret;
+  }
+
+  ret = InitializeRequestDefaults();
+  if (ret != OK) {
+    return ret;
+  }
+
+  ret = InitializeRequestValidator();
+  if (ret != OK) {
+    return ret;
+  }
+
+  // Leave room in every result for the values added by the sensor and the
+  // logical camera, the lens shading map dominates if it is supported.
+  size_t spare_data = kResultSpareData;
+  camera_metadata_ro_entry_t entry;
+  ret = static_metadata_->Get(ANDROID_LENS_INFO_SHADING_MAP_SIZE, &entry);
+  if ((ret == OK) && (entry.count == 2)) {
+    spare_data += calculate_camera_metadata_entry_data_size(
+        TYPE_FLOAT, entry.data.i32[0] * entry.data.i32[1] * 4);
+  }
+  result_builder_.SetSpareCapacity(kResultSpareEntries, spare_data);
+  // Results are released shortly after being sent, recycle their buffers.
+  result_builder_.SetArena(HalCameraMetadataArena::Create());
+
+  return OK;
 }
 
 status_t EmulatedRequestState::GetDefaultRequest(
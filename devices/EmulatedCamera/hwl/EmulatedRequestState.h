@@ -22,6 +22,8 @@
 
 #include "EmulatedSensor.h"
 #include "hwl_types.h"
+#include "utils/RequestValidator.h"
+#include "utils/ResultMetadataBuilder.h"
 
 namespace android {
 
@@ -51,7 +53,28 @@ class EmulatedRequestState {
                                                       uint32_t frame_number);
 
   status_t InitializeSensorSettings(
-      std::unique_ptr<HalCameraMetadata> request_settings,
+      std::shared_ptr<const HalCameraMetadata> request_settings,
+      EmulatedSensor::SensorSettings* sensor_settings /*out*/);
+
+  // Constrained high speed sessions accept the high speed framerate ranges
+  // and frame durations down to kMinHighSpeedFrameDuration.
+  void SetHighSpeedMode(bool enabled);
+
+  // Request settings parsed once and shared between request states, such as
+  // the physical devices of a logical camera.
+  struct ParsedSettings {
+    std::shared_ptr<const HalCameraMetadata> settings;
+    RequestValidator::Entries entries;
+    // AF or AE precapture triggers, which must reach the 3A of every device
+    bool has_triggers = false;
+  };
+
+  status_t ParseSettings(
+      std::shared_ptr<const HalCameraMetadata> request_settings,
+      ParsedSettings* parsed_settings /*out*/) const;
+
+  status_t InitializeSensorSettings(
+      const ParsedSettings& parsed_settings,
       EmulatedSensor::SensorSettings* sensor_settings /*out*/);
 
  private:
@@ -80,18 +103,37 @@ class EmulatedRequestState {
   status_t InitializeControlefaults();
   status_t InitializeInfoDefaults();
   status_t InitializeLensDefaults();
+  status_t InitializeRequestValidator();
 
+  status_t ApplySensorSettings(
+      EmulatedSensor::SensorSettings* sensor_settings /*out*/);
   status_t ProcessAE();
   status_t ProcessAF();
   status_t ProcessAWB();
   status_t DoFakeAE();
   status_t CompensateAE();
-  status_t Update3AMeteringRegion(uint32_t tag,
-                                  const HalCameraMetadata& settings,
-                                  int32_t* region /*out*/);
+  status_t Update3AMeteringRegion(uint32_t tag, int32_t* region /*out*/);
+  // Looks up 'tag' in the current request settings
+  status_t GetRequestEntry(uint32_t tag, camera_metadata_ro_entry_t* entry);
+  // Shortest frame duration of the current session
+  nsecs_t GetMinFrameDuration() const;
 
   std::mutex request_state_mutex_;
-  std::unique_ptr<HalCameraMetadata> request_settings_;
+  // Settings snapshot, possibly shared with other request states. Results are
+  // not copied from it, 'result_builder_' only reads it to rebuild its result
+  // template when the snapshot or the reported tags change.
+  std::shared_ptr<const HalCameraMetadata> request_settings_;
+  // Patches the values that changed since the previous frame into a template
+  // of the previous result
+  ResultMetadataBuilder result_builder_;
+  // Result capacity reserved for values added after InitializeResult()
+  static const size_t kResultSpareEntries;
+  static const size_t kResultSpareData;
+  // Compiled at Initialize(), the current settings are parsed once per request
+  RequestValidator request_validator_;
+  RequestValidator::Entries request_entries_;
+  // Request tags consumed without validation of their values
+  static const std::vector<uint32_t> kRequestSettingsTags;
 
   // Supported capabilities and features
   static const std::set<uint8_t> kSupportedCapabilites;
@@ -177,6 +219,9 @@ class EmulatedRequestState {
   std::vector<ExtendedSceneModeCapability> available_extended_scene_mode_caps_;
   std::unordered_map<uint8_t, SceneOverride> scene_overrides_;
   std::vector<FPSRange> available_fps_ranges_;
+  // Only valid in constrained high speed sessions
+  std::vector<FPSRange> high_speed_fps_ranges_;
+  bool high_speed_mode_ = false;
   int32_t exposure_compensation_range_[2] = {0, 0};
   float max_zoom_ = 1.0f;
   bool zoom_ratio_supported_ = false;
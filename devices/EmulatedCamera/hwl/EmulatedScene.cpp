@@ -528,6 +528,17 @@ const uint32_t* EmulatedScene::GetPixelElectronsColumn() {
   return pixel;
 }
 
+EmulatedScene::Sampler EmulatedScene::GetSampler() const {
+  Sampler sampler;
+  memcpy(sampler.colors_, current_colors_, sizeof(sampler.colors_));
+  sampler.scene_ = current_scene_;
+  sampler.offset_x_ = offset_x_ + handshake_x_;
+  sampler.offset_y_ = offset_y_ + handshake_y_;
+  sampler.map_div_ = map_div_;
+
+  return sampler;
+}
+
 // Handshake model constants.
 // Frequencies measured in a nanosecond timebase
 const float EmulatedScene::kHorizShakeFreq1 = 2 * M_PI * 2 / 1e9;   // 2 Hz
@@ -26,6 +26,8 @@
 #ifndef HW_EMULATOR_CAMERA2_SCENE_H
 #define HW_EMULATOR_CAMERA2_SCENE_H
 
+#include <string>
+
 #include "android/frameworks/sensorservice/1.0/ISensorManager.h"
 #include "android/frameworks/sensorservice/1.0/types.h"
 #include "utils/Timers.h"
@@ -88,6 +90,13 @@ class EmulatedScene : public RefBase {
   // indexed with ColorChannels.
   const uint32_t* GetPixelElectronsColumn();
 
+  // Immutable snapshot of the scene state computed by the last
+  // CalculateScene() call. Unlike the readout cursor above it does not carry
+  // a current position, so disjoint regions can be sampled from any number of
+  // threads concurrently.
+  class Sampler;
+  Sampler GetSampler() const;
+
   enum ColorChannels { R = 0, Gr, Gb, B, Y, Cb, Cr, NUM_CHANNELS };
 
   static const int kSceneWidth = 20;
@@ -160,7 +169,9 @@ class EmulatedScene : public RefBase {
     NUM_MATERIALS
   };
 
-  uint32_t current_colors_[NUM_MATERIALS * NUM_CHANNELS];
+  // Only the RGGB channels are computed, the remaining ones stay zero since
+  // they are part of the render cache key.
+  uint32_t current_colors_[NUM_MATERIALS * NUM_CHANNELS] = {};
 
   /**
    * Constants for scene definition. These are various degrees of approximate.
@@ -216,6 +227,103 @@ class EmulatedScene : public RefBase {
   static const uint8_t kScene[];
 };
 
+class EmulatedScene::Sampler {
+ public:
+  // Equivalent to SetReadoutPixel(x, y) followed by a single
+  // GetPixelElectrons() or GetPixelElectronsColumn() call.
+  const uint32_t* GetPixelElectrons(int x, int y) const {
+    return GetSceneElectrons(GetSceneColumn(x), GetSceneRow(y));
+  }
+
+  // Scene tile coordinates covering a sensor column or row.
+  int GetSceneColumn(int x) const {
+    return (x + offset_x_) / map_div_;
+  }
+  int GetSceneRow(int y) const {
+    return (y + offset_y_) / map_div_;
+  }
+
+  const uint32_t* GetSceneElectrons(int scene_x, int scene_y) const {
+    return &colors_[scene_[scene_y * kSceneWidth + scene_x]];
+  }
+
+  // Electron counts of all scene materials, NUM_CHANNELS entries per
+  // material.
+  static const size_t kColorCount = NUM_MATERIALS * NUM_CHANNELS;
+  const uint32_t* GetColors() const {
+    return colors_;
+  }
+
+  // Append everything the sampled values depend on to 'key'.
+  void AppendStateKey(std::string* key) const {
+    key->append(reinterpret_cast<const char*>(colors_), sizeof(colors_));
+    key->append(reinterpret_cast<const char*>(scene_),
+                kSceneWidth * kSceneHeight);
+    const int params[] = {offset_x_, offset_y_, map_div_};
+    key->append(reinterpret_cast<const char*>(params), sizeof(params));
+  }
+
+  // Horizontal readout of a single sensor row starting at (x, y). Produces
+  // the same sequence as SetReadoutPixel(x, y) followed by repeated
+  // GetPixelElectrons() calls, up to the end of the row.
+  class RowReadout {
+   public:
+    RowReadout(const Sampler& sampler, int x, int y)
+        : colors_(sampler.colors_),
+          scene_(sampler.scene_),
+          map_div_(sampler.map_div_),
+          sub_x_((x + sampler.offset_x_) % sampler.map_div_),
+          scene_idx_(((y + sampler.offset_y_) / sampler.map_div_) *
+                         kSceneWidth +
+                     (x + sampler.offset_x_) / sampler.map_div_) {
+    }
+
+    const uint32_t* GetPixelElectrons() {
+      return &colors_[GetPixelColorIndex()];
+    }
+
+    // Same as GetPixelElectrons() but returns the offset of the pixel
+    // material within the sampler colors, see Sampler::GetColors().
+    uint32_t GetPixelColorIndex() {
+      uint32_t index = scene_[scene_idx_];
+      sub_x_++;
+      if (sub_x_ > map_div_) {
+        scene_idx_++;
+        sub_x_ = 0;
+      }
+      return index;
+    }
+
+    // Advance the readout position without sampling.
+    void Skip(uint32_t count) {
+      for (uint32_t i = 0; i < count; i++) {
+        sub_x_++;
+        if (sub_x_ > map_div_) {
+          scene_idx_++;
+          sub_x_ = 0;
+        }
+      }
+    }
+
+   private:
+    const uint32_t* colors_;
+    const uint8_t* scene_;
+    int map_div_;
+    int sub_x_;
+    int scene_idx_;
+  };
+
+ private:
+  friend class EmulatedScene;
+  Sampler() = default;
+
+  uint32_t colors_[kColorCount];
+  const uint8_t* scene_ = nullptr;
+  int offset_x_ = 0;
+  int offset_y_ = 0;
+  int map_div_ = 1;
+};
+
 }  // namespace android
 
 #endif  // HW_EMULATOR_CAMERA2_SCENE_H
@@ -27,17 +27,21 @@
 
 #include "EmulatedSensor.h"
 
+#include <cutils/properties.h>
 #include <inttypes.h>
 #include <libyuv.h>
 #include <system/camera_metadata.h>
 #include <utils/Log.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 
 #include "utils/ExifUtils.h"
 #include "utils/HWLUtils.h"
+#include "utils/NoiseGenerator.h"
+#include "utils/YUVSpanFill.h"
 
 namespace android {
 
@@ -55,14 +59,13 @@ const nsecs_t EmulatedSensor::kSupportedExposureTimeRange[2] = {1000LL,
 // ~1/30 s - 30 sec
 const nsecs_t EmulatedSensor::kSupportedFrameDurationRange[2] = {33331760LL,
                                                                  30000000000LL};
+// ~1/240 s, only reachable by constrained high speed sessions
+const nsecs_t EmulatedSensor::kMinHighSpeedFrameDuration = 4166666LL;
 
 const int32_t EmulatedSensor::kSupportedSensitivityRange[2] = {100, 1600};
 const int32_t EmulatedSensor::kDefaultSensitivity = 100;  // ISO
 const nsecs_t EmulatedSensor::kDefaultExposureTime = ms2ns(15);
 const nsecs_t EmulatedSensor::kDefaultFrameDuration = ms2ns(33);
-// Deadline within we should return the results as soon as possible to
-// avoid skewing the frame cycle due to external delays.
-const nsecs_t EmulatedSensor::kReturnResultThreshod = 3 * kDefaultFrameDuration;
 
 // Sensor defaults
 const uint8_t EmulatedSensor::kSupportedColorFilterArrangement =
@@ -96,6 +99,8 @@ const uint32_t EmulatedSensor::kMaxRAWStreams = 1;
 const uint32_t EmulatedSensor::kMaxProcessedStreams = 3;
 const uint32_t EmulatedSensor::kMaxStallingStreams = 2;
 const uint32_t EmulatedSensor::kMaxInputStreams = 1;
+// Preview and recording
+const uint32_t EmulatedSensor::kMaxHighSpeedStreams = 2;
 
 const uint32_t EmulatedSensor::kMaxLensShadingMapSize[2]{64, 64};
 const int32_t EmulatedSensor::kFixedBitPrecision = 64;  // 6-bit
@@ -104,10 +109,23 @@ const int32_t EmulatedSensor::kSaturationPoint = kFixedBitPrecision * 255;
 const camera_metadata_rational EmulatedSensor::kNeutralColorPoint[3] = {
     {255, 1}, {255, 1}, {255, 1}};
 const float EmulatedSensor::kGreenSplit = 1.f;  // No divergence
-// Reduce memory usage by allowing only one buffer in sensor, one in jpeg
-// compressor and one pending request to avoid stalls.
+// Minimum pipeline depth: one buffer in sensor, one in jpeg compressor and
+// one pending request to avoid stalls. Deeper pipelines follow
+// ANDROID_REQUEST_PIPELINE_MAX_DEPTH.
 const uint8_t EmulatedSensor::kPipelineDepth = 3;
 
+// Number of threads used by the capture kernels. '1' disables parallel
+// readout, '0' or an absent value picks a default based on the available
+// cores.
+const char* EmulatedSensor::kCaptureThreadsProperty =
+    "persist.vendor.camera.emulated.capture_threads";
+const uint32_t EmulatedSensor::kMaxCaptureThreads = 4;
+// Smaller bands are not worth the dispatch overhead
+const size_t EmulatedSensor::kMinCaptureBandRows = 16;
+// Idle staging buffers kept around for reuse, enough for a couple of 12MP
+// YUV420 frames.
+const size_t EmulatedSensor::kMaxStagingPoolBytes = 64 * 1024 * 1024;
+
 const camera_metadata_rational EmulatedSensor::kDefaultColorTransform[9] = {
     {1, 1}, {0, 1}, {0, 1}, {0, 1}, {1, 1}, {0, 1}, {0, 1}, {0, 1}, {1, 1}};
 const float EmulatedSensor::kDefaultColorCorrectionGains[4] = {1.0f, 1.0f, 1.0f,
@@ -117,24 +135,9 @@ const float EmulatedSensor::kDefaultToneMapCurveRed[4] = {.0f, .0f, 1.f, 1.f};
 const float EmulatedSensor::kDefaultToneMapCurveGreen[4] = {.0f, .0f, 1.f, 1.f};
 const float EmulatedSensor::kDefaultToneMapCurveBlue[4] = {.0f, .0f, 1.f, 1.f};
 
-/** A few utility functions for math, normal distributions */
-
-// Take advantage of IEEE floating-point format to calculate an approximate
-// square root. Accurate to within +-3.6%
-float sqrtf_approx(float r) {
-  // Modifier is based on IEEE floating-point representation; the
-  // manipulations boil down to finding approximate log2, dividing by two, and
-  // then inverting the log2. A bias is added to make the relative error
-  // symmetric about the real answer.
-  const int32_t modifier = 0x1FBB4000;
-
-  int32_t r_i = *(int32_t*)(&r);
-  r_i = (r_i >> 1) + modifier;
-
-  return *(float*)(&r_i);
-}
-
-EmulatedSensor::EmulatedSensor() : Thread(false), got_vsync_(false) {
+EmulatedSensor::EmulatedSensor()
+    : Thread(false),
+      staging_pool_(BufferPool::Create(kMaxStagingPoolBytes)) {
   gamma_table_.resize(kSaturationPoint + 1);
   for (int32_t i = 0; i <= kSaturationPoint; i++) {
     gamma_table_[i] = ApplysRGBGamma(i, kSaturationPoint);
@@ -240,6 +243,17 @@ bool EmulatedSensor::AreCharacteristicsSupported(
     return false;
   }
 
+  for (const auto& config : characteristics.high_speed_video_configs) {
+    if ((config.min_fps <= 0) || (config.min_fps > config.max_fps) ||
+        ((s2ns(1) / config.max_fps) < kMinHighSpeedFrameDuration) ||
+        (config.batch_size_max == 0)) {
+      ALOGE("%s: Unsupported high speed video configuration %ux%u [%d, %d]",
+            __FUNCTION__, config.width, config.height, config.min_fps,
+            config.max_fps);
+      return false;
+    }
+  }
+
   return true;
 }
 
@@ -251,6 +265,34 @@ bool EmulatedSensor::IsStreamCombinationSupported(
   uint32_t processed_stream_count = 0;
   uint32_t stalling_stream_count = 0;
 
+  if (config.operation_mode ==
+      google_camera_hal::StreamConfigurationMode::kConstrainedHighSpeed) {
+    if ((config.streams.empty()) ||
+        (config.streams.size() > kMaxHighSpeedStreams)) {
+      ALOGE("%s: High speed stream count %zu not supported!", __FUNCTION__,
+            config.streams.size());
+      return false;
+    }
+
+    for (const auto& stream : config.streams) {
+      if ((stream.stream_type != google_camera_hal::StreamType::kOutput) ||
+          (stream.format != HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED) ||
+          (stream.width != config.streams[0].width) ||
+          (stream.height != config.streams[0].height)) {
+        ALOGE("%s: High speed stream with size %dx%d and format 0x%x is not"
+              " supported!", __FUNCTION__, stream.width, stream.height,
+              stream.format);
+        return false;
+      }
+    }
+
+    if (GetHighSpeedBatchSize(config, sensor_chars) == 0) {
+      ALOGE("%s: No high speed video configuration matches the session!",
+            __FUNCTION__);
+      return false;
+    }
+  }
+
   for (const auto& stream : config.streams) {
     if (stream.rotation != google_camera_hal::StreamRotation::kRotation0) {
       ALOGE("%s: Stream rotation: 0x%x not supported!", __FUNCTION__,
@@ -335,9 +377,41 @@ bool EmulatedSensor::IsStreamCombinationSupported(
   return true;
 }
 
+uint32_t EmulatedSensor::GetHighSpeedBatchSize(
+    const StreamConfiguration& config,
+    const SensorCharacteristics& sensor_chars) {
+  if (config.streams.empty()) {
+    return 0;
+  }
+
+  camera_metadata_ro_entry_t entry;
+  bool has_fps_range =
+      (config.session_params.get() != nullptr) &&
+      (config.session_params->Get(ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+                                  &entry) == OK) &&
+      (entry.count == 2);
+  uint32_t batch_size = 0;
+  for (const auto& it : sensor_chars.high_speed_video_configs) {
+    if ((it.width != config.streams[0].width) ||
+        (it.height != config.streams[0].height)) {
+      continue;
+    }
+
+    if (!has_fps_range) {
+      batch_size = std::max(batch_size, it.batch_size_max);
+    } else if ((it.min_fps == entry.data.i32[0]) &&
+               (it.max_fps == entry.data.i32[1])) {
+      return it.batch_size_max;
+    }
+  }
+
+  return batch_size;
+}
+
 status_t EmulatedSensor::StartUp(
     uint32_t logical_camera_id,
-    std::unique_ptr<LogicalCharacteristics> logical_chars) {
+    std::unique_ptr<LogicalCharacteristics> logical_chars,
+    std::shared_ptr<RenderCache> render_cache) {
   if (isRunning()) {
     return OK;
   }
@@ -355,12 +429,14 @@ status_t EmulatedSensor::StartUp(
     return BAD_VALUE;
   }
 
+  exif_pools_.clear();
   for (const auto& it : *chars_) {
     if (!AreCharacteristicsSupported(it.second)) {
       ALOGE("%s: Sensor characteristics for camera id: %u not supported!",
             __FUNCTION__, it.first);
       return BAD_VALUE;
     }
+    exif_pools_.emplace(it.first, ExifUtilsPool::Create(it.second));
   }
 
   logical_camera_id_ = logical_camera_id;
@@ -369,14 +445,37 @@ status_t EmulatedSensor::StartUp(
       kElectronsPerLuxSecond, device_chars->second.orientation,
       device_chars->second.is_front_facing);
   scene_->InitializeSensorQueue();
-  jpeg_compressor_ = std::make_unique<JpegCompressor>();
+  jpeg_compressor_ = std::make_unique<JpegCompressor>(staging_pool_);
+
+  int32_t capture_threads = property_get_int32(kCaptureThreadsProperty, 0);
+  if (capture_threads <= 0) {
+    capture_threads =
+        std::min(std::max(std::thread::hardware_concurrency(), 1u),
+                 kMaxCaptureThreads);
+  }
+  capture_workers_ = std::make_unique<WorkerPool>(capture_threads);
+  render_cache_ = render_cache;
+
+  // Frames in flight between the stages are bounded by the pipeline depth of
+  // the logical camera
+  render_queue_ =
+      std::make_unique<FrameQueue>(device_chars->second.max_pipeline_depth);
+  result_queue_ =
+      std::make_unique<FrameQueue>(device_chars->second.max_pipeline_depth);
+  render_exiting_ = false;
+  result_exiting_ = false;
 
   auto res = run(LOG_TAG, ANDROID_PRIORITY_URGENT_DISPLAY);
   if (res != OK) {
     ALOGE("Unable to start up sensor capture thread: %d", res);
+    return res;
   }
 
-  return res;
+  // Frames queue up in 'render_queue_' until the stages are running
+  render_thread_ = std::thread([this] { RenderLoop(); });
+  result_thread_ = std::thread([this] { ResultLoop(); });
+
+  return OK;
 }
 
 status_t EmulatedSensor::ShutDown() {
@@ -385,6 +484,18 @@ status_t EmulatedSensor::ShutDown() {
   if (res != OK) {
     ALOGE("Unable to shut down sensor capture thread: %d", res);
   }
+
+  // Frames already in flight are drained before the stages exit
+  StopStage(&render_thread_, &render_exiting_);
+  StopStage(&result_thread_, &result_exiting_);
+
+  // A request that was never latched won't complete anymore
+  std::unique_ptr<PipelineFrame> frame;
+  while (request_mailbox_.TryPop(&frame)) {
+    AbortFrame(frame.get());
+    CompleteRequest();
+  }
+
   return res;
 }
 
@@ -393,118 +504,170 @@ void EmulatedSensor::SetCurrentRequest(
     std::unique_ptr<HwlPipelineResult> result,
     std::unique_ptr<Buffers> input_buffers,
     std::unique_ptr<Buffers> output_buffers) {
-  Mutex::Autolock lock(control_mutex_);
-  current_settings_ = std::move(logical_settings);
-  current_result_ = std::move(result);
-  current_input_buffers_ = std::move(input_buffers);
-  current_output_buffers_ = std::move(output_buffers);
-}
+  auto frame = std::make_unique<PipelineFrame>();
+  frame->request = true;
+  frame->settings = std::move(logical_settings);
+  frame->result = std::move(result);
+  frame->input_buffers = std::move(input_buffers);
+  frame->output_buffers = std::move(output_buffers);
+  // Counted before the hand-off, the result may be returned right after it
+  pending_requests_.fetch_add(1);
+  while (true) {
+    // Snapshot the VSync count first so the VSync that frees the mailbox
+    // can't be missed
+    auto vsync_count = vsync_.GetCount();
+    if (request_mailbox_.TryPush(std::move(frame))) {
+      return;
+    }
 
-bool EmulatedSensor::WaitForVSyncLocked(nsecs_t reltime) {
-  got_vsync_ = false;
-  while (!got_vsync_) {
-    auto res = vsync_.waitRelative(control_mutex_, reltime);
-    if (res != OK && res != TIMED_OUT) {
-      ALOGE("%s: Error waiting for VSync signal: %d", __FUNCTION__, res);
-      return false;
+    if (!vsync_.WaitForChange(vsync_count, kSupportedFrameDurationRange[1])) {
+      ALOGE("%s: Previous request not latched, dropping request!",
+            __FUNCTION__);
+      AbortFrame(frame.get());
+      CompleteRequest();
+      return;
     }
   }
+}
 
-  return got_vsync_;
+void EmulatedSensor::SetHighSpeedMode(uint32_t batch_size) {
+  high_speed_batch_size_.store(batch_size, std::memory_order_relaxed);
 }
 
 bool EmulatedSensor::WaitForVSync(nsecs_t reltime) {
-  Mutex::Autolock lock(control_mutex_);
+  return vsync_.Wait(reltime);
+}
 
-  return WaitForVSyncLocked(reltime);
+BufferPool::Statistics EmulatedSensor::GetStagingPoolStatistics() const {
+  return staging_pool_->GetStatistics();
+}
+
+FrameScheduler::Statistics EmulatedSensor::GetFrameTimingStatistics() const {
+  return frame_scheduler_.GetStatistics();
+}
+
+void EmulatedSensor::DumpFrameTiming(int fd) const {
+  frame_scheduler_.Dump(fd);
 }
 
 status_t EmulatedSensor::Flush() {
-  Mutex::Autolock lock(control_mutex_);
-  auto ret = WaitForVSyncLocked(kSupportedFrameDurationRange[1]);
+  // Pending requests are latched by the processing thread on the next VSync,
+  // wait until they also passed the render and result stages
+  nsecs_t deadline =
+      systemTime(SYSTEM_TIME_MONOTONIC) + kSupportedFrameDurationRange[1];
+  bool ret = true;
+  while (true) {
+    // Snapshot the signal count first so the completion can't be missed
+    auto stage_count = stage_signal_.GetCount();
+    if (pending_requests_.load() == 0) {
+      break;
+    }
 
-  // First recreate the jpeg compressor. This will abort any ongoing processing
-  // and flush any pending jobs.
-  jpeg_compressor_ = std::make_unique<JpegCompressor>();
+    nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+    if ((remaining <= 0) ||
+        !stage_signal_.WaitForChange(stage_count, remaining)) {
+      ALOGE("%s: Timed out waiting for %u pending requests!", __FUNCTION__,
+            pending_requests_.load());
+      ret = false;
+      break;
+    }
+  }
 
-  // Then return any pending frames here
-  if ((current_input_buffers_.get() != nullptr) &&
-      (!current_input_buffers_->empty())) {
-    current_input_buffers_->clear();
+  // Recreating the jpeg compressor aborts any ongoing processing and flushes
+  // any pending jobs.
+  {
+    std::lock_guard<std::mutex> lock(jpeg_mutex_);
+    jpeg_compressor_ = std::make_unique<JpegCompressor>(staging_pool_);
   }
-  if ((current_output_buffers_.get() != nullptr) &&
-      (!current_output_buffers_->empty())) {
-    for (const auto& buffer : *current_output_buffers_) {
+
+  return ret ? OK : TIMED_OUT;
+}
+
+void EmulatedSensor::AbortFrame(PipelineFrame* frame) {
+  if ((frame->input_buffers.get() != nullptr) &&
+      (!frame->input_buffers->empty())) {
+    frame->input_buffers->clear();
+  }
+  if ((frame->output_buffers.get() != nullptr) &&
+      (!frame->output_buffers->empty())) {
+    for (const auto& buffer : *frame->output_buffers) {
       buffer->stream_buffer.status = BufferStatus::kError;
     }
 
-    if ((current_result_.get() != nullptr) &&
-        (current_result_->result_metadata.get() != nullptr)) {
-      if (current_output_buffers_->at(0)->callback.notify != nullptr) {
+    if ((frame->result.get() != nullptr) &&
+        (frame->result->result_metadata.get() != nullptr)) {
+      if (frame->output_buffers->at(0)->callback.notify != nullptr) {
         NotifyMessage msg{
             .type = MessageType::kError,
             .message.error = {
-                .frame_number = current_output_buffers_->at(0)->frame_number,
+                .frame_number = frame->output_buffers->at(0)->frame_number,
                 .error_stream_id = -1,
                 .error_code = ErrorCode::kErrorResult,
             }};
 
-        current_output_buffers_->at(0)->callback.notify(
-            current_result_->pipeline_id, msg);
+        frame->output_buffers->at(0)->callback.notify(
+            frame->result->pipeline_id, msg);
       }
     }
 
-    current_output_buffers_->clear();
+    frame->output_buffers->clear();
   }
-
-  return ret ? OK : TIMED_OUT;
 }
 
 bool EmulatedSensor::threadLoop() {
   ATRACE_CALL();
   /**
-   * Sensor capture operation main loop.
+   * Sensor capture operation main loop. Only keeps the frame cadence, the
+   * actual rendering and result return run in the following pipeline stages.
    *
    */
 
   /**
    * Stage 1: Read in latest control parameters
    */
-  std::unique_ptr<Buffers> next_buffers;
-  std::unique_ptr<Buffers> next_input_buffer;
-  std::unique_ptr<HwlPipelineResult> next_result;
-  std::unique_ptr<LogicalCameraSettings> settings;
-  HwlPipelineCallback callback = {nullptr, nullptr};
-  {
-    Mutex::Autolock lock(control_mutex_);
-    std::swap(settings, current_settings_);
-    std::swap(next_buffers, current_output_buffers_);
-    std::swap(next_input_buffer, current_input_buffers_);
-    std::swap(next_result, current_result_);
-
-    // Signal VSync for start of readout
-    ALOGVV("Sensor VSync");
-    got_vsync_ = true;
-    vsync_.signal();
+  std::unique_ptr<PipelineFrame> frame;
+  if (!request_mailbox_.TryPop(&frame)) {
+    frame = std::make_unique<PipelineFrame>();
   }
+  auto batch_size = high_speed_batch_size_.load(std::memory_order_relaxed);
+
+  // Signal VSync for start of readout
+  ALOGVV("Sensor VSync");
+  vsync_.Signal();
 
-  auto frame_duration = EmulatedSensor::kSupportedFrameDurationRange[0];
+  // Idle sensors keep the regular frame rate
+  auto frame_duration = EmulatedSensor::kDefaultFrameDuration;
   // Frame duration must always be the same among all physical devices
-  if ((settings.get() != nullptr) && (!settings->empty())) {
-    frame_duration = settings->begin()->second.frame_duration;
+  if ((frame->settings.get() != nullptr) && (!frame->settings->empty())) {
+    frame_duration = frame->settings->begin()->second.frame_duration;
   }
 
-  nsecs_t start_real_time = systemTime();
   // Stagefright cares about system time for timestamps, so base simulated
-  // time on that.
-  nsecs_t frame_end_real_time = start_real_time + frame_duration;
+  // time on that. Frames follow the deadline schedule instead of the actual
+  // wakeup time, which keeps the timestamps free of drift.
+  nsecs_t work_start_time = systemTime();
+  nsecs_t frame_start_time = frame_scheduler_.BeginFrame(frame_duration);
+  nsecs_t frame_end_time = frame_start_time + frame_duration;
 
   /**
-   * Stage 2: Capture new image
+   * Stage 2: Start exposure of the new image
    */
-  next_capture_time_ = frame_end_real_time;
+  frame->capture_time = frame_end_time;
+  frame->frame_duration = frame_duration;
+  frame->frame_end_time = frame_end_time;
+  frame->high_speed = batch_size > 0;
+
+  bool flush_batch = false;
+  if (frame->result.get() != nullptr) {
+    batch_frames_ = (batch_size > 1) ? (batch_frames_ + 1) % batch_size : 0;
+    frame->batch_end = batch_frames_ == 0;
+  } else if (batch_frames_ > 0) {
+    // The burst ended early, return what was captured so far
+    batch_frames_ = 0;
+    flush_batch = true;
+  }
 
-  bool reprocess_request = false;
+  auto& next_input_buffer = frame->input_buffers;
   if ((next_input_buffer.get() != nullptr) && (!next_input_buffer->empty())) {
     if (next_input_buffer->size() > 1) {
       ALOGW("%s: Reprocess supports only single input!", __FUNCTION__);
@@ -516,27 +679,66 @@ bool EmulatedSensor::threadLoop() {
     } else {
       camera_metadata_ro_entry_t entry;
       auto ret =
-          next_result->result_metadata->Get(ANDROID_SENSOR_TIMESTAMP, &entry);
+          frame->result->result_metadata->Get(ANDROID_SENSOR_TIMESTAMP, &entry);
       if ((ret == OK) && (entry.count == 1)) {
-        next_capture_time_ = entry.data.i64[0];
+        frame->capture_time = entry.data.i64[0];
       } else {
         ALOGW("%s: Reprocess timestamp absent!", __FUNCTION__);
       }
 
-      reprocess_request = true;
+      frame->reprocess_request = true;
     }
   }
 
-  if ((next_buffers != nullptr) && (settings != nullptr)) {
-    callback = next_buffers->at(0)->callback;
-    if (callback.notify != nullptr) {
+  if ((frame->output_buffers != nullptr) && (frame->settings != nullptr)) {
+    frame->callback = frame->output_buffers->at(0)->callback;
+    if (frame->callback.notify != nullptr) {
       NotifyMessage msg{
           .type = MessageType::kShutter,
           .message.shutter = {
-              .frame_number = next_buffers->at(0)->frame_number,
-              .timestamp_ns = static_cast<uint64_t>(next_capture_time_)}};
-      callback.notify(next_result->pipeline_id, msg);
+              .frame_number = frame->output_buffers->at(0)->frame_number,
+              .timestamp_ns = static_cast<uint64_t>(frame->capture_time)}};
+      frame->callback.notify(frame->result->pipeline_id, msg);
     }
+  }
+
+  /**
+   * Stage 3: Hand the frame over to the render stage. Rendering overlaps with
+   * the exposure of the following frames, this only blocks in case the render
+   * stage falls behind by more than the pipeline depth.
+   */
+  if (frame->request || flush_batch) {
+    PushFrame(render_queue_.get(), std::move(frame));
+  }
+
+  frame_scheduler_.RecordStageCost(FrameScheduler::STAGE_TIMING,
+                                   systemTime() - work_start_time);
+  ALOGVV("Sensor vertical blanking interval");
+  frame_scheduler_.EndFrame(frame_end_time);
+
+  return true;
+};
+
+void EmulatedSensor::RenderLoop() {
+  std::unique_ptr<PipelineFrame> frame;
+  while ((frame = PopFrame(render_queue_.get(), render_exiting_)) != nullptr) {
+    nsecs_t start_time = systemTime();
+    RenderFrame(frame.get());
+    frame_scheduler_.RecordStageCost(FrameScheduler::STAGE_RENDER,
+                                     systemTime() - start_time);
+    PushFrame(result_queue_.get(), std::move(frame));
+  }
+}
+
+void EmulatedSensor::RenderFrame(PipelineFrame* frame) {
+  ATRACE_CALL();
+  auto& settings = frame->settings;
+  auto& next_buffers = frame->output_buffers;
+  auto& next_input_buffer = frame->input_buffers;
+  auto& next_result = frame->result;
+  bool reprocess_request = frame->reprocess_request;
+
+  if ((next_buffers != nullptr) && (settings != nullptr)) {
     auto b = next_buffers->begin();
     while (b != next_buffers->end()) {
       auto device_settings = settings->find((*b)->camera_id);
@@ -578,14 +780,16 @@ bool EmulatedSensor::threadLoop() {
       uint32_t handshake_divider =
         (device_settings->second.video_stab == ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_ON) ?
         kReducedSceneHandshake : kRegularSceneHandshake;
-      scene_->CalculateScene(next_capture_time_, handshake_divider);
+      scene_->CalculateScene(frame->capture_time, handshake_divider);
 
       (*b)->stream_buffer.status = BufferStatus::kOk;
       switch ((*b)->format) {
         case HAL_PIXEL_FORMAT_RAW16:
           if (!reprocess_request) {
             CaptureRaw((*b)->plane.img.img, device_settings->second.gain,
-                       (*b)->width, device_chars->second);
+                       (*b)->width,
+                       GetNoiseKey((*b)->camera_id, (*b)->frame_number),
+                       device_chars->second);
           } else {
             ALOGE("%s: Reprocess requests with output format %x no supported!",
                   __FUNCTION__, (*b)->format);
@@ -628,8 +832,9 @@ bool EmulatedSensor::threadLoop() {
             auto jpeg_input = std::make_unique<JpegYUV420Input>();
             jpeg_input->width = (*b)->width;
             jpeg_input->height = (*b)->height;
-            auto img =
-                new uint8_t[(jpeg_input->width * jpeg_input->height * 3) / 2];
+            jpeg_input->buffer = staging_pool_->Acquire(
+                (jpeg_input->width * jpeg_input->height * 3) / 2);
+            auto img = jpeg_input->buffer.data();
             jpeg_input->yuv_planes = {
                 .img_y = img,
                 .img_cb = img + jpeg_input->width * jpeg_input->height,
@@ -637,7 +842,6 @@ bool EmulatedSensor::threadLoop() {
                 .y_stride = jpeg_input->width,
                 .cbcr_stride = jpeg_input->width / 2,
                 .cbcr_step = 1};
-            jpeg_input->buffer_owner = true;
             YUV420Frame yuv_output{.width = jpeg_input->width,
                                    .height = jpeg_input->height,
                                    .planes = jpeg_input->yuv_planes};
@@ -657,17 +861,18 @@ bool EmulatedSensor::threadLoop() {
             }
 
             auto jpeg_job = std::make_unique<JpegYUV420Job>();
-            jpeg_job->exif_utils = std::unique_ptr<ExifUtils>(
-                ExifUtils::Create(device_chars->second));
+            if ((next_result.get() != nullptr) &&
+                (next_result->result_metadata.get() != nullptr)) {
+              jpeg_job->exif = exif_pools_.at((*b)->camera_id)
+                                   ->Acquire(*next_result->result_metadata);
+            }
             jpeg_job->input = std::move(jpeg_input);
             // If jpeg compression is successful, then the jpeg compressor
             // must set the corresponding status.
             (*b)->stream_buffer.status = BufferStatus::kError;
             std::swap(jpeg_job->output, *b);
-            jpeg_job->result_metadata =
-                HalCameraMetadata::Clone(next_result->result_metadata.get());
 
-            Mutex::Autolock lock(control_mutex_);
+            std::lock_guard<std::mutex> lock(jpeg_mutex_);
             jpeg_compressor_->QueueYUV420(std::move(jpeg_job));
           } else {
             ALOGE("%s: Format %x with dataspace %x is TODO", __FUNCTION__,
@@ -691,6 +896,7 @@ bool EmulatedSensor::threadLoop() {
           bool rotate =
               device_settings->second.rotate_and_crop == ANDROID_SCALER_ROTATE_AND_CROP_90;
           ProcessType process_type = reprocess_request ? REPROCESS :
+            frame->high_speed ? HIGH_SPEED :
             (device_settings->second.edge_mode == ANDROID_EDGE_MODE_HIGH_QUALITY) ?
             HIGH_QUALITY : REGULAR;
           auto ret = ProcessYUV420(
@@ -735,50 +941,106 @@ bool EmulatedSensor::threadLoop() {
     }
     next_input_buffer->clear();
   }
+}
 
-  nsecs_t work_done_real_time = systemTime();
-  // Returning the results at this point is not entirely correct from timing
-  // perspective. Under ideal conditions where 'ReturnResults' completes
-  // in less than 'time_accuracy' we need to return the results after the
-  // frame cycle expires. However under real conditions various system
-  // components like SurfaceFlinger, Encoder, LMK etc. could be consuming most
-  // of the resources and the duration of "ReturnResults" can get comparable to
-  // 'kDefaultFrameDuration'. This will skew the frame cycle and can result in
-  // potential frame drops. To avoid this scenario when we are running under
-  // tight deadlines (less than 'kReturnResultThreshod') try to return the
-  // results immediately. In all other cases with more relaxed deadlines
-  // the occasional bump during 'ReturnResults' should not have any
-  // noticeable effect.
-  if ((work_done_real_time + kReturnResultThreshod) > frame_end_real_time) {
-    ReturnResults(callback, std::move(settings), std::move(next_result));
-  }
-
-  work_done_real_time = systemTime();
-  ALOGVV("Sensor vertical blanking interval");
-  const nsecs_t time_accuracy = 2e6;  // 2 ms of imprecision is ok
-  if (work_done_real_time < frame_end_real_time - time_accuracy) {
-    timespec t;
-    t.tv_sec = (frame_end_real_time - work_done_real_time) / 1000000000L;
-    t.tv_nsec = (frame_end_real_time - work_done_real_time) % 1000000000L;
+void EmulatedSensor::ResultLoop() {
+  std::vector<std::unique_ptr<PipelineFrame>> batch;
+  std::unique_ptr<PipelineFrame> frame;
+  while ((frame = PopFrame(result_queue_.get(), result_exiting_)) != nullptr) {
+    bool batch_end = frame->batch_end;
+    batch.push_back(std::move(frame));
+    if (batch_end) {
+      ReturnBatch(&batch);
+    }
+  }
+
+  ReturnBatch(&batch);
+}
 
-    int ret;
-    do {
-      ret = nanosleep(&t, &t);
-    } while (ret != 0);
+void EmulatedSensor::ReturnBatch(
+    std::vector<std::unique_ptr<PipelineFrame>>* batch) {
+  if (batch->empty()) {
+    return;
   }
-  nsecs_t end_real_time __unused = systemTime();
-  ALOGVV("Frame cycle took %" PRIu64 "  ms, target %" PRIu64 " ms",
-         ns2ms(end_real_time - start_real_time), ns2ms(frame_duration));
 
-  ReturnResults(callback, std::move(settings), std::move(next_result));
+  // Results are due once the frame readout completes. Start returning them
+  // ahead of that by the time result delivery usually takes, but never
+  // before the readout is half way through. Frames that took longer to
+  // render are returned immediately.
+  const auto& last_frame = batch->back();
+  nsecs_t result_cost =
+      frame_scheduler_.GetStageCost(FrameScheduler::STAGE_RESULT);
+  FrameScheduler::SleepUntil(
+      last_frame->frame_end_time -
+      std::min(result_cost, last_frame->frame_duration / 2));
+
+  nsecs_t start_time = systemTime();
+  for (auto& frame : *batch) {
+    ReturnResults(frame->callback, std::move(frame->settings),
+                  std::move(frame->result), frame->capture_time);
+    if (frame->request) {
+      CompleteRequest();
+    }
+  }
+  frame_scheduler_.RecordStageCost(FrameScheduler::STAGE_RESULT,
+                                   systemTime() - start_time);
+  batch->clear();
+}
 
-  return true;
-};
+void EmulatedSensor::PushFrame(FrameQueue* queue,
+                               std::unique_ptr<PipelineFrame> frame) {
+  while (true) {
+    // Snapshot the signal count first so the pop that frees a slot can't be
+    // missed
+    auto stage_count = stage_signal_.GetCount();
+    if (queue->TryPush(std::move(frame))) {
+      break;
+    }
+    stage_signal_.WaitForChange(stage_count, kSupportedFrameDurationRange[1]);
+  }
+  stage_signal_.Signal();
+}
+
+std::unique_ptr<EmulatedSensor::PipelineFrame> EmulatedSensor::PopFrame(
+    FrameQueue* queue, const std::atomic<bool>& exiting) {
+  std::unique_ptr<PipelineFrame> frame;
+  while (true) {
+    auto stage_count = stage_signal_.GetCount();
+    // The producer is gone once 'exiting' is set, all of its frames are
+    // visible to the pop below
+    bool drain = exiting.load();
+    if (queue->TryPop(&frame)) {
+      break;
+    }
+    if (drain) {
+      return nullptr;
+    }
+    stage_signal_.WaitForChange(stage_count, kSupportedFrameDurationRange[1]);
+  }
+  stage_signal_.Signal();
+
+  return frame;
+}
+
+void EmulatedSensor::StopStage(std::thread* stage,
+                               std::atomic<bool>* exiting) {
+  exiting->store(true);
+  stage_signal_.Signal();
+  if (stage->joinable()) {
+    stage->join();
+  }
+}
+
+void EmulatedSensor::CompleteRequest() {
+  if (pending_requests_.fetch_sub(1) == 1) {
+    stage_signal_.Signal();
+  }
+}
 
 void EmulatedSensor::ReturnResults(
     HwlPipelineCallback callback,
     std::unique_ptr<LogicalCameraSettings> settings,
-    std::unique_ptr<HwlPipelineResult> result) {
+    std::unique_ptr<HwlPipelineResult> result, nsecs_t capture_time) {
   if ((callback.process_pipeline_result != nullptr) &&
       (result.get() != nullptr) && (result->result_metadata.get() != nullptr)) {
     auto logical_settings = settings->find(logical_camera_id_);
@@ -794,8 +1056,7 @@ void EmulatedSensor::ReturnResults(
       return;
     }
 
-    result->result_metadata->Set(ANDROID_SENSOR_TIMESTAMP, &next_capture_time_,
-                                 1);
+    result->result_metadata->Set(ANDROID_SENSOR_TIMESTAMP, &capture_time, 1);
     if (logical_settings->second.lens_shading_map_mode ==
         ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_ON) {
       if ((device_chars->second.lens_shading_map_size[0] > 0) &&
@@ -848,7 +1109,7 @@ void EmulatedSensor::ReturnResults(
         }
 
         // Sensor timestamp for all physical devices must be the same.
-        it.second->Set(ANDROID_SENSOR_TIMESTAMP, &next_capture_time_, 1);
+        it.second->Set(ANDROID_SENSOR_TIMESTAMP, &capture_time, 1);
         if (physical_settings->second.report_neutral_color_point) {
           it.second->Set(ANDROID_SENSOR_NEUTRAL_COLOR_POINT, kNeutralColorPoint,
                          ARRAY_SIZE(kNeutralColorPoint));
@@ -891,7 +1152,136 @@ void EmulatedSensor::CalculateAndAppendNoiseProfile(
   }
 }
 
+std::string EmulatedSensor::GetRenderCacheKey(
+    RenderOutput output, uint32_t width, uint32_t height, uint32_t gain,
+    float zoom_ratio, bool rotate, const EmulatedScene::Sampler& sampler,
+    const SensorCharacteristics& chars) {
+  struct {
+    uint32_t output, width, height, gain;
+    float zoom_ratio;
+    uint32_t rotate;
+    uint32_t sensor_width, sensor_height, max_raw_value;
+  } params = {static_cast<uint32_t>(output),
+              width,
+              height,
+              gain,
+              zoom_ratio,
+              rotate,
+              static_cast<uint32_t>(chars.width),
+              static_cast<uint32_t>(chars.height),
+              chars.max_raw_value};
+
+  std::string key(reinterpret_cast<const char*>(&params), sizeof(params));
+  sampler.AppendStateKey(&key);
+  return key;
+}
+
+bool EmulatedSensor::IsRenderStateRepeated(const std::string& key) {
+  auto it = std::find(missed_render_keys_.begin(), missed_render_keys_.end(),
+                      key);
+  if (it != missed_render_keys_.end()) {
+    missed_render_keys_.erase(it);
+    return true;
+  }
+
+  if (missed_render_keys_.size() >= kMaxMissedRenderKeys) {
+    missed_render_keys_.erase(missed_render_keys_.begin());
+  }
+  missed_render_keys_.push_back(key);
+  return false;
+}
+
+bool EmulatedSensor::ReadCachedPlane(const std::string& key, uint8_t* img,
+                                     uint32_t stride, uint32_t row_bytes,
+                                     uint32_t rows) {
+  auto entry = render_cache_->Get(key);
+  if ((entry.get() == nullptr) || (entry->size() != row_bytes * rows)) {
+    return false;
+  }
+
+  libyuv::CopyPlane(entry->data(), row_bytes, img, stride, row_bytes, rows);
+  return true;
+}
+
+void EmulatedSensor::StoreCachedPlane(const std::string& key,
+                                      const uint8_t* img, uint32_t stride,
+                                      uint32_t row_bytes, uint32_t rows) {
+  auto entry = std::make_shared<std::vector<uint8_t>>(row_bytes * rows);
+  libyuv::CopyPlane(img, stride, entry->data(), row_bytes, row_bytes, rows);
+  render_cache_->Put(key, std::move(entry));
+}
+
+// Cached YUV420 output is kept in planar I420 layout, which allows any
+// YUV420 output layout to share the same entry.
+bool EmulatedSensor::ReadCachedYUV420(const std::string& key,
+                                      YCbCrPlanes yuv_layout, uint32_t width,
+                                      uint32_t height) {
+  if ((yuv_layout.cbcr_step != 1) && (yuv_layout.cbcr_step != 2)) {
+    return false;
+  }
+
+  uint32_t cbcr_width = (width + 1) / 2;
+  uint32_t cbcr_height = (height + 1) / 2;
+  size_t y_size = width * height;
+  size_t cbcr_size = cbcr_width * cbcr_height;
+  auto entry = render_cache_->Get(key);
+  if ((entry.get() == nullptr) || (entry->size() != y_size + cbcr_size * 2)) {
+    return false;
+  }
+
+  const uint8_t* cb = entry->data() + y_size;
+  const uint8_t* cr = cb + cbcr_size;
+  libyuv::CopyPlane(entry->data(), width, yuv_layout.img_y,
+                    yuv_layout.y_stride, width, height);
+  if (yuv_layout.cbcr_step == 1) {
+    libyuv::CopyPlane(cb, cbcr_width, yuv_layout.img_cb,
+                      yuv_layout.cbcr_stride, cbcr_width, cbcr_height);
+    libyuv::CopyPlane(cr, cbcr_width, yuv_layout.img_cr,
+                      yuv_layout.cbcr_stride, cbcr_width, cbcr_height);
+  } else if (yuv_layout.img_cb < yuv_layout.img_cr) {
+    libyuv::MergeUVPlane(cb, cbcr_width, cr, cbcr_width, yuv_layout.img_cb,
+                         yuv_layout.cbcr_stride, cbcr_width, cbcr_height);
+  } else {
+    libyuv::MergeUVPlane(cr, cbcr_width, cb, cbcr_width, yuv_layout.img_cr,
+                         yuv_layout.cbcr_stride, cbcr_width, cbcr_height);
+  }
+
+  return true;
+}
+
+void EmulatedSensor::StoreCachedYUV420(const std::string& key,
+                                       YCbCrPlanes yuv_layout, uint32_t width,
+                                       uint32_t height) {
+  if ((yuv_layout.cbcr_step != 1) && (yuv_layout.cbcr_step != 2)) {
+    return;
+  }
+
+  uint32_t cbcr_width = (width + 1) / 2;
+  uint32_t cbcr_height = (height + 1) / 2;
+  size_t y_size = width * height;
+  size_t cbcr_size = cbcr_width * cbcr_height;
+  auto entry = std::make_shared<std::vector<uint8_t>>(y_size + cbcr_size * 2);
+  uint8_t* cb = entry->data() + y_size;
+  uint8_t* cr = cb + cbcr_size;
+  libyuv::CopyPlane(yuv_layout.img_y, yuv_layout.y_stride, entry->data(),
+                    width, width, height);
+  if (yuv_layout.cbcr_step == 1) {
+    libyuv::CopyPlane(yuv_layout.img_cb, yuv_layout.cbcr_stride, cb,
+                      cbcr_width, cbcr_width, cbcr_height);
+    libyuv::CopyPlane(yuv_layout.img_cr, yuv_layout.cbcr_stride, cr,
+                      cbcr_width, cbcr_width, cbcr_height);
+  } else if (yuv_layout.img_cb < yuv_layout.img_cr) {
+    libyuv::SplitUVPlane(yuv_layout.img_cb, yuv_layout.cbcr_stride, cb,
+                         cbcr_width, cr, cbcr_width, cbcr_width, cbcr_height);
+  } else {
+    libyuv::SplitUVPlane(yuv_layout.img_cr, yuv_layout.cbcr_stride, cr,
+                         cbcr_width, cb, cbcr_width, cbcr_width, cbcr_height);
+  }
+  render_cache_->Put(key, std::move(entry));
+}
+
 void EmulatedSensor::CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
+                                uint64_t noise_key,
                                 const SensorCharacteristics& chars) {
   ATRACE_CALL();
   float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
@@ -902,39 +1292,63 @@ void EmulatedSensor::CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
   // RGGB
   int bayer_select[4] = {EmulatedScene::R, EmulatedScene::Gr, EmulatedScene::Gb,
                          EmulatedScene::B};
-  scene_->SetReadoutPixel(0, 0);
-  for (unsigned int y = 0; y < chars.height; y++) {
-    int* bayer_row = bayer_select + (y & 0x1) * 2;
-    uint16_t* px = (uint16_t*)img + y * width;
-    for (unsigned int x = 0; x < chars.width; x++) {
-      uint32_t electron_count;
-      electron_count = scene_->GetPixelElectrons()[bayer_row[x & 0x1]];
-
-      // TODO: Better pixel saturation curve?
-      electron_count = (electron_count < kSaturationElectrons)
-                           ? electron_count
-                           : kSaturationElectrons;
-
-      // TODO: Better A/D saturation curve?
-      uint16_t raw_count = electron_count * total_gain;
-      raw_count =
-          (raw_count < chars.max_raw_value) ? raw_count : chars.max_raw_value;
-
-      // Calculate noise value
-      // TODO: Use more-correct Gaussian instead of uniform noise
-      float photon_noise_var = electron_count * noise_var_gain;
-      float noise_stddev = sqrtf_approx(read_noise_var + photon_noise_var);
-      // Scaled to roughly match gaussian/uniform noise stddev
-      float noise_sample = rand_r(&rand_seed_) * (2.5 / (1.0 + RAND_MAX)) - 1.25;
-
-      raw_count += chars.black_level_pattern[bayer_row[x & 0x1]];
-      raw_count += noise_stddev * noise_sample;
-
-      *px++ = raw_count;
+  const auto sampler = scene_->GetSampler();
+
+  // Every scene material produces the same raw count and noise level for a
+  // given CFA channel, calculate both once per frame instead of per pixel.
+  struct RawValue {
+    uint16_t raw_count = 0;
+    float noise_stddev = 0.f;
+  };
+  RawValue raw_values[EmulatedScene::Sampler::kColorCount];
+  const uint32_t* colors = sampler.GetColors();
+  for (size_t i = 0; i < EmulatedScene::Sampler::kColorCount; i++) {
+    size_t channel = i % EmulatedScene::NUM_CHANNELS;
+    if (channel > EmulatedScene::B) {
+      continue;
     }
-    // TODO: Handle this better
-    // simulatedTime += mRowReadoutTime;
+
+    // TODO: Better pixel saturation curve?
+    uint32_t electron_count = (colors[i] < kSaturationElectrons)
+                                  ? colors[i]
+                                  : kSaturationElectrons;
+
+    // TODO: Better A/D saturation curve?
+    uint16_t raw_count = electron_count * total_gain;
+    raw_count =
+        (raw_count < chars.max_raw_value) ? raw_count : chars.max_raw_value;
+
+    float photon_noise_var = electron_count * noise_var_gain;
+    raw_values[i].raw_count = raw_count + chars.black_level_pattern[channel];
+    raw_values[i].noise_stddev = sqrtf(read_noise_var + photon_noise_var);
   }
+
+  // Noise samples are indexed by pixel position, which keeps the output
+  // reproducible for a given key regardless of how the rows are split.
+  const NoiseGenerator noise(noise_key);
+  capture_workers_->ParallelFor(
+      chars.height, kMinCaptureBandRows, [&](size_t y_begin, size_t y_end) {
+        for (size_t y = y_begin; y < y_end; y++) {
+          int* bayer_row = bayer_select + (y & 0x1) * 2;
+          uint16_t* px = (uint16_t*)img + y * width;
+          uint64_t noise_index = y * chars.width;
+          EmulatedScene::Sampler::RowReadout row(sampler, 0, y);
+          for (unsigned int x = 0; x < chars.width; x++) {
+            const RawValue& value =
+                raw_values[row.GetPixelColorIndex() + bayer_row[x & 0x1]];
+
+            float raw_count =
+                value.raw_count +
+                value.noise_stddev * noise.GetGaussian(noise_index++);
+
+            // Clamp instead of wrapping around on strong noise
+            raw_count = std::max(raw_count, 0.f);
+            *px++ = std::min(raw_count, static_cast<float>(UINT16_MAX));
+          }
+          // TODO: Handle this better
+          // simulatedTime += mRowReadoutTime;
+        }
+      });
   ALOGVV("Raw sensor image captured");
 }
 
@@ -942,50 +1356,76 @@ void EmulatedSensor::CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
                                 uint32_t stride, RGBLayout layout, uint32_t gain,
                                 const SensorCharacteristics& chars) {
   ATRACE_CALL();
+  if ((layout != RGB) && (layout != RGBA) && (layout != ARGB)) {
+    ALOGE("%s: RGB layout: %d not supported", __FUNCTION__, layout);
+    return;
+  }
   float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
   // In fixed-point math, calculate total scaling from electrons to 8bpp
   int scale64x = 64 * total_gain * 255 / chars.max_raw_value;
   uint32_t inc_h = ceil((float)chars.width / width);
   uint32_t inc_v = ceil((float)chars.height / height);
-
-  for (unsigned int y = 0, outy = 0; y < chars.height; y += inc_v, outy++) {
-    scene_->SetReadoutPixel(0, y);
-    uint8_t* px = img + outy * stride;
-    for (unsigned int x = 0; x < chars.width; x += inc_h) {
-      uint32_t r_count, g_count, b_count;
-      // TODO: Perfect demosaicing is a cheat
-      const uint32_t* pixel = scene_->GetPixelElectrons();
-      r_count = pixel[EmulatedScene::R] * scale64x;
-      g_count = pixel[EmulatedScene::Gr] * scale64x;
-      b_count = pixel[EmulatedScene::B] * scale64x;
-
-      uint8_t r = r_count < 255 * 64 ? r_count / 64 : 255;
-      uint8_t g = g_count < 255 * 64 ? g_count / 64 : 255;
-      uint8_t b = b_count < 255 * 64 ? b_count / 64 : 255;
-      switch (layout) {
-        case RGB:
-          *px++ = r;
-          *px++ = g;
-          *px++ = b;
-          break;
-        case RGBA:
-          *px++ = r;
-          *px++ = g;
-          *px++ = b;
-          *px++ = 255;
-          break;
-        case ARGB:
-          *px++ = 255;
-          *px++ = r;
-          *px++ = g;
-          *px++ = b;
-          break;
-        default:
-          ALOGE("%s: RGB layout: %d not supported", __FUNCTION__, layout);
-          return;
-      }
-      for (unsigned int j = 1; j < inc_h; j++) scene_->GetPixelElectrons();
+  size_t out_height = (chars.height + inc_v - 1) / inc_v;
+
+  const auto sampler = scene_->GetSampler();
+  std::string cache_key;
+  bool store_in_cache = false;
+  uint32_t row_bytes = ((chars.width + inc_h - 1) / inc_h) *
+                       ((layout == RGB) ? 3 : 4);
+  if (render_cache_.get() != nullptr) {
+    RenderOutput output = (layout == RGB)    ? RENDER_RGB
+                          : (layout == RGBA) ? RENDER_RGBA
+                                             : RENDER_ARGB;
+    cache_key = GetRenderCacheKey(output, width, height, gain,
+                                  /*zoom_ratio*/ 1.f, /*rotate*/ false,
+                                  sampler, chars);
+    if (ReadCachedPlane(cache_key, img, stride, row_bytes, out_height)) {
+      return;
     }
+    store_in_cache = IsRenderStateRepeated(cache_key);
+  }
+
+  capture_workers_->ParallelFor(
+      out_height, kMinCaptureBandRows, [&](size_t out_begin, size_t out_end) {
+        for (size_t outy = out_begin; outy < out_end; outy++) {
+          EmulatedScene::Sampler::RowReadout row(sampler, 0, outy * inc_v);
+          uint8_t* px = img + outy * stride;
+          for (unsigned int x = 0; x < chars.width; x += inc_h) {
+            uint32_t r_count, g_count, b_count;
+            // TODO: Perfect demosaicing is a cheat
+            const uint32_t* pixel = row.GetPixelElectrons();
+            r_count = pixel[EmulatedScene::R] * scale64x;
+            g_count = pixel[EmulatedScene::Gr] * scale64x;
+            b_count = pixel[EmulatedScene::B] * scale64x;
+
+            uint8_t r = r_count < 255 * 64 ? r_count / 64 : 255;
+            uint8_t g = g_count < 255 * 64 ? g_count / 64 : 255;
+            uint8_t b = b_count < 255 * 64 ? b_count / 64 : 255;
+            switch (layout) {
+              case RGB:
+                *px++ = r;
+                *px++ = g;
+                *px++ = b;
+                break;
+              case RGBA:
+                *px++ = r;
+                *px++ = g;
+                *px++ = b;
+                *px++ = 255;
+                break;
+              case ARGB:
+                *px++ = 255;
+                *px++ = r;
+                *px++ = g;
+                *px++ = b;
+                break;
+            }
+            row.Skip(inc_h - 1);
+          }
+        }
+      });
+  if (store_in_cache) {
+    StoreCachedPlane(cache_key, img, stride, row_bytes, out_height);
   }
   ALOGVV("RGB sensor image captured");
 }
@@ -995,6 +1435,18 @@ void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
                                    float zoom_ratio, bool rotate,
                                    const SensorCharacteristics& chars) {
   ATRACE_CALL();
+  const auto sampler = scene_->GetSampler();
+  std::string cache_key;
+  bool store_in_cache = false;
+  if (render_cache_.get() != nullptr) {
+    cache_key = GetRenderCacheKey(RENDER_YUV420, width, height, gain,
+                                  zoom_ratio, rotate, sampler, chars);
+    if (ReadCachedYUV420(cache_key, yuv_layout, width, height)) {
+      return;
+    }
+    store_in_cache = IsRenderStateRepeated(cache_key);
+  }
+
   float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
   // Using fixed-point math with 6 bits of fractional precision.
   // In fixed-point math, calculate total scaling from electrons to 8bpp
@@ -1022,59 +1474,99 @@ void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
   const float norm_rot_left =
       norm_left_top + (norm_width + norm_rot_width) * 0.5f;
 
-  for (unsigned int out_y = 0; out_y < height; out_y++) {
-    uint8_t* px_y = yuv_layout.img_y + out_y * yuv_layout.y_stride;
-    uint8_t* px_cb = yuv_layout.img_cb + (out_y / 2) * yuv_layout.cbcr_stride;
-    uint8_t* px_cr = yuv_layout.img_cr + (out_y / 2) * yuv_layout.cbcr_stride;
-
-    for (unsigned int out_x = 0; out_x < width; out_x++) {
-      int x, y;
-      float norm_x = out_x / (width * zoom_ratio);
-      float norm_y = out_y / (height * zoom_ratio);
-      if (rotate) {
-        x = static_cast<int>(chars.width *
-                             (norm_rot_left - norm_y * norm_rot_width));
-        y = static_cast<int>(chars.height *
-                             (norm_rot_top + norm_x * norm_rot_height));
-      } else {
-        x = static_cast<int>(chars.width * (norm_left_top + norm_x));
-        y = static_cast<int>(chars.height * (norm_left_top + norm_y));
-      }
-      x = std::min(std::max(x, 0), (int)chars.width - 1);
+  auto to_yuv = [&](const uint32_t* pixel) {
+    int32_t r_count, g_count, b_count;
+    // TODO: Perfect demosaicing is a cheat
+    r_count = pixel[EmulatedScene::R] * scale64x;
+    r_count = r_count < kSaturationPoint ? r_count : kSaturationPoint;
+    g_count = pixel[EmulatedScene::Gr] * scale64x;
+    g_count = g_count < kSaturationPoint ? g_count : kSaturationPoint;
+    b_count = pixel[EmulatedScene::B] * scale64x;
+    b_count = b_count < kSaturationPoint ? b_count : kSaturationPoint;
+
+    // Gamma correction
+    r_count = gamma_table_[r_count];
+    g_count = gamma_table_[g_count];
+    b_count = gamma_table_[b_count];
+
+    YUV420SpanValue value;
+    value.y = (rgb_to_y[0] * r_count + rgb_to_y[1] * g_count +
+               rgb_to_y[2] * b_count) /
+              scale_out_sq;
+    value.cb = (rgb_to_cb[0] * r_count + rgb_to_cb[1] * g_count +
+                rgb_to_cb[2] * b_count + rgb_to_cb[3]) /
+               scale_out_sq;
+    value.cr = (rgb_to_cr[0] * r_count + rgb_to_cr[1] * g_count +
+                rgb_to_cr[2] * b_count + rgb_to_cr[3]) /
+               scale_out_sq;
+    return value;
+  };
+
+  // The scene is piecewise constant. Output columns map to the same scene
+  // tile column (tile row when rotated) on every output row, so each row
+  // splits into the same handful of spans that share a single material.
+  struct Span {
+    uint32_t begin;
+    uint32_t end;
+    int tile;
+  };
+  std::vector<Span> spans;
+  for (unsigned int out_x = 0; out_x < width; out_x++) {
+    float norm_x = out_x / (width * zoom_ratio);
+    int tile;
+    if (rotate) {
+      int y = static_cast<int>(chars.height *
+                               (norm_rot_top + norm_x * norm_rot_height));
       y = std::min(std::max(y, 0), (int)chars.height - 1);
-      scene_->SetReadoutPixel(x, y);
-
-      int32_t r_count, g_count, b_count;
-      // TODO: Perfect demosaicing is a cheat
-      const uint32_t* pixel = rotate ? scene_->GetPixelElectronsColumn()
-                                     : scene_->GetPixelElectrons();
-      r_count = pixel[EmulatedScene::R] * scale64x;
-      r_count = r_count < kSaturationPoint ? r_count : kSaturationPoint;
-      g_count = pixel[EmulatedScene::Gr] * scale64x;
-      g_count = g_count < kSaturationPoint ? g_count : kSaturationPoint;
-      b_count = pixel[EmulatedScene::B] * scale64x;
-      b_count = b_count < kSaturationPoint ? b_count : kSaturationPoint;
-
-      // Gamma correction
-      r_count = gamma_table_[r_count];
-      g_count = gamma_table_[g_count];
-      b_count = gamma_table_[b_count];
-
-      *px_y++ = (rgb_to_y[0] * r_count + rgb_to_y[1] * g_count +
-                 rgb_to_y[2] * b_count) /
-                scale_out_sq;
-      if (out_y % 2 == 0 && out_x % 2 == 0) {
-        *px_cb = (rgb_to_cb[0] * r_count + rgb_to_cb[1] * g_count +
-                  rgb_to_cb[2] * b_count + rgb_to_cb[3]) /
-                 scale_out_sq;
-        *px_cr = (rgb_to_cr[0] * r_count + rgb_to_cr[1] * g_count +
-                  rgb_to_cr[2] * b_count + rgb_to_cr[3]) /
-                 scale_out_sq;
-        px_cr += yuv_layout.cbcr_step;
-        px_cb += yuv_layout.cbcr_step;
-      }
+      tile = sampler.GetSceneRow(y);
+    } else {
+      int x = static_cast<int>(chars.width * (norm_left_top + norm_x));
+      x = std::min(std::max(x, 0), (int)chars.width - 1);
+      tile = sampler.GetSceneColumn(x);
+    }
+    if (spans.empty() || (spans.back().tile != tile)) {
+      spans.push_back({out_x, out_x + 1, tile});
+    } else {
+      spans.back().end++;
     }
   }
+
+  // Rows are independent, chroma is only written by the even rows owning it.
+  capture_workers_->ParallelFor(
+      height, kMinCaptureBandRows, [&](size_t y_begin, size_t y_end) {
+        for (unsigned int out_y = y_begin; out_y < y_end; out_y++) {
+          uint8_t* px_y = yuv_layout.img_y + out_y * yuv_layout.y_stride;
+          uint8_t* px_cb =
+              yuv_layout.img_cb + (out_y / 2) * yuv_layout.cbcr_stride;
+          uint8_t* px_cr =
+              yuv_layout.img_cr + (out_y / 2) * yuv_layout.cbcr_stride;
+
+          float norm_y = out_y / (height * zoom_ratio);
+          int row_tile;
+          if (rotate) {
+            int x = static_cast<int>(chars.width *
+                                     (norm_rot_left - norm_y * norm_rot_width));
+            x = std::min(std::max(x, 0), (int)chars.width - 1);
+            row_tile = sampler.GetSceneColumn(x);
+          } else {
+            int y = static_cast<int>(chars.height * (norm_left_top + norm_y));
+            y = std::min(std::max(y, 0), (int)chars.height - 1);
+            row_tile = sampler.GetSceneRow(y);
+          }
+
+          for (const auto& span : spans) {
+            const uint32_t* pixel =
+                rotate ? sampler.GetSceneElectrons(row_tile, span.tile)
+                       : sampler.GetSceneElectrons(span.tile, row_tile);
+            FillYUV420Span(px_y, px_cb, px_cr, yuv_layout.cbcr_step,
+                           span.begin, span.end, (out_y % 2) == 0,
+                           to_yuv(pixel));
+          }
+        }
+      });
+  if (store_in_cache) {
+    StoreCachedYUV420(cache_key, yuv_layout, width, height);
+  }
   ALOGVV("YUV420 sensor image captured");
 }
 
@@ -1087,22 +1579,41 @@ void EmulatedSensor::CaptureDepth(uint8_t* img, uint32_t gain, uint32_t width,
   int scale64x = 64 * total_gain * 8191 / chars.max_raw_value;
   uint32_t inc_h = ceil((float)chars.width / width);
   uint32_t inc_v = ceil((float)chars.height / height);
-
-  for (unsigned int y = 0, out_y = 0; y < chars.height; y += inc_v, out_y++) {
-    scene_->SetReadoutPixel(0, y);
-    uint16_t* px = (uint16_t*)(img + (out_y * stride));
-    for (unsigned int x = 0; x < chars.width; x += inc_h) {
-      uint32_t depth_count;
-      // TODO: Make up real depth scene instead of using green channel
-      // as depth
-      const uint32_t* pixel = scene_->GetPixelElectrons();
-      depth_count = pixel[EmulatedScene::Gr] * scale64x;
-
-      *px++ = depth_count < 8191 * 64 ? depth_count / 64 : 0;
-      for (unsigned int j = 1; j < inc_h; j++) scene_->GetPixelElectrons();
+  size_t out_height = (chars.height + inc_v - 1) / inc_v;
+
+  const auto sampler = scene_->GetSampler();
+  std::string cache_key;
+  bool store_in_cache = false;
+  uint32_t row_bytes = ((chars.width + inc_h - 1) / inc_h) * sizeof(uint16_t);
+  if (render_cache_.get() != nullptr) {
+    cache_key = GetRenderCacheKey(RENDER_DEPTH, width, height, gain,
+                                  /*zoom_ratio*/ 1.f, /*rotate*/ false,
+                                  sampler, chars);
+    if (ReadCachedPlane(cache_key, img, stride, row_bytes, out_height)) {
+      return;
     }
-    // TODO: Handle this better
-    // simulatedTime += mRowReadoutTime;
+    store_in_cache = IsRenderStateRepeated(cache_key);
+  }
+
+  capture_workers_->ParallelFor(
+      out_height, kMinCaptureBandRows, [&](size_t out_begin, size_t out_end) {
+        for (size_t out_y = out_begin; out_y < out_end; out_y++) {
+          EmulatedScene::Sampler::RowReadout row(sampler, 0, out_y * inc_v);
+          uint16_t* px = (uint16_t*)(img + (out_y * stride));
+          for (unsigned int x = 0; x < chars.width; x += inc_h) {
+            uint32_t depth_count;
+            // TODO: Make up real depth scene instead of using green channel
+            // as depth
+            const uint32_t* pixel = row.GetPixelElectrons();
+            depth_count = pixel[EmulatedScene::Gr] * scale64x;
+
+            *px++ = depth_count < 8191 * 64 ? depth_count / 64 : 0;
+            row.Skip(inc_h - 1);
+          }
+        }
+      });
+  if (store_in_cache) {
+    StoreCachedPlane(cache_key, img, stride, row_bytes, out_height);
   }
   ALOGVV("Depth sensor image captured");
 }
@@ -1113,9 +1624,8 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
                                        bool rotate_and_crop,
                                        const SensorCharacteristics& chars) {
   ATRACE_CALL();
-  size_t input_width, input_height;
-  YCbCrPlanes input_planes, output_planes;
-  std::vector<uint8_t> temp_yuv, temp_output_uv, temp_input_uv;
+  YUV420Frame scaler_input;
+  BufferPool::Lease temp_yuv;
 
   switch (process_type) {
     case HIGH_QUALITY:
@@ -1123,58 +1633,133 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
                     rotate_and_crop, chars);
       return OK;
     case REPROCESS:
-      input_width = input.width;
-      input_height = input.height;
-      input_planes = input.planes;
-
-      // libyuv only supports planar YUV420 during scaling.
-      // Split the input U/V plane in separate planes if needed.
-      if (input_planes.cbcr_step == 2) {
-        temp_input_uv.resize(input_width * input_height / 2);
-        auto temp_uv_buffer = temp_input_uv.data();
-        input_planes.img_cb = temp_uv_buffer;
-        input_planes.img_cr = temp_uv_buffer + (input_width * input_height) / 4;
-        input_planes.cbcr_stride = input_width / 2;
-        if (input.planes.img_cb < input.planes.img_cr) {
-          libyuv::SplitUVPlane(input.planes.img_cb, input.planes.cbcr_stride,
-                               input_planes.img_cb, input_planes.cbcr_stride,
-                               input_planes.img_cr, input_planes.cbcr_stride,
-                               input_width / 2, input_height / 2);
-        } else {
-          libyuv::SplitUVPlane(input.planes.img_cr, input.planes.cbcr_stride,
-                               input_planes.img_cr, input_planes.cbcr_stride,
-                               input_planes.img_cb, input_planes.cbcr_stride,
-                               input_width / 2, input_height / 2);
-        }
-      }
+      scaler_input = input;
       break;
+    case HIGH_SPEED:
+      // High speed frames always take the reduced resolution path below,
+      // regardless of the requested edge mode.
     case REGULAR:
     default:
       // Generate the smallest possible frame with the expected AR and
-      // then scale using libyuv.
+      // then scale using libyuv. The frame uses the output chroma layout so
+      // that semi-planar outputs can be scaled without extra passes.
       float aspect_ratio = static_cast<float>(output.width) / output.height;
       zoom_ratio = std::max(1.f, zoom_ratio);
-      input_width = EmulatedScene::kSceneWidth * aspect_ratio;
-      input_height = EmulatedScene::kSceneHeight;
-      temp_yuv.reserve((input_width * input_height * 3) / 2);
+      uint32_t input_width = EmulatedScene::kSceneWidth * aspect_ratio;
+      uint32_t input_height = EmulatedScene::kSceneHeight;
+      uint32_t cbcr_width = (input_width + 1) / 2;
+      uint32_t cbcr_height = (input_height + 1) / 2;
+      temp_yuv = staging_pool_->Acquire(input_width * input_height +
+                                        cbcr_width * cbcr_height * 2);
       auto temp_yuv_buffer = temp_yuv.data();
-      input_planes = {
-          .img_y = temp_yuv_buffer,
-          .img_cb = temp_yuv_buffer + input_width * input_height,
-          .img_cr = temp_yuv_buffer + (input_width * input_height * 5) / 4,
-          .y_stride = static_cast<uint32_t>(input_width),
-          .cbcr_stride = static_cast<uint32_t>(input_width) / 2,
-          .cbcr_step = 1};
-      CaptureYUV420(input_planes, input_width, input_height, gain, zoom_ratio,
-                    rotate_and_crop, chars);
+      auto temp_cbcr_buffer = temp_yuv_buffer + input_width * input_height;
+      scaler_input.width = input_width;
+      scaler_input.height = input_height;
+      scaler_input.planes.img_y = temp_yuv_buffer;
+      scaler_input.planes.y_stride = input_width;
+      if (IsAlignedSemiPlanar(output.planes)) {
+        bool cb_first = output.planes.img_cb < output.planes.img_cr;
+        scaler_input.planes.img_cb = temp_cbcr_buffer + (cb_first ? 0 : 1);
+        scaler_input.planes.img_cr = temp_cbcr_buffer + (cb_first ? 1 : 0);
+        scaler_input.planes.cbcr_stride = cbcr_width * 2;
+        scaler_input.planes.cbcr_step = 2;
+      } else {
+        scaler_input.planes.img_cb = temp_cbcr_buffer;
+        scaler_input.planes.img_cr =
+            temp_cbcr_buffer + cbcr_width * cbcr_height;
+        scaler_input.planes.cbcr_stride = cbcr_width;
+        scaler_input.planes.cbcr_step = 1;
+      }
+      CaptureYUV420(scaler_input.planes, input_width, input_height, gain,
+                    zoom_ratio, rotate_and_crop, chars);
+  }
+
+  return ScaleYUV420(scaler_input, output);
+}
+
+bool EmulatedSensor::IsAlignedSemiPlanar(const YCbCrPlanes& planes) {
+  if ((planes.cbcr_step != 2) ||
+      (std::abs(planes.img_cr - planes.img_cb) != 1)) {
+    return false;
   }
 
-  output_planes = output.planes;
+  auto cbcr = std::min(planes.img_cb, planes.img_cr);
+  return ((reinterpret_cast<uintptr_t>(cbcr) % sizeof(uint16_t)) == 0) &&
+         ((planes.cbcr_stride % sizeof(uint16_t)) == 0);
+}
+
+status_t EmulatedSensor::ScaleYUV420(const YUV420Frame& input,
+                                     const YUV420Frame& output) {
+  bool same_cbcr_order = (input.planes.img_cb < input.planes.img_cr) ==
+                         (output.planes.img_cb < output.planes.img_cr);
+  if (IsAlignedSemiPlanar(input.planes) &&
+      IsAlignedSemiPlanar(output.planes) && same_cbcr_order) {
+    return ScaleYUV420SemiPlanar(input, output);
+  }
+
+  return ScaleYUV420Planar(input, output);
+}
+
+status_t EmulatedSensor::ScaleYUV420SemiPlanar(const YUV420Frame& input,
+                                               const YUV420Frame& output) {
+  ATRACE_CALL();
+  if ((input.width == 0) || (input.height == 0) || (output.width == 0) ||
+      (output.height == 0)) {
+    ALOGE("%s: Invalid frame size %ux%u -> %ux%u", __FUNCTION__, input.width,
+          input.height, output.width, output.height);
+    return BAD_VALUE;
+  }
+
+  libyuv::ScalePlane(input.planes.img_y, input.planes.y_stride, input.width,
+                     input.height, output.planes.img_y, output.planes.y_stride,
+                     output.width, output.height, libyuv::kFilterNone);
+  // Every Cb/Cr pair is scaled as a single 16-bit sample, which keeps the
+  // interleaving intact without splitting and merging the chroma planes.
+  auto input_cbcr = reinterpret_cast<const uint16_t*>(
+      std::min(input.planes.img_cb, input.planes.img_cr));
+  auto output_cbcr = reinterpret_cast<uint16_t*>(
+      std::min(output.planes.img_cb, output.planes.img_cr));
+  libyuv::ScalePlane_16(input_cbcr, input.planes.cbcr_stride / 2,
+                        (input.width + 1) / 2, (input.height + 1) / 2,
+                        output_cbcr, output.planes.cbcr_stride / 2,
+                        (output.width + 1) / 2, (output.height + 1) / 2,
+                        libyuv::kFilterNone);
+
+  return OK;
+}
+
+status_t EmulatedSensor::ScaleYUV420Planar(const YUV420Frame& input,
+                                           const YUV420Frame& output) {
+  ATRACE_CALL();
+  YCbCrPlanes input_planes = input.planes;
+  YCbCrPlanes output_planes = output.planes;
+  BufferPool::Lease temp_output_uv, temp_input_uv;
+
   // libyuv only supports planar YUV420 during scaling.
+  // Split the input U/V plane in separate planes if needed.
+  if (input_planes.cbcr_step == 2) {
+    temp_input_uv = staging_pool_->Acquire(input.width * input.height / 2);
+    auto temp_uv_buffer = temp_input_uv.data();
+    input_planes.img_cb = temp_uv_buffer;
+    input_planes.img_cr = temp_uv_buffer + (input.width * input.height) / 4;
+    input_planes.cbcr_stride = input.width / 2;
+    if (input.planes.img_cb < input.planes.img_cr) {
+      libyuv::SplitUVPlane(input.planes.img_cb, input.planes.cbcr_stride,
+                           input_planes.img_cb, input_planes.cbcr_stride,
+                           input_planes.img_cr, input_planes.cbcr_stride,
+                           input.width / 2, input.height / 2);
+    } else {
+      libyuv::SplitUVPlane(input.planes.img_cr, input.planes.cbcr_stride,
+                           input_planes.img_cr, input_planes.cbcr_stride,
+                           input_planes.img_cb, input_planes.cbcr_stride,
+                           input.width / 2, input.height / 2);
+    }
+  }
+
   // Treat the output UV space as planar first and then
   // interleave in the second step.
   if (output_planes.cbcr_step == 2) {
-    temp_output_uv.resize(output.width * output.height / 2);
+    temp_output_uv = staging_pool_->Acquire(output.width * output.height / 2);
     auto temp_uv_buffer = temp_output_uv.data();
     output_planes.img_cb = temp_uv_buffer;
     output_planes.img_cr = temp_uv_buffer + output.width * output.height / 4;
@@ -1184,7 +1769,7 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
   auto ret = I420Scale(
       input_planes.img_y, input_planes.y_stride, input_planes.img_cb,
       input_planes.cbcr_stride, input_planes.img_cr, input_planes.cbcr_stride,
-      input_width, input_height, output_planes.img_y, output_planes.y_stride,
+      input.width, input.height, output_planes.img_y, output_planes.y_stride,
       output_planes.img_cb, output_planes.cbcr_stride, output_planes.img_cr,
       output_planes.cbcr_stride, output.width, output.height,
       libyuv::kFilterNone);
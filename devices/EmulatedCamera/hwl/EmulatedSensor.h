@@ -77,16 +77,26 @@
 
 #include <hwl_types.h>
 
+#include <atomic>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "Base.h"
 #include "EmulatedScene.h"
 #include "HandleImporter.h"
 #include "JpegCompressor.h"
+#include "utils/BufferPool.h"
+#include "utils/FrameScheduler.h"
+#include "utils/FutexSignal.h"
 #include "utils/Mutex.h"
+#include "utils/RenderCache.h"
+#include "utils/SPSCQueue.h"
 #include "utils/StreamConfigurationMap.h"
 #include "utils/Thread.h"
 #include "utils/Timers.h"
+#include "utils/WorkerPool.h"
 
 namespace android {
 
@@ -113,6 +123,15 @@ struct ColorFilterXYZ {
   float bZ = 1.0570f;
 };
 
+// See ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS
+struct HighSpeedVideoConfig {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  int32_t min_fps = 0;
+  int32_t max_fps = 0;
+  uint32_t batch_size_max = 0;
+};
+
 struct SensorCharacteristics {
   size_t width = 0;
   size_t height = 0;
@@ -134,6 +153,8 @@ struct SensorCharacteristics {
   uint32_t max_pipeline_depth = 0;
   uint32_t orientation = 0;
   bool is_front_facing = false;
+  // Only present on devices with constrained high speed video support
+  std::vector<HighSpeedVideoConfig> high_speed_video_configs;
 };
 
 // Maps logical/physical camera ids to sensor characteristics
@@ -168,13 +189,23 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   static bool IsStreamCombinationSupported(
       const StreamConfiguration& config, StreamConfigurationMap& map,
       const SensorCharacteristics& sensor_chars);
+  // Burst size of a constrained high speed session. Follows the high speed
+  // configuration that matches the session target framerate range, or the
+  // largest burst at the stream size in case the range is absent. Returns 0
+  // if no configuration matches.
+  static uint32_t GetHighSpeedBatchSize(
+      const StreamConfiguration& config,
+      const SensorCharacteristics& sensor_chars);
 
   /*
    * Power control
    */
 
+  // 'render_cache' is optional and may be shared with other sensor instances
+  // of the same camera.
   status_t StartUp(uint32_t logical_camera_id,
-                   std::unique_ptr<LogicalCharacteristics> logical_chars);
+                   std::unique_ptr<LogicalCharacteristics> logical_chars,
+                   std::shared_ptr<RenderCache> render_cache = nullptr);
   status_t ShutDown();
 
   /*
@@ -207,6 +238,12 @@ class EmulatedSensor : private Thread, public virtual RefBase {
 
   status_t Flush();
 
+  // Constrained high speed sessions capture bursts of 'batch_size' frames.
+  // The results of a burst are returned together once its last frame is
+  // read out and processed outputs always take the reduced resolution render
+  // path. A 'batch_size' of 0 switches back to regular operation.
+  void SetHighSpeedMode(uint32_t batch_size);
+
   /*
    * Synchronizing with sensor operation (vertical sync)
    */
@@ -216,15 +253,26 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   // sync is signaled, false if the wait timed out.
   bool WaitForVSync(nsecs_t rel_time);
 
+  // Intermediate YUV buffers used by BLOB capture, reprocess and JPEG
+  // encoding are leased from a pool owned by the sensor.
+  BufferPool::Statistics GetStagingPoolStatistics() const;
+
+  // Frame start/end jitter against the scheduled deadlines and smoothed
+  // per-stage costs.
+  FrameScheduler::Statistics GetFrameTimingStatistics() const;
+  void DumpFrameTiming(int fd) const;
+
   static const nsecs_t kSupportedExposureTimeRange[2];
   static const nsecs_t kSupportedFrameDurationRange[2];
+  // Lower bound of the frame duration in constrained high speed sessions,
+  // the regular lower bound is kSupportedFrameDurationRange[0].
+  static const nsecs_t kMinHighSpeedFrameDuration;
   static const int32_t kSupportedSensitivityRange[2];
   static const uint8_t kSupportedColorFilterArrangement;
   static const uint32_t kDefaultMaxRawValue;
   static const nsecs_t kDefaultExposureTime;
   static const int32_t kDefaultSensitivity;
   static const nsecs_t kDefaultFrameDuration;
-  static const nsecs_t kReturnResultThreshod;
   static const uint32_t kDefaultBlackLevelPattern[4];
   static const camera_metadata_rational kDefaultColorTransform[9];
   static const float kDefaultColorCorrectionGains[4];
@@ -234,6 +282,9 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   static const uint8_t kPipelineDepth;
 
  private:
+  friend class EmulatedSensorBenchmarks;
+  friend class EmulatedSensorTests;
+
   // Scene stabilization
   static const uint32_t kRegularSceneHandshake;
   static const uint32_t kReducedSceneHandshake;
@@ -265,25 +316,82 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   static const uint32_t kMaxProcessedStreams;
   static const uint32_t kMaxStallingStreams;
   static const uint32_t kMaxInputStreams;
+  static const uint32_t kMaxHighSpeedStreams;
   static const uint32_t kMaxLensShadingMapSize[2];
   static const int32_t kFixedBitPrecision;
   static const int32_t kSaturationPoint;
+  static const char* kCaptureThreadsProperty;
+  static const uint32_t kMaxCaptureThreads;
+  static const size_t kMinCaptureBandRows;
+  static const size_t kMaxStagingPoolBytes;
 
   std::vector<int32_t> gamma_table_;
 
-  Mutex control_mutex_;  // Lock before accessing control parameters
-  // Start of control parameters
-  Condition vsync_;
-  bool got_vsync_;
-  std::unique_ptr<LogicalCameraSettings> current_settings_;
-  std::unique_ptr<HwlPipelineResult> current_result_;
-  std::unique_ptr<Buffers> current_output_buffers_;
-  std::unique_ptr<Buffers> current_input_buffers_;
+  /**
+   * Capture pipeline. The sensor thread only keeps the frame cadence: it
+   * latches the next request on VSync, notifies the shutter and hands the
+   * frame over to the render stage. The render stage fills the output
+   * buffers and passes the frame on to the result stage, which returns the
+   * result metadata once the frame readout is complete. Stages are linked by
+   * bounded lock-free queues and only park on 'stage_signal_' while their
+   * input queue is empty or their output queue is full. The scene evolves
+   * from one frame to the next, so frames are rendered in order and each
+   * frame is split across 'capture_workers_'.
+   */
+  struct PipelineFrame {
+    std::unique_ptr<LogicalCameraSettings> settings;
+    std::unique_ptr<HwlPipelineResult> result;
+    std::unique_ptr<Buffers> input_buffers;
+    std::unique_ptr<Buffers> output_buffers;
+    HwlPipelineCallback callback = {nullptr, nullptr};
+    nsecs_t capture_time = 0;
+    nsecs_t frame_duration = 0;
+    nsecs_t frame_end_time = 0;
+    bool reprocess_request = false;
+    bool high_speed = false;
+    // Last frame of a high speed burst, regular frames are single frame
+    // bursts. Frames without a request can complete a partial burst.
+    bool batch_end = true;
+    // Set by SetCurrentRequest(), counted in 'pending_requests_' until the
+    // result is returned
+    bool request = false;
+  };
+  typedef SPSCQueue<std::unique_ptr<PipelineFrame>> FrameQueue;
+
+  // Single slot mailbox carrying the next request from the request thread to
+  // the processing thread, which latches it on VSync. Requests are set from
+  // one thread at a time, which keeps the request thread the only producer.
+  FrameQueue request_mailbox_{1};
+  // Signaled by the processing thread right after latching a request
+  FutexSignal vsync_;
+  std::atomic<uint32_t> high_speed_batch_size_ = 0;
+  // Serializes the JPEG hand-off of the render stage with Flush(), which
+  // recreates 'jpeg_compressor_'
+  std::mutex jpeg_mutex_;
   std::unique_ptr<JpegCompressor> jpeg_compressor_;
 
-  // End of control parameters
-
-  unsigned int rand_seed_ = 1;
+  // Sized by the pipeline depth at StartUp()
+  std::unique_ptr<FrameQueue> render_queue_;
+  std::unique_ptr<FrameQueue> result_queue_;
+  // Rung whenever a stage queue changes, a stage exits or the last pending
+  // request completes. Only enters the kernel while somebody is parked.
+  FutexSignal stage_signal_;
+  std::atomic<bool> render_exiting_ = false;
+  std::atomic<bool> result_exiting_ = false;
+  // Requests handed to the sensor whose results were not returned yet
+  std::atomic<uint32_t> pending_requests_ = 0;
+  std::thread render_thread_;
+  std::thread result_thread_;
+  // Shared with 'jpeg_compressor_'
+  std::shared_ptr<BufferPool> staging_pool_;
+  FrameScheduler frame_scheduler_;
+
+  void PushFrame(FrameQueue* queue, std::unique_ptr<PipelineFrame> frame);
+  // Returns nullptr once 'exiting' is set and 'queue' is drained.
+  std::unique_ptr<PipelineFrame> PopFrame(FrameQueue* queue,
+                                          const std::atomic<bool>& exiting);
+  void StopStage(std::thread* stage, std::atomic<bool>* exiting);
+  void CompleteRequest();
 
   /**
    * Inherited Thread virtual overrides, and members only used by the
@@ -291,12 +399,61 @@ class EmulatedSensor : private Thread, public virtual RefBase {
    */
   bool threadLoop() override;
 
-  nsecs_t next_capture_time_;
-
+  /**
+   * Render and result stage loops
+   */
+  void RenderLoop();
+  void RenderFrame(PipelineFrame* frame);
+  void ResultLoop();
+  // Returns the results of all frames in 'batch' once the readout of the
+  // last one completes.
+  void ReturnBatch(std::vector<std::unique_ptr<PipelineFrame>>* batch);
+
+  // Requests latched into the current high speed burst, only accessed by the
+  // processing thread
+  uint32_t batch_frames_ = 0;
+
+  // Only accessed by the render stage
   sp<EmulatedScene> scene_;
-
+  // Renders disjoint row bands of the capture output in parallel
+  std::unique_ptr<WorkerPool> capture_workers_;
+  // Noise free output that doesn't change between frames is served from here
+  std::shared_ptr<RenderCache> render_cache_;
+  // Exif generators of every physical and logical camera, built at StartUp()
+  // and reused by all JPEG captures afterwards
+  std::unordered_map<uint32_t, std::shared_ptr<ExifUtilsPool>> exif_pools_;
+
+  enum RenderOutput {
+    RENDER_RGB,
+    RENDER_RGBA,
+    RENDER_ARGB,
+    RENDER_YUV420,
+    RENDER_DEPTH
+  };
+  std::string GetRenderCacheKey(RenderOutput output, uint32_t width,
+                                uint32_t height, uint32_t gain,
+                                float zoom_ratio, bool rotate,
+                                const EmulatedScene::Sampler& sampler,
+                                const SensorCharacteristics& chars);
+  // Rendered output is only stored once the same key missed twice, i.e. the
+  // scene stayed static across frames. Returns true for the second miss.
+  bool IsRenderStateRepeated(const std::string& key);
+  static const size_t kMaxMissedRenderKeys = 8;
+  // Keys of recent cache misses, only accessed by the render stage
+  std::vector<std::string> missed_render_keys_;
+  // Copy 'rows' of 'row_bytes' each between the cache and 'img'
+  bool ReadCachedPlane(const std::string& key, uint8_t* img, uint32_t stride,
+                       uint32_t row_bytes, uint32_t rows);
+  void StoreCachedPlane(const std::string& key, const uint8_t* img,
+                        uint32_t stride, uint32_t row_bytes, uint32_t rows);
+  bool ReadCachedYUV420(const std::string& key, YCbCrPlanes yuv_layout,
+                        uint32_t width, uint32_t height);
+  void StoreCachedYUV420(const std::string& key, YCbCrPlanes yuv_layout,
+                         uint32_t width, uint32_t height);
+
+  // Noise is seeded per camera and frame, see GetNoiseKey().
   void CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
-                  const SensorCharacteristics& chars);
+                  uint64_t noise_key, const SensorCharacteristics& chars);
   enum RGBLayout { RGB, RGBA, ARGB };
   void CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
                   uint32_t stride, RGBLayout layout, uint32_t gain,
@@ -313,22 +470,38 @@ class EmulatedSensor : private Thread, public virtual RefBase {
     YCbCrPlanes planes;
   };
 
-  enum ProcessType { REPROCESS, HIGH_QUALITY, REGULAR };
+  enum ProcessType { REPROCESS, HIGH_QUALITY, REGULAR, HIGH_SPEED };
   status_t ProcessYUV420(const YUV420Frame& input, const YUV420Frame& output,
                          uint32_t gain, ProcessType process_type,
                          float zoom_ratio, bool rotate_and_crop,
                          const SensorCharacteristics& chars);
+  // Picks the semi-planar path when both frames share the same interleaved
+  // chroma order, everything else goes through planar intermediates.
+  status_t ScaleYUV420(const YUV420Frame& input, const YUV420Frame& output);
+  status_t ScaleYUV420SemiPlanar(const YUV420Frame& input,
+                                 const YUV420Frame& output);
+  status_t ScaleYUV420Planar(const YUV420Frame& input,
+                             const YUV420Frame& output);
+  // Adjacent Cb/Cr samples (NV12/NV21) that can be read as 16-bit pairs.
+  static bool IsAlignedSemiPlanar(const YCbCrPlanes& planes);
 
   inline int32_t ApplysRGBGamma(int32_t value, int32_t saturation);
 
-  bool WaitForVSyncLocked(nsecs_t reltime);
+  // Returns the buffers of a request that never reached the sensor with an
+  // error status.
+  void AbortFrame(PipelineFrame* frame);
   void CalculateAndAppendNoiseProfile(float gain /*in ISO*/,
                                       float base_gain_factor,
                                       HalCameraMetadata* result /*out*/);
 
   void ReturnResults(HwlPipelineCallback callback,
                      std::unique_ptr<LogicalCameraSettings> settings,
-                     std::unique_ptr<HwlPipelineResult> result);
+                     std::unique_ptr<HwlPipelineResult> result,
+                     nsecs_t capture_time);
+
+  static uint64_t GetNoiseKey(uint32_t camera_id, uint32_t frame_number) {
+    return (static_cast<uint64_t>(camera_id) << 32) | frame_number;
+  }
 
   static float GetBaseGainFactor(float max_raw_value) {
     return max_raw_value / EmulatedSensor::kSaturationElectrons;
@@ -25,14 +25,34 @@
 #include <utils/Log.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
+#include <cstring>
+
 namespace android {
 
 using google_camera_hal::ErrorCode;
 using google_camera_hal::MessageType;
 using google_camera_hal::NotifyMessage;
 
-JpegCompressor::JpegCompressor() {
+// Number of encoder threads. '1' encodes one job at a time on a single
+// thread, '0' or an absent value picks a default based on the available
+// cores.
+const char* JpegCompressor::kJpegThreadsProperty =
+    "persist.vendor.camera.emulated.jpeg_threads";
+const uint32_t JpegCompressor::kMaxJpegThreads = 4;
+// Smaller strips are not worth the stitching overhead
+const size_t JpegCompressor::kMinStripRows = 256;
+// Used only in case the client doesn't provide a pool, enough for a couple of
+// thumbnails.
+const size_t JpegCompressor::kMaxStagingPoolBytes = 1024 * 1024;
+
+JpegCompressor::JpegCompressor(std::shared_ptr<BufferPool> staging_pool)
+    : staging_pool_(staging_pool) {
   ATRACE_CALL();
+  if (staging_pool_.get() == nullptr) {
+    staging_pool_ = BufferPool::Create(kMaxStagingPoolBytes);
+  }
+
   char value[PROPERTY_VALUE_MAX];
   if (property_get("ro.product.vendor.manufacturer", value, "unknown") <= 0) {
     ALOGW("%s: No Exif make data!", __FUNCTION__);
@@ -44,18 +64,30 @@ JpegCompressor::JpegCompressor() {
   }
   exif_model_ = std::string(value);
 
-  jpeg_processing_thread_ = std::thread([this] { this->ThreadLoop(); });
+  int32_t jpeg_threads = property_get_int32(kJpegThreadsProperty, 0);
+  if (jpeg_threads <= 0) {
+    jpeg_threads = std::min(std::max(std::thread::hardware_concurrency(), 1u),
+                            kMaxJpegThreads);
+  }
+  for (int32_t i = 0; i < jpeg_threads; i++) {
+    jpeg_processing_threads_.emplace_back([this] { this->ThreadLoop(); });
+  }
 }
 
 JpegCompressor::~JpegCompressor() {
   ATRACE_CALL();
 
   // Abort the ongoing compression and flush any pending jobs
-  jpeg_done_ = true;
-  condition_.notify_one();
-  jpeg_processing_thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jpeg_done_ = true;
+  }
+  condition_.notify_all();
+  for (auto& thread : jpeg_processing_threads_) {
+    thread.join();
+  }
   while (!pending_yuv_jobs_.empty()) {
-    auto job = std::move(pending_yuv_jobs_.front());
+    auto job = std::move(pending_yuv_jobs_.front().second);
     job->output->stream_buffer.status = BufferStatus::kError;
     pending_yuv_jobs_.pop();
   }
@@ -73,7 +105,7 @@ status_t JpegCompressor::QueueYUV420(std::unique_ptr<JpegYUV420Job> job) {
   }
 
   std::unique_lock<std::mutex> lock(mutex_);
-  pending_yuv_jobs_.push(std::move(job));
+  pending_yuv_jobs_.emplace(next_job_id_++, std::move(job));
   condition_.notify_one();
 
   return OK;
@@ -82,120 +114,203 @@ status_t JpegCompressor::QueueYUV420(std::unique_ptr<JpegYUV420Job> job) {
 void JpegCompressor::ThreadLoop() {
   ATRACE_CALL();
 
-  while (!jpeg_done_) {
-    std::unique_ptr<JpegYUV420Job> current_yuv_job = nullptr;
+  while (true) {
+    std::function<void()> task;
+    std::pair<uint64_t, std::unique_ptr<JpegYUV420Job>> current_yuv_job;
     {
-      std::lock_guard<std::mutex> lock(mutex_);
-      if (!pending_yuv_jobs_.empty()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] {
+        return jpeg_done_ || !pending_tasks_.empty() ||
+               !pending_yuv_jobs_.empty();
+      });
+      if (!pending_tasks_.empty()) {
+        task = std::move(pending_tasks_.front());
+        pending_tasks_.pop();
+      } else if (jpeg_done_) {
+        return;
+      } else {
         current_yuv_job = std::move(pending_yuv_jobs_.front());
         pending_yuv_jobs_.pop();
       }
     }
 
-    if (current_yuv_job.get() != nullptr) {
-      CompressYUV420(std::move(current_yuv_job));
+    if (task) {
+      task();
+    } else {
+      CompressYUV420(current_yuv_job.second.get());
+      RetireJob(current_yuv_job.first, std::move(current_yuv_job.second));
+    }
+  }
+}
+
+void JpegCompressor::RunTasks(std::vector<std::function<void()>>* tasks) {
+  if ((tasks->size() == 1) || (jpeg_processing_threads_.size() <= 1)) {
+    for (auto& task : *tasks) {
+      task();
+    }
+    return;
+  }
+
+  size_t pending = tasks->size();  // Guarded by 'mutex_'
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& task : *tasks) {
+      pending_tasks_.push([this, &pending, task = std::move(task)] {
+        task();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending == 0) {
+          tasks_done_.notify_all();
+        }
+      });
     }
+  }
+  condition_.notify_all();
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    auto ret = condition_.wait_for(lock, std::chrono::milliseconds(10));
-    if (ret == std::cv_status::timeout) {
-      ALOGV("%s: Jpeg thread timeout", __FUNCTION__);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (pending > 0) {
+    if (pending_tasks_.empty()) {
+      // Whatever is left is already running on other threads
+      tasks_done_.wait(lock);
+      continue;
     }
+
+    auto task = std::move(pending_tasks_.front());
+    pending_tasks_.pop();
+    lock.unlock();
+    task();
+    lock.lock();
   }
 }
 
-void JpegCompressor::CompressYUV420(std::unique_ptr<JpegYUV420Job> job) {
-  const uint8_t* app1_buffer = nullptr;
-  size_t app1_buffer_size = 0;
-  std::vector<uint8_t> thumbnail_jpeg_buffer;
+void JpegCompressor::RetireJob(uint64_t job_id,
+                               std::unique_ptr<JpegYUV420Job> job) {
+  std::lock_guard<std::mutex> retire_lock(retire_mutex_);
+  std::vector<std::unique_ptr<JpegYUV420Job>> retired_jobs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    encoded_jobs_.emplace(job_id, std::move(job));
+    auto it = encoded_jobs_.begin();
+    while ((it != encoded_jobs_.end()) && (it->first == next_retired_job_id_)) {
+      retired_jobs.push_back(std::move(it->second));
+      it = encoded_jobs_.erase(it);
+      next_retired_job_id_++;
+    }
+  }
+
+  // Releasing the output buffer returns it to the client
+  for (auto& retired_job : retired_jobs) {
+    retired_job.reset();
+  }
+}
+
+bool JpegCompressor::GenerateApp1(JpegYUV420Job* job) {
+  auto exif_utils = job->exif->exif_utils.get();
+  const auto& metadata = *job->exif->metadata;
   size_t encoded_thumbnail_size = 0;
-  if ((job->exif_utils.get() != nullptr) &&
-      (job->result_metadata.get() != nullptr)) {
-    if (job->exif_utils->Initialize()) {
-      camera_metadata_ro_entry_t entry;
-      size_t thumbnail_width = 0;
-      size_t thumbnail_height = 0;
-      std::vector<uint8_t> thumb_yuv420_frame;
-      YCbCrPlanes thumb_planes;
-      auto ret = job->result_metadata->Get(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
-      if ((ret == OK) && (entry.count == 2)) {
-        thumbnail_width = entry.data.i32[0];
-        thumbnail_height = entry.data.i32[1];
-        if ((thumbnail_width > 0) && (thumbnail_height > 0)) {
-          thumb_yuv420_frame.resize((thumbnail_width * thumbnail_height * 3) /
-                                    2);
-          thumb_planes = {
-              .img_y = thumb_yuv420_frame.data(),
-              .img_cb = thumb_yuv420_frame.data() +
-                        thumbnail_width * thumbnail_height,
-              .img_cr = thumb_yuv420_frame.data() +
-                        (thumbnail_width * thumbnail_height * 5) / 4,
-              .y_stride = static_cast<uint32_t>(thumbnail_width),
-              .cbcr_stride = static_cast<uint32_t>(thumbnail_width) / 2};
-          // TODO: Crop thumbnail according to documentation
-          auto stat = I420Scale(
-              job->input->yuv_planes.img_y, job->input->yuv_planes.y_stride,
-              job->input->yuv_planes.img_cb, job->input->yuv_planes.cbcr_stride,
-              job->input->yuv_planes.img_cr, job->input->yuv_planes.cbcr_stride,
-              job->input->width, job->input->height, thumb_planes.img_y,
-              thumb_planes.y_stride, thumb_planes.img_cb,
-              thumb_planes.cbcr_stride, thumb_planes.img_cr,
-              thumb_planes.cbcr_stride, thumbnail_width, thumbnail_height,
-              libyuv::kFilterNone);
-          if (stat != 0) {
-            ALOGE("%s: Failed during thumbnail scaling: %d", __FUNCTION__, stat);
-            thumb_yuv420_frame.clear();
-          }
-        }
+  if (!exif_utils->BeginImage()) {
+    ALOGE("%s: Unable to initialize Exif generator!", __FUNCTION__);
+    return false;
+  }
+
+  camera_metadata_ro_entry_t entry;
+  size_t thumbnail_width = 0;
+  size_t thumbnail_height = 0;
+  BufferPool::Lease thumb_yuv420_frame;
+  YCbCrPlanes thumb_planes;
+  auto ret = metadata.Get(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
+  if ((ret == OK) && (entry.count == 2)) {
+    thumbnail_width = entry.data.i32[0];
+    thumbnail_height = entry.data.i32[1];
+    if ((thumbnail_width > 0) && (thumbnail_height > 0)) {
+      thumb_yuv420_frame =
+          staging_pool_->Acquire((thumbnail_width * thumbnail_height * 3) / 2);
+      thumb_planes = {
+          .img_y = thumb_yuv420_frame.data(),
+          .img_cb =
+              thumb_yuv420_frame.data() + thumbnail_width * thumbnail_height,
+          .img_cr = thumb_yuv420_frame.data() +
+                    (thumbnail_width * thumbnail_height * 5) / 4,
+          .y_stride = static_cast<uint32_t>(thumbnail_width),
+          .cbcr_stride = static_cast<uint32_t>(thumbnail_width) / 2};
+      // TODO: Crop thumbnail according to documentation
+      auto stat = I420Scale(
+          job->input->yuv_planes.img_y, job->input->yuv_planes.y_stride,
+          job->input->yuv_planes.img_cb, job->input->yuv_planes.cbcr_stride,
+          job->input->yuv_planes.img_cr, job->input->yuv_planes.cbcr_stride,
+          job->input->width, job->input->height, thumb_planes.img_y,
+          thumb_planes.y_stride, thumb_planes.img_cb, thumb_planes.cbcr_stride,
+          thumb_planes.img_cr, thumb_planes.cbcr_stride, thumbnail_width,
+          thumbnail_height, libyuv::kFilterNone);
+      if (stat != 0) {
+        ALOGE("%s: Failed during thumbnail scaling: %d", __FUNCTION__, stat);
+        thumb_yuv420_frame.Release();
       }
+    }
+  }
 
-      if (job->exif_utils->SetFromMetadata(
-              *job->result_metadata, job->input->width, job->input->height)) {
-        if (!thumb_yuv420_frame.empty()) {
-          thumbnail_jpeg_buffer.resize(64 * 1024);  // APP1 is limited by 64k
-          encoded_thumbnail_size = CompressYUV420Frame(
-              {.output_buffer = thumbnail_jpeg_buffer.data(),
-               .output_buffer_size = thumbnail_jpeg_buffer.size(),
-               .yuv_planes = thumb_planes,
-               .width = thumbnail_width,
-               .height = thumbnail_height,
-               .app1_buffer = nullptr,
-               .app1_buffer_size = 0});
-          if (encoded_thumbnail_size > 0) {
-            job->output->stream_buffer.status = BufferStatus::kOk;
-          } else {
-            ALOGE("%s: Failed encoding thumbail!", __FUNCTION__);
-            thumbnail_jpeg_buffer.clear();
-          }
-        }
+  if (!exif_utils->SetFromMetadata(metadata, job->input->width,
+                                   job->input->height)) {
+    ALOGE("%s: Unable to generate EXIF section!", __FUNCTION__);
+    return false;
+  }
 
-        job->exif_utils->SetMake(exif_make_);
-        job->exif_utils->SetModel(exif_model_);
-        if (job->exif_utils->GenerateApp1(thumbnail_jpeg_buffer.empty()
-                                              ? nullptr
-                                              : thumbnail_jpeg_buffer.data(),
-                                          encoded_thumbnail_size)) {
-          app1_buffer = job->exif_utils->GetApp1Buffer();
-          app1_buffer_size = job->exif_utils->GetApp1Length();
-        } else {
-          ALOGE("%s: Unable to generate App1 buffer", __FUNCTION__);
-        }
-      } else {
-        ALOGE("%s: Unable to generate EXIF section!", __FUNCTION__);
-      }
-    } else {
-      ALOGE("%s: Unable to initialize Exif generator!", __FUNCTION__);
+  BufferPool::Lease thumbnail_jpeg_buffer;
+  if (thumb_yuv420_frame.data() != nullptr) {
+    // APP1 is limited by 64k
+    thumbnail_jpeg_buffer = staging_pool_->Acquire(64 * 1024);
+    encoded_thumbnail_size = CompressYUV420Frame(
+        {.output_buffer = thumbnail_jpeg_buffer.data(),
+         .output_buffer_size = thumbnail_jpeg_buffer.size(),
+         .yuv_planes = thumb_planes,
+         .width = thumbnail_width,
+         .height = thumbnail_height,
+         .app1_buffer = nullptr,
+         .app1_buffer_size = 0});
+    if (encoded_thumbnail_size == 0) {
+      ALOGE("%s: Failed encoding thumbail!", __FUNCTION__);
     }
   }
 
-  auto encoded_size = CompressYUV420Frame(
+  exif_utils->SetMake(exif_make_);
+  exif_utils->SetModel(exif_model_);
+  auto thumbnail =
+      (encoded_thumbnail_size > 0) ? thumbnail_jpeg_buffer.data() : nullptr;
+  if (!exif_utils->GenerateApp1(thumbnail, encoded_thumbnail_size)) {
+    ALOGE("%s: Unable to generate App1 buffer", __FUNCTION__);
+    return false;
+  }
+
+  return true;
+}
+
+void JpegCompressor::CompressYUV420(JpegYUV420Job* job) {
+  ATRACE_CALL();
+
+  // The EXIF section including the thumbnail doesn't depend on the main image
+  // and is generated concurrently. The APP1 marker is spliced in afterwards.
+  bool app1_ready = false;
+  std::function<void()> app1_task;
+  if (job->exif.get() != nullptr) {
+    app1_task = [this, job, &app1_ready] {
+      app1_ready = GenerateApp1(job);
+    };
+  }
+
+  auto encoded_size = CompressYUV420Strips(
       {.output_buffer = job->output->plane.img.img,
        .output_buffer_size = job->output->plane.img.buffer_size,
        .yuv_planes = job->input->yuv_planes,
        .width = job->input->width,
        .height = job->input->height,
-       .app1_buffer = app1_buffer,
-       .app1_buffer_size = app1_buffer_size});
+       .app1_buffer = nullptr,
+       .app1_buffer_size = 0},
+      GetStripCount(job->input->height), std::move(app1_task));
+  if ((encoded_size > 0) && app1_ready) {
+    encoded_size = InsertApp1(
+        job->output->plane.img.img, job->output->plane.img.buffer_size,
+        encoded_size, job->exif->exif_utils->GetApp1Buffer(),
+        job->exif->exif_utils->GetApp1Length());
+  }
   if (encoded_size > 0) {
     job->output->stream_buffer.status = BufferStatus::kOk;
   } else {
@@ -218,18 +333,191 @@ void JpegCompressor::CompressYUV420(std::unique_ptr<JpegYUV420Job> job) {
   }
 }
 
+size_t JpegCompressor::GetStripCount(size_t height) const {
+  return std::max<size_t>(
+      std::min(jpeg_processing_threads_.size(), height / kMinStripRows), 1);
+}
+
+// Returns the offsets of the SOF0 segment and of the entropy coded data that
+// follows the SOS segment.
+static const uint8_t kMarkerSOF0 = 0xC0;
+static const uint8_t kMarkerSOS = 0xDA;
+static bool FindScanData(const uint8_t* data, size_t size, size_t* sof_offset,
+                         size_t* scan_offset) {
+  size_t offset = 2;  // SOI
+  *sof_offset = 0;
+  while (offset + 4 <= size) {
+    if (data[offset] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = data[offset + 1];
+    size_t length = (data[offset + 2] << 8) | data[offset + 3];
+    if (marker == kMarkerSOF0) {
+      *sof_offset = offset;
+    } else if (marker == kMarkerSOS) {
+      *scan_offset = offset + 2 + length;
+      return (*sof_offset > 0) && (*scan_offset + 2 <= size);
+    }
+    offset += 2 + length;
+  }
+
+  return false;
+}
+
+size_t JpegCompressor::CompressYUV420Strips(YUV420Frame frame,
+                                            size_t strip_count,
+                                            std::function<void()> side_task) {
+  ATRACE_CALL();
+
+  std::vector<std::function<void()>> tasks;
+  if (side_task) {
+    tasks.push_back(std::move(side_task));
+  }
+
+  // Strips must consist of whole MCU rows and each of them has to fit in a
+  // single restart interval.
+  const size_t mcu_size = DCTSIZE * 2;
+  size_t mcus_per_row = (frame.width + mcu_size - 1) / mcu_size;
+  size_t mcu_rows = (frame.height + mcu_size - 1) / mcu_size;
+  size_t strip_mcu_rows = (mcu_rows + strip_count - 1) / strip_count;
+  strip_mcu_rows = std::min(strip_mcu_rows, UINT16_MAX / mcus_per_row);
+  if ((strip_count <= 1) || (strip_mcu_rows == 0)) {
+    size_t encoded_size = 0;
+    tasks.push_back([this, &frame, &encoded_size] {
+      encoded_size = CompressYUV420Frame(frame);
+    });
+    RunTasks(&tasks);
+    return encoded_size;
+  }
+  strip_count = (mcu_rows + strip_mcu_rows - 1) / strip_mcu_rows;
+
+  auto strips = AcquireStrips(strip_count);
+  size_t strip_rows = strip_mcu_rows * mcu_size;
+  for (size_t i = 0; i < strip_count; i++) {
+    tasks.push_back([this, &frame, &strips, i, strip_rows, strip_count,
+                     restart_interval = mcus_per_row * strip_mcu_rows] {
+      size_t begin = i * strip_rows;
+      YUV420Frame strip = frame;
+      strip.height = std::min(strip_rows, frame.height - begin);
+      strip.yuv_planes.img_y += begin * frame.yuv_planes.y_stride;
+      strip.yuv_planes.img_cb += (begin / 2) * frame.yuv_planes.cbcr_stride;
+      strip.yuv_planes.img_cr += (begin / 2) * frame.yuv_planes.cbcr_stride;
+      strip.restart_interval = restart_interval;
+      strip.output_vector = &strips[i];
+      strips[i].resize(frame.output_buffer_size / strip_count);
+      strips[i].resize(CompressYUV420Frame(strip));
+    });
+  }
+  RunTasks(&tasks);
+
+  auto encoded_size = StitchStrips(frame, strips);
+  ReleaseStrips(std::move(strips));
+
+  return encoded_size;
+}
+
+size_t JpegCompressor::StitchStrips(const YUV420Frame& frame,
+                                    const Strips& strips) {
+  // All strips share the same tables. The first strip provides the headers,
+  // the entropy coded data of the following strips is appended after restart
+  // markers.
+  size_t encoded_size = 0;
+  for (size_t i = 0; i < strips.size(); i++) {
+    size_t sof_offset, scan_offset;
+    if (!FindScanData(strips[i].data(), strips[i].size(), &sof_offset,
+                      &scan_offset)) {
+      ALOGE("%s: Failed encoding strip %zu", __FUNCTION__, i);
+      return 0;
+    }
+
+    size_t begin = (i == 0) ? 0 : scan_offset;
+    size_t end = strips[i].size() - 2;  // EOI
+    size_t marker_size = (i == 0) ? 0 : 2;
+    if (encoded_size + marker_size + end - begin + 2 >
+        frame.output_buffer_size) {
+      ALOGE("%s: Out of buffer", __FUNCTION__);
+      return 0;
+    }
+    if (i > 0) {
+      frame.output_buffer[encoded_size++] = 0xFF;
+      frame.output_buffer[encoded_size++] = JPEG_RST0 + ((i - 1) & 0x7);
+    }
+    memcpy(frame.output_buffer + encoded_size, strips[i].data() + begin,
+           end - begin);
+    if (i == 0) {
+      // Image height
+      frame.output_buffer[sof_offset + 5] = (frame.height >> 8) & 0xFF;
+      frame.output_buffer[sof_offset + 6] = frame.height & 0xFF;
+    }
+    encoded_size += end - begin;
+  }
+  frame.output_buffer[encoded_size++] = 0xFF;
+  frame.output_buffer[encoded_size++] = JPEG_EOI;
+
+  return encoded_size;
+}
+
+JpegCompressor::Strips JpegCompressor::AcquireStrips(size_t strip_count) {
+  Strips strips;
+  {
+    std::lock_guard<std::mutex> lock(strips_mutex_);
+    if (!free_strips_.empty()) {
+      strips = std::move(free_strips_.back());
+      free_strips_.pop_back();
+    }
+  }
+  strips.resize(strip_count);
+
+  return strips;
+}
+
+void JpegCompressor::ReleaseStrips(Strips strips) {
+  std::lock_guard<std::mutex> lock(strips_mutex_);
+  free_strips_.push_back(std::move(strips));
+}
+
+size_t JpegCompressor::InsertApp1(uint8_t* buffer, size_t buffer_size,
+                                  size_t encoded_size,
+                                  const uint8_t* app1_buffer,
+                                  size_t app1_buffer_size) {
+  size_t offset = 2;  // SOI
+  if ((encoded_size >= offset + 4) && (buffer[offset] == 0xFF) &&
+      (buffer[offset + 1] == JPEG_APP0)) {
+    offset += 2 + ((buffer[offset + 2] << 8) | buffer[offset + 3]);
+  }
+
+  size_t segment_length = app1_buffer_size + 2;
+  if ((segment_length > UINT16_MAX) || (offset > encoded_size) ||
+      (encoded_size + segment_length + 2 > buffer_size)) {
+    ALOGE("%s: Not enough space for APP1 segment of size: %zu", __FUNCTION__,
+          app1_buffer_size);
+    return 0;
+  }
+
+  memmove(buffer + offset + segment_length + 2, buffer + offset,
+          encoded_size - offset);
+  buffer[offset] = 0xFF;
+  buffer[offset + 1] = JPEG_APP0 + 1;
+  buffer[offset + 2] = (segment_length >> 8) & 0xFF;
+  buffer[offset + 3] = segment_length & 0xFF;
+  memcpy(buffer + offset + 4, app1_buffer, app1_buffer_size);
+
+  return encoded_size + segment_length + 2;
+}
+
 size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
   ATRACE_CALL();
 
   struct CustomJpegDestMgr : public jpeg_destination_mgr {
     JOCTET* buffer;
     size_t buffer_size;
+    std::vector<uint8_t>* vector;
     size_t encoded_size;
     bool success;
   } dmgr;
 
   // Set up error management
-  jpeg_error_info_ = NULL;
+  j_common_ptr jpeg_error_info = NULL;
   jpeg_error_mgr jerr;
 
   auto cinfo = std::make_unique<jpeg_compress_struct>();
@@ -243,12 +531,18 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
   };
 
   jpeg_create_compress(cinfo.get());
-  if (CheckError("Error initializing compression")) {
+  if (CheckError(jpeg_error_info, "Error initializing compression")) {
     return 0;
   }
 
-  dmgr.buffer = static_cast<JOCTET*>(frame.output_buffer);
-  dmgr.buffer_size = frame.output_buffer_size;
+  dmgr.vector = frame.output_vector;
+  if (dmgr.vector != nullptr) {
+    dmgr.buffer = static_cast<JOCTET*>(dmgr.vector->data());
+    dmgr.buffer_size = dmgr.vector->size();
+  } else {
+    dmgr.buffer = static_cast<JOCTET*>(frame.output_buffer);
+    dmgr.buffer_size = frame.output_buffer_size;
+  }
   dmgr.encoded_size = 0;
   dmgr.success = true;
   cinfo->client_data = static_cast<void*>(&dmgr);
@@ -260,9 +554,20 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
           dmgr.buffer_size);
   };
 
-  dmgr.empty_output_buffer = [](j_compress_ptr cinfo __unused) {
-    ALOGE("%s:%d Out of buffer", __FUNCTION__, __LINE__);
-    return 0;
+  dmgr.empty_output_buffer = [](j_compress_ptr cinfo) {
+    auto& dmgr = static_cast<CustomJpegDestMgr&>(*cinfo->dest);
+    if (dmgr.vector == nullptr) {
+      ALOGE("%s:%d Out of buffer", __FUNCTION__, __LINE__);
+      return 0;
+    }
+
+    size_t used = dmgr.buffer_size;
+    dmgr.vector->resize(std::max(used * 2, static_cast<size_t>(4096)));
+    dmgr.buffer = static_cast<JOCTET*>(dmgr.vector->data());
+    dmgr.buffer_size = dmgr.vector->size();
+    dmgr.next_output_byte = dmgr.buffer + used;
+    dmgr.free_in_buffer = dmgr.buffer_size - used;
+    return 1;
   };
 
   dmgr.term_destination = [](j_compress_ptr cinfo) {
@@ -281,15 +586,17 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
   cinfo->in_color_space = JCS_YCbCr;
 
   jpeg_set_defaults(cinfo.get());
-  if (CheckError("Error configuring defaults")) {
+  if (CheckError(jpeg_error_info, "Error configuring defaults")) {
     return 0;
   }
 
   jpeg_set_colorspace(cinfo.get(), JCS_YCbCr);
-  if (CheckError("Error configuring color space")) {
+  if (CheckError(jpeg_error_info, "Error configuring color space")) {
     return 0;
   }
 
+  cinfo->restart_interval = frame.restart_interval;
+
   cinfo->raw_data_in = 1;
   // YUV420 planar with chroma subsampling
   cinfo->comp_info[0].h_samp_factor = 2;
@@ -307,7 +614,7 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
 
   // Start compression
   jpeg_start_compress(cinfo.get(), TRUE);
-  if (CheckError("Error starting compression")) {
+  if (CheckError(jpeg_error_info, "Error starting compression")) {
     return 0;
   }
 
@@ -352,7 +659,7 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
                          &cr_lines[cinfo->next_scanline / c_vsub_sampling]};
 
     jpeg_write_raw_data(cinfo.get(), planes, batch_size);
-    if (CheckError("Error while compressing")) {
+    if (CheckError(jpeg_error_info, "Error while compressing")) {
       return 0;
     }
 
@@ -364,19 +671,18 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
   }
 
   jpeg_finish_compress(cinfo.get());
-  if (CheckError("Error while finishing compression")) {
+  if (CheckError(jpeg_error_info, "Error while finishing compression")) {
     return 0;
   }
 
   return dmgr.encoded_size;
 }
 
-bool JpegCompressor::CheckError(const char* msg) {
-  if (jpeg_error_info_) {
+bool JpegCompressor::CheckError(j_common_ptr error_info, const char* msg) {
+  if (error_info) {
     char err_buffer[JMSG_LENGTH_MAX];
-    jpeg_error_info_->err->format_message(jpeg_error_info_, err_buffer);
+    error_info->err->format_message(error_info, err_buffer);
     ALOGE("%s: %s: %s", __FUNCTION__, msg, err_buffer);
-    jpeg_error_info_ = NULL;
     return true;
   }
 
@@ -19,13 +19,18 @@
 
 #include <hwl_types.h>
 
+#include <atomic>
 #include <condition_variable>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 
 #include "Base.h"
 #include "HandleImporter.h"
+#include "utils/BufferPool.h"
 
 extern "C" {
 #include <jpeglib.h>
@@ -42,16 +47,12 @@ using google_camera_hal::HwlPipelineResult;
 
 struct JpegYUV420Input {
   uint32_t width, height;
-  bool buffer_owner;
   YCbCrPlanes yuv_planes;
+  // Optional staging buffer backing 'yuv_planes', returned to its pool along
+  // with the job.
+  BufferPool::Lease buffer;
 
-  JpegYUV420Input() : width(0), height(0), buffer_owner(false) {
-  }
-  ~JpegYUV420Input() {
-    if ((yuv_planes.img_y != nullptr) && buffer_owner) {
-      delete[] yuv_planes.img_y;
-      yuv_planes = {};
-    }
+  JpegYUV420Input() : width(0), height(0) {
   }
 
   JpegYUV420Input(const JpegYUV420Input&) = delete;
@@ -61,28 +62,57 @@ struct JpegYUV420Input {
 struct JpegYUV420Job {
   std::unique_ptr<JpegYUV420Input> input;
   std::unique_ptr<SensorBuffer> output;
-  std::unique_ptr<HalCameraMetadata> result_metadata;
-  std::unique_ptr<ExifUtils> exif_utils;
+  // Exif generator and result metadata snapshot, no EXIF section is written
+  // without one.
+  ExifUtilsPool::Lease exif;
 };
 
 class JpegCompressor {
  public:
-  JpegCompressor();
+  // Staging buffers are leased from 'staging_pool' if present, otherwise
+  // from a private pool.
+  explicit JpegCompressor(std::shared_ptr<BufferPool> staging_pool = nullptr);
   virtual ~JpegCompressor();
 
   status_t QueueYUV420(std::unique_ptr<JpegYUV420Job> job);
 
  private:
+  friend class JpegCompressorBenchmarks;
+  friend class JpegCompressorTests;
+
+  static const char* kJpegThreadsProperty;
+  static const uint32_t kMaxJpegThreads;
+  static const size_t kMinStripRows;
+  static const size_t kMaxStagingPoolBytes;
+
   std::mutex mutex_;
+  // Signaled on new jobs or tasks and on exit
   std::condition_variable condition_;
+  // Signaled whenever a group of tasks completes
+  std::condition_variable tasks_done_;
   std::atomic_bool jpeg_done_ = false;
-  std::thread jpeg_processing_thread_;
-  std::queue<std::unique_ptr<JpegYUV420Job>> pending_yuv_jobs_;
+  std::vector<std::thread> jpeg_processing_threads_;
+  std::queue<std::pair<uint64_t, std::unique_ptr<JpegYUV420Job>>>
+      pending_yuv_jobs_;
+  // Parts of jobs already in progress, served ahead of any new jobs
+  std::queue<std::function<void()>> pending_tasks_;
+  uint64_t next_job_id_ = 0;
+  // Buffers must be returned in order, jobs that finish early are held back
+  // until all jobs queued before them are done.
+  std::mutex retire_mutex_;
+  std::map<uint64_t, std::unique_ptr<JpegYUV420Job>> encoded_jobs_;
+  uint64_t next_retired_job_id_ = 0;
   std::string exif_make_, exif_model_;
-
-  j_common_ptr jpeg_error_info_;
-  bool CheckError(const char* msg);
-  void CompressYUV420(std::unique_ptr<JpegYUV420Job> job);
+  std::shared_ptr<BufferPool> staging_pool_;
+  // Encoded strips of each job in flight. The strip buffers are recycled, so
+  // that they are only allocated for the first frames.
+  using Strips = std::vector<std::vector<uint8_t>>;
+  std::mutex strips_mutex_;
+  std::vector<Strips> free_strips_;
+
+  static bool CheckError(j_common_ptr error_info, const char* msg);
+  void CompressYUV420(JpegYUV420Job* job);
+  bool GenerateApp1(JpegYUV420Job* job);
   struct YUV420Frame {
     uint8_t* output_buffer;
     size_t output_buffer_size;
@@ -91,8 +121,31 @@ class JpegCompressor {
     size_t height;
     const uint8_t* app1_buffer;
     size_t app1_buffer_size;
+    unsigned int restart_interval = 0;  // In MCUs, 0 disables restart markers
+    // Grows on demand, overrides 'output_buffer' if present.
+    std::vector<uint8_t>* output_vector = nullptr;
   };
   size_t CompressYUV420Frame(YUV420Frame frame);
+  size_t GetStripCount(size_t height) const;
+  // Encodes 'strip_count' horizontal strips of 'frame' in parallel, each of
+  // them as a separate restart interval, and stitches them together in
+  // 'frame.output_buffer'. 'side_task' if present runs concurrently.
+  size_t CompressYUV420Strips(YUV420Frame frame, size_t strip_count,
+                              std::function<void()> side_task);
+  // Stitches the encoded 'strips' of 'frame' together in 'frame.output_buffer'
+  static size_t StitchStrips(const YUV420Frame& frame, const Strips& strips);
+  Strips AcquireStrips(size_t strip_count);
+  void ReleaseStrips(Strips strips);
+  // Splices an APP1 segment into an encoded image right after the SOI and
+  // JFIF markers, which is where libjpeg writes markers ahead of the scan.
+  static size_t InsertApp1(uint8_t* buffer, size_t buffer_size,
+                           size_t encoded_size, const uint8_t* app1_buffer,
+                           size_t app1_buffer_size);
+
+  // Runs 'tasks' on the encoder threads and returns once all of them are
+  // done. The calling thread helps draining pending tasks meanwhile.
+  void RunTasks(std::vector<std::function<void()>>* tasks);
+  void RetireJob(uint64_t job_id, std::unique_ptr<JpegYUV420Job> job);
   void ThreadLoop();
 
   JpegCompressor(const JpegCompressor&) = delete;
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AllocationCounter.h"
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <system/camera_metadata.h>
+
+#include <atomic>
+#include <new>
+
+namespace {
+std::atomic<uint64_t> allocation_count(0);
+// clone_camera_metadata() may allocate through allocate_camera_metadata(),
+// which must not count the clone a second time
+thread_local bool in_clone = false;
+
+template <typename Func>
+Func GetNextSymbol(const char* name) {
+  Func func = reinterpret_cast<Func>(dlsym(RTLD_NEXT, name));
+  if (func == nullptr) {
+    abort();
+  }
+
+  return func;
+}
+
+void* CountedAlloc(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+
+  return ptr;
+}
+}  // namespace
+
+void* operator new(size_t size) {
+  return CountedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+  return CountedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+// Interposes the metadata buffer allocations of libcamera_metadata, which
+// allocates them with calloc().
+extern "C" camera_metadata_t* allocate_camera_metadata(size_t entry_capacity,
+                                                       size_t data_capacity) {
+  using AllocateFunc = camera_metadata_t* (*)(size_t, size_t);
+  static AllocateFunc allocate =
+      GetNextSymbol<AllocateFunc>("allocate_camera_metadata");
+  if (!in_clone) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  return allocate(entry_capacity, data_capacity);
+}
+
+extern "C" camera_metadata_t* clone_camera_metadata(
+    const camera_metadata_t* src) {
+  using CloneFunc = camera_metadata_t* (*)(const camera_metadata_t*);
+  static CloneFunc clone = GetNextSymbol<CloneFunc>("clone_camera_metadata");
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  in_clone = true;
+  camera_metadata_t* ret = clone(src);
+  in_clone = false;
+
+  return ret;
+}
+
+namespace android {
+
+uint64_t AllocationCounter::GetCount() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+}  // namespace android
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_BENCHMARKS_ALLOCATION_COUNTER_H_
+#define EMULATOR_CAMERA_HAL_HWL_BENCHMARKS_ALLOCATION_COUNTER_H_
+
+#include <stdint.h>
+
+namespace android {
+
+// Counts the allocations of the benchmark process made through the global
+// operator new, which covers every HalCameraMetadata instance, along with the
+// camera_metadata buffers allocated by libcamera_metadata. Other direct
+// malloc() calls are not counted.
+class AllocationCounter {
+ public:
+  static uint64_t GetCount();
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_BENCHMARKS_ALLOCATION_COUNTER_H_
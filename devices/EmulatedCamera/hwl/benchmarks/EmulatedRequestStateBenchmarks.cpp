@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EmulatedRequestStateBenchmarks"
+#include <log/log.h>
+
+#include <benchmark/benchmark.h>
+
+#include <set>
+#include <string>
+
+#include "AllocationCounter.h"
+#include "EmulatedCameraProviderHWLImpl.h"
+#include "EmulatedRequestProcessor.h"
+#include "utils/HWLUtils.h"
+
+namespace android {
+
+class EmulatedRequestStateBenchmarks {
+ public:
+  // Request state of the first camera device exposed by the emulated
+  // provider.
+  static status_t CreateRequestState(
+      std::unique_ptr<EmulatedRequestState>* request_state /*out*/) {
+    auto provider = EmulatedCameraProviderHwlImpl::Create();
+    if (provider.get() == nullptr) {
+      return NO_INIT;
+    }
+
+    std::vector<uint32_t> camera_ids;
+    auto ret = provider->GetVisibleCameraIds(&camera_ids);
+    if ((ret != OK) || camera_ids.empty()) {
+      return NAME_NOT_FOUND;
+    }
+
+    std::unique_ptr<CameraDeviceHwl> device;
+    std::unique_ptr<HalCameraMetadata> chars;
+    ret = provider->CreateCameraDeviceHwl(camera_ids[0], &device);
+    if (ret != OK) {
+      return ret;
+    }
+    ret = device->GetCameraCharacteristics(&chars);
+    if (ret != OK) {
+      return ret;
+    }
+
+    *request_state = std::make_unique<EmulatedRequestState>(camera_ids[0]);
+    return (*request_state)->Initialize(std::move(chars));
+  }
+
+  // Request processor of the first logical multi-camera device exposed by the
+  // emulated provider along with its camera ids. The processor runs on a
+  // started sensor, like in a session.
+  static status_t CreateLogicalRequestProcessor(
+      std::unique_ptr<EmulatedRequestProcessor>* processor /*out*/,
+      uint32_t* logical_id /*out*/, std::set<uint32_t>* physical_ids /*out*/) {
+    auto provider = EmulatedCameraProviderHwlImpl::Create();
+    if (provider.get() == nullptr) {
+      return NO_INIT;
+    }
+
+    std::vector<uint32_t> camera_ids;
+    auto ret = provider->GetVisibleCameraIds(&camera_ids);
+    if (ret != OK) {
+      return ret;
+    }
+
+    for (auto camera_id : camera_ids) {
+      std::unique_ptr<CameraDeviceHwl> device;
+      std::unique_ptr<HalCameraMetadata> chars;
+      if ((provider->CreateCameraDeviceHwl(camera_id, &device) != OK) ||
+          (device->GetCameraCharacteristics(&chars) != OK)) {
+        continue;
+      }
+
+      camera_metadata_ro_entry_t entry;
+      ret = chars->Get(ANDROID_LOGICAL_MULTI_CAMERA_PHYSICAL_IDS, &entry);
+      if ((ret != OK) || (entry.count == 0)) {
+        continue;
+      }
+
+      auto logical_chars = std::make_unique<LogicalCharacteristics>();
+      SensorCharacteristics sensor_chars;
+      ret = GetSensorCharacteristics(chars.get(), &sensor_chars);
+      if (ret != OK) {
+        return ret;
+      }
+      logical_chars->emplace(camera_id, sensor_chars);
+
+      auto physical_devices = std::make_unique<PhysicalDeviceMap>();
+      const char* ids = reinterpret_cast<const char*>(entry.data.u8);
+      for (size_t offset = 0; offset < entry.count;) {
+        std::string id(ids + offset);
+        offset += id.size() + 1;
+        uint32_t physical_id = std::stoul(id);
+        std::unique_ptr<HalCameraMetadata> physical_chars;
+        ret = device->GetPhysicalCameraCharacteristics(physical_id,
+                                                       &physical_chars);
+        if (ret != OK) {
+          return ret;
+        }
+        ret = GetSensorCharacteristics(physical_chars.get(), &sensor_chars);
+        if (ret != OK) {
+          return ret;
+        }
+        logical_chars->emplace(physical_id, sensor_chars);
+        physical_devices->emplace(
+            physical_id, std::make_pair(CameraDeviceStatus::kPresent,
+                                        std::move(physical_chars)));
+        physical_ids->insert(physical_id);
+      }
+
+      sp<EmulatedSensor> sensor = new EmulatedSensor();
+      ret = sensor->StartUp(camera_id, std::move(logical_chars),
+                            /*render_cache*/ nullptr);
+      if (ret != OK) {
+        return ret;
+      }
+
+      *logical_id = camera_id;
+      *processor = std::make_unique<EmulatedRequestProcessor>(camera_id, sensor);
+      return (*processor)->Initialize(std::move(chars),
+                                      std::move(physical_devices));
+    }
+
+    return NAME_NOT_FOUND;
+  }
+
+  // The settings stage of EmulatedRequestProcessor::RequestProcessorLoop()
+  static status_t InitializeSensorRequest(
+      EmulatedRequestProcessor* processor, const PendingRequest& request,
+      const Buffers& output_buffers, uint32_t frame_number,
+      EmulatedSensor::LogicalCameraSettings* logical_settings /*out*/,
+      std::unique_ptr<HwlPipelineResult>* result /*out*/) {
+    std::lock_guard<std::mutex> lock(processor->process_mutex_);
+    return processor->InitializeSensorRequestLocked(
+        request, output_buffers, /*pipeline_id*/ 0, frame_number,
+        logical_settings, result);
+  }
+};
+
+// Follows the settings of a preview request through the request processor
+// for a logical camera, from the settings snapshot taken at submission to the
+// sensor settings and the initial result handed to the sensor.
+// Args: repeating, only the first request of a repeating request carries
+// settings. physical_outputs, stream from all physical devices or from the
+// logical device only.
+static void BM_LogicalRequestSettings(benchmark::State& state) {
+  std::unique_ptr<EmulatedRequestProcessor> processor;
+  uint32_t logical_id;
+  std::set<uint32_t> physical_ids;
+  if (EmulatedRequestStateBenchmarks::CreateLogicalRequestProcessor(
+          &processor, &logical_id, &physical_ids) != OK) {
+    state.SkipWithError("No logical camera device available");
+    return;
+  }
+
+  std::unique_ptr<HalCameraMetadata> settings;
+  if (processor->GetDefaultRequest(RequestTemplate::kPreview, &settings) !=
+      OK) {
+    state.SkipWithError("No default preview request");
+    return;
+  }
+
+  bool repeating = state.range(0) != 0;
+  if (state.range(1) == 0) {
+    physical_ids.clear();
+  }
+  // Only the camera ids of the output buffers matter for the settings
+  Buffers output_buffers;
+  output_buffers.push_back(std::make_unique<SensorBuffer>());
+  output_buffers.back()->camera_id = logical_id;
+  for (auto physical_id : physical_ids) {
+    output_buffers.push_back(std::make_unique<SensorBuffer>());
+    output_buffers.back()->camera_id = physical_id;
+  }
+
+  uint32_t frame_number = 0;
+  uint64_t allocations = 0;
+  for (auto _ : state) {
+    uint64_t start = AllocationCounter::GetCount();
+    // EmulatedRequestProcessor::ProcessPipelineRequests()
+    PendingRequest request;
+    if (!repeating || (frame_number == 0)) {
+      request.settings = HalCameraMetadata::Clone(settings.get());
+    }
+
+    auto logical_settings =
+        std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+    std::unique_ptr<HwlPipelineResult> result;
+    auto ret = EmulatedRequestStateBenchmarks::InitializeSensorRequest(
+        processor.get(), request, output_buffers, frame_number,
+        logical_settings.get(), &result);
+    allocations += AllocationCounter::GetCount() - start;
+    if ((ret != OK) || (result.get() == nullptr)) {
+      state.SkipWithError("Failed to process request settings");
+      break;
+    }
+    frame_number++;
+  }
+
+  state.counters["allocs_per_frame"] =
+      benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_LogicalRequestSettings)
+    ->ArgNames({"repeating", "physical_outputs"})
+    ->ArgsProduct({{0, 1}, {0, 1}});
+
+// Validates the settings of the standard request templates and runs 3A on
+// them.
+// Args: template, see RequestTemplate
+static void BM_SensorSettings(benchmark::State& state) {
+  std::unique_ptr<EmulatedRequestState> request_state;
+  if (EmulatedRequestStateBenchmarks::CreateRequestState(&request_state) !=
+      OK) {
+    state.SkipWithError("No camera device available");
+    return;
+  }
+
+  std::unique_ptr<HalCameraMetadata> settings;
+  auto ret = request_state->GetDefaultRequest(
+      static_cast<RequestTemplate>(state.range(0)), &settings);
+  if ((ret != OK) || (settings.get() == nullptr)) {
+    state.SkipWithError("Request template not supported");
+    return;
+  }
+
+  std::shared_ptr<const HalCameraMetadata> request_settings =
+      std::move(settings);
+  for (auto _ : state) {
+    EmulatedSensor::SensorSettings sensor_settings;
+    if (request_state->InitializeSensorSettings(request_settings,
+                                                &sensor_settings) != OK) {
+      state.SkipWithError("Failed to process request settings");
+      break;
+    }
+    benchmark::DoNotOptimize(sensor_settings);
+  }
+}
+BENCHMARK(BM_SensorSettings)
+    ->ArgNames({"template"})
+    ->DenseRange(static_cast<int>(RequestTemplate::kPreview),
+                 static_cast<int>(RequestTemplate::kManual));
+
+}  // namespace android
@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EmulatedSensorBenchmarks"
+#include <log/log.h>
+
+#include <benchmark/benchmark.h>
+#include <cutils/properties.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EmulatedSensor.h"
+#include "FrameStatistics.h"
+
+namespace android {
+
+class EmulatedSensorBenchmarks {
+ public:
+  enum YUV420Layout { I420, NV12, NV21 };
+
+  struct YUV420Image {
+    std::vector<uint8_t> buffer;
+    EmulatedSensor::YUV420Frame frame;
+  };
+
+  // Sensor with a rendered scene and capture workers, nothing else is
+  // started.
+  static sp<EmulatedSensor> CreateSensor(uint32_t width = kSensorWidth,
+                                         uint32_t height = kSensorHeight) {
+    sp<EmulatedSensor> sensor = new EmulatedSensor();
+    sensor->scene_ = new EmulatedScene(width, height,
+                                       EmulatedSensor::kElectronsPerLuxSecond,
+                                       /*sensor_orientation*/ 0,
+                                       /*is_front_facing*/ false);
+    sensor->scene_->SetExposureDuration(
+        EmulatedSensor::kDefaultExposureTime / 1e9);
+    sensor->scene_->CalculateScene(/*time*/ 0,
+                                   EmulatedSensor::kRegularSceneHandshake);
+    int32_t capture_threads =
+        property_get_int32(EmulatedSensor::kCaptureThreadsProperty, 0);
+    if (capture_threads <= 0) {
+      capture_threads =
+          std::min(std::max(std::thread::hardware_concurrency(), 1u),
+                   EmulatedSensor::kMaxCaptureThreads);
+    }
+    sensor->capture_workers_ = std::make_unique<WorkerPool>(capture_threads);
+    return sensor;
+  }
+
+  // Characteristics accepted by 'EmulatedSensor::StartUp()'
+  static std::unique_ptr<LogicalCharacteristics> GetLogicalCharacteristics(
+      uint32_t camera_id) {
+    auto chars = GetCharacteristics(/*width*/ 640, /*height*/ 480);
+    chars.exposure_time_range[0] =
+        EmulatedSensor::kSupportedExposureTimeRange[0];
+    chars.exposure_time_range[1] =
+        EmulatedSensor::kSupportedExposureTimeRange[1];
+    chars.frame_duration_range[0] =
+        EmulatedSensor::kSupportedFrameDurationRange[0];
+    chars.frame_duration_range[1] =
+        EmulatedSensor::kSupportedFrameDurationRange[1];
+    chars.sensitivity_range[0] = EmulatedSensor::kSupportedSensitivityRange[0];
+    chars.sensitivity_range[1] = EmulatedSensor::kSupportedSensitivityRange[1];
+    chars.max_pipeline_depth = EmulatedSensor::kPipelineDepth;
+    auto logical_chars = std::make_unique<LogicalCharacteristics>();
+    logical_chars->emplace(camera_id, chars);
+    return logical_chars;
+  }
+
+  static SensorCharacteristics GetCharacteristics(
+      uint32_t width = kSensorWidth, uint32_t height = kSensorHeight) {
+    SensorCharacteristics chars;
+    chars.width = width;
+    chars.height = height;
+    chars.max_raw_value = EmulatedSensor::kDefaultMaxRawValue;
+    return chars;
+  }
+
+  static YUV420Image CreateImage(uint32_t width, uint32_t height,
+                                 YUV420Layout layout) {
+    YUV420Image image;
+    uint32_t cbcr_width = (width + 1) / 2;
+    uint32_t cbcr_height = (height + 1) / 2;
+    image.buffer.resize(width * height + cbcr_width * cbcr_height * 2, 0x80);
+    uint8_t* chroma = image.buffer.data() + width * height;
+    auto& planes = image.frame.planes;
+    image.frame.width = width;
+    image.frame.height = height;
+    planes.img_y = image.buffer.data();
+    planes.y_stride = width;
+    switch (layout) {
+      case I420:
+        planes.img_cb = chroma;
+        planes.img_cr = chroma + cbcr_width * cbcr_height;
+        planes.cbcr_stride = cbcr_width;
+        planes.cbcr_step = 1;
+        break;
+      case NV12:
+        planes.img_cb = chroma;
+        planes.img_cr = chroma + 1;
+        planes.cbcr_stride = cbcr_width * 2;
+        planes.cbcr_step = 2;
+        break;
+      case NV21:
+        planes.img_cr = chroma;
+        planes.img_cb = chroma + 1;
+        planes.cbcr_stride = cbcr_width * 2;
+        planes.cbcr_step = 2;
+        break;
+    }
+
+    return image;
+  }
+
+  // Estimated memory traffic of a single nearest neighbour scaling pass,
+  // including the optional chroma split and merge passes.
+  static size_t GetBytesTouched(const EmulatedSensor::YUV420Frame& input,
+                                const EmulatedSensor::YUV420Frame& output,
+                                bool split_input, bool merge_output) {
+    size_t input_luma = input.width * input.height;
+    size_t output_luma = output.width * output.height;
+    size_t input_chroma = input_luma / 2;
+    size_t output_chroma = output_luma / 2;
+    size_t ret = std::min(input_luma, output_luma) + output_luma +
+                 std::min(input_chroma, output_chroma) + output_chroma;
+    if (split_input) {
+      ret += input_chroma * 2;
+    }
+    if (merge_output) {
+      ret += output_chroma * 2;
+    }
+
+    return ret;
+  }
+
+  static void CaptureRaw(EmulatedSensor* sensor, uint8_t* img,
+                         uint64_t frame_number,
+                         const SensorCharacteristics& chars) {
+    sensor->CaptureRaw(img, kGain, chars.width,
+                       EmulatedSensor::GetNoiseKey(/*camera_id*/ 0,
+                                                   frame_number),
+                       chars);
+  }
+
+  static void CaptureRGBA(EmulatedSensor* sensor, uint8_t* img, uint32_t width,
+                          uint32_t height) {
+    sensor->CaptureRGB(img, width, height, width * 4, EmulatedSensor::RGBA,
+                       kGain, GetCharacteristics());
+  }
+
+  static void CaptureYUV420(EmulatedSensor* sensor, YUV420Image* image,
+                            float zoom_ratio, bool rotate) {
+    sensor->CaptureYUV420(image->frame.planes, image->frame.width,
+                          image->frame.height, kGain, zoom_ratio, rotate,
+                          GetCharacteristics());
+  }
+
+  static void CaptureDepth(EmulatedSensor* sensor, uint8_t* img,
+                           uint32_t width, uint32_t height) {
+    sensor->CaptureDepth(img, kGain, width, height, width * sizeof(uint16_t),
+                         GetCharacteristics());
+  }
+
+  // 'process_type': 0 regular, 1 high quality, 2 reprocess
+  static status_t ProcessYUV420(EmulatedSensor* sensor,
+                                const YUV420Image& input, YUV420Image* output,
+                                int64_t process_type, float zoom_ratio,
+                                bool rotate) {
+    const EmulatedSensor::ProcessType process_types[] = {
+        EmulatedSensor::REGULAR, EmulatedSensor::HIGH_QUALITY,
+        EmulatedSensor::REPROCESS};
+    return sensor->ProcessYUV420(input.frame, output->frame, kGain,
+                                 process_types[process_type], zoom_ratio,
+                                 rotate, GetCharacteristics());
+  }
+
+  static status_t Scale(EmulatedSensor* sensor, const YUV420Image& input,
+                        YUV420Image* output, bool planar) {
+    return planar ? sensor->ScaleYUV420Planar(input.frame, output->frame)
+                  : sensor->ScaleYUV420(input.frame, output->frame);
+  }
+
+  static uint32_t GetRenderWidth(uint32_t width, uint32_t height) {
+    return EmulatedScene::kSceneWidth * static_cast<float>(width) / height;
+  }
+
+  static uint32_t GetRenderHeight() {
+    return EmulatedScene::kSceneHeight;
+  }
+
+ private:
+  static const uint32_t kSensorWidth = 4032;
+  static const uint32_t kSensorHeight = 3024;
+  static const uint32_t kGain = 100;
+};
+
+using Benchmarks = EmulatedSensorBenchmarks;
+
+// Args: sensor width, sensor height
+static void BM_CaptureRaw(benchmark::State& state) {
+  auto chars = Benchmarks::GetCharacteristics(state.range(0), state.range(1));
+  auto sensor = Benchmarks::CreateSensor(chars.width, chars.height);
+  std::vector<uint16_t> img(chars.width * chars.height);
+  FrameStatistics stats(chars.width * chars.height);
+  uint64_t frame_number = 0;
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    Benchmarks::CaptureRaw(sensor.get(),
+                           reinterpret_cast<uint8_t*>(img.data()),
+                           frame_number++, chars);
+    benchmark::ClobberMemory();
+  }
+  stats.Report(&state);
+}
+BENCHMARK(BM_CaptureRaw)
+    ->ArgNames({"width", "height"})
+    ->Args({1920, 1440})
+    ->Args({4032, 3024})
+    ->UseRealTime();
+
+// Args: output width, output height
+static void BM_CaptureRGB(benchmark::State& state) {
+  auto sensor = Benchmarks::CreateSensor();
+  uint32_t width = state.range(0);
+  uint32_t height = state.range(1);
+  std::vector<uint8_t> img(width * height * 4);
+  FrameStatistics stats(width * height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    Benchmarks::CaptureRGBA(sensor.get(), img.data(), width, height);
+    benchmark::ClobberMemory();
+  }
+  stats.Report(&state);
+}
+BENCHMARK(BM_CaptureRGB)
+    ->ArgNames({"width", "height"})
+    ->Args({640, 480})
+    ->Args({1920, 1080})
+    ->UseRealTime();
+
+// Args: output width, output height, zoom ratio in percent, rotate and crop
+static void BM_CaptureYUV420(benchmark::State& state) {
+  auto sensor = Benchmarks::CreateSensor();
+  auto image =
+      Benchmarks::CreateImage(state.range(0), state.range(1), Benchmarks::NV21);
+  float zoom_ratio = state.range(2) / 100.f;
+  bool rotate = state.range(3) != 0;
+  FrameStatistics stats(image.frame.width * image.frame.height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    Benchmarks::CaptureYUV420(sensor.get(), &image, zoom_ratio, rotate);
+    benchmark::ClobberMemory();
+  }
+  stats.Report(&state);
+}
+BENCHMARK(BM_CaptureYUV420)
+    ->ArgNames({"width", "height", "zoom", "rotate"})
+    ->Args({640, 480, 100, 0})
+    ->Args({1920, 1080, 100, 0})
+    ->Args({1920, 1080, 200, 0})
+    ->Args({1920, 1080, 100, 1})
+    ->Args({4032, 3024, 100, 0})
+    ->UseRealTime();
+
+// Args: output width, output height
+static void BM_CaptureDepth(benchmark::State& state) {
+  auto sensor = Benchmarks::CreateSensor();
+  uint32_t width = state.range(0);
+  uint32_t height = state.range(1);
+  std::vector<uint16_t> img(width * height);
+  FrameStatistics stats(width * height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    Benchmarks::CaptureDepth(sensor.get(),
+                             reinterpret_cast<uint8_t*>(img.data()), width,
+                             height);
+    benchmark::ClobberMemory();
+  }
+  stats.Report(&state);
+}
+BENCHMARK(BM_CaptureDepth)
+    ->ArgNames({"width", "height"})
+    ->Args({240, 180})
+    ->Args({640, 480})
+    ->UseRealTime();
+
+// Args: process type (0 regular, 1 high quality, 2 reprocess), output width,
+// output height, zoom ratio in percent, rotate and crop. Reprocess reads a
+// full resolution NV21 input.
+static void BM_ProcessYUV420(benchmark::State& state) {
+  auto sensor = Benchmarks::CreateSensor();
+  auto process_type = state.range(0);
+  auto input = Benchmarks::CreateImage(4032, 3024, Benchmarks::NV21);
+  Benchmarks::CaptureYUV420(sensor.get(), &input, /*zoom_ratio*/ 1.f,
+                            /*rotate*/ false);
+  auto output =
+      Benchmarks::CreateImage(state.range(1), state.range(2), Benchmarks::NV21);
+  float zoom_ratio = state.range(3) / 100.f;
+  bool rotate = state.range(4) != 0;
+  FrameStatistics stats(output.frame.width * output.frame.height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    if (Benchmarks::ProcessYUV420(sensor.get(), input, &output, process_type,
+                                  zoom_ratio, rotate) != OK) {
+      state.SkipWithError("Processing failed");
+      break;
+    }
+    benchmark::ClobberMemory();
+  }
+  stats.Report(&state);
+}
+BENCHMARK(BM_ProcessYUV420)
+    ->ArgNames({"type", "width", "height", "zoom", "rotate"})
+    ->ArgsProduct({{0, 1, 2}, {640}, {480}, {100}, {0}})
+    ->ArgsProduct({{0, 1, 2}, {1920}, {1080}, {100, 200}, {0, 1}})
+    ->ArgsProduct({{0, 2}, {4032}, {3024}, {100}, {0}})
+    ->UseRealTime();
+
+// Reprocess of an NV21 input into an NV21 output of the given size.
+// Arg 2 selects the legacy planar path.
+static void BM_ScaleNV21(benchmark::State& state) {
+  auto sensor = Benchmarks::CreateSensor();
+  auto input = Benchmarks::CreateImage(4032, 3024, Benchmarks::NV21);
+  auto output =
+      Benchmarks::CreateImage(state.range(0), state.range(1), Benchmarks::NV21);
+  bool planar = state.range(2) != 0;
+  FrameStatistics stats(output.frame.width * output.frame.height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    if (Benchmarks::Scale(sensor.get(), input, &output, planar) != OK) {
+      state.SkipWithError("Scaling failed");
+      break;
+    }
+    benchmark::ClobberMemory();
+  }
+  stats.Report(&state);
+
+  auto bytes = Benchmarks::GetBytesTouched(input.frame, output.frame, planar,
+                                           planar);
+  state.counters["bytes_touched_per_frame"] = bytes;
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_ScaleNV21)
+    ->ArgNames({"width", "height", "planar"})
+    ->Args({640, 480, 0})
+    ->Args({640, 480, 1})
+    ->Args({1920, 1440, 0})
+    ->Args({1920, 1440, 1})
+    ->Args({4032, 3024, 0})
+    ->Args({4032, 3024, 1})
+    ->UseRealTime();
+
+// Regular NV21 output, the low resolution render is upscaled to the given
+// size. Arg 2 selects the legacy I420 render followed by the planar path.
+static void BM_RegularNV21(benchmark::State& state) {
+  auto sensor = Benchmarks::CreateSensor();
+  auto output =
+      Benchmarks::CreateImage(state.range(0), state.range(1), Benchmarks::NV21);
+  bool planar = state.range(2) != 0;
+  auto render = Benchmarks::CreateImage(
+      Benchmarks::GetRenderWidth(state.range(0), state.range(1)),
+      Benchmarks::GetRenderHeight(),
+      planar ? Benchmarks::I420 : Benchmarks::NV21);
+  FrameStatistics stats(output.frame.width * output.frame.height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    Benchmarks::CaptureYUV420(sensor.get(), &render, /*zoom_ratio*/ 1.f,
+                              /*rotate*/ false);
+    if (Benchmarks::Scale(sensor.get(), render, &output, planar) != OK) {
+      state.SkipWithError("Scaling failed");
+      break;
+    }
+    benchmark::ClobberMemory();
+  }
+  stats.Report(&state);
+
+  auto bytes = Benchmarks::GetBytesTouched(render.frame, output.frame,
+                                           /*split_input*/ false, planar);
+  state.counters["bytes_touched_per_frame"] = bytes;
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_RegularNV21)
+    ->ArgNames({"width", "height", "planar"})
+    ->Args({1920, 1080, 0})
+    ->Args({1920, 1080, 1})
+    ->Args({4032, 3024, 0})
+    ->Args({4032, 3024, 1})
+    ->UseRealTime();
+
+// Hands requests over to a running sensor at its shortest frame duration the
+// same way the request processor does. Arg 0 adds threads that wait for
+// VSync concurrently, similar to a flush racing the request thread. Reports
+// the time the request thread spends in 'SetCurrentRequest()' along with the
+// deviation of the VSync wakeups from the frame cadence in microseconds.
+static void BM_RequestHandoff(benchmark::State& state) {
+  typedef std::chrono::steady_clock Clock;
+  const uint32_t camera_id = 0;
+  const nsecs_t frame_duration =
+      EmulatedSensor::kSupportedFrameDurationRange[0];
+  sp<EmulatedSensor> sensor = new EmulatedSensor();
+  if (sensor->StartUp(camera_id,
+                      Benchmarks::GetLogicalCharacteristics(camera_id)) != OK) {
+    state.SkipWithError("Sensor start up failed");
+    return;
+  }
+
+  std::atomic_bool done = false;
+  std::vector<std::thread> waiters;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    waiters.emplace_back([&sensor, &done] {
+      while (!done) {
+        sensor->WaitForVSync(EmulatedSensor::kSupportedFrameDurationRange[1]);
+      }
+    });
+  }
+
+  std::vector<double> handoff_us, jitter_us;
+  Clock::time_point last_vsync;
+  for (auto _ : state) {
+    auto settings = std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+    (*settings)[camera_id] = {
+        .exposure_time = EmulatedSensor::kSupportedExposureTimeRange[0],
+        .frame_duration = frame_duration,
+        .gain = EmulatedSensor::kSupportedSensitivityRange[0]};
+    auto start = Clock::now();
+    sensor->SetCurrentRequest(std::move(settings), /*result*/ nullptr,
+                              /*input_buffers*/ nullptr,
+                              /*output_buffers*/ nullptr);
+    handoff_us.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - start)
+            .count());
+    if (!sensor->WaitForVSync(
+            EmulatedSensor::kSupportedFrameDurationRange[1])) {
+      state.SkipWithError("VSync wait timed out");
+      break;
+    }
+
+    auto vsync = Clock::now();
+    if (last_vsync != Clock::time_point()) {
+      auto interval =
+          std::chrono::duration<double, std::micro>(vsync - last_vsync)
+              .count();
+      jitter_us.push_back(std::abs(interval - frame_duration / 1e3));
+    }
+    last_vsync = vsync;
+  }
+
+  done = true;
+  for (auto& it : waiters) {
+    it.join();
+  }
+  sensor->ShutDown();
+
+  auto report = [&state](const char* name, std::vector<double>* values) {
+    if (values->empty()) {
+      return;
+    }
+    std::sort(values->begin(), values->end());
+    state.counters[std::string(name) + "_p50_us"] =
+        (*values)[values->size() / 2];
+    state.counters[std::string(name) + "_p99_us"] =
+        (*values)[(values->size() - 1) * 99 / 100];
+    state.counters[std::string(name) + "_max_us"] = values->back();
+  };
+  report("handoff", &handoff_us);
+  report("vsync_jitter", &jitter_us);
+}
+BENCHMARK(BM_RequestHandoff)
+    ->ArgNames({"waiters"})
+    ->Arg(0)
+    ->Arg(2)
+    ->Iterations(500)
+    ->UseRealTime();
+
+}  // namespace android
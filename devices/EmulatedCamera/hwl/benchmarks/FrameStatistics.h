@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_BENCHMARKS_FRAME_STATISTICS_H_
+#define EMULATOR_CAMERA_HAL_HWL_BENCHMARKS_FRAME_STATISTICS_H_
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace android {
+
+// Collects per-frame latencies of a benchmark loop and reports the pixel
+// throughput in megapixels per second along with latency percentiles in
+// milliseconds.
+//
+//   FrameStatistics stats(width * height);
+//   for (auto _ : state) {
+//     FrameStatistics::ScopedFrame frame(&stats);
+//     ...
+//   }
+//   stats.Report(&state);
+class FrameStatistics {
+  typedef std::chrono::steady_clock Clock;
+
+ public:
+  explicit FrameStatistics(size_t pixels_per_frame)
+      : pixels_per_frame_(pixels_per_frame) {
+  }
+
+  class ScopedFrame {
+   public:
+    explicit ScopedFrame(FrameStatistics* stats)
+        : stats_(stats), start_(Clock::now()) {
+    }
+
+    ~ScopedFrame() {
+      stats_->latencies_.push_back(Clock::now() - start_);
+    }
+
+   private:
+    FrameStatistics* stats_;
+    Clock::time_point start_;
+
+    ScopedFrame(const ScopedFrame&) = delete;
+    ScopedFrame& operator=(const ScopedFrame&) = delete;
+  };
+
+  void Report(benchmark::State* state) {
+    state->counters["MPix"] =
+        benchmark::Counter(pixels_per_frame_ / 1e6,
+                           benchmark::Counter::kIsIterationInvariantRate);
+    if (latencies_.empty()) {
+      return;
+    }
+
+    std::sort(latencies_.begin(), latencies_.end());
+    state->counters["p50_ms"] = GetPercentile(0.5);
+    state->counters["p90_ms"] = GetPercentile(0.9);
+    state->counters["p99_ms"] = GetPercentile(0.99);
+    state->counters["max_ms"] = GetPercentile(1.0);
+  }
+
+ private:
+  // Nearest rank on the sorted latencies
+  double GetPercentile(double percentile) const {
+    size_t rank = percentile * (latencies_.size() - 1) + 0.5;
+    return std::chrono::duration<double, std::milli>(latencies_[rank]).count();
+  }
+
+  size_t pixels_per_frame_;
+  std::vector<Clock::duration> latencies_;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_BENCHMARKS_FRAME_STATISTICS_H_
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "JpegCompressorBenchmarks"
+#include <log/log.h>
+
+#include <benchmark/benchmark.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "AllocationCounter.h"
+#include "EmulatedSensor.h"
+#include "FrameStatistics.h"
+#include "JpegCompressor.h"
+
+namespace android {
+
+class JpegCompressorBenchmarks {
+ public:
+  struct YUV420Image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> buffer;
+    YCbCrPlanes planes;
+  };
+
+  // I420 gradients with some texture, flat content would make the entropy
+  // coder unrealistically cheap.
+  static YUV420Image CreateImage(uint32_t width, uint32_t height) {
+    YUV420Image image;
+    image.width = width;
+    image.height = height;
+    uint32_t cbcr_width = (width + 1) / 2;
+    uint32_t cbcr_height = (height + 1) / 2;
+    image.buffer.resize(width * height + cbcr_width * cbcr_height * 2);
+    image.planes = {.img_y = image.buffer.data(),
+                    .img_cb = image.buffer.data() + width * height,
+                    .img_cr = image.buffer.data() + width * height +
+                              cbcr_width * cbcr_height,
+                    .y_stride = width,
+                    .cbcr_stride = cbcr_width,
+                    .cbcr_step = 1};
+    for (uint32_t y = 0; y < height; y++) {
+      for (uint32_t x = 0; x < width; x++) {
+        image.planes.img_y[y * width + x] = (x + 2 * y + (x * y) % 23) & 0xFF;
+      }
+    }
+    for (uint32_t y = 0; y < cbcr_height; y++) {
+      for (uint32_t x = 0; x < cbcr_width; x++) {
+        image.planes.img_cb[y * cbcr_width + x] = (3 * x + y) & 0xFF;
+        image.planes.img_cr[y * cbcr_width + x] = (x + 5 * y) & 0xFF;
+      }
+    }
+
+    return image;
+  }
+
+  // Encodes in horizontal strips on the encoder threads if 'strips' is set.
+  static size_t Compress(JpegCompressor* compressor, const YUV420Image& image,
+                         bool strips, std::vector<uint8_t>* output) {
+    JpegCompressor::YUV420Frame frame{.output_buffer = output->data(),
+                                      .output_buffer_size = output->size(),
+                                      .yuv_planes = image.planes,
+                                      .width = image.width,
+                                      .height = image.height,
+                                      .app1_buffer = nullptr,
+                                      .app1_buffer_size = 0};
+    if (strips) {
+      return compressor->CompressYUV420Strips(
+          frame, compressor->GetStripCount(image.height), nullptr);
+    }
+
+    return compressor->CompressYUV420Frame(frame);
+  }
+};
+
+// Args: width, height, strips
+static void BM_CompressYUV420Frame(benchmark::State& state) {
+  JpegCompressor compressor;
+  auto image =
+      JpegCompressorBenchmarks::CreateImage(state.range(0), state.range(1));
+  std::vector<uint8_t> output(image.width * image.height * 2);
+  bool strips = state.range(2) != 0;
+  FrameStatistics stats(image.width * image.height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    if (JpegCompressorBenchmarks::Compress(&compressor, image, strips,
+                                           &output) == 0) {
+      state.SkipWithError("Compression failed");
+      break;
+    }
+  }
+  stats.Report(&state);
+}
+BENCHMARK(BM_CompressYUV420Frame)
+    ->ArgNames({"width", "height", "strips"})
+    ->ArgsProduct({{640}, {480}, {0, 1}})
+    ->ArgsProduct({{1920}, {1080}, {0, 1}})
+    ->ArgsProduct({{4032}, {3024}, {0, 1}})
+    ->UseRealTime();
+
+// Complete BLOB jobs with an EXIF section and a thumbnail, queued the same
+// way the sensor does. Reports the allocations per job made through the
+// global operator new, buffers allocated by libexif and libjpeg are not
+// counted.
+static void BM_EncodeJobWithExif(benchmark::State& state) {
+  JpegCompressor compressor(BufferPool::Create(/*max_cached_bytes*/ 64 << 20));
+  auto image =
+      JpegCompressorBenchmarks::CreateImage(state.range(0), state.range(1));
+  std::vector<uint8_t> output(image.width * image.height * 2);
+  SensorCharacteristics chars;
+  chars.width = image.width;
+  chars.height = image.height;
+  auto exif_pool = ExifUtilsPool::Create(chars);
+  auto result_metadata = HalCameraMetadata::Create(/*entry_capacity*/ 4,
+                                                   /*data_capacity*/ 16);
+  const int32_t thumbnail_size[] = {320, 240};
+  const uint8_t flash_state = ANDROID_FLASH_STATE_UNAVAILABLE;
+  const uint8_t ae_mode = ANDROID_CONTROL_AE_MODE_ON;
+  result_metadata->Set(ANDROID_JPEG_THUMBNAIL_SIZE, thumbnail_size, 2);
+  result_metadata->Set(ANDROID_FLASH_STATE, &flash_state, 1);
+  result_metadata->Set(ANDROID_CONTROL_AE_MODE, &ae_mode, 1);
+
+  std::mutex lock;
+  std::condition_variable done;
+  bool encoded = false;
+  HwlPipelineCallback callback = {
+      .process_pipeline_result =
+          [&](std::unique_ptr<HwlPipelineResult> /*result*/) {
+            std::lock_guard<std::mutex> l(lock);
+            encoded = true;
+            done.notify_one();
+          },
+      .notify = nullptr};
+
+  uint64_t allocations = 0;
+  FrameStatistics stats(image.width * image.height);
+  for (auto _ : state) {
+    FrameStatistics::ScopedFrame frame(&stats);
+    uint64_t start = AllocationCounter::GetCount();
+    auto job = std::make_unique<JpegYUV420Job>();
+    job->input = std::make_unique<JpegYUV420Input>();
+    job->input->width = image.width;
+    job->input->height = image.height;
+    job->input->yuv_planes = image.planes;
+    job->output = std::make_unique<SensorBuffer>();
+    job->output->format = HAL_PIXEL_FORMAT_BLOB;
+    job->output->dataSpace = HAL_DATASPACE_V0_JFIF;
+    job->output->callback = callback;
+    job->output->plane.img.img = output.data();
+    job->output->plane.img.buffer_size = output.size();
+    job->exif = exif_pool->Acquire(*result_metadata);
+    encoded = false;
+    if (compressor.QueueYUV420(std::move(job)) != OK) {
+      state.SkipWithError("Queueing failed");
+      break;
+    }
+    {
+      std::unique_lock<std::mutex> l(lock);
+      done.wait(l, [&] { return encoded; });
+    }
+    allocations += AllocationCounter::GetCount() - start;
+  }
+  stats.Report(&state);
+
+  state.counters["allocs_per_job"] =
+      benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_EncodeJobWithExif)
+    ->ArgNames({"width", "height"})
+    ->Args({1920, 1080})
+    ->Args({4032, 3024})
+    ->UseRealTime();
+
+}  // namespace android
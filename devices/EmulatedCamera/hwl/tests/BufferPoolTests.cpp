@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BufferPoolTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "utils/BufferPool.h"
+
+namespace android {
+
+TEST(BufferPoolTests, BucketSizes) {
+  EXPECT_EQ(BufferPool::GetBucketSize(0), 4096u);
+  EXPECT_EQ(BufferPool::GetBucketSize(4096), 4096u);
+  EXPECT_EQ(BufferPool::GetBucketSize(4097), 5120u);
+  EXPECT_EQ(BufferPool::GetBucketSize(8192), 8192u);
+  EXPECT_EQ(BufferPool::GetBucketSize(8193), 10240u);
+
+  // At most a quarter of every bucket is wasted
+  for (size_t size = 4096; size < 64 * 1024 * 1024; size = size * 3 / 2 + 1) {
+    auto bucket_size = BufferPool::GetBucketSize(size);
+    EXPECT_GE(bucket_size, size);
+    EXPECT_LT(bucket_size - size, bucket_size / 4) << size;
+  }
+}
+
+TEST(BufferPoolTests, ReuseReleasedBuffers) {
+  auto pool = BufferPool::Create(/*max_cached_bytes*/ 1024 * 1024);
+  uint8_t* data = nullptr;
+  {
+    auto lease = pool->Acquire(10000);
+    ASSERT_NE(lease.data(), nullptr);
+    EXPECT_EQ(lease.size(), 10000u);
+    data = lease.data();
+  }
+
+  // Same bucket, same buffer
+  auto lease = pool->Acquire(9000);
+  EXPECT_EQ(lease.data(), data);
+  // Different bucket
+  auto other = pool->Acquire(20000);
+  EXPECT_NE(other.data(), data);
+
+  auto stats = pool->GetStatistics();
+  EXPECT_EQ(stats.allocations, 2u);
+  EXPECT_EQ(stats.reuses, 1u);
+  EXPECT_EQ(stats.leased_bytes, BufferPool::GetBucketSize(10000) +
+                                    BufferPool::GetBucketSize(20000));
+  EXPECT_EQ(stats.cached_bytes, 0u);
+}
+
+TEST(BufferPoolTests, SteadyStateDoesNotAllocate) {
+  auto pool = BufferPool::Create(/*max_cached_bytes*/ 16 * 1024 * 1024);
+  const size_t sizes[] = {640 * 480 * 3 / 2, 640 * 480 / 2, 1920 * 1080 / 2};
+  for (size_t frame = 0; frame < 100; frame++) {
+    std::vector<BufferPool::Lease> leases;
+    for (auto size : sizes) {
+      leases.push_back(pool->Acquire(size));
+    }
+  }
+
+  auto stats = pool->GetStatistics();
+  EXPECT_EQ(stats.allocations, 3u);
+  EXPECT_EQ(stats.reuses, 297u);
+  EXPECT_EQ(stats.leased_bytes, 0u);
+  EXPECT_EQ(stats.cached_bytes, stats.allocated_bytes);
+  EXPECT_EQ(stats.peak_leased_bytes, stats.peak_allocated_bytes);
+
+  pool->Trim();
+  stats = pool->GetStatistics();
+  EXPECT_EQ(stats.cached_bytes, 0u);
+  EXPECT_EQ(stats.allocated_bytes, 0u);
+}
+
+TEST(BufferPoolTests, CachedBytesAreBounded) {
+  const size_t kBufferSize = 64 * 1024;
+  auto pool = BufferPool::Create(/*max_cached_bytes*/ 2 * kBufferSize);
+  {
+    std::vector<BufferPool::Lease> leases;
+    for (size_t i = 0; i < 4; i++) {
+      leases.push_back(pool->Acquire(kBufferSize));
+    }
+    EXPECT_EQ(pool->GetStatistics().allocated_bytes, 4 * kBufferSize);
+  }
+
+  auto stats = pool->GetStatistics();
+  EXPECT_EQ(stats.cached_bytes, 2 * kBufferSize);
+  EXPECT_EQ(stats.allocated_bytes, 2 * kBufferSize);
+  EXPECT_EQ(stats.peak_allocated_bytes, 4 * kBufferSize);
+}
+
+TEST(BufferPoolTests, LeaseOutlivesPool) {
+  auto pool = BufferPool::Create(/*max_cached_bytes*/ 1024 * 1024);
+  auto lease = pool->Acquire(100);
+  pool.reset();
+
+  lease.data()[99] = 0xFF;
+  auto moved = std::move(lease);
+  EXPECT_EQ(lease.data(), nullptr);
+  EXPECT_EQ(lease.size(), 0u);
+  EXPECT_EQ(moved.size(), 100u);
+  moved.Release();
+  EXPECT_EQ(moved.data(), nullptr);
+}
+
+TEST(BufferPoolTests, ReleaseFromOtherThreads) {
+  auto pool = BufferPool::Create(/*max_cached_bytes*/ 1024 * 1024);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; i++) {
+    threads.emplace_back([pool] {
+      for (size_t j = 0; j < 1000; j++) {
+        auto lease = pool->Acquire(4096 * (1 + j % 4));
+        lease.data()[0] = j & 0xFF;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto stats = pool->GetStatistics();
+  EXPECT_EQ(stats.allocations + stats.reuses, 4000u);
+  EXPECT_EQ(stats.leased_bytes, 0u);
+  EXPECT_EQ(stats.cached_bytes, stats.allocated_bytes);
+}
+
+}  // namespace android
@@ -0,0 +1,995 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EmulatedSensorTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "EmulatedSensor.h"
+
+namespace android {
+
+class EmulatedSensorTests : public ::testing::Test {
+ protected:
+  struct YUV420Image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> buffer;
+    YCbCrPlanes planes;
+  };
+
+  enum YUV420Layout { I420, NV12, NV21 };
+
+  void SetUp() override {
+    sensor_ = new EmulatedSensor();
+    chars_.width = 640;
+    chars_.height = 480;
+    chars_.max_raw_value = EmulatedSensor::kDefaultMaxRawValue;
+  }
+
+  void PrepareScene(size_t capture_threads, nsecs_t time) {
+    sensor_->scene_ = new EmulatedScene(chars_.width, chars_.height,
+                                        EmulatedSensor::kElectronsPerLuxSecond,
+                                        /*sensor_orientation*/ 0,
+                                        /*is_front_facing*/ false);
+    sensor_->scene_->SetExposureDuration(
+        EmulatedSensor::kDefaultExposureTime / 1e9);
+    sensor_->scene_->CalculateScene(time,
+                                    EmulatedSensor::kRegularSceneHandshake);
+    sensor_->capture_workers_ = std::make_unique<WorkerPool>(capture_threads);
+  }
+
+  void SetSceneHour(int hour) {
+    sensor_->scene_->SetHour(hour);
+    sensor_->scene_->CalculateScene(/*time*/ 0,
+                                    EmulatedSensor::kRegularSceneHandshake);
+  }
+
+  static YUV420Image CreateImage(uint32_t width, uint32_t height,
+                                 YUV420Layout layout) {
+    YUV420Image image;
+    image.width = width;
+    image.height = height;
+    uint32_t cbcr_width = (width + 1) / 2;
+    uint32_t cbcr_height = (height + 1) / 2;
+    image.buffer.resize(width * height + cbcr_width * cbcr_height * 2, 0xAB);
+    uint8_t* chroma = image.buffer.data() + width * height;
+    image.planes.img_y = image.buffer.data();
+    image.planes.y_stride = width;
+    switch (layout) {
+      case I420:
+        image.planes.img_cb = chroma;
+        image.planes.img_cr = chroma + cbcr_width * cbcr_height;
+        image.planes.cbcr_stride = cbcr_width;
+        image.planes.cbcr_step = 1;
+        break;
+      case NV12:
+        image.planes.img_cb = chroma;
+        image.planes.img_cr = chroma + 1;
+        image.planes.cbcr_stride = cbcr_width * 2;
+        image.planes.cbcr_step = 2;
+        break;
+      case NV21:
+        image.planes.img_cr = chroma;
+        image.planes.img_cb = chroma + 1;
+        image.planes.cbcr_stride = cbcr_width * 2;
+        image.planes.cbcr_step = 2;
+        break;
+    }
+
+    return image;
+  }
+
+  // Per-pixel YUV420 synthesis through the stateful scene readout cursor.
+  // Serves as the golden reference for the optimized capture path.
+  void CaptureYUV420Reference(YCbCrPlanes yuv_layout, uint32_t width,
+                              uint32_t height, uint32_t gain,
+                              float zoom_ratio, bool rotate) {
+    auto& scene = sensor_->scene_;
+    float total_gain = gain / 100.0 *
+                       EmulatedSensor::GetBaseGainFactor(chars_.max_raw_value);
+    const int scale64x = EmulatedSensor::kFixedBitPrecision * total_gain *
+                         255 / chars_.max_raw_value;
+    const int rgb_to_y[] = {19, 37, 7};
+    const int rgb_to_cb[] = {-10, -21, 32, 524288};
+    const int rgb_to_cr[] = {32, -26, -5, 524288};
+    const int scale_out_sq = 64 * 64;
+    const int32_t saturation = EmulatedSensor::kSaturationPoint;
+    const float aspect_ratio = static_cast<float>(width) / height;
+    const float norm_left_top = 0.5f - 0.5f / zoom_ratio;
+    const float norm_rot_top = norm_left_top;
+    const float norm_width = 1 / zoom_ratio;
+    const float norm_rot_width = norm_width / aspect_ratio;
+    const float norm_rot_height = norm_width;
+    const float norm_rot_left =
+        norm_left_top + (norm_width + norm_rot_width) * 0.5f;
+
+    for (unsigned int out_y = 0; out_y < height; out_y++) {
+      uint8_t* px_y = yuv_layout.img_y + out_y * yuv_layout.y_stride;
+      uint8_t* px_cb = yuv_layout.img_cb + (out_y / 2) * yuv_layout.cbcr_stride;
+      uint8_t* px_cr = yuv_layout.img_cr + (out_y / 2) * yuv_layout.cbcr_stride;
+
+      for (unsigned int out_x = 0; out_x < width; out_x++) {
+        int x, y;
+        float norm_x = out_x / (width * zoom_ratio);
+        float norm_y = out_y / (height * zoom_ratio);
+        if (rotate) {
+          x = static_cast<int>(chars_.width *
+                               (norm_rot_left - norm_y * norm_rot_width));
+          y = static_cast<int>(chars_.height *
+                               (norm_rot_top + norm_x * norm_rot_height));
+        } else {
+          x = static_cast<int>(chars_.width * (norm_left_top + norm_x));
+          y = static_cast<int>(chars_.height * (norm_left_top + norm_y));
+        }
+        x = std::min(std::max(x, 0), (int)chars_.width - 1);
+        y = std::min(std::max(y, 0), (int)chars_.height - 1);
+        scene->SetReadoutPixel(x, y);
+
+        const uint32_t* pixel = rotate ? scene->GetPixelElectronsColumn()
+                                       : scene->GetPixelElectrons();
+        int32_t r_count, g_count, b_count;
+        r_count = pixel[EmulatedScene::R] * scale64x;
+        r_count = r_count < saturation ? r_count : saturation;
+        g_count = pixel[EmulatedScene::Gr] * scale64x;
+        g_count = g_count < saturation ? g_count : saturation;
+        b_count = pixel[EmulatedScene::B] * scale64x;
+        b_count = b_count < saturation ? b_count : saturation;
+        r_count = sensor_->gamma_table_[r_count];
+        g_count = sensor_->gamma_table_[g_count];
+        b_count = sensor_->gamma_table_[b_count];
+
+        *px_y++ = (rgb_to_y[0] * r_count + rgb_to_y[1] * g_count +
+                   rgb_to_y[2] * b_count) /
+                  scale_out_sq;
+        if (out_y % 2 == 0 && out_x % 2 == 0) {
+          *px_cb = (rgb_to_cb[0] * r_count + rgb_to_cb[1] * g_count +
+                    rgb_to_cb[2] * b_count + rgb_to_cb[3]) /
+                   scale_out_sq;
+          *px_cr = (rgb_to_cr[0] * r_count + rgb_to_cr[1] * g_count +
+                    rgb_to_cr[2] * b_count + rgb_to_cr[3]) /
+                   scale_out_sq;
+          px_cr += yuv_layout.cbcr_step;
+          px_cb += yuv_layout.cbcr_step;
+        }
+      }
+    }
+  }
+
+  void CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width, uint32_t height,
+                     uint32_t gain, float zoom_ratio, bool rotate) {
+    sensor_->CaptureYUV420(yuv_layout, width, height, gain, zoom_ratio, rotate,
+                           chars_);
+  }
+
+  enum ProcessType { REPROCESS, HIGH_QUALITY, REGULAR };
+
+  status_t ProcessYUV420(const YUV420Image& input, YUV420Image* output,
+                         ProcessType process_type) {
+    const EmulatedSensor::ProcessType process_types[] = {
+        EmulatedSensor::REPROCESS, EmulatedSensor::HIGH_QUALITY,
+        EmulatedSensor::REGULAR};
+    EmulatedSensor::YUV420Frame input_frame{.width = input.width,
+                                            .height = input.height,
+                                            .planes = input.planes};
+    EmulatedSensor::YUV420Frame output_frame{.width = output->width,
+                                             .height = output->height,
+                                             .planes = output->planes};
+    return sensor_->ProcessYUV420(input_frame, output_frame, /*gain*/ 400,
+                                  process_types[process_type],
+                                  /*zoom_ratio*/ 1.f,
+                                  /*rotate_and_crop*/ false, chars_);
+  }
+
+  // Scales through planar intermediates regardless of the chroma layouts.
+  status_t ScaleYUV420Planar(const YUV420Image& input, YUV420Image* output) {
+    return sensor_->ScaleYUV420Planar(
+        {.width = input.width, .height = input.height, .planes = input.planes},
+        {.width = output->width,
+         .height = output->height,
+         .planes = output->planes});
+  }
+
+  // Planar I420 copy of any YUV420 layout.
+  static std::vector<uint8_t> ToI420(const YUV420Image& image) {
+    std::vector<uint8_t> ret(image.planes.img_y,
+                             image.planes.img_y + image.width * image.height);
+    for (auto plane : {image.planes.img_cb, image.planes.img_cr}) {
+      for (uint32_t y = 0; y < (image.height + 1) / 2; y++) {
+        for (uint32_t x = 0; x < (image.width + 1) / 2; x++) {
+          ret.push_back(plane[y * image.planes.cbcr_stride +
+                              x * image.planes.cbcr_step]);
+        }
+      }
+    }
+
+    return ret;
+  }
+
+  std::vector<uint16_t> CaptureRaw(uint32_t gain, uint64_t noise_key) {
+    std::vector<uint16_t> image(chars_.width * chars_.height);
+    sensor_->CaptureRaw(reinterpret_cast<uint8_t*>(image.data()), gain,
+                        chars_.width, noise_key, chars_);
+    return image;
+  }
+
+  static uint64_t GetNoiseKey(uint32_t camera_id, uint32_t frame_number) {
+    return EmulatedSensor::GetNoiseKey(camera_id, frame_number);
+  }
+
+  EmulatedScene::Sampler GetSampler() const {
+    return sensor_->scene_->GetSampler();
+  }
+
+  float GetTotalGain(uint32_t gain) const {
+    return gain / 100.0 *
+           EmulatedSensor::GetBaseGainFactor(chars_.max_raw_value);
+  }
+
+  std::unique_ptr<HalCameraMetadata> GetNoiseProfile(uint32_t gain) {
+    auto result = HalCameraMetadata::Create(/*entry_capacity*/ 1,
+                                            /*data_capacity*/ 128);
+    sensor_->CalculateAndAppendNoiseProfile(
+        gain, EmulatedSensor::GetBaseGainFactor(chars_.max_raw_value),
+        result.get());
+    return result;
+  }
+
+  std::shared_ptr<RenderCache> EnableRenderCache(size_t max_size_bytes) {
+    sensor_->render_cache_ = std::make_shared<RenderCache>(max_size_bytes);
+    return sensor_->render_cache_;
+  }
+
+  std::vector<uint8_t> CaptureRGB(uint32_t width, uint32_t height,
+                                  uint32_t gain) {
+    std::vector<uint8_t> image(width * height * 4, 0xAB);
+    sensor_->CaptureRGB(image.data(), width, height, width * 4,
+                        EmulatedSensor::RGBA, gain, chars_);
+    return image;
+  }
+
+  std::unique_ptr<LogicalCharacteristics> GetLogicalCharacteristics() {
+    chars_.exposure_time_range[0] =
+        EmulatedSensor::kSupportedExposureTimeRange[0];
+    chars_.exposure_time_range[1] =
+        EmulatedSensor::kSupportedExposureTimeRange[1];
+    chars_.frame_duration_range[0] =
+        EmulatedSensor::kSupportedFrameDurationRange[0];
+    chars_.frame_duration_range[1] =
+        EmulatedSensor::kSupportedFrameDurationRange[1];
+    chars_.sensitivity_range[0] = EmulatedSensor::kSupportedSensitivityRange[0];
+    chars_.sensitivity_range[1] = EmulatedSensor::kSupportedSensitivityRange[1];
+    chars_.max_pipeline_depth = EmulatedSensor::kPipelineDepth;
+    auto logical_chars = std::make_unique<LogicalCharacteristics>();
+    logical_chars->emplace(kCameraId, chars_);
+    return logical_chars;
+  }
+
+  static void SleepFor(nsecs_t duration) {
+    timespec t = {.tv_sec = static_cast<time_t>(duration / 1000000000L),
+                  .tv_nsec = static_cast<long>(duration % 1000000000L)};
+    while (nanosleep(&t, &t) != 0) {
+    }
+  }
+
+  static constexpr uint32_t kCameraId = 0;
+
+  sp<EmulatedSensor> sensor_;
+  SensorCharacteristics chars_;
+};
+
+TEST_F(EmulatedSensorTests, CaptureYUV420MatchesReference) {
+  const uint32_t sizes[][2] = {{640, 480}, {320, 240}, {176, 144},
+                               {97, 61},   {20, 20},   {1, 1}};
+  const float zoom_ratios[] = {1.f, 1.5f, 4.f};
+  const uint32_t gains[] = {100, 400, 1600};
+  const size_t thread_counts[] = {1, 4};
+  const YUV420Layout layouts[] = {I420, NV12, NV21};
+
+  for (size_t threads : thread_counts) {
+    // Cover a couple of different scene illuminations and handshake offsets
+    for (nsecs_t time : {0LL, 123456789LL, 7200000000000LL}) {
+      PrepareScene(threads, time);
+      for (const auto& size : sizes) {
+        for (auto layout : layouts) {
+          for (float zoom_ratio : zoom_ratios) {
+            for (uint32_t gain : gains) {
+              for (bool rotate : {false, true}) {
+                auto golden = CreateImage(size[0], size[1], layout);
+                auto image = CreateImage(size[0], size[1], layout);
+                CaptureYUV420Reference(golden.planes, golden.width,
+                                       golden.height, gain, zoom_ratio, rotate);
+                CaptureYUV420(image.planes, image.width, image.height, gain,
+                              zoom_ratio, rotate);
+                ASSERT_EQ(golden.buffer, image.buffer)
+                    << "Mismatch for " << size[0] << "x" << size[1]
+                    << " layout: " << layout << " zoom: " << zoom_ratio
+                    << " gain: " << gain << " rotate: " << rotate
+                    << " threads: " << threads;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(EmulatedSensorTests, CaptureRawNoiseIsReproducible) {
+  const uint64_t key = GetNoiseKey(/*camera_id*/ 1, 42);
+
+  PrepareScene(/*capture_threads*/ 1, /*time*/ 0);
+  auto serial = CaptureRaw(/*gain*/ 400, key);
+  PrepareScene(/*capture_threads*/ 4, /*time*/ 0);
+  auto parallel = CaptureRaw(/*gain*/ 400, key);
+  EXPECT_EQ(serial, parallel) << "Noise must not depend on the row split";
+  EXPECT_EQ(parallel, CaptureRaw(/*gain*/ 400, key));
+
+  auto next_frame =
+      CaptureRaw(/*gain*/ 400, GetNoiseKey(1, 43));
+  auto other_camera =
+      CaptureRaw(/*gain*/ 400, GetNoiseKey(2, 42));
+  EXPECT_NE(parallel, next_frame);
+  EXPECT_NE(parallel, other_camera);
+}
+
+// Measure the noise of every scene material and CFA channel and compare it
+// against the model reported in ANDROID_SENSOR_NOISE_PROFILE:
+// variance = S * electrons + O.
+TEST_F(EmulatedSensorTests, CaptureRawNoiseMatchesNoiseProfile) {
+  // Enough samples per material to estimate the variance within ~5%
+  const size_t kMinSampleCount = 4000;
+  const double kVarianceTolerance = 0.05;
+  const uint32_t kSaturationElectrons = 2000;
+  const int bayer_select[4] = {EmulatedScene::R, EmulatedScene::Gr,
+                               EmulatedScene::Gb, EmulatedScene::B};
+
+  PrepareScene(/*capture_threads*/ 4, /*time*/ 0);
+  const auto sampler = GetSampler();
+  for (uint32_t gain : {100, 400, 1600}) {
+    auto noise_profile = GetNoiseProfile(gain);
+    ASSERT_NE(noise_profile, nullptr);
+    camera_metadata_ro_entry_t entry;
+    ASSERT_EQ(noise_profile->Get(ANDROID_SENSOR_NOISE_PROFILE, &entry), OK);
+    ASSERT_EQ(entry.count, 8u);
+
+    float total_gain = GetTotalGain(gain);
+    struct Statistics {
+      size_t count = 0;
+      double sum = 0;
+      double sum_sq = 0;
+      double expected_mean = 0;
+      double expected_variance = 0;
+    };
+    std::map<std::pair<uint32_t, int>, Statistics> materials;
+    auto image = CaptureRaw(gain, GetNoiseKey(0, gain));
+    for (uint32_t y = 0; y < chars_.height; y++) {
+      EmulatedScene::Sampler::RowReadout row(sampler, 0, y);
+      for (uint32_t x = 0; x < chars_.width; x++) {
+        int channel = bayer_select[(y & 0x1) * 2 + (x & 0x1)];
+        const uint32_t* pixel = row.GetPixelElectrons();
+        uint32_t electrons = std::min(pixel[channel], kSaturationElectrons);
+        auto& stats = materials[{electrons, channel}];
+        if (stats.count == 0) {
+          double noise_scale = entry.data.d[channel * 2];
+          double noise_offset = entry.data.d[channel * 2 + 1];
+          stats.expected_variance = noise_scale * electrons + noise_offset;
+          stats.expected_mean =
+              std::min<uint32_t>(electrons * total_gain, chars_.max_raw_value) +
+              chars_.black_level_pattern[channel];
+        }
+        double value = image[y * chars_.width + x];
+        stats.count++;
+        stats.sum += value;
+        stats.sum_sq += value * value;
+      }
+    }
+
+    size_t verified = 0;
+    for (const auto& it : materials) {
+      const auto& stats = it.second;
+      double stddev = std::sqrt(stats.expected_variance);
+      // Skip rare materials and the ones where clamping to zero skews the
+      // distribution
+      if ((stats.count < kMinSampleCount) ||
+          (stats.expected_mean < 4 * stddev)) {
+        continue;
+      }
+      double mean = stats.sum / stats.count;
+      double variance = stats.sum_sq / stats.count - mean * mean;
+      // Raw values are truncated to integers, which biases the mean by up to
+      // one count and adds up to 1/12 of quantization variance.
+      EXPECT_NEAR(mean, stats.expected_mean - 0.5,
+                  0.5 + 4 * stddev / std::sqrt(stats.count))
+          << "gain: " << gain << " electrons: " << it.first.first;
+      EXPECT_NEAR(variance, stats.expected_variance,
+                  stats.expected_variance * kVarianceTolerance + 1.0 / 12)
+          << "gain: " << gain << " electrons: " << it.first.first;
+      verified++;
+    }
+    EXPECT_GT(verified, 4u) << "Too few uniform scene regions at gain: "
+                            << gain;
+  }
+}
+
+TEST_F(EmulatedSensorTests, RenderCacheMatchesRenderedOutput) {
+  PrepareScene(/*capture_threads*/ 4, /*time*/ 0);
+  auto golden = CreateImage(320, 240, I420);
+  CaptureYUV420(golden.planes, golden.width, golden.height, /*gain*/ 400,
+                /*zoom_ratio*/ 1.5f, /*rotate*/ false);
+  auto golden_rgb = CaptureRGB(320, 240, /*gain*/ 400);
+
+  auto cache = EnableRenderCache(/*max_size_bytes*/ 4 * 1024 * 1024);
+  for (auto layout : {I420, NV12, NV21, I420}) {
+    auto image = CreateImage(320, 240, layout);
+    CaptureYUV420(image.planes, image.width, image.height, /*gain*/ 400,
+                  /*zoom_ratio*/ 1.5f, /*rotate*/ false);
+    auto reference = CreateImage(320, 240, layout);
+    CaptureYUV420Reference(reference.planes, reference.width,
+                           reference.height, /*gain*/ 400,
+                           /*zoom_ratio*/ 1.5f, /*rotate*/ false);
+    EXPECT_EQ(image.buffer, reference.buffer) << "layout: " << layout;
+  }
+  // Output is stored once its key repeats, all layouts share the same entry
+  auto stats = cache->GetStatistics();
+  EXPECT_EQ(stats.misses, 2u);
+  EXPECT_EQ(stats.hits, 2u);
+  EXPECT_EQ(stats.entry_count, 1u);
+
+  EXPECT_EQ(golden_rgb, CaptureRGB(320, 240, /*gain*/ 400));
+  EXPECT_EQ(golden_rgb, CaptureRGB(320, 240, /*gain*/ 400));
+  EXPECT_EQ(golden_rgb, CaptureRGB(320, 240, /*gain*/ 400));
+  stats = cache->GetStatistics();
+  EXPECT_EQ(stats.misses, 4u);
+  EXPECT_EQ(stats.hits, 3u);
+  EXPECT_EQ(stats.entry_count, 2u);
+
+  // Any change of the capture parameters or the scene must miss, output that
+  // doesn't repeat is not stored
+  auto image = CreateImage(320, 240, I420);
+  CaptureYUV420(image.planes, image.width, image.height, /*gain*/ 800,
+                /*zoom_ratio*/ 1.5f, /*rotate*/ false);
+  CaptureYUV420(image.planes, image.width, image.height, /*gain*/ 400,
+                /*zoom_ratio*/ 1.f, /*rotate*/ false);
+  CaptureYUV420(image.planes, image.width, image.height, /*gain*/ 400,
+                /*zoom_ratio*/ 1.5f, /*rotate*/ true);
+  stats = cache->GetStatistics();
+  EXPECT_EQ(stats.misses, 7u);
+  EXPECT_EQ(stats.entry_count, 2u);
+
+  PrepareScene(/*capture_threads*/ 4, /*time*/ 0);
+  SetSceneHour(18);
+  auto next = CreateImage(320, 240, I420);
+  CaptureYUV420(next.planes, next.width, next.height, /*gain*/ 400,
+                /*zoom_ratio*/ 1.5f, /*rotate*/ false);
+  EXPECT_EQ(cache->GetStatistics().misses, 8u);
+  auto reference = CreateImage(320, 240, I420);
+  CaptureYUV420Reference(reference.planes, reference.width, reference.height,
+                         /*gain*/ 400, /*zoom_ratio*/ 1.5f, /*rotate*/ false);
+  EXPECT_EQ(next.buffer, reference.buffer);
+}
+
+TEST_F(EmulatedSensorTests, StagingBuffersAreReused) {
+  PrepareScene(/*capture_threads*/ 4, /*time*/ 0);
+  auto input = CreateImage(640, 480, NV21);
+  CaptureYUV420(input.planes, input.width, input.height, /*gain*/ 400,
+                /*zoom_ratio*/ 1.f, /*rotate*/ false);
+
+  auto process_frames = [&]() {
+    auto regular = CreateImage(320, 240, NV21);
+    ASSERT_EQ(ProcessYUV420(input, &regular, REGULAR), OK);
+    auto high_quality = CreateImage(640, 480, NV12);
+    ASSERT_EQ(ProcessYUV420(input, &high_quality, HIGH_QUALITY), OK);
+    auto reprocess = CreateImage(320, 240, NV12);
+    ASSERT_EQ(ProcessYUV420(input, &reprocess, REPROCESS), OK);
+  };
+
+  process_frames();
+  auto warm_stats = sensor_->GetStagingPoolStatistics();
+  EXPECT_GT(warm_stats.allocations, 0u);
+  for (size_t i = 0; i < 10; i++) {
+    process_frames();
+  }
+
+  auto stats = sensor_->GetStagingPoolStatistics();
+  EXPECT_EQ(stats.allocations, warm_stats.allocations);
+  EXPECT_GT(stats.reuses, warm_stats.reuses);
+  EXPECT_EQ(stats.leased_bytes, 0u);
+  EXPECT_EQ(stats.peak_allocated_bytes, warm_stats.peak_allocated_bytes);
+}
+
+TEST_F(EmulatedSensorTests, SemiPlanarScalingMatchesPlanar) {
+  PrepareScene(/*capture_threads*/ 4, /*time*/ 0);
+  const uint32_t sizes[][2] = {{320, 240}, {1280, 720}, {160, 160}};
+  for (auto input_layout : {I420, NV12, NV21}) {
+    auto input = CreateImage(640, 480, input_layout);
+    CaptureYUV420(input.planes, input.width, input.height, /*gain*/ 400,
+                  /*zoom_ratio*/ 1.f, /*rotate*/ false);
+    for (const auto& size : sizes) {
+      for (auto output_layout : {I420, NV12, NV21}) {
+        auto reference = CreateImage(size[0], size[1], output_layout);
+        ASSERT_EQ(ScaleYUV420Planar(input, &reference), OK);
+        auto output = CreateImage(size[0], size[1], output_layout);
+        ASSERT_EQ(ProcessYUV420(input, &output, REPROCESS), OK);
+        EXPECT_EQ(output.buffer, reference.buffer)
+            << "layout: " << input_layout << " -> " << output_layout
+            << " size: " << size[0] << "x" << size[1];
+      }
+    }
+  }
+
+  // Regular outputs render in the output layout, which must not change the
+  // result.
+  for (const auto& size : sizes) {
+    auto planar = CreateImage(size[0], size[1], I420);
+    ASSERT_EQ(ProcessYUV420(planar, &planar, REGULAR), OK);
+    for (auto layout : {NV12, NV21}) {
+      auto output = CreateImage(size[0], size[1], layout);
+      ASSERT_EQ(ProcessYUV420(planar, &output, REGULAR), OK);
+      EXPECT_EQ(ToI420(output), planar.buffer)
+          << "layout: " << layout << " size: " << size[0] << "x" << size[1];
+    }
+  }
+
+  // Matching semi-planar layouts need no staging buffers
+  auto input = CreateImage(640, 480, NV21);
+  auto output = CreateImage(320, 240, NV21);
+  auto stats = sensor_->GetStagingPoolStatistics();
+  ASSERT_EQ(ProcessYUV420(input, &output, REPROCESS), OK);
+  auto next_stats = sensor_->GetStagingPoolStatistics();
+  EXPECT_EQ(next_stats.allocations + next_stats.reuses,
+            stats.allocations + stats.reuses);
+}
+
+// Flush() returns once the results of all requests handed to the sensor were
+// returned, including the frames still in the render and result stages.
+TEST_F(EmulatedSensorTests, FlushWaitsForInFlightFrames) {
+  const uint32_t kFrameCount = 6;
+  const uint32_t width = 320;
+  const uint32_t height = 240;
+
+  sensor_ = new EmulatedSensor();
+  ASSERT_EQ(sensor_->StartUp(kCameraId, GetLogicalCharacteristics()), OK);
+
+  std::mutex lock;
+  uint32_t results = 0;
+  HwlPipelineCallback callback = {
+      .process_pipeline_result =
+          [&](std::unique_ptr<HwlPipelineResult> result) {
+            // Keeps frames queued up in the result stage
+            SleepFor(ms2ns(20));
+            if (result->result_metadata.get() != nullptr) {
+              std::lock_guard<std::mutex> l(lock);
+              results++;
+            }
+          },
+      .notify = [](uint32_t /*pipeline_id*/, const NotifyMessage& /*msg*/) {}};
+
+  std::vector<std::vector<uint8_t>> images(
+      kFrameCount, std::vector<uint8_t>(width * height * 4));
+  for (uint32_t frame = 0; frame < kFrameCount; frame++) {
+    EmulatedSensor::SensorSettings device_settings = {};
+    device_settings.exposure_time = EmulatedSensor::kDefaultExposureTime;
+    device_settings.frame_duration = ms2ns(16);
+    device_settings.gain = EmulatedSensor::kDefaultSensitivity;
+    auto settings = std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+    settings->emplace(kCameraId, device_settings);
+
+    auto result = std::make_unique<HwlPipelineResult>();
+    result->camera_id = kCameraId;
+    result->frame_number = frame;
+    result->result_metadata = HalCameraMetadata::Create(
+        /*entry_capacity*/ 1, /*data_capacity*/ 8);
+
+    auto buffer = std::make_unique<SensorBuffer>();
+    buffer->width = width;
+    buffer->height = height;
+    buffer->frame_number = frame;
+    buffer->camera_id = kCameraId;
+    buffer->format = HAL_PIXEL_FORMAT_RGBA_8888;
+    buffer->callback = callback;
+    buffer->plane.img.img = images[frame].data();
+    buffer->plane.img.stride = width * 4;
+    buffer->plane.img.buffer_size = images[frame].size();
+    auto buffers = std::make_unique<Buffers>();
+    buffers->push_back(std::move(buffer));
+
+    sensor_->SetCurrentRequest(std::move(settings), std::move(result),
+                               /*input_buffers*/ nullptr, std::move(buffers));
+  }
+
+  EXPECT_EQ(sensor_->Flush(), OK);
+  {
+    std::lock_guard<std::mutex> l(lock);
+    EXPECT_EQ(results, kFrameCount);
+  }
+
+  // Nothing left to wait for
+  EXPECT_EQ(sensor_->Flush(), OK);
+  ASSERT_EQ(sensor_->ShutDown(), OK);
+}
+
+// Buffer and result consumers that each take most of a frame duration must
+// not push the sensor off its frame cadence, even when their combined cost
+// exceeds the frame duration.
+TEST_F(EmulatedSensorTests, PipelineKeepsFrameCadenceUnderLoad) {
+  const uint32_t kFrameCount = 40;
+  const uint32_t kWarmupFrames = 4;
+  const uint32_t width = 320;
+  const uint32_t height = 240;
+
+  for (nsecs_t frame_duration : {ms2ns(33), ms2ns(16)}) {
+    sensor_ = new EmulatedSensor();
+    ASSERT_EQ(sensor_->StartUp(kCameraId, GetLogicalCharacteristics()), OK);
+
+    const nsecs_t load = frame_duration * 6 / 10;
+    std::mutex lock;
+    std::vector<nsecs_t> shutters;
+    std::vector<uint32_t> result_frames;
+    std::vector<uint32_t> buffer_frames;
+    HwlPipelineCallback callback = {
+        .process_pipeline_result =
+            [&](std::unique_ptr<HwlPipelineResult> result) {
+              SleepFor(load);
+              std::lock_guard<std::mutex> l(lock);
+              if (result->result_metadata.get() != nullptr) {
+                result_frames.push_back(result->frame_number);
+              } else {
+                EXPECT_EQ(result->output_buffers.size(), 1u);
+                EXPECT_EQ(result->output_buffers[0].status, BufferStatus::kOk);
+                buffer_frames.push_back(result->frame_number);
+              }
+            },
+        .notify =
+            [&](uint32_t /*pipeline_id*/, const NotifyMessage& msg) {
+              std::lock_guard<std::mutex> l(lock);
+              ASSERT_EQ(msg.type, MessageType::kShutter);
+              shutters.push_back(msg.message.shutter.timestamp_ns);
+            }};
+
+    std::vector<std::vector<uint8_t>> images(
+        kFrameCount, std::vector<uint8_t>(width * height * 4));
+    for (uint32_t frame = 0; frame < kFrameCount; frame++) {
+      EmulatedSensor::SensorSettings device_settings = {};
+      device_settings.exposure_time = EmulatedSensor::kDefaultExposureTime;
+      device_settings.frame_duration = frame_duration;
+      device_settings.gain = EmulatedSensor::kDefaultSensitivity;
+      auto settings = std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+      settings->emplace(kCameraId, device_settings);
+
+      auto result = std::make_unique<HwlPipelineResult>();
+      result->camera_id = kCameraId;
+      result->frame_number = frame;
+      result->result_metadata = HalCameraMetadata::Create(
+          /*entry_capacity*/ 1, /*data_capacity*/ 8);
+
+      auto buffer = std::make_unique<SensorBuffer>();
+      buffer->width = width;
+      buffer->height = height;
+      buffer->frame_number = frame;
+      buffer->camera_id = kCameraId;
+      buffer->format = HAL_PIXEL_FORMAT_RGBA_8888;
+      buffer->callback = callback;
+      buffer->plane.img.img = images[frame].data();
+      buffer->plane.img.stride = width * 4;
+      buffer->plane.img.buffer_size = images[frame].size();
+      auto buffers = std::make_unique<Buffers>();
+      buffers->push_back(std::move(buffer));
+
+      sensor_->SetCurrentRequest(std::move(settings), std::move(result),
+                                 /*input_buffers*/ nullptr,
+                                 std::move(buffers));
+      ASSERT_TRUE(sensor_->WaitForVSync(
+          EmulatedSensor::kSupportedFrameDurationRange[1]));
+    }
+    ASSERT_EQ(sensor_->ShutDown(), OK);
+
+    ASSERT_EQ(shutters.size(), kFrameCount);
+    ASSERT_EQ(result_frames.size(), kFrameCount);
+    ASSERT_EQ(buffer_frames.size(), kFrameCount);
+    for (uint32_t frame = 0; frame < kFrameCount; frame++) {
+      EXPECT_EQ(result_frames[frame], frame);
+      EXPECT_EQ(buffer_frames[frame], frame);
+    }
+
+    nsecs_t max_interval = 0;
+    for (uint32_t frame = kWarmupFrames + 1; frame < kFrameCount; frame++) {
+      max_interval =
+          std::max(max_interval, shutters[frame] - shutters[frame - 1]);
+    }
+    nsecs_t mean_interval =
+        (shutters[kFrameCount - 1] - shutters[kWarmupFrames]) /
+        (kFrameCount - kWarmupFrames - 1);
+    EXPECT_NEAR(mean_interval, frame_duration, frame_duration / 20)
+        << "frame duration: " << frame_duration;
+    EXPECT_LT(max_interval, frame_duration * 3 / 2)
+        << "frame duration: " << frame_duration;
+
+    auto timing = sensor_->GetFrameTimingStatistics();
+    EXPECT_GE(timing.frames, kFrameCount);
+    EXPECT_EQ(timing.end_jitter.count, timing.frames);
+    EXPECT_GT(timing.stage_cost[FrameScheduler::STAGE_RENDER], 0);
+    EXPECT_GT(timing.stage_cost[FrameScheduler::STAGE_RESULT], 0);
+  }
+}
+
+// Constrained high speed sessions must sustain the shorter frame durations
+// while the results are returned in bursts.
+TEST_F(EmulatedSensorTests, HighSpeedBurstsSustainFrameRate) {
+  const uint32_t kBurstCount = 8;
+  const uint32_t kMaxOverrunsPerBurst = 1;
+  const nsecs_t kMaxRateDeviationPercent = 10;
+  const uint32_t width = 640;
+  const uint32_t height = 480;
+
+  for (int32_t fps : {120, 240}) {
+    const nsecs_t frame_duration = s2ns(1) / fps;
+    const uint32_t batch_size = fps / 30;
+    const uint32_t frame_count = batch_size * kBurstCount;
+    sensor_ = new EmulatedSensor();
+    ASSERT_EQ(sensor_->StartUp(kCameraId, GetLogicalCharacteristics()), OK);
+    sensor_->SetHighSpeedMode(batch_size);
+
+    std::mutex lock;
+    std::vector<nsecs_t> shutters;
+    // Shutters notified by the time each result arrives
+    std::vector<size_t> result_shutters;
+    std::vector<uint32_t> result_frames;
+    uint32_t buffer_count = 0;
+    HwlPipelineCallback callback = {
+        .process_pipeline_result =
+            [&](std::unique_ptr<HwlPipelineResult> result) {
+              std::lock_guard<std::mutex> l(lock);
+              if (result->result_metadata.get() != nullptr) {
+                result_frames.push_back(result->frame_number);
+                result_shutters.push_back(shutters.size());
+              } else {
+                for (const auto& buffer : result->output_buffers) {
+                  EXPECT_EQ(buffer.status, BufferStatus::kOk);
+                  buffer_count++;
+                }
+              }
+            },
+        .notify =
+            [&](uint32_t /*pipeline_id*/, const NotifyMessage& msg) {
+              std::lock_guard<std::mutex> l(lock);
+              ASSERT_EQ(msg.type, MessageType::kShutter);
+              shutters.push_back(msg.message.shutter.timestamp_ns);
+            }};
+
+    // Preview and recording outputs
+    std::vector<YUV420Image> images;
+    for (uint32_t i = 0; i < frame_count * 2; i++) {
+      images.push_back(CreateImage(width, height, NV21));
+    }
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+      EmulatedSensor::SensorSettings device_settings = {};
+      device_settings.exposure_time = frame_duration / 2;
+      device_settings.frame_duration = frame_duration;
+      device_settings.gain = EmulatedSensor::kDefaultSensitivity;
+      device_settings.edge_mode = ANDROID_EDGE_MODE_HIGH_QUALITY;
+      auto settings = std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+      settings->emplace(kCameraId, device_settings);
+
+      auto result = std::make_unique<HwlPipelineResult>();
+      result->camera_id = kCameraId;
+      result->frame_number = frame;
+      result->result_metadata = HalCameraMetadata::Create(
+          /*entry_capacity*/ 1, /*data_capacity*/ 8);
+
+      auto buffers = std::make_unique<Buffers>();
+      for (uint32_t i = 0; i < 2; i++) {
+        auto buffer = std::make_unique<SensorBuffer>();
+        buffer->width = width;
+        buffer->height = height;
+        buffer->frame_number = frame;
+        buffer->camera_id = kCameraId;
+        buffer->format = HAL_PIXEL_FORMAT_YCBCR_420_888;
+        buffer->callback = callback;
+        buffer->plane.img_y_crcb = images[frame * 2 + i].planes;
+        buffers->push_back(std::move(buffer));
+      }
+
+      sensor_->SetCurrentRequest(std::move(settings), std::move(result),
+                                 /*input_buffers*/ nullptr,
+                                 std::move(buffers));
+      ASSERT_TRUE(sensor_->WaitForVSync(
+          EmulatedSensor::kSupportedFrameDurationRange[1]));
+    }
+    ASSERT_EQ(sensor_->ShutDown(), OK);
+    auto timing = sensor_->GetFrameTimingStatistics();
+
+    ASSERT_EQ(shutters.size(), frame_count);
+    ASSERT_EQ(result_frames.size(), frame_count);
+    EXPECT_EQ(buffer_count, frame_count * 2);
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+      EXPECT_EQ(result_frames[frame], frame);
+      // Results wait for the last frame of their burst
+      uint32_t burst_end = (frame / batch_size + 1) * batch_size;
+      EXPECT_GE(result_shutters[frame], burst_end) << "frame: " << frame;
+    }
+
+    // Shutter timestamps follow the frame deadlines, so consecutive frames
+    // are exactly one frame duration apart unless the schedule restarted
+    // after an overrun or an idle frame ran in between because the next
+    // request was late. Wall clock timing is not checked since it depends on
+    // the load.
+    uint64_t off_schedule_frames = 0;
+    for (uint32_t frame = 1; frame < frame_count; frame++) {
+      nsecs_t interval = shutters[frame] - shutters[frame - 1];
+      EXPECT_GE(interval, frame_duration) << "fps: " << fps;
+      if (interval != frame_duration) {
+        off_schedule_frames++;
+      }
+    }
+    EXPECT_LE(off_schedule_frames,
+              timing.overruns + (timing.frames - frame_count))
+        << "fps: " << fps;
+
+    // Every overrun restarts the schedule late, so the delivered shutter rate
+    // must stay close to 'fps' and overruns must remain rare.
+    nsecs_t shutter_span = shutters.back() - shutters.front();
+    EXPECT_LE(shutter_span, (frame_count - 1) * frame_duration *
+                                (100 + kMaxRateDeviationPercent) / 100)
+        << "fps: " << fps;
+    EXPECT_LE(timing.overruns, kMaxOverrunsPerBurst * kBurstCount)
+        << "fps: " << fps;
+  }
+}
+
+TEST_F(EmulatedSensorTests, HighSpeedBatchSizeFollowsSessionFramerate) {
+  chars_.high_speed_video_configs = {
+      {.width = 640, .height = 480, .min_fps = 30, .max_fps = 120,
+       .batch_size_max = 4},
+      {.width = 640, .height = 480, .min_fps = 240, .max_fps = 240,
+       .batch_size_max = 8}};
+  StreamConfiguration config;
+  config.operation_mode =
+      google_camera_hal::StreamConfigurationMode::kConstrainedHighSpeed;
+  config.streams.resize(2);
+  for (auto& stream : config.streams) {
+    stream.width = 640;
+    stream.height = 480;
+  }
+
+  // The largest burst is picked without a session framerate
+  EXPECT_EQ(EmulatedSensor::GetHighSpeedBatchSize(config, chars_), 8u);
+
+  config.session_params = HalCameraMetadata::Create(/*entry_capacity*/ 1,
+                                                    /*data_capacity*/ 8);
+  int32_t fps_range[] = {30, 120};
+  ASSERT_EQ(config.session_params->Set(ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+                                       fps_range, 2),
+            OK);
+  EXPECT_EQ(EmulatedSensor::GetHighSpeedBatchSize(config, chars_), 4u);
+
+  fps_range[0] = 60;
+  ASSERT_EQ(config.session_params->Set(ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+                                       fps_range, 2),
+            OK);
+  EXPECT_EQ(EmulatedSensor::GetHighSpeedBatchSize(config, chars_), 0u);
+
+  config.session_params.reset();
+  config.streams[0].width = 1280;
+  config.streams[0].height = 720;
+  EXPECT_EQ(EmulatedSensor::GetHighSpeedBatchSize(config, chars_), 0u);
+}
+
+// A stalled result consumer must not stall the sensor before the whole
+// pipeline depth is in flight, all frames are still returned in order.
+TEST_F(EmulatedSensorTests, PipelineDepthAbsorbsStalledConsumer) {
+  const uint32_t kPipelineDepth = 8;
+  const uint32_t kFrameCount = kPipelineDepth * 2;
+  const uint32_t width = 64;
+  const uint32_t height = 48;
+  auto logical_chars = GetLogicalCharacteristics();
+  logical_chars->begin()->second.max_pipeline_depth = kPipelineDepth;
+  sensor_ = new EmulatedSensor();
+  ASSERT_EQ(sensor_->StartUp(kCameraId, std::move(logical_chars)), OK);
+
+  std::mutex lock;
+  std::condition_variable cond;
+  bool stalled = true;
+  bool watchdog_fired = false;
+  std::vector<uint32_t> result_frames;
+  HwlPipelineCallback callback = {
+      .process_pipeline_result =
+          [&](std::unique_ptr<HwlPipelineResult> result) {
+            if (result->result_metadata.get() == nullptr) {
+              return;
+            }
+            std::unique_lock<std::mutex> l(lock);
+            cond.wait(l, [&] { return !stalled; });
+            result_frames.push_back(result->frame_number);
+          },
+      .notify = [](uint32_t /*pipeline_id*/, const NotifyMessage& /*msg*/) {}};
+
+  // Releases the consumer in case the sensor stalls, which would otherwise
+  // block the submission below forever.
+  std::thread watchdog([&] {
+    std::unique_lock<std::mutex> l(lock);
+    if (!cond.wait_for(l, std::chrono::seconds(5), [&] { return !stalled; })) {
+      watchdog_fired = true;
+      stalled = false;
+      cond.notify_all();
+    }
+  });
+
+  std::vector<std::vector<uint8_t>> images(
+      kFrameCount, std::vector<uint8_t>(width * height * 4));
+  for (uint32_t frame = 0; frame < kFrameCount; frame++) {
+    EmulatedSensor::SensorSettings device_settings = {};
+    device_settings.exposure_time = EmulatedSensor::kDefaultExposureTime;
+    device_settings.frame_duration =
+        EmulatedSensor::kSupportedFrameDurationRange[0];
+    device_settings.gain = EmulatedSensor::kDefaultSensitivity;
+    auto settings = std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+    settings->emplace(kCameraId, device_settings);
+
+    auto result = std::make_unique<HwlPipelineResult>();
+    result->camera_id = kCameraId;
+    result->frame_number = frame;
+    result->result_metadata = HalCameraMetadata::Create(
+        /*entry_capacity*/ 1, /*data_capacity*/ 8);
+
+    auto buffer = std::make_unique<SensorBuffer>();
+    buffer->width = width;
+    buffer->height = height;
+    buffer->frame_number = frame;
+    buffer->camera_id = kCameraId;
+    buffer->format = HAL_PIXEL_FORMAT_RGBA_8888;
+    buffer->callback = callback;
+    buffer->plane.img.img = images[frame].data();
+    buffer->plane.img.stride = width * 4;
+    buffer->plane.img.buffer_size = images[frame].size();
+    auto buffers = std::make_unique<Buffers>();
+    buffers->push_back(std::move(buffer));
+
+    sensor_->SetCurrentRequest(std::move(settings), std::move(result),
+                               /*input_buffers*/ nullptr, std::move(buffers));
+    // No early return, 'watchdog' must be joined first
+    bool vsync =
+        sensor_->WaitForVSync(EmulatedSensor::kSupportedFrameDurationRange[1]);
+    EXPECT_TRUE(vsync);
+    if (!vsync) {
+      break;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> l(lock);
+    EXPECT_FALSE(watchdog_fired);
+    stalled = false;
+  }
+  cond.notify_all();
+  watchdog.join();
+  ASSERT_EQ(sensor_->ShutDown(), OK);
+
+  ASSERT_EQ(result_frames.size(), kFrameCount);
+  for (uint32_t frame = 0; frame < kFrameCount; frame++) {
+    EXPECT_EQ(result_frames[frame], frame);
+  }
+}
+
+}  // namespace android
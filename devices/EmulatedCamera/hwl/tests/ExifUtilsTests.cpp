@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ExifUtilsTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include "EmulatedSensor.h"
+#include "utils/ExifUtils.h"
+
+namespace android {
+
+class ExifUtilsTests : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    chars_.width = 640;
+    chars_.height = 480;
+    chars_.physical_size[0] = 4;
+    chars_.physical_size[1] = 3;
+  }
+
+  static std::unique_ptr<HalCameraMetadata> CreateResultMetadata(bool gps) {
+    auto metadata = HalCameraMetadata::Create(/*entry_capacity*/ 8,
+                                              /*data_capacity*/ 128);
+    const float focal_length = 4.38f;
+    const int64_t exposure_time = 10000000;
+    const int32_t thumbnail_size[] = {160, 120};
+    const int64_t timestamp = 1234;
+    const uint8_t flash_state = ANDROID_FLASH_STATE_UNAVAILABLE;
+    const uint8_t ae_mode = ANDROID_CONTROL_AE_MODE_ON;
+    metadata->Set(ANDROID_LENS_FOCAL_LENGTH, &focal_length, 1);
+    metadata->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1);
+    metadata->Set(ANDROID_JPEG_THUMBNAIL_SIZE, thumbnail_size, 2);
+    metadata->Set(ANDROID_FLASH_STATE, &flash_state, 1);
+    metadata->Set(ANDROID_CONTROL_AE_MODE, &ae_mode, 1);
+    // Not consumed by the Exif generator
+    metadata->Set(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
+    if (gps) {
+      const double coordinates[] = {37.42, -122.08, 30.0};
+      metadata->Set(ANDROID_JPEG_GPS_COORDINATES, coordinates, 3);
+    }
+
+    return metadata;
+  }
+
+  static unsigned int GenerateApp1(ExifUtils* exif_utils,
+                                   const HalCameraMetadata& metadata) {
+    if (!exif_utils->BeginImage() ||
+        !exif_utils->SetFromMetadata(metadata, /*image_width*/ 640,
+                                     /*image_height*/ 480) ||
+        !exif_utils->GenerateApp1(/*thumbnail_buffer*/ nullptr,
+                                  /*size*/ 0)) {
+      return 0;
+    }
+
+    return exif_utils->GetApp1Length();
+  }
+
+  SensorCharacteristics chars_;
+};
+
+TEST_F(ExifUtilsTests, PoolRecyclesEntries) {
+  auto pool = ExifUtilsPool::Create(chars_);
+  auto metadata = CreateResultMetadata(/*gps*/ false);
+  ExifUtilsPool::Entry* entry = nullptr;
+  {
+    auto lease = pool->Acquire(*metadata);
+    ASSERT_NE(lease.get(), nullptr);
+    ASSERT_NE(lease->exif_utils.get(), nullptr);
+    entry = lease.get();
+    auto concurrent_lease = pool->Acquire(*metadata);
+    ASSERT_NE(concurrent_lease.get(), nullptr);
+    EXPECT_NE(concurrent_lease.get(), entry);
+  }
+  EXPECT_EQ(pool->GetEntryCount(), 2u);
+
+  auto lease = pool->Acquire(*metadata);
+  EXPECT_EQ(lease.get(), entry);
+  EXPECT_EQ(pool->GetEntryCount(), 2u);
+}
+
+TEST_F(ExifUtilsTests, SnapshotFollowsResultMetadata) {
+  auto pool = ExifUtilsPool::Create(chars_);
+  camera_metadata_ro_entry_t entry;
+  {
+    auto lease = pool->Acquire(*CreateResultMetadata(/*gps*/ true));
+    ASSERT_NE(lease.get(), nullptr);
+    ASSERT_EQ(lease->metadata->Get(ANDROID_JPEG_GPS_COORDINATES, &entry), OK);
+    EXPECT_EQ(entry.count, 3u);
+    ASSERT_EQ(lease->metadata->Get(ANDROID_JPEG_THUMBNAIL_SIZE, &entry), OK);
+    EXPECT_EQ(entry.data.i32[0], 160);
+    EXPECT_NE(lease->metadata->Get(ANDROID_SENSOR_TIMESTAMP, &entry), OK);
+  }
+
+  // The recycled snapshot must not keep tags of the previous capture
+  auto lease = pool->Acquire(*CreateResultMetadata(/*gps*/ false));
+  ASSERT_NE(lease.get(), nullptr);
+  EXPECT_NE(lease->metadata->Get(ANDROID_JPEG_GPS_COORDINATES, &entry), OK);
+  EXPECT_EQ(lease->metadata->Get(ANDROID_LENS_FOCAL_LENGTH, &entry), OK);
+  EXPECT_EQ(pool->GetEntryCount(), 1u);
+}
+
+TEST_F(ExifUtilsTests, ImagesDropStaleTags) {
+  auto gps_metadata = CreateResultMetadata(/*gps*/ true);
+  auto metadata = CreateResultMetadata(/*gps*/ false);
+  std::unique_ptr<ExifUtils> reused(ExifUtils::Create(chars_));
+  std::unique_ptr<ExifUtils> fresh(ExifUtils::Create(chars_));
+
+  auto gps_length = GenerateApp1(reused.get(), *gps_metadata);
+  auto reused_length = GenerateApp1(reused.get(), *metadata);
+  auto fresh_length = GenerateApp1(fresh.get(), *metadata);
+  ASSERT_GT(fresh_length, 0u);
+  EXPECT_GT(gps_length, fresh_length);
+  EXPECT_EQ(reused_length, fresh_length);
+
+  // Images without changes keep producing the same segment
+  EXPECT_EQ(GenerateApp1(reused.get(), *metadata), fresh_length);
+}
+
+}  // namespace android
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FenceWaiterTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "utils/FenceWaiter.h"
+
+namespace android {
+
+// Pipes stand in for sync fences, the read end polls readable once the
+// write end has been written to.
+class FenceWaiterTests : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (auto& pipe_fds : pipes_) {
+      ASSERT_EQ(pipe(pipe_fds), 0);
+    }
+  }
+
+  void TearDown() override {
+    for (auto& pipe_fds : pipes_) {
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+    }
+  }
+
+  void Signal(size_t idx) {
+    char value = 1;
+    ASSERT_EQ(write(pipes_[idx][1], &value, sizeof(value)), 1);
+  }
+
+  std::vector<int> GetFences() const {
+    return {pipes_[0][0], pipes_[1][0], pipes_[2][0]};
+  }
+
+  int pipes_[3][2];
+};
+
+TEST_F(FenceWaiterTests, ReportsSignaledFences) {
+  FenceWaiter waiter;
+  std::vector<FenceWaiter::FenceStatus> status;
+  Signal(1);
+  ASSERT_EQ(waiter.Wait(GetFences(), ms2ns(100), &status), OK);
+  ASSERT_EQ(status.size(), 3u);
+  EXPECT_EQ(status[0], FenceWaiter::FENCE_PENDING);
+  EXPECT_EQ(status[1], FenceWaiter::FENCE_SIGNALED);
+  EXPECT_EQ(status[2], FenceWaiter::FENCE_PENDING);
+}
+
+TEST_F(FenceWaiterTests, InvalidFencesFail) {
+  FenceWaiter waiter;
+  std::vector<FenceWaiter::FenceStatus> status;
+  auto fences = GetFences();
+  fences[2] = 1 << 20;
+  ASSERT_EQ(waiter.Wait(fences, ms2ns(100), &status), OK);
+  EXPECT_EQ(status[2], FenceWaiter::FENCE_ERROR);
+  EXPECT_EQ(waiter.Wait(fences, 0, nullptr), BAD_VALUE);
+}
+
+TEST_F(FenceWaiterTests, TimesOutWithPendingFences) {
+  FenceWaiter waiter;
+  std::vector<FenceWaiter::FenceStatus> status;
+  nsecs_t start = systemTime();
+  ASSERT_EQ(waiter.Wait(GetFences(), ms2ns(20), &status), OK);
+  EXPECT_GE(systemTime() - start, ms2ns(20));
+  for (auto fence_status : status) {
+    EXPECT_EQ(fence_status, FenceWaiter::FENCE_PENDING);
+  }
+}
+
+TEST_F(FenceWaiterTests, WakeInterruptsWait) {
+  FenceWaiter waiter;
+  std::vector<FenceWaiter::FenceStatus> status;
+  std::thread waker([&waiter] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    waiter.Wake();
+  });
+  nsecs_t start = systemTime();
+  ASSERT_EQ(waiter.Wait(GetFences(), /*timeout*/ -1, &status), OK);
+  EXPECT_LT(systemTime() - start, seconds_to_nanoseconds(1));
+  waker.join();
+
+  // Wakeups before the wait are not lost, but are consumed by it
+  waiter.Wake();
+  ASSERT_EQ(waiter.Wait({}, -1, &status), OK);
+  EXPECT_TRUE(status.empty());
+  start = systemTime();
+  ASSERT_EQ(waiter.Wait({}, ms2ns(20), &status), OK);
+  EXPECT_GE(systemTime() - start, ms2ns(20));
+}
+
+}  // namespace android
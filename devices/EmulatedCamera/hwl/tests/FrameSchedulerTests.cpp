@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameSchedulerTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include "utils/FrameScheduler.h"
+
+namespace android {
+
+static void BusyWait(nsecs_t duration) {
+  nsecs_t end = systemTime() + duration;
+  while (systemTime() < end) {
+  }
+}
+
+TEST(FrameSchedulerTests, DeadlinesDoNotDrift) {
+  const nsecs_t kFrameDuration = ms2ns(10);
+  const size_t kFrameCount = 50;
+  FrameScheduler scheduler;
+  nsecs_t first_start = 0;
+  nsecs_t next_start = 0;
+  uint64_t overruns = 0;
+  for (size_t i = 0; i < kFrameCount; i++) {
+    nsecs_t start = scheduler.BeginFrame(kFrameDuration);
+    uint64_t frame_overruns = scheduler.GetStatistics().overruns;
+    if (i == 0) {
+      first_start = start;
+    } else if (frame_overruns == overruns) {
+      // Deadlines follow each other exactly, regardless of the wakeup latency
+      // and the amount of work in each frame.
+      EXPECT_EQ(start, next_start);
+    } else {
+      // Only a thread preempted for more than a frame restarts the schedule,
+      // which never moves a frame ahead of its deadline.
+      EXPECT_GT(start, next_start);
+    }
+    overruns = frame_overruns;
+    next_start = start + kFrameDuration;
+    BusyWait(ms2ns(i % 7));
+    scheduler.EndFrame(start + kFrameDuration);
+  }
+
+  // Frames never end ahead of their deadline. The upper bound depends on the
+  // load and isn't checked.
+  EXPECT_GE(systemTime() - first_start, kFrameCount * kFrameDuration);
+
+  auto stats = scheduler.GetStatistics();
+  EXPECT_EQ(stats.frames, kFrameCount);
+  EXPECT_LT(stats.overruns, kFrameCount);
+  EXPECT_EQ(stats.start_jitter.count, kFrameCount);
+  EXPECT_EQ(stats.end_jitter.count, kFrameCount);
+}
+
+TEST(FrameSchedulerTests, LateFramesCatchUp) {
+  const nsecs_t kFrameDuration = ms2ns(10);
+  FrameScheduler scheduler;
+  nsecs_t start = scheduler.BeginFrame(kFrameDuration);
+  scheduler.EndFrame(start + kFrameDuration);
+
+  // Less than a frame late, the next frame is shortened. Preemption can
+  // still push it past a full frame, which has to restart the schedule.
+  BusyWait(ms2ns(4));
+  nsecs_t next_start = scheduler.BeginFrame(kFrameDuration);
+  uint64_t overruns = scheduler.GetStatistics().overruns;
+  if (overruns == 0) {
+    EXPECT_EQ(next_start, start + kFrameDuration);
+  } else {
+    EXPECT_EQ(overruns, 1u);
+    EXPECT_GT(next_start, start + kFrameDuration);
+  }
+  scheduler.EndFrame(next_start + kFrameDuration);
+
+  // More than a frame late, the schedule restarts
+  BusyWait(ms2ns(25));
+  nsecs_t now = systemTime();
+  start = scheduler.BeginFrame(kFrameDuration);
+  EXPECT_GE(start, now);
+  EXPECT_EQ(scheduler.GetStatistics().overruns, overruns + 1);
+}
+
+TEST(FrameSchedulerTests, JitterHistogramBuckets) {
+  FrameScheduler::JitterHistogram histogram;
+  histogram.Add(0);
+  histogram.Add(us2ns(49));
+  histogram.Add(us2ns(50));
+  histogram.Add(-us2ns(300));
+  histogram.Add(ms2ns(100));
+
+  EXPECT_EQ(histogram.count, 5u);
+  EXPECT_EQ(histogram.buckets[0], 2u);
+  EXPECT_EQ(histogram.buckets[1], 1u);
+  EXPECT_EQ(histogram.buckets[3], 1u);
+  const size_t kLastBucket = FrameScheduler::JitterHistogram::kBucketCount - 1;
+  EXPECT_EQ(histogram.buckets[kLastBucket], 1u);
+  EXPECT_EQ(histogram.max, ms2ns(100));
+  EXPECT_EQ(histogram.total,
+            us2ns(49) + us2ns(50) + us2ns(300) + ms2ns(100));
+}
+
+TEST(FrameSchedulerTests, StageCostFollowsSamples) {
+  FrameScheduler scheduler;
+  EXPECT_EQ(scheduler.GetStageCost(FrameScheduler::STAGE_RESULT), 0);
+  scheduler.RecordStageCost(FrameScheduler::STAGE_RESULT, ms2ns(8));
+  EXPECT_EQ(scheduler.GetStageCost(FrameScheduler::STAGE_RESULT), ms2ns(8));
+
+  for (size_t i = 0; i < 100; i++) {
+    scheduler.RecordStageCost(FrameScheduler::STAGE_RESULT, ms2ns(2));
+  }
+  EXPECT_NEAR(scheduler.GetStageCost(FrameScheduler::STAGE_RESULT), ms2ns(2),
+              us2ns(10));
+  EXPECT_EQ(scheduler.GetStageCost(FrameScheduler::STAGE_RENDER), 0);
+}
+
+}  // namespace android
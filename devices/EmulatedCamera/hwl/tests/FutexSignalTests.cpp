@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FutexSignalTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "utils/FutexSignal.h"
+
+namespace android {
+
+TEST(FutexSignalTests, TimesOutWithoutSignal) {
+  FutexSignal signal;
+  auto start = systemTime(SYSTEM_TIME_MONOTONIC);
+  EXPECT_FALSE(signal.Wait(ms2ns(20)));
+  EXPECT_GE(systemTime(SYSTEM_TIME_MONOTONIC) - start, ms2ns(20));
+  EXPECT_FALSE(signal.Wait(0));
+}
+
+TEST(FutexSignalTests, PastSignalsDoNotWake) {
+  FutexSignal signal;
+  signal.Signal();
+  EXPECT_EQ(signal.GetCount(), 1u);
+  EXPECT_FALSE(signal.Wait(ms2ns(10)));
+}
+
+TEST(FutexSignalTests, SignalRacingTheWaitIsNotLost) {
+  FutexSignal signal;
+  auto count = signal.GetCount();
+  signal.Signal();
+  // The count changed before the wait started
+  EXPECT_TRUE(signal.WaitForChange(count, ms2ns(100)));
+}
+
+TEST(FutexSignalTests, SignalWakesAllWaiters) {
+  const size_t waiter_count = 4;
+  FutexSignal signal;
+  std::atomic_size_t started = 0, woken = 0;
+  std::vector<std::thread> waiters;
+  for (size_t i = 0; i < waiter_count; i++) {
+    waiters.emplace_back([&] {
+      auto count = signal.GetCount();
+      started++;
+      if (signal.WaitForChange(count, ms2ns(5000))) {
+        woken++;
+      }
+    });
+  }
+
+  while (started < waiter_count) {
+    std::this_thread::yield();
+  }
+  signal.Signal();
+  for (auto& it : waiters) {
+    it.join();
+  }
+
+  EXPECT_EQ(woken, waiter_count);
+}
+
+TEST(FutexSignalTests, WaiterFollowsEverySignal) {
+  const uint32_t signal_count = 1000;
+  FutexSignal signal;
+  std::atomic_bool done = false;
+  std::thread signaler([&] {
+    while (!done) {
+      signal.Signal();
+      std::this_thread::yield();
+    }
+  });
+
+  auto count = signal.GetCount();
+  for (uint32_t i = 0; i < signal_count; i++) {
+    ASSERT_TRUE(signal.WaitForChange(count, ms2ns(5000)));
+    auto next = signal.GetCount();
+    EXPECT_NE(next, count);
+    count = next;
+  }
+  done = true;
+  signaler.join();
+}
+
+}  // namespace android
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ImportedBufferCacheTests"
+#include <log/log.h>
+
+#include <cutils/native_handle.h>
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "utils/ImportedBufferCache.h"
+
+namespace android {
+
+// Empty native handles can be imported without a mapper
+class ImportedBufferCacheTests : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (size_t i = 0; i < kBufferCount; i++) {
+      handles_.push_back(native_handle_create(/*numFds*/ 0, /*numInts*/ 0));
+    }
+  }
+
+  void TearDown() override {
+    for (auto handle : handles_) {
+      native_handle_delete(handle);
+    }
+  }
+
+  static constexpr size_t kBufferCount = 20;
+  std::vector<native_handle_t*> handles_;
+};
+
+TEST_F(ImportedBufferCacheTests, RepeatedBuffersHit) {
+  ImportedBufferCache cache;
+  std::vector<std::shared_ptr<ImportedBufferCache::ImportedBuffer>> imports;
+  for (size_t i = 0; i < 4; i++) {
+    imports.push_back(cache.Import(/*stream_id*/ 1, i + 1, handles_[i]));
+    ASSERT_NE(imports.back().get(), nullptr);
+  }
+  for (size_t frame = 0; frame < 40; frame++) {
+    auto i = frame % 4;
+    EXPECT_EQ(cache.Import(/*stream_id*/ 1, i + 1, handles_[i]), imports[i]);
+  }
+  // Streams are cached separately
+  EXPECT_NE(cache.Import(/*stream_id*/ 2, 1, handles_[0]), imports[0]);
+
+  auto stats = cache.GetStatistics();
+  ASSERT_EQ(stats.size(), 2u);
+  EXPECT_EQ(stats[1].hits, 40u);
+  EXPECT_EQ(stats[1].misses, 4u);
+  EXPECT_EQ(stats[1].cached_buffers, 4u);
+  EXPECT_EQ(stats[2].hits, 0u);
+  EXPECT_EQ(stats[2].misses, 1u);
+}
+
+TEST_F(ImportedBufferCacheTests, ChangedHandlesAreReimported) {
+  ImportedBufferCache cache;
+  auto imported = cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[0]);
+  auto reimported = cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[1]);
+  EXPECT_NE(imported, reimported);
+  EXPECT_EQ(cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[1]),
+            reimported);
+
+  // Buffers without an id are never cached
+  auto uncached = cache.Import(/*stream_id*/ 1, /*buffer_id*/ 0, handles_[2]);
+  EXPECT_NE(cache.Import(/*stream_id*/ 1, /*buffer_id*/ 0, handles_[2]),
+            uncached);
+
+  auto stats = cache.GetStatistics()[1];
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 4u);
+  EXPECT_EQ(stats.cached_buffers, 1u);
+}
+
+TEST_F(ImportedBufferCacheTests, LeastRecentlyUsedBuffersAreEvicted) {
+  ImportedBufferCache cache;
+  auto first = cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[0]);
+  for (size_t i = 1; i < kBufferCount; i++) {
+    cache.Import(/*stream_id*/ 1, i + 1, handles_[i]);
+  }
+
+  auto stats = cache.GetStatistics()[1];
+  EXPECT_EQ(stats.evictions + stats.cached_buffers, kBufferCount);
+  EXPECT_GT(stats.evictions, 0u);
+  // Evicted imports stay valid while referenced
+  EXPECT_EQ(first.use_count(), 1);
+  EXPECT_NE(cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[0]),
+            first);
+}
+
+TEST_F(ImportedBufferCacheTests, RemoveDropsImports) {
+  ImportedBufferCache cache;
+  auto removed = cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[0]);
+  auto kept = cache.Import(/*stream_id*/ 1, /*buffer_id*/ 2, handles_[1]);
+  cache.Remove(/*stream_id*/ 1, /*buffer_id*/ 1);
+  // Unknown streams and buffers are ignored
+  cache.Remove(/*stream_id*/ 1, /*buffer_id*/ 3);
+  cache.Remove(/*stream_id*/ 2, /*buffer_id*/ 1);
+  EXPECT_EQ(removed.use_count(), 1);
+  EXPECT_EQ(cache.GetStatistics()[1].cached_buffers, 1u);
+
+  EXPECT_EQ(cache.Import(/*stream_id*/ 1, /*buffer_id*/ 2, handles_[1]), kept);
+  EXPECT_NE(cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[0]),
+            removed);
+  auto stats = cache.GetStatistics();
+  EXPECT_EQ(stats.size(), 1u);
+  EXPECT_EQ(stats[1].hits, 1u);
+  EXPECT_EQ(stats[1].misses, 3u);
+}
+
+TEST_F(ImportedBufferCacheTests, ClearDropsImports) {
+  ImportedBufferCache cache;
+  auto imported = cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[0]);
+  EXPECT_EQ(imported.use_count(), 2);
+  cache.Clear();
+  EXPECT_EQ(imported.use_count(), 1);
+  EXPECT_EQ(cache.GetStatistics()[1].cached_buffers, 0u);
+
+  EXPECT_NE(cache.Import(/*stream_id*/ 1, /*buffer_id*/ 1, handles_[0]),
+            imported);
+  auto stats = cache.GetStatistics()[1];
+  EXPECT_EQ(stats.misses, 2u);
+  EXPECT_EQ(stats.cached_buffers, 1u);
+}
+
+}  // namespace android
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "JpegCompressorTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <hardware/camera3.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "JpegCompressor.h"
+
+namespace android {
+
+class JpegCompressorTests : public ::testing::Test {
+ protected:
+  struct YUV420Image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> buffer;
+    YCbCrPlanes planes;
+  };
+
+  void SetUp() override {
+    compressor_ = std::make_unique<JpegCompressor>();
+  }
+
+  static YUV420Image CreateImage(uint32_t width, uint32_t height) {
+    YUV420Image image;
+    image.width = width;
+    image.height = height;
+    uint32_t cbcr_width = (width + 1) / 2;
+    uint32_t cbcr_height = (height + 1) / 2;
+    image.buffer.resize(width * height + cbcr_width * cbcr_height * 2);
+    image.planes = {.img_y = image.buffer.data(),
+                    .img_cb = image.buffer.data() + width * height,
+                    .img_cr = image.buffer.data() + width * height +
+                              cbcr_width * cbcr_height,
+                    .y_stride = width,
+                    .cbcr_stride = cbcr_width,
+                    .cbcr_step = 1};
+    // Smooth gradients with some texture, so that every strip has distinct
+    // DC levels and non-trivial AC coefficients.
+    for (uint32_t y = 0; y < height; y++) {
+      for (uint32_t x = 0; x < width; x++) {
+        image.planes.img_y[y * width + x] = (x + 2 * y + (x * y) % 23) & 0xFF;
+      }
+    }
+    for (uint32_t y = 0; y < cbcr_height; y++) {
+      for (uint32_t x = 0; x < cbcr_width; x++) {
+        image.planes.img_cb[y * cbcr_width + x] = (3 * x + y) & 0xFF;
+        image.planes.img_cr[y * cbcr_width + x] = (x + 5 * y) & 0xFF;
+      }
+    }
+
+    return image;
+  }
+
+  size_t CompressStrips(const YUV420Image& image, size_t strip_count,
+                        std::vector<uint8_t>* output) {
+    output->resize(image.width * image.height * 2);
+    return compressor_->CompressYUV420Strips(
+        {.output_buffer = output->data(),
+         .output_buffer_size = output->size(),
+         .yuv_planes = image.planes,
+         .width = image.width,
+         .height = image.height,
+         .app1_buffer = nullptr,
+         .app1_buffer_size = 0},
+        strip_count, nullptr);
+  }
+
+  size_t CompressWithApp1(const YUV420Image& image,
+                          const std::vector<uint8_t>& app1,
+                          std::vector<uint8_t>* output) {
+    output->resize(image.width * image.height * 2);
+    return compressor_->CompressYUV420Frame(
+        {.output_buffer = output->data(),
+         .output_buffer_size = output->size(),
+         .yuv_planes = image.planes,
+         .width = image.width,
+         .height = image.height,
+         .app1_buffer = app1.data(),
+         .app1_buffer_size = app1.size()});
+  }
+
+  // Returns the buffers of the recycled strips of each job.
+  std::vector<std::vector<const uint8_t*>> GetFreeStripBuffers() {
+    std::lock_guard<std::mutex> lock(compressor_->strips_mutex_);
+    std::vector<std::vector<const uint8_t*>> ret;
+    for (const auto& strips : compressor_->free_strips_) {
+      ret.emplace_back();
+      for (const auto& strip : strips) {
+        ret.back().push_back(strip.data());
+      }
+    }
+
+    return ret;
+  }
+
+  static size_t InsertApp1(std::vector<uint8_t>* output, size_t encoded_size,
+                           const std::vector<uint8_t>& app1) {
+    return JpegCompressor::InsertApp1(output->data(), output->size(),
+                                      encoded_size, app1.data(), app1.size());
+  }
+
+  // Returns the decoded interleaved YCbCr samples, empty on failure.
+  static std::vector<uint8_t> Decode(const uint8_t* data, size_t size,
+                                     uint32_t* width, uint32_t* height) {
+    std::vector<uint8_t> ret;
+    jpeg_decompress_struct dinfo;
+    jpeg_error_mgr jerr;
+    dinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&dinfo);
+    jpeg_mem_src(&dinfo, data, size);
+    if (jpeg_read_header(&dinfo, TRUE) == JPEG_HEADER_OK) {
+      dinfo.out_color_space = JCS_YCbCr;
+      jpeg_start_decompress(&dinfo);
+      *width = dinfo.output_width;
+      *height = dinfo.output_height;
+      size_t row_size = dinfo.output_width * dinfo.output_components;
+      ret.resize(row_size * dinfo.output_height);
+      while (dinfo.output_scanline < dinfo.output_height) {
+        JSAMPROW row = ret.data() + dinfo.output_scanline * row_size;
+        jpeg_read_scanlines(&dinfo, &row, 1);
+      }
+      jpeg_finish_decompress(&dinfo);
+    }
+    jpeg_destroy_decompress(&dinfo);
+
+    return ret;
+  }
+
+  std::unique_ptr<JpegCompressor> compressor_;
+};
+
+TEST_F(JpegCompressorTests, StripsDecodeIdenticalToSingleStrip) {
+  const uint32_t sizes[][2] = {{1920, 1080}, {1001, 777}, {640, 480}};
+  const size_t strip_counts[] = {2, 3, 7, 9};
+  for (const auto& size : sizes) {
+    auto image = CreateImage(size[0], size[1]);
+    std::vector<uint8_t> reference;
+    size_t reference_size = CompressStrips(image, 1, &reference);
+    ASSERT_GT(reference_size, 0u);
+    uint32_t reference_width = 0, reference_height = 0;
+    auto reference_pixels = Decode(reference.data(), reference_size,
+                                   &reference_width, &reference_height);
+    ASSERT_EQ(reference_width, size[0]);
+    ASSERT_EQ(reference_height, size[1]);
+
+    for (auto strip_count : strip_counts) {
+      std::vector<uint8_t> output;
+      size_t output_size = CompressStrips(image, strip_count, &output);
+      ASSERT_GT(output_size, 0u);
+      uint32_t width = 0, height = 0;
+      auto pixels = Decode(output.data(), output_size, &width, &height);
+      EXPECT_EQ(width, size[0]);
+      EXPECT_EQ(height, size[1]);
+      EXPECT_EQ(pixels, reference_pixels)
+          << size[0] << "x" << size[1] << " strips: " << strip_count;
+    }
+  }
+}
+
+TEST_F(JpegCompressorTests, StripBuffersAreRecycled) {
+  auto image = CreateImage(1920, 1080);
+  std::vector<uint8_t> output;
+  ASSERT_GT(CompressStrips(image, 4, &output), 0u);
+  auto strip_buffers = GetFreeStripBuffers();
+  ASSERT_EQ(strip_buffers.size(), 1u);
+  ASSERT_EQ(strip_buffers[0].size(), 4u);
+
+  for (size_t frame = 0; frame < 4; frame++) {
+    ASSERT_GT(CompressStrips(image, 4, &output), 0u);
+    EXPECT_EQ(GetFreeStripBuffers(), strip_buffers)
+        << "Frame " << frame << " reallocated its strips.";
+  }
+}
+
+TEST_F(JpegCompressorTests, InsertedApp1MatchesEncoderMarker) {
+  auto image = CreateImage(320, 240);
+  std::vector<uint8_t> app1(1000);
+  for (size_t i = 0; i < app1.size(); i++) {
+    app1[i] = i & 0xFF;
+  }
+
+  std::vector<uint8_t> reference;
+  size_t reference_size = CompressWithApp1(image, app1, &reference);
+  ASSERT_GT(reference_size, 0u);
+  std::vector<uint8_t> output;
+  size_t encoded_size = CompressStrips(image, 1, &output);
+  ASSERT_GT(encoded_size, 0u);
+  std::vector<uint8_t> encoded(output.begin(), output.begin() + encoded_size);
+  size_t output_size = InsertApp1(&output, encoded_size, app1);
+  ASSERT_EQ(output_size, reference_size);
+  output.resize(output_size);
+  reference.resize(reference_size);
+  EXPECT_EQ(output, reference);
+
+  // No space left for the segment
+  encoded.resize(reference_size - 1);
+  EXPECT_EQ(InsertApp1(&encoded, encoded_size, app1), 0u);
+}
+
+TEST_F(JpegCompressorTests, JobsAreReturnedInOrder) {
+  const uint32_t kJobCount = 12;
+  const uint32_t sizes[][2] = {{1920, 1080}, {64, 48}, {640, 480}};
+  std::vector<YUV420Image> images;
+  for (const auto& size : sizes) {
+    images.push_back(CreateImage(size[0], size[1]));
+  }
+
+  std::mutex lock;
+  std::condition_variable done;
+  std::vector<uint32_t> frames;
+  std::vector<std::vector<uint8_t>> outputs(kJobCount);
+  HwlPipelineCallback callback = {
+      .process_pipeline_result =
+          [&](std::unique_ptr<HwlPipelineResult> result) {
+            std::lock_guard<std::mutex> l(lock);
+            ASSERT_EQ(result->output_buffers.size(), 1u);
+            EXPECT_EQ(result->output_buffers[0].status, BufferStatus::kOk);
+            frames.push_back(result->frame_number);
+            done.notify_one();
+          },
+      .notify = nullptr};
+
+  for (uint32_t i = 0; i < kJobCount; i++) {
+    const auto& image = images[i % images.size()];
+    auto job = std::make_unique<JpegYUV420Job>();
+    job->input = std::make_unique<JpegYUV420Input>();
+    job->input->width = image.width;
+    job->input->height = image.height;
+    job->input->yuv_planes = image.planes;
+    outputs[i].resize(image.width * image.height * 2);
+    job->output = std::make_unique<SensorBuffer>();
+    job->output->frame_number = i;
+    job->output->format = HAL_PIXEL_FORMAT_BLOB;
+    job->output->dataSpace = HAL_DATASPACE_V0_JFIF;
+    job->output->callback = callback;
+    job->output->plane.img.img = outputs[i].data();
+    job->output->plane.img.buffer_size = outputs[i].size();
+    ASSERT_EQ(compressor_->QueueYUV420(std::move(job)), OK);
+  }
+
+  {
+    std::unique_lock<std::mutex> l(lock);
+    ASSERT_TRUE(done.wait_for(l, std::chrono::seconds(30),
+                              [&] { return frames.size() == kJobCount; }));
+  }
+  for (uint32_t i = 0; i < kJobCount; i++) {
+    EXPECT_EQ(frames[i], i);
+
+    const auto& image = images[i % images.size()];
+    auto blob = reinterpret_cast<const camera3_jpeg_blob*>(
+        outputs[i].data() + outputs[i].size() - sizeof(camera3_jpeg_blob));
+    ASSERT_EQ(blob->jpeg_blob_id, CAMERA3_JPEG_BLOB_ID);
+    uint32_t width = 0, height = 0;
+    EXPECT_FALSE(
+        Decode(outputs[i].data(), blob->jpeg_size, &width, &height).empty());
+    EXPECT_EQ(width, image.width);
+    EXPECT_EQ(height, image.height);
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RenderCacheTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include "utils/RenderCache.h"
+
+namespace android {
+
+static RenderCache::Entry CreateEntry(size_t size, uint8_t value) {
+  return std::make_shared<std::vector<uint8_t>>(size, value);
+}
+
+TEST(RenderCacheTests, HitAndMiss) {
+  RenderCache cache(/*max_size_bytes*/ 1024);
+  EXPECT_EQ(cache.Get("a"), nullptr);
+
+  cache.Put("a", CreateEntry(16, 0xA));
+  auto entry = cache.Get("a");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(*entry, std::vector<uint8_t>(16, 0xA));
+
+  // Replacing an entry must not leak its size
+  cache.Put("a", CreateEntry(32, 0xB));
+  entry = cache.Get("a");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(*entry, std::vector<uint8_t>(32, 0xB));
+
+  auto stats = cache.GetStatistics();
+  EXPECT_EQ(stats.hits, 2u);
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.entry_count, 1u);
+  EXPECT_EQ(stats.size_bytes, 32u);
+}
+
+TEST(RenderCacheTests, EvictLeastRecentlyUsed) {
+  RenderCache cache(/*max_size_bytes*/ 300);
+  cache.Put("a", CreateEntry(100, 0xA));
+  cache.Put("b", CreateEntry(100, 0xB));
+  cache.Put("c", CreateEntry(100, 0xC));
+
+  // Refresh "a" so that "b" becomes the oldest entry
+  ASSERT_NE(cache.Get("a"), nullptr);
+  cache.Put("d", CreateEntry(100, 0xD));
+
+  EXPECT_EQ(cache.Get("b"), nullptr);
+  EXPECT_NE(cache.Get("a"), nullptr);
+  EXPECT_NE(cache.Get("c"), nullptr);
+  EXPECT_NE(cache.Get("d"), nullptr);
+
+  auto stats = cache.GetStatistics();
+  EXPECT_EQ(stats.evictions, 1u);
+  EXPECT_EQ(stats.entry_count, 3u);
+  EXPECT_EQ(stats.size_bytes, 300u);
+}
+
+TEST(RenderCacheTests, EntriesLargerThanCapacity) {
+  RenderCache cache(/*max_size_bytes*/ 100);
+  cache.Put("a", CreateEntry(50, 0xA));
+  cache.Put("b", CreateEntry(101, 0xB));
+  EXPECT_EQ(cache.Get("b"), nullptr);
+  // Oversized entries must not flush the cache
+  EXPECT_NE(cache.Get("a"), nullptr);
+}
+
+TEST(RenderCacheTests, EntriesOutliveEviction) {
+  RenderCache cache(/*max_size_bytes*/ 100);
+  cache.Put("a", CreateEntry(100, 0xA));
+  auto entry = cache.Get("a");
+  cache.Clear();
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(*entry, std::vector<uint8_t>(100, 0xA));
+  EXPECT_EQ(cache.GetStatistics().size_bytes, 0u);
+}
+
+}  // namespace android
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RequestValidatorTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include "utils/RequestValidator.h"
+
+namespace android {
+
+TEST(RequestValidatorTests, SupportedValuesAreValidated) {
+  RequestValidator validator;
+  ASSERT_EQ(validator.AddTag(ANDROID_CONTROL_AE_MODE,
+                             {ANDROID_CONTROL_AE_MODE_OFF,
+                              ANDROID_CONTROL_AE_MODE_ON}),
+            OK);
+  ASSERT_EQ(validator.AddTag(ANDROID_SENSOR_EXPOSURE_TIME), OK);
+
+  EXPECT_TRUE(validator.IsSupported(ANDROID_CONTROL_AE_MODE,
+                                    ANDROID_CONTROL_AE_MODE_ON));
+  EXPECT_FALSE(validator.IsSupported(ANDROID_CONTROL_AE_MODE,
+                                     ANDROID_CONTROL_AE_MODE_ON_AUTO_FLASH));
+  EXPECT_FALSE(validator.IsSupported(ANDROID_SENSOR_EXPOSURE_TIME, 0));
+  EXPECT_FALSE(validator.IsSupported(ANDROID_CONTROL_AF_MODE,
+                                     ANDROID_CONTROL_AF_MODE_OFF));
+}
+
+TEST(RequestValidatorTests, OnlyByteTagsCarrySupportedValues) {
+  RequestValidator validator;
+  EXPECT_EQ(validator.AddTag(ANDROID_SENSOR_EXPOSURE_TIME, {0}), BAD_VALUE);
+  EXPECT_FALSE(validator.IsRegistered(ANDROID_SENSOR_EXPOSURE_TIME));
+}
+
+TEST(RequestValidatorTests, ParseFindsRegisteredTags) {
+  RequestValidator validator;
+  ASSERT_EQ(validator.AddTag(ANDROID_CONTROL_MODE,
+                             {ANDROID_CONTROL_MODE_AUTO}),
+            OK);
+  ASSERT_EQ(validator.AddTag(ANDROID_SENSOR_EXPOSURE_TIME), OK);
+  ASSERT_EQ(validator.AddTag(ANDROID_SENSOR_SENSITIVITY), OK);
+
+  auto settings = HalCameraMetadata::Create(/*entry_capacity*/ 3,
+                                            /*data_capacity*/ 16);
+  uint8_t control_mode = ANDROID_CONTROL_MODE_AUTO;
+  int64_t exposure_time = 1000;
+  uint8_t ae_mode = ANDROID_CONTROL_AE_MODE_ON;
+  settings->Set(ANDROID_CONTROL_MODE, &control_mode, 1);
+  settings->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1);
+  settings->Set(ANDROID_CONTROL_AE_MODE, &ae_mode, 1);
+
+  RequestValidator::Entries entries;
+  validator.Parse(*settings, &entries);
+  camera_metadata_ro_entry_t entry;
+  ASSERT_EQ(validator.Get(entries, ANDROID_CONTROL_MODE, &entry), OK);
+  ASSERT_EQ(entry.count, 1u);
+  EXPECT_EQ(entry.data.u8[0], control_mode);
+  ASSERT_EQ(validator.Get(entries, ANDROID_SENSOR_EXPOSURE_TIME, &entry), OK);
+  ASSERT_EQ(entry.count, 1u);
+  EXPECT_EQ(entry.data.i64[0], exposure_time);
+  EXPECT_EQ(validator.Get(entries, ANDROID_SENSOR_SENSITIVITY, &entry),
+            NAME_NOT_FOUND);
+  // Present in the settings but never registered
+  EXPECT_EQ(validator.Get(entries, ANDROID_CONTROL_AE_MODE, &entry),
+            BAD_VALUE);
+}
+
+TEST(RequestValidatorTests, ParseResetsPreviousEntries) {
+  RequestValidator validator;
+  ASSERT_EQ(validator.AddTag(ANDROID_SENSOR_EXPOSURE_TIME), OK);
+
+  auto settings = HalCameraMetadata::Create(/*entry_capacity*/ 1,
+                                            /*data_capacity*/ 8);
+  int64_t exposure_time = 1000;
+  settings->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1);
+  RequestValidator::Entries entries;
+  validator.Parse(*settings, &entries);
+  camera_metadata_ro_entry_t entry;
+  EXPECT_EQ(validator.Get(entries, ANDROID_SENSOR_EXPOSURE_TIME, &entry), OK);
+
+  auto empty_settings = HalCameraMetadata::Create(/*entry_capacity*/ 1,
+                                                  /*data_capacity*/ 8);
+  validator.Parse(*empty_settings, &entries);
+  EXPECT_EQ(validator.Get(entries, ANDROID_SENSOR_EXPOSURE_TIME, &entry),
+            NAME_NOT_FOUND);
+}
+
+TEST(RequestValidatorTests, EntriesAreSharedWithMatchingLayouts) {
+  RequestValidator validator, same_layout, other_layout;
+  ASSERT_EQ(validator.AddTag(ANDROID_CONTROL_MODE,
+                             {ANDROID_CONTROL_MODE_AUTO}),
+            OK);
+  ASSERT_EQ(validator.AddTag(ANDROID_SENSOR_EXPOSURE_TIME), OK);
+  ASSERT_EQ(same_layout.AddTag(ANDROID_CONTROL_MODE,
+                               {ANDROID_CONTROL_MODE_OFF}),
+            OK);
+  ASSERT_EQ(same_layout.AddTag(ANDROID_SENSOR_EXPOSURE_TIME), OK);
+  ASSERT_EQ(other_layout.AddTag(ANDROID_SENSOR_EXPOSURE_TIME), OK);
+  ASSERT_EQ(other_layout.AddTag(ANDROID_CONTROL_MODE), OK);
+
+  auto settings = HalCameraMetadata::Create(/*entry_capacity*/ 1,
+                                            /*data_capacity*/ 8);
+  int64_t exposure_time = 1000;
+  settings->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1);
+  RequestValidator::Entries entries;
+  validator.Parse(*settings, &entries);
+  camera_metadata_ro_entry_t entry;
+  EXPECT_EQ(same_layout.Get(entries, ANDROID_SENSOR_EXPOSURE_TIME, &entry),
+            OK);
+  EXPECT_EQ(other_layout.Get(entries, ANDROID_SENSOR_EXPOSURE_TIME, &entry),
+            BAD_VALUE);
+}
+
+}  // namespace android
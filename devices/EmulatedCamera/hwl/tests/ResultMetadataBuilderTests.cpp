@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ResultMetadataBuilderTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include "utils/ResultMetadataBuilder.h"
+
+namespace android {
+
+class ResultMetadataBuilderTests : public ::testing::Test {
+ protected:
+  static std::shared_ptr<const HalCameraMetadata> CreateSettings(
+      uint8_t control_mode, int64_t exposure_time) {
+    auto settings = HalCameraMetadata::Create(/*entry_capacity*/ 2,
+                                              /*data_capacity*/ 16);
+    settings->Set(ANDROID_CONTROL_MODE, &control_mode, 1);
+    settings->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1);
+    return settings;
+  }
+
+  static void ExpectValue(const HalCameraMetadata& metadata, uint32_t tag,
+                          int64_t expected) {
+    camera_metadata_ro_entry_t entry;
+    ASSERT_EQ(metadata.Get(tag, &entry), OK) << tag;
+    ASSERT_EQ(entry.count, 1u);
+    switch (entry.type) {
+      case TYPE_BYTE:
+        EXPECT_EQ(entry.data.u8[0], static_cast<uint8_t>(expected)) << tag;
+        break;
+      case TYPE_INT32:
+        EXPECT_EQ(entry.data.i32[0], expected) << tag;
+        break;
+      case TYPE_INT64:
+        EXPECT_EQ(entry.data.i64[0], expected) << tag;
+        break;
+      default:
+        ADD_FAILURE() << "Unexpected type " << entry.type;
+    }
+  }
+
+  static std::unique_ptr<HalCameraMetadata> BuildResult(
+      ResultMetadataBuilder* builder,
+      std::shared_ptr<const HalCameraMetadata> settings, uint8_t ae_state,
+      int32_t sensitivity) {
+    builder->Begin(settings);
+    builder->Set(ANDROID_CONTROL_AE_STATE, &ae_state, 1);
+    builder->Set(ANDROID_SENSOR_SENSITIVITY, &sensitivity, 1);
+    uint8_t control_mode = ANDROID_CONTROL_MODE_AUTO;
+    builder->Set(ANDROID_CONTROL_MODE, &control_mode, 1);
+    return builder->Finish();
+  }
+};
+
+TEST_F(ResultMetadataBuilderTests, ResultsMergeSettingsAndValues) {
+  ResultMetadataBuilder builder;
+  auto settings = CreateSettings(ANDROID_CONTROL_MODE_OFF, 1000);
+  auto result = BuildResult(&builder, settings,
+                            ANDROID_CONTROL_AE_STATE_SEARCHING, 100);
+  ASSERT_NE(result.get(), nullptr);
+  EXPECT_EQ(result->GetEntryCount(), 4u);
+  ExpectValue(*result, ANDROID_CONTROL_MODE, ANDROID_CONTROL_MODE_AUTO);
+  ExpectValue(*result, ANDROID_SENSOR_EXPOSURE_TIME, 1000);
+  ExpectValue(*result, ANDROID_CONTROL_AE_STATE,
+              ANDROID_CONTROL_AE_STATE_SEARCHING);
+  ExpectValue(*result, ANDROID_SENSOR_SENSITIVITY, 100);
+
+  // The settings snapshot is left untouched
+  ExpectValue(*settings, ANDROID_CONTROL_MODE, ANDROID_CONTROL_MODE_OFF);
+  EXPECT_EQ(settings->GetEntryCount(), 2u);
+
+  // Values of the wrong type are rejected
+  int64_t sensitivity = 100;
+  EXPECT_NE(builder.Set(ANDROID_SENSOR_SENSITIVITY, &sensitivity, 1), OK);
+}
+
+TEST_F(ResultMetadataBuilderTests, OnlyChangedValuesAreWritten) {
+  ResultMetadataBuilder builder;
+  auto settings = CreateSettings(ANDROID_CONTROL_MODE_AUTO, 1000);
+  for (int32_t frame = 0; frame < 10; frame++) {
+    auto result =
+        BuildResult(&builder, settings, ANDROID_CONTROL_AE_STATE_CONVERGED,
+                    100 + frame / 5);
+    ASSERT_NE(result.get(), nullptr);
+    ExpectValue(*result, ANDROID_SENSOR_SENSITIVITY, 100 + frame / 5);
+    ExpectValue(*result, ANDROID_CONTROL_AE_STATE,
+                ANDROID_CONTROL_AE_STATE_CONVERGED);
+  }
+
+  auto stats = builder.GetStatistics();
+  EXPECT_EQ(stats.results, 10u);
+  EXPECT_EQ(stats.rebuilds, 1u);
+  // Three values for the first result and a single sensitivity change
+  EXPECT_EQ(stats.written_values, 4u);
+  EXPECT_EQ(stats.skipped_values, 26u);
+}
+
+TEST_F(ResultMetadataBuilderTests, NewSettingsAndTagsRebuild) {
+  ResultMetadataBuilder builder;
+  auto settings = CreateSettings(ANDROID_CONTROL_MODE_AUTO, 1000);
+  BuildResult(&builder, settings, ANDROID_CONTROL_AE_STATE_CONVERGED, 100);
+  auto result =
+      BuildResult(&builder, CreateSettings(ANDROID_CONTROL_MODE_AUTO, 2000),
+                  ANDROID_CONTROL_AE_STATE_CONVERGED, 100);
+  ExpectValue(*result, ANDROID_SENSOR_EXPOSURE_TIME, 2000);
+  EXPECT_EQ(builder.GetStatistics().rebuilds, 2u);
+
+  // Tags that are no longer reported are dropped
+  builder.Begin(settings);
+  uint8_t lens_state = ANDROID_LENS_STATE_MOVING;
+  builder.Set(ANDROID_LENS_STATE, &lens_state, 1);
+  result = builder.Finish();
+  ASSERT_NE(result.get(), nullptr);
+  EXPECT_EQ(result->GetEntryCount(), 3u);
+  ExpectValue(*result, ANDROID_LENS_STATE, ANDROID_LENS_STATE_MOVING);
+  ExpectValue(*result, ANDROID_SENSOR_EXPOSURE_TIME, 1000);
+  camera_metadata_ro_entry_t entry;
+  EXPECT_NE(result->Get(ANDROID_CONTROL_AE_STATE, &entry), OK);
+  EXPECT_EQ(builder.GetStatistics().rebuilds, 3u);
+}
+
+TEST_F(ResultMetadataBuilderTests, ResultsReserveSpareCapacity) {
+  ResultMetadataBuilder builder;
+  builder.SetSpareCapacity(/*entries*/ 2, /*data*/ 64);
+  auto result =
+      BuildResult(&builder, CreateSettings(ANDROID_CONTROL_MODE_AUTO, 1000),
+                  ANDROID_CONTROL_AE_STATE_CONVERGED, 100);
+  ASSERT_NE(result.get(), nullptr);
+  auto raw = result->GetRawCameraMetadata();
+  EXPECT_GE(get_camera_metadata_entry_capacity(raw),
+            get_camera_metadata_entry_count(raw) + 2);
+  EXPECT_GE(get_camera_metadata_data_capacity(raw),
+            get_camera_metadata_data_count(raw) + 64);
+
+  // Additions within the spare capacity do not reallocate
+  int64_t timestamp = 1;
+  double noise_profile[] = {1., 2., 3., 4.};
+  ASSERT_EQ(result->Set(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1), OK);
+  ASSERT_EQ(result->Set(ANDROID_SENSOR_NOISE_PROFILE, noise_profile, 4), OK);
+  EXPECT_EQ(result->GetRawCameraMetadata(), raw);
+}
+
+TEST_F(ResultMetadataBuilderTests, ResultsAreRecycledThroughArena) {
+  static constexpr uint32_t kNumFrames = 5;
+  auto arena = HalCameraMetadataArena::Create();
+  ASSERT_NE(arena.get(), nullptr);
+  ResultMetadataBuilder builder;
+  builder.SetArena(arena);
+  auto settings = CreateSettings(ANDROID_CONTROL_MODE_AUTO, 1000);
+
+  for (uint32_t i = 0; i < kNumFrames; i++) {
+    auto result = BuildResult(&builder, settings,
+                              ANDROID_CONTROL_AE_STATE_CONVERGED, 100 + i);
+    ASSERT_NE(result.get(), nullptr);
+    ExpectValue(*result, ANDROID_SENSOR_SENSITIVITY, 100 + i);
+  }
+
+  // Only the first result is allocated from the heap
+  auto stats = arena->GetStatistics();
+  EXPECT_EQ(stats.allocations, 1u);
+  EXPECT_EQ(stats.reuses, kNumFrames - 1);
+}
+
+}  // namespace android
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RingQueueTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "utils/RingQueue.h"
+
+namespace android {
+
+TEST(RingQueueTests, ItemsWrapAroundInOrder) {
+  RingQueue<int> queue(3);
+  int next_push = 0, next_pop = 0;
+  for (size_t round = 0; round < 10; round++) {
+    while (queue.Push(int(next_push))) {
+      next_push++;
+    }
+    EXPECT_TRUE(queue.Full());
+    EXPECT_EQ(queue.Size(), 3u);
+    for (size_t i = 0; i < queue.Size(); i++) {
+      EXPECT_EQ(queue[i], next_pop + static_cast<int>(i));
+    }
+
+    // Leave one item behind so the head keeps moving around the ring
+    while (queue.Size() > 1) {
+      EXPECT_EQ(queue.Front(), next_pop++);
+      queue.Pop();
+    }
+  }
+  EXPECT_EQ(next_push, next_pop + 1);
+}
+
+TEST(RingQueueTests, FullQueueKeepsItem) {
+  RingQueue<std::unique_ptr<int>> queue(1);
+  ASSERT_TRUE(queue.Push(std::make_unique<int>(1)));
+  auto item = std::make_unique<int>(2);
+  EXPECT_FALSE(queue.Push(std::move(item)));
+  ASSERT_NE(item.get(), nullptr);
+  EXPECT_EQ(*item, 2);
+}
+
+TEST(RingQueueTests, PopReleasesSlot) {
+  auto item = std::make_shared<int>(1);
+  RingQueue<std::shared_ptr<int>> queue(2);
+  ASSERT_TRUE(queue.Push(std::shared_ptr<int>(item)));
+  EXPECT_EQ(item.use_count(), 2);
+  queue.Pop();
+  EXPECT_EQ(item.use_count(), 1);
+  EXPECT_TRUE(queue.Empty());
+}
+
+TEST(RingQueueTests, ResetDropsItems) {
+  RingQueue<int> queue;
+  EXPECT_EQ(queue.Capacity(), 0u);
+  EXPECT_FALSE(queue.Push(1));
+
+  queue.Reset(4);
+  EXPECT_EQ(queue.Capacity(), 4u);
+  ASSERT_TRUE(queue.Push(1));
+  ASSERT_TRUE(queue.Push(2));
+  queue.Reset(2);
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_EQ(queue.Capacity(), 2u);
+}
+
+}  // namespace android
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BufferPool.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+namespace android {
+
+const size_t BufferPool::kMinBucketSize = 4096;
+
+BufferPool::Lease::Lease(Lease&& other)
+    : pool_(std::move(other.pool_)),
+      buffer_(std::move(other.buffer_)),
+      size_(other.size_),
+      bucket_size_(other.bucket_size_) {
+  other.size_ = 0;
+  other.bucket_size_ = 0;
+}
+
+BufferPool::Lease& BufferPool::Lease::operator=(Lease&& other) {
+  if (this != &other) {
+    Release();
+    pool_ = std::move(other.pool_);
+    buffer_ = std::move(other.buffer_);
+    size_ = other.size_;
+    bucket_size_ = other.bucket_size_;
+    other.size_ = 0;
+    other.bucket_size_ = 0;
+  }
+
+  return *this;
+}
+
+void BufferPool::Lease::Release() {
+  if ((pool_.get() != nullptr) && (buffer_.get() != nullptr)) {
+    pool_->Return(std::move(buffer_), bucket_size_);
+  }
+  pool_.reset();
+  buffer_.reset();
+  size_ = 0;
+  bucket_size_ = 0;
+}
+
+std::shared_ptr<BufferPool> BufferPool::Create(size_t max_cached_bytes) {
+  return std::shared_ptr<BufferPool>(new BufferPool(max_cached_bytes));
+}
+
+BufferPool::BufferPool(size_t max_cached_bytes) {
+  stats_.max_cached_bytes = max_cached_bytes;
+}
+
+size_t BufferPool::GetBucketSize(size_t size) {
+  if (size <= kMinBucketSize) {
+    return kMinBucketSize;
+  }
+
+  // Quarter steps between consecutive powers of two
+  size_t power = kMinBucketSize;
+  while (power * 2 < size) {
+    power *= 2;
+  }
+  size_t step = power / 4;
+  return ((size + step - 1) / step) * step;
+}
+
+BufferPool::Lease BufferPool::Acquire(size_t size) {
+  Lease lease;
+  lease.pool_ = shared_from_this();
+  lease.size_ = size;
+  lease.bucket_size_ = GetBucketSize(size);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto idle = idle_buffers_.find(lease.bucket_size_);
+    if ((idle != idle_buffers_.end()) && !idle->second.empty()) {
+      lease.buffer_ = std::move(idle->second.back());
+      idle->second.pop_back();
+      stats_.cached_bytes -= lease.bucket_size_;
+      stats_.reuses++;
+    } else {
+      stats_.allocations++;
+      stats_.allocated_bytes += lease.bucket_size_;
+      stats_.peak_allocated_bytes =
+          std::max(stats_.peak_allocated_bytes, stats_.allocated_bytes);
+    }
+    stats_.leased_bytes += lease.bucket_size_;
+    stats_.peak_leased_bytes =
+        std::max(stats_.peak_leased_bytes, stats_.leased_bytes);
+  }
+
+  if (lease.buffer_.get() == nullptr) {
+    // Default initialization, the pages are only touched once written
+    lease.buffer_.reset(new uint8_t[lease.bucket_size_]);
+  }
+
+  return lease;
+}
+
+void BufferPool::Return(std::unique_ptr<uint8_t[]> buffer, size_t bucket_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.leased_bytes -= bucket_size;
+  if (stats_.cached_bytes + bucket_size > stats_.max_cached_bytes) {
+    stats_.allocated_bytes -= bucket_size;
+    return;
+  }
+
+  stats_.cached_bytes += bucket_size;
+  idle_buffers_[bucket_size].push_back(std::move(buffer));
+}
+
+void BufferPool::Trim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_buffers_.clear();
+  stats_.allocated_bytes -= stats_.cached_bytes;
+  stats_.cached_bytes = 0;
+}
+
+BufferPool::Statistics BufferPool::GetStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void BufferPool::Dump(int fd) const {
+  auto stats = GetStatistics();
+  dprintf(fd,
+          "  Buffer pool: allocations: %" PRIu64 " reuses: %" PRIu64 "\n",
+          stats.allocations, stats.reuses);
+  dprintf(fd,
+          "    allocated: %zu (peak %zu) leased: %zu (peak %zu) cached: "
+          "%zu/%zu bytes\n",
+          stats.allocated_bytes, stats.peak_allocated_bytes,
+          stats.leased_bytes, stats.peak_leased_bytes, stats.cached_bytes,
+          stats.max_cached_bytes);
+}
+
+}  // namespace android
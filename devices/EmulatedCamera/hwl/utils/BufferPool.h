@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_BUFFER_POOL_H_
+#define EMULATOR_CAMERA_HAL_HWL_BUFFER_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace android {
+
+// Pool of reusable staging buffers. Requests are rounded up to size buckets
+// with four buckets per power of two, so buffers of similar sizes are
+// recycled while at most 25% of a buffer is wasted. Buffers are handed out
+// as leases that return them to the pool once destroyed. Leases keep the
+// pool alive and may be released from any thread.
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+ public:
+  struct Statistics {
+    uint64_t allocations = 0;  // Requests that had to allocate memory
+    uint64_t reuses = 0;       // Requests served from the pool
+    size_t allocated_bytes = 0;  // Leased and cached
+    size_t peak_allocated_bytes = 0;
+    size_t leased_bytes = 0;
+    size_t peak_leased_bytes = 0;
+    size_t cached_bytes = 0;
+    size_t max_cached_bytes = 0;
+  };
+
+  class Lease {
+   public:
+    Lease() = default;
+    ~Lease() {
+      Release();
+    }
+    Lease(Lease&& other);
+    Lease& operator=(Lease&& other);
+
+    uint8_t* data() const {
+      return buffer_.get();
+    }
+
+    // Requested size, the underlying buffer may be larger.
+    size_t size() const {
+      return size_;
+    }
+
+    void Release();
+
+   private:
+    friend class BufferPool;
+    std::shared_ptr<BufferPool> pool_;
+    std::unique_ptr<uint8_t[]> buffer_;
+    size_t size_ = 0;
+    size_t bucket_size_ = 0;
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+  };
+
+  // Idle buffers beyond 'max_cached_bytes' are freed once returned.
+  static std::shared_ptr<BufferPool> Create(size_t max_cached_bytes);
+
+  // Buffer contents are undefined.
+  Lease Acquire(size_t size);
+
+  // Frees all idle buffers
+  void Trim();
+
+  Statistics GetStatistics() const;
+
+  void Dump(int fd) const;
+
+  static size_t GetBucketSize(size_t size);
+
+ private:
+  explicit BufferPool(size_t max_cached_bytes);
+
+  void Return(std::unique_ptr<uint8_t[]> buffer, size_t bucket_size);
+
+  static const size_t kMinBucketSize;
+
+  mutable std::mutex mutex_;
+  // Idle buffers keyed by bucket size
+  std::map<size_t, std::vector<std::unique_ptr<uint8_t[]>>> idle_buffers_;
+  Statistics stats_;
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_BUFFER_POOL_H_
@@ -24,7 +24,9 @@
 #include <log/log.h>
 #include <math.h>
 #include <stdint.h>
+#include <utils/Trace.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -57,6 +59,9 @@ class ExifUtilsImpl : public ExifUtils {
   // cleared.
   virtual bool Initialize();
 
+  // Starts the next image on top of the current Exif data.
+  virtual bool BeginImage();
+
   // set all known fields from a metadata structure
   virtual bool SetFromMetadata(const HalCameraMetadata& metadata,
                                size_t image_width, size_t image_height);
@@ -235,6 +240,9 @@ class ExifUtilsImpl : public ExifUtils {
   // Destroys the buffer of APP1 segment if exists.
   virtual void DestroyApp1();
 
+  // Removes the entries that were not set since the last BeginImage().
+  virtual void RemoveStaleEntries();
+
   // The Exif data (APP1). Owned by this class.
   ExifData* exif_data_;
   // The raw data of APP1 segment. It's allocated by ExifMem in |exif_data_| but
@@ -242,6 +250,9 @@ class ExifUtilsImpl : public ExifUtils {
   uint8_t* app1_buffer_;
   // The length of |app1_buffer_|.
   unsigned int app1_length_;
+  // Entries set since the last BeginImage() or Initialize(), only used for
+  // comparison and never dereferenced.
+  std::vector<ExifEntry*> image_entries_;
 
   // How precise the float-to-rational conversion for EXIF tags would be.
   const static int kRationalPrecision = 10000;
@@ -312,6 +323,7 @@ ExifUtilsImpl::~ExifUtilsImpl() {
 
 bool ExifUtilsImpl::Initialize() {
   Reset();
+  image_entries_.clear();
   exif_data_ = exif_data_new();
   if (exif_data_ == nullptr) {
     ALOGE("%s: allocate memory for exif_data_ failed", __FUNCTION__);
@@ -330,6 +342,16 @@ bool ExifUtilsImpl::Initialize() {
   return true;
 }
 
+bool ExifUtilsImpl::BeginImage() {
+  if (exif_data_ == nullptr) {
+    return Initialize();
+  }
+
+  DestroyApp1();
+  image_entries_.clear();
+  return SetExifVersion("0220");
+}
+
 bool ExifUtilsImpl::SetAperture(float aperture) {
   float apex_value = ConvertToApex(aperture);
   SET_RATIONAL(
@@ -719,10 +741,14 @@ bool ExifUtilsImpl::SetWhiteBalance(uint8_t white_balance) {
 bool ExifUtilsImpl::GenerateApp1(unsigned char* thumbnail_buffer,
                                  uint32_t size) {
   DestroyApp1();
+  RemoveStaleEntries();
   exif_data_->data = thumbnail_buffer;
   exif_data_->size = size;
   // Save the result into |app1_buffer_|.
   exif_data_save_data(exif_data_, &app1_buffer_, &app1_length_);
+  // The thumbnail is owned by the caller and may not outlive this call
+  exif_data_->data = nullptr;
+  exif_data_->size = 0;
   if (!app1_length_) {
     ALOGE("%s: Allocate memory for app1_buffer_ failed", __FUNCTION__);
     return false;
@@ -782,9 +808,18 @@ void ExifUtilsImpl::Reset() {
 std::unique_ptr<ExifEntry> ExifUtilsImpl::AddVariableLengthEntry(
     ExifIfd ifd, ExifTag tag, ExifFormat format, uint64_t components,
     unsigned int size) {
+  ExifEntry* current_entry = exif_content_get_entry(exif_data_->ifd[ifd], tag);
+  if ((current_entry != nullptr) && (current_entry->format == format) &&
+      (current_entry->components == components) &&
+      (current_entry->size == size)) {
+    // Same layout, the existing entry is updated in place
+    exif_entry_ref(current_entry);
+    image_entries_.push_back(current_entry);
+    return std::unique_ptr<ExifEntry>(current_entry);
+  }
+
   // Remove old entry if exists.
-  exif_content_remove_entry(exif_data_->ifd[ifd],
-                            exif_content_get_entry(exif_data_->ifd[ifd], tag));
+  exif_content_remove_entry(exif_data_->ifd[ifd], current_entry);
   ExifMem* mem = exif_mem_new_default();
   if (!mem) {
     ALOGE("%s: Allocate memory for exif entry failed", __FUNCTION__);
@@ -811,6 +846,7 @@ std::unique_ptr<ExifEntry> ExifUtilsImpl::AddVariableLengthEntry(
 
   exif_content_add_entry(exif_data_->ifd[ifd], entry.get());
   exif_mem_unref(mem);
+  image_entries_.push_back(entry.get());
 
   return entry;
 }
@@ -821,6 +857,7 @@ std::unique_ptr<ExifEntry> ExifUtilsImpl::AddEntry(ExifIfd ifd, ExifTag tag) {
   if (entry) {
     // exif_content_get_entry() won't ref the entry, so we ref here.
     exif_entry_ref(entry.get());
+    image_entries_.push_back(entry.get());
     return entry;
   }
   entry.reset(exif_entry_new());
@@ -831,6 +868,7 @@ std::unique_ptr<ExifEntry> ExifUtilsImpl::AddEntry(ExifIfd ifd, ExifTag tag) {
   entry->tag = tag;
   exif_content_add_entry(exif_data_->ifd[ifd], entry.get());
   exif_entry_initialize(entry.get(), tag);
+  image_entries_.push_back(entry.get());
   return entry;
 }
 
@@ -909,6 +947,20 @@ void ExifUtilsImpl::DestroyApp1() {
   app1_length_ = 0;
 }
 
+void ExifUtilsImpl::RemoveStaleEntries() {
+  for (int i = 0; i < EXIF_IFD_COUNT; i++) {
+    ExifContent* content = exif_data_->ifd[i];
+    // Removal shifts the following entries down
+    for (unsigned int j = content->count; j > 0; j--) {
+      ExifEntry* entry = content->entries[j - 1];
+      if (std::find(image_entries_.begin(), image_entries_.end(), entry) ==
+          image_entries_.end()) {
+        exif_content_remove_entry(content, entry);
+      }
+    }
+  }
+}
+
 bool ExifUtilsImpl::SetFromMetadata(const HalCameraMetadata& metadata,
                                     size_t image_width, size_t image_height) {
   if (!SetImageWidth(image_width) || !SetImageHeight(image_height)) {
@@ -1106,4 +1158,95 @@ bool ExifUtilsImpl::SetFromMetadata(const HalCameraMetadata& metadata,
   return true;
 }
 
+// Every result tag read by SetFromMetadata() and the JPEG thumbnail size
+const uint32_t ExifUtilsPool::kMetadataTags[] = {
+    ANDROID_CONTROL_AE_MODE,
+    ANDROID_CONTROL_AWB_MODE,
+    ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST,
+    ANDROID_FLASH_STATE,
+    ANDROID_JPEG_GPS_COORDINATES,
+    ANDROID_JPEG_GPS_PROCESSING_METHOD,
+    ANDROID_JPEG_GPS_TIMESTAMP,
+    ANDROID_JPEG_ORIENTATION,
+    ANDROID_JPEG_THUMBNAIL_SIZE,
+    ANDROID_LENS_APERTURE,
+    ANDROID_LENS_FOCAL_LENGTH,
+    ANDROID_LENS_FOCUS_DISTANCE,
+    ANDROID_SCALER_CROP_REGION,
+    ANDROID_SENSOR_EXPOSURE_TIME,
+    ANDROID_SENSOR_SENSITIVITY};
+// Fits all fixed size tags along with a generous GPS processing method
+const size_t ExifUtilsPool::kMetadataDataCapacity = 512;
+
+void ExifUtilsPool::Recycler::operator()(Entry* entry) const {
+  if (pool.get() == nullptr) {
+    delete entry;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(pool->mutex_);
+  pool->idle_entries_.emplace_back(entry);
+}
+
+std::shared_ptr<ExifUtilsPool> ExifUtilsPool::Create(
+    const SensorCharacteristics& sensor_chars) {
+  return std::shared_ptr<ExifUtilsPool>(new ExifUtilsPool(sensor_chars));
+}
+
+ExifUtilsPool::ExifUtilsPool(const SensorCharacteristics& sensor_chars)
+    : sensor_chars_(std::make_unique<SensorCharacteristics>(sensor_chars)) {
+}
+
+ExifUtilsPool::~ExifUtilsPool() {
+}
+
+ExifUtilsPool::Lease ExifUtilsPool::Acquire(
+    const HalCameraMetadata& result_metadata) {
+  ATRACE_CALL();
+  std::unique_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_entries_.empty()) {
+      entry = std::move(idle_entries_.back());
+      idle_entries_.pop_back();
+    } else {
+      entry_count_++;
+    }
+  }
+
+  if (entry.get() == nullptr) {
+    entry = std::make_unique<Entry>();
+    entry->exif_utils.reset(ExifUtils::Create(*sensor_chars_));
+    entry->metadata = HalCameraMetadata::Create(
+        sizeof(kMetadataTags) / sizeof(kMetadataTags[0]),
+        kMetadataDataCapacity);
+    if (entry->metadata.get() == nullptr) {
+      ALOGE("%s: Failed to allocate metadata snapshot!", __FUNCTION__);
+      std::lock_guard<std::mutex> lock(mutex_);
+      entry_count_--;
+      return nullptr;
+    }
+  }
+
+  Lease lease(entry.release(), Recycler{.pool = shared_from_this()});
+  camera_metadata_ro_entry_t metadata_entry;
+  for (auto tag : kMetadataTags) {
+    auto ret = (result_metadata.Get(tag, &metadata_entry) == OK)
+                   ? lease->metadata->Set(metadata_entry)
+                   : lease->metadata->Erase(tag);
+    if (ret != OK) {
+      ALOGE("%s: Failed to update tag 0x%x in the metadata snapshot!",
+            __FUNCTION__, tag);
+      return nullptr;
+    }
+  }
+
+  return lease;
+}
+
+size_t ExifUtilsPool::GetEntryCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entry_count_;
+}
+
 }  // namespace android
@@ -17,6 +17,10 @@
 #ifndef ANDROID_EMULATOR_CAMERA_EXIF_UTILS_H
 #define ANDROID_EMULATOR_CAMERA_EXIF_UTILS_H
 
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "hwl_types.h"
 
 namespace android {
@@ -55,6 +59,12 @@ class ExifUtils {
   // cleared.
   virtual bool Initialize() = 0;
 
+  // Starts the next image on top of the Exif data of the previous one, which
+  // serves as a template. Tags that are set again update their entries in
+  // place, tags that are not set again before GenerateApp1() are removed.
+  // Initializes the Exif data on first use.
+  virtual bool BeginImage() = 0;
+
   // Set all known fields from a metadata structure
   virtual bool SetFromMetadata(const HalCameraMetadata& metadata,
                                size_t image_width, size_t image_height) = 0;
@@ -187,6 +197,51 @@ class ExifUtils {
   virtual unsigned int GetApp1Length() = 0;
 };
 
+// Recycles the Exif generators of a single camera along with snapshots of
+// the result metadata tags they consume. Generators keep their Exif data
+// between images, see ExifUtils::BeginImage(), and snapshots are updated in
+// place, so steady state captures allocate neither of them. Leases return
+// their entry to the pool once destroyed and may be released from any
+// thread.
+class ExifUtilsPool : public std::enable_shared_from_this<ExifUtilsPool> {
+ public:
+  struct Entry {
+    std::unique_ptr<ExifUtils> exif_utils;
+    // Result metadata tags used by the Exif generator and the thumbnail
+    std::unique_ptr<HalCameraMetadata> metadata;
+  };
+
+  struct Recycler {
+    std::shared_ptr<ExifUtilsPool> pool;
+    void operator()(Entry* entry) const;
+  };
+  typedef std::unique_ptr<Entry, Recycler> Lease;
+
+  static std::shared_ptr<ExifUtilsPool> Create(
+      const SensorCharacteristics& sensor_chars);
+  ~ExifUtilsPool();
+
+  // Returns nullptr in case the snapshot of 'result_metadata' fails.
+  Lease Acquire(const HalCameraMetadata& result_metadata);
+
+  // Entries allocated so far, leased or idle
+  size_t GetEntryCount() const;
+
+ private:
+  static const uint32_t kMetadataTags[];
+  static const size_t kMetadataDataCapacity;
+
+  explicit ExifUtilsPool(const SensorCharacteristics& sensor_chars);
+
+  std::unique_ptr<SensorCharacteristics> sensor_chars_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Entry>> idle_entries_;  // Guarded by 'mutex_'
+  size_t entry_count_ = 0;                            // Guarded by 'mutex_'
+
+  ExifUtilsPool(const ExifUtilsPool&) = delete;
+  ExifUtilsPool& operator=(const ExifUtilsPool&) = delete;
+};
+
 }  // namespace android
 
 #endif  // ANDROID_EMULATOR_CAMERA_EXIF_UTILS_H
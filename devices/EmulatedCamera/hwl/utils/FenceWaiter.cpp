@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "FenceWaiter"
+
+#include "FenceWaiter.h"
+
+#include <errno.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace android {
+
+const nsecs_t FenceWaiter::kFallbackWakeupInterval = ms2ns(5);
+
+FenceWaiter::FenceWaiter() {
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0) {
+    ALOGE("%s: Failed to create event fd: %s (%d)", __FUNCTION__,
+          strerror(errno), errno);
+  }
+}
+
+FenceWaiter::~FenceWaiter() {
+  if (event_fd_ >= 0) {
+    close(event_fd_);
+  }
+}
+
+status_t FenceWaiter::Wait(const std::vector<int>& fences, nsecs_t timeout,
+                           std::vector<FenceStatus>* status /*out*/) {
+  if (status == nullptr) {
+    return BAD_VALUE;
+  }
+
+  if ((event_fd_ < 0) &&
+      ((timeout < 0) || (timeout > kFallbackWakeupInterval))) {
+    timeout = kFallbackWakeupInterval;
+  }
+
+  poll_fds_.clear();
+  for (auto fence : fences) {
+    poll_fds_.push_back({.fd = fence, .events = POLLIN, .revents = 0});
+  }
+  if (event_fd_ >= 0) {
+    poll_fds_.push_back({.fd = event_fd_, .events = POLLIN, .revents = 0});
+  }
+
+  // Round up so that short timeouts do not degrade into busy polling
+  int timeout_ms = (timeout < 0) ? -1 : ns2ms(timeout + ms2ns(1) - 1);
+  int ret;
+  do {
+    ret = poll(poll_fds_.data(), poll_fds_.size(), timeout_ms);
+  } while ((ret < 0) && (errno == EINTR));
+  if (ret < 0) {
+    ALOGE("%s: Polling %zu fences failed: %s (%d)", __FUNCTION__,
+          fences.size(), strerror(errno), errno);
+    return -errno;
+  }
+
+  if ((event_fd_ >= 0) && (poll_fds_.back().revents & POLLIN)) {
+    eventfd_t value;
+    eventfd_read(event_fd_, &value);
+  }
+
+  status->resize(fences.size());
+  for (size_t i = 0; i < fences.size(); i++) {
+    auto revents = poll_fds_[i].revents;
+    if (revents & (POLLERR | POLLNVAL)) {
+      (*status)[i] = FENCE_ERROR;
+    } else if (revents & POLLIN) {
+      (*status)[i] = FENCE_SIGNALED;
+    } else {
+      (*status)[i] = FENCE_PENDING;
+    }
+  }
+
+  return OK;
+}
+
+void FenceWaiter::Wake() {
+  if (event_fd_ >= 0) {
+    eventfd_write(event_fd_, 1);
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_FENCE_WAITER_H_
+#define EMULATOR_CAMERA_HAL_HWL_FENCE_WAITER_H_
+
+#include <poll.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <vector>
+
+namespace android {
+
+// Waits on any number of sync fence file descriptors with a single poll()
+// call. Wake() interrupts an ongoing wait from any other thread, which lets
+// the waiting thread pick up new fences or react to state changes without
+// waiting for one of the current fences to signal.
+class FenceWaiter {
+ public:
+  enum FenceStatus { FENCE_PENDING, FENCE_SIGNALED, FENCE_ERROR };
+
+  FenceWaiter();
+  ~FenceWaiter();
+
+  // Blocks until at least one of 'fences' leaves the pending state, 'timeout'
+  // expires or Wake() is called. A negative timeout waits indefinitely. The
+  // state of every fence is reported in 'status' on success.
+  status_t Wait(const std::vector<int>& fences, nsecs_t timeout,
+                std::vector<FenceStatus>* status /*out*/);
+
+  void Wake();
+
+ private:
+  // Without an event fd wakeups are only noticed at this interval
+  static const nsecs_t kFallbackWakeupInterval;
+
+  int event_fd_ = -1;
+  std::vector<struct pollfd> poll_fds_;
+
+  FenceWaiter(const FenceWaiter&) = delete;
+  FenceWaiter& operator=(const FenceWaiter&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_FENCE_WAITER_H_
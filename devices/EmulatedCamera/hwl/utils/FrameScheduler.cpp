@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "FrameScheduler"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+
+#include "FrameScheduler.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <log/log.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace android {
+
+const nsecs_t FrameScheduler::JitterHistogram::kBucketLimits[] = {
+    us2ns(50),   us2ns(100),  us2ns(250),   us2ns(500),  us2ns(1000),
+    us2ns(2000), us2ns(5000), us2ns(10000), us2ns(20000)};
+// Roughly the last eight frames dominate the estimate
+const uint32_t FrameScheduler::kCostSmoothingShift = 3;
+
+void FrameScheduler::JitterHistogram::Add(nsecs_t jitter) {
+  jitter = std::abs(jitter);
+  const nsecs_t* limits_end = kBucketLimits + kBucketCount - 1;
+  auto bucket = std::upper_bound(kBucketLimits, limits_end, jitter) -
+                kBucketLimits;
+  buckets[bucket]++;
+  count++;
+  total += jitter;
+  max = std::max(max, jitter);
+}
+
+nsecs_t FrameScheduler::BeginFrame(nsecs_t frame_duration) {
+  nsecs_t now = systemTime();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (next_frame_start_ == 0) {
+    next_frame_start_ = now;
+  } else if (now - next_frame_start_ > frame_duration) {
+    ALOGV("%s: Frame started %" PRId64 " ns late, restarting the schedule",
+          __FUNCTION__, now - next_frame_start_);
+    stats_.overruns++;
+    next_frame_start_ = now;
+  }
+
+  nsecs_t start_jitter = now - next_frame_start_;
+  ATRACE_INT64("FrameScheduler::start_jitter_ns", start_jitter);
+  stats_.start_jitter.Add(start_jitter);
+  stats_.frames++;
+
+  return next_frame_start_;
+}
+
+void FrameScheduler::EndFrame(nsecs_t frame_end_time) {
+  SleepUntil(frame_end_time);
+  nsecs_t end_jitter = systemTime() - frame_end_time;
+  ATRACE_INT64("FrameScheduler::end_jitter_ns", end_jitter);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.end_jitter.Add(end_jitter);
+  next_frame_start_ = frame_end_time;
+}
+
+void FrameScheduler::RecordStageCost(Stage stage, nsecs_t cost) {
+  if (stage >= STAGE_COUNT) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& smoothed_cost = stats_.stage_cost[stage];
+  if (smoothed_cost == 0) {
+    smoothed_cost = cost;
+  } else {
+    smoothed_cost += (cost - smoothed_cost) >> kCostSmoothingShift;
+  }
+}
+
+nsecs_t FrameScheduler::GetStageCost(Stage stage) const {
+  if (stage >= STAGE_COUNT) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_.stage_cost[stage];
+}
+
+FrameScheduler::Statistics FrameScheduler::GetStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void FrameScheduler::SleepUntil(nsecs_t deadline) {
+  timespec t;
+  t.tv_sec = deadline / 1000000000LL;
+  t.tv_nsec = deadline % 1000000000LL;
+  int ret;
+  do {
+    ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr);
+  } while (ret == EINTR);
+  if (ret != 0) {
+    ALOGE("%s: Failed to sleep: %s (%d)", __FUNCTION__, strerror(ret), ret);
+  }
+}
+
+static void DumpHistogram(int fd, const char* name,
+                          const FrameScheduler::JitterHistogram& histogram) {
+  typedef FrameScheduler::JitterHistogram Histogram;
+  dprintf(fd, "    %s jitter: mean: %" PRId64 " us max: %" PRId64 " us\n",
+          name,
+          histogram.count > 0 ? ns2us(histogram.total / histogram.count) : 0,
+          ns2us(histogram.max));
+  dprintf(fd, "     ");
+  for (size_t i = 0; i < Histogram::kBucketCount - 1; i++) {
+    dprintf(fd, " <%" PRId64 "us: %" PRIu64, ns2us(Histogram::kBucketLimits[i]),
+            histogram.buckets[i]);
+  }
+  dprintf(fd, " >=%" PRId64 "us: %" PRIu64 "\n",
+          ns2us(Histogram::kBucketLimits[Histogram::kBucketCount - 2]),
+          histogram.buckets[Histogram::kBucketCount - 1]);
+}
+
+void FrameScheduler::Dump(int fd) const {
+  auto stats = GetStatistics();
+  dprintf(fd, "  Frame timing: frames: %" PRIu64 " overruns: %" PRIu64 "\n",
+          stats.frames, stats.overruns);
+  DumpHistogram(fd, "start", stats.start_jitter);
+  DumpHistogram(fd, "end", stats.end_jitter);
+  dprintf(fd,
+          "    stage cost: timing: %" PRId64 " us render: %" PRId64
+          " us result: %" PRId64 " us\n",
+          ns2us(stats.stage_cost[STAGE_TIMING]),
+          ns2us(stats.stage_cost[STAGE_RENDER]),
+          ns2us(stats.stage_cost[STAGE_RESULT]));
+}
+
+}  // namespace android
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_FRAME_SCHEDULER_H_
+#define EMULATOR_CAMERA_HAL_HWL_FRAME_SCHEDULER_H_
+
+#include <utils/Timers.h>
+
+#include <mutex>
+
+namespace android {
+
+// Paces frames against absolute deadlines on the monotonic clock, which is
+// the time base of systemTime(). Each frame starts exactly where the previous
+// one was scheduled to end, so wakeup latency and slow frames do not
+// accumulate into drift. Only a schedule that falls behind by more than a
+// whole frame is restarted from the current time.
+//
+// BeginFrame() and EndFrame() must be called from a single thread, stage
+// costs and statistics may be accessed from any thread.
+class FrameScheduler {
+ public:
+  enum Stage { STAGE_TIMING, STAGE_RENDER, STAGE_RESULT, STAGE_COUNT };
+
+  // Distribution of the absolute deviation from target times
+  struct JitterHistogram {
+    static const size_t kBucketCount = 10;
+    // Upper bucket limits, the last bucket is open ended
+    static const nsecs_t kBucketLimits[kBucketCount - 1];
+
+    uint64_t buckets[kBucketCount] = {};
+    uint64_t count = 0;
+    nsecs_t total = 0;
+    nsecs_t max = 0;
+
+    void Add(nsecs_t jitter);
+  };
+
+  struct Statistics {
+    uint64_t frames = 0;
+    // Frames that started more than a frame duration late and restarted the
+    // schedule
+    uint64_t overruns = 0;
+    JitterHistogram start_jitter;
+    JitterHistogram end_jitter;
+    // Smoothed cost of each pipeline stage per frame
+    nsecs_t stage_cost[STAGE_COUNT] = {};
+  };
+
+  // Returns the target start time of the next frame.
+  nsecs_t BeginFrame(nsecs_t frame_duration);
+
+  // Sleeps until 'frame_end_time', which becomes the start of the next frame.
+  void EndFrame(nsecs_t frame_end_time);
+
+  void RecordStageCost(Stage stage, nsecs_t cost);
+  nsecs_t GetStageCost(Stage stage) const;
+
+  Statistics GetStatistics() const;
+
+  void Dump(int fd) const;
+
+  // Retries on signal interruptions until 'deadline' has passed.
+  static void SleepUntil(nsecs_t deadline);
+
+ private:
+  // New samples are weighted by 1/2^kCostSmoothingShift
+  static const uint32_t kCostSmoothingShift;
+
+  mutable std::mutex mutex_;
+  Statistics stats_;
+  // Accessed only from the thread driving the frames
+  nsecs_t next_frame_start_ = 0;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_FRAME_SCHEDULER_H_
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "FutexSignal"
+
+#include "FutexSignal.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace android {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "Futex words must be plain lock-free 32-bit integers");
+
+static uint32_t* GetFutexWord(std::atomic<uint32_t>* value) {
+  return reinterpret_cast<uint32_t*>(value);
+}
+
+void FutexSignal::Signal() {
+  count_.fetch_add(1, std::memory_order_seq_cst);
+  // Pairs with the waiter registration, either the waiter sees the new count
+  // before sleeping or the wakeup below sees the waiter.
+  if (waiters_.load(std::memory_order_seq_cst) > 0) {
+    syscall(SYS_futex, GetFutexWord(&count_), FUTEX_WAKE_PRIVATE, INT_MAX,
+            nullptr, nullptr, 0);
+  }
+}
+
+bool FutexSignal::WaitForChange(uint32_t count, nsecs_t timeout) {
+  nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + timeout;
+  bool ret = true;
+  waiters_.fetch_add(1, std::memory_order_seq_cst);
+  while (count_.load(std::memory_order_seq_cst) == count) {
+    nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+    if (remaining <= 0) {
+      ret = false;
+      break;
+    }
+
+    struct timespec ts = {
+        .tv_sec = static_cast<time_t>(remaining / 1000000000L),
+        .tv_nsec = static_cast<long>(remaining % 1000000000L)};
+    // Returns right away in case the count changed in the meantime
+    if ((syscall(SYS_futex, GetFutexWord(&count_), FUTEX_WAIT_PRIVATE, count,
+                 &ts, nullptr, 0) != 0) &&
+        (errno != EAGAIN) && (errno != EINTR) && (errno != ETIMEDOUT)) {
+      ALOGE("%s: Futex wait failed: %s (%d)", __FUNCTION__, strerror(errno),
+            errno);
+      ret = false;
+      break;
+    }
+  }
+  waiters_.fetch_sub(1, std::memory_order_seq_cst);
+
+  return ret;
+}
+
+}  // namespace android
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_FUTEX_SIGNAL_H_
+#define EMULATOR_CAMERA_HAL_HWL_FUTEX_SIGNAL_H_
+
+#include <utils/Timers.h>
+
+#include <atomic>
+
+namespace android {
+
+// Broadcast signal on a single futex word that counts the signals so far.
+// Signal() never blocks and only enters the kernel while threads are
+// waiting, waiters sleep on the futex without any user space lock. Every
+// waiter observes every signal that happens after it started waiting.
+//
+//   // Signaling thread      // Waiting threads
+//   signal.Signal();         signal.Wait(timeout);
+class FutexSignal {
+ public:
+  FutexSignal() = default;
+
+  // Wakes all current waiters.
+  void Signal();
+
+  uint32_t GetCount() const {
+    return count_.load(std::memory_order_seq_cst);
+  }
+
+  // Blocks until the signal count differs from 'count' or 'timeout' expires.
+  // Returns false in case of a timeout.
+  bool WaitForChange(uint32_t count, nsecs_t timeout);
+
+  // Blocks until the next signal or until 'timeout' expires.
+  bool Wait(nsecs_t timeout) {
+    return WaitForChange(GetCount(), timeout);
+  }
+
+ private:
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint32_t> waiters_{0};
+
+  FutexSignal(const FutexSignal&) = delete;
+  FutexSignal& operator=(const FutexSignal&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_FUTEX_SIGNAL_H_
@@ -189,6 +189,12 @@ status_t GetSensorCharacteristics(const HalCameraMetadata* metadata,
     sensor_chars->max_input_streams = entry.data.i32[0];
   }
 
+  ret = GetHighSpeedVideoConfigs(metadata,
+                                 &sensor_chars->high_speed_video_configs);
+  if (ret != OK) {
+    return ret;
+  }
+
   ret = metadata->Get(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &entry);
   if ((ret == OK) && (entry.count == 1)) {
     if (entry.data.u8[0] == 0) {
@@ -223,6 +229,43 @@ status_t GetSensorCharacteristics(const HalCameraMetadata* metadata,
   return ret;
 }
 
+status_t GetHighSpeedVideoConfigs(
+    const HalCameraMetadata* metadata,
+    std::vector<HighSpeedVideoConfig>* configs /*out*/) {
+  if ((metadata == nullptr) || (configs == nullptr)) {
+    return BAD_VALUE;
+  }
+
+  configs->clear();
+  if (!HasCapability(
+          metadata,
+          ANDROID_REQUEST_AVAILABLE_CAPABILITIES_CONSTRAINED_HIGH_SPEED_VIDEO)) {
+    return OK;
+  }
+
+  // Entries of width, height, min fps, max fps and maximum batch size
+  const size_t kConfigSize = 5;
+  camera_metadata_ro_entry_t entry;
+  auto ret = metadata->Get(
+      ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS, &entry);
+  if ((ret != OK) || (entry.count == 0) || ((entry.count % kConfigSize) != 0)) {
+    ALOGE("%s: Invalid high speed video configurations!", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  configs->reserve(entry.count / kConfigSize);
+  for (size_t i = 0; i < entry.count; i += kConfigSize) {
+    configs->push_back(
+        {.width = static_cast<uint32_t>(entry.data.i32[i]),
+         .height = static_cast<uint32_t>(entry.data.i32[i + 1]),
+         .min_fps = entry.data.i32[i + 2],
+         .max_fps = entry.data.i32[i + 3],
+         .batch_size_max = static_cast<uint32_t>(entry.data.i32[i + 4])});
+  }
+
+  return OK;
+}
+
 PhysicalDeviceMapPtr ClonePhysicalDeviceMap(const PhysicalDeviceMapPtr& src) {
   auto ret = std::make_unique<PhysicalDeviceMap>();
   for (const auto& it : *src) {
@@ -46,6 +46,10 @@ typedef std::unique_ptr<PhysicalDeviceMap> PhysicalDeviceMapPtr;
 bool HasCapability(const HalCameraMetadata* metadata, uint8_t capability);
 status_t GetSensorCharacteristics(const HalCameraMetadata* metadata,
                                   SensorCharacteristics* sensor_chars /*out*/);
+// Empty in case the constrained high speed capability is absent
+status_t GetHighSpeedVideoConfigs(
+    const HalCameraMetadata* metadata,
+    std::vector<HighSpeedVideoConfig>* configs /*out*/);
 PhysicalDeviceMapPtr ClonePhysicalDeviceMap(const PhysicalDeviceMapPtr& src);
 // Metadata utility functions end
 
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ImportedBufferCache"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+
+#include "ImportedBufferCache.h"
+
+#include <inttypes.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+namespace android {
+
+// Comfortably above the buffer count of a typical buffer queue
+const size_t ImportedBufferCache::kMaxBuffersPerStream = 16;
+
+ImportedBufferCache::ImportedBuffer::~ImportedBuffer() {
+  if (handle_ != nullptr) {
+    importer_->freeBuffer(handle_);
+  }
+}
+
+ImportedBufferCache::ImportedBufferCache()
+    : importer_(std::make_shared<HandleImporter>()) {
+}
+
+std::shared_ptr<ImportedBufferCache::ImportedBuffer>
+ImportedBufferCache::ImportLocked(buffer_handle_t buffer) {
+  ATRACE_CALL();
+  if (!importer_->importBuffer(buffer)) {
+    return nullptr;
+  }
+
+  return std::make_shared<ImportedBuffer>(importer_, buffer);
+}
+
+std::shared_ptr<ImportedBufferCache::ImportedBuffer>
+ImportedBufferCache::Import(int32_t stream_id, uint64_t buffer_id,
+                            buffer_handle_t buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& stream = streams_[stream_id];
+  if (buffer_id == 0) {
+    stream.stats.misses++;
+    return ImportLocked(buffer);
+  }
+
+  for (auto entry = stream.entries.begin(); entry != stream.entries.end();
+       entry++) {
+    if (entry->buffer_id != buffer_id) {
+      continue;
+    }
+
+    if (entry->buffer == buffer) {
+      stream.stats.hits++;
+      stream.entries.splice(stream.entries.begin(), stream.entries, entry);
+      return entry->imported_buffer;
+    }
+
+    // The id now refers to a different handle, the old import is stale
+    ALOGV("%s: Stream %d buffer %" PRIu64 " changed its handle", __FUNCTION__,
+          stream_id, buffer_id);
+    stream.entries.erase(entry);
+    break;
+  }
+
+  stream.stats.misses++;
+  auto imported_buffer = ImportLocked(buffer);
+  if (imported_buffer.get() == nullptr) {
+    stream.stats.cached_buffers = stream.entries.size();
+    return nullptr;
+  }
+
+  stream.entries.push_front({.buffer_id = buffer_id,
+                             .buffer = buffer,
+                             .imported_buffer = imported_buffer});
+  if (stream.entries.size() > kMaxBuffersPerStream) {
+    stream.entries.pop_back();
+    stream.stats.evictions++;
+  }
+  stream.stats.cached_buffers = stream.entries.size();
+
+  return imported_buffer;
+}
+
+void ImportedBufferCache::Remove(int32_t stream_id, uint64_t buffer_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto stream = streams_.find(stream_id);
+  if (stream == streams_.end()) {
+    return;
+  }
+
+  stream->second.entries.remove_if(
+      [buffer_id](const Entry& entry) { return entry.buffer_id == buffer_id; });
+  stream->second.stats.cached_buffers = stream->second.entries.size();
+}
+
+void ImportedBufferCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& stream : streams_) {
+    stream.second.entries.clear();
+    stream.second.stats.cached_buffers = 0;
+  }
+}
+
+std::unordered_map<int32_t, ImportedBufferCache::Statistics>
+ImportedBufferCache::GetStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<int32_t, Statistics> stats;
+  for (const auto& stream : streams_) {
+    stats[stream.first] = stream.second.stats;
+  }
+
+  return stats;
+}
+
+}  // namespace android
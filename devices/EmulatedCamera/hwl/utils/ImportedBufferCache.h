@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_IMPORTED_BUFFER_CACHE_H_
+#define EMULATOR_CAMERA_HAL_HWL_IMPORTED_BUFFER_CACHE_H_
+
+#include <HandleImporter.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace android {
+
+using android::hardware::camera::common::V1_0::helper::HandleImporter;
+
+// Keeps gralloc imports of stream buffers alive across requests. The
+// framework cycles through a small set of buffers per stream, so every
+// stream caches the imports of its most recently used buffers keyed on the
+// buffer id. Imports handed out remain valid after they have been evicted or
+// the cache has been cleared, until the last reference is gone.
+class ImportedBufferCache {
+ public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t cached_buffers = 0;
+  };
+
+  class ImportedBuffer {
+   public:
+    ImportedBuffer(std::shared_ptr<HandleImporter> importer,
+                   buffer_handle_t handle)
+        : importer_(importer), handle_(handle) {
+    }
+    ~ImportedBuffer();
+
+    buffer_handle_t handle() const {
+      return handle_;
+    }
+
+   private:
+    std::shared_ptr<HandleImporter> importer_;
+    buffer_handle_t handle_;
+
+    ImportedBuffer(const ImportedBuffer&) = delete;
+    ImportedBuffer& operator=(const ImportedBuffer&) = delete;
+  };
+
+  ImportedBufferCache();
+
+  // Returns the import of the framework buffer 'buffer' and imports it on a
+  // cache miss. Buffers without an id are imported without being cached.
+  // Returns nullptr in case the import fails.
+  std::shared_ptr<ImportedBuffer> Import(int32_t stream_id, uint64_t buffer_id,
+                                         buffer_handle_t buffer);
+
+  // Drops the cached import of a buffer the framework removed.
+  void Remove(int32_t stream_id, uint64_t buffer_id);
+
+  // Drops all cached imports, statistics are preserved.
+  void Clear();
+
+  // Cache statistics indexed by stream id
+  std::unordered_map<int32_t, Statistics> GetStatistics() const;
+
+ private:
+  static const size_t kMaxBuffersPerStream;
+
+  struct Entry {
+    uint64_t buffer_id;
+    buffer_handle_t buffer;  // Framework handle
+    std::shared_ptr<ImportedBuffer> imported_buffer;
+  };
+
+  struct StreamCache {
+    std::list<Entry> entries;  // Most recently used first
+    Statistics stats;
+  };
+
+  std::shared_ptr<ImportedBuffer> ImportLocked(buffer_handle_t buffer);
+
+  mutable std::mutex mutex_;
+  std::shared_ptr<HandleImporter> importer_;
+  std::unordered_map<int32_t, StreamCache> streams_;
+
+  ImportedBufferCache(const ImportedBufferCache&) = delete;
+  ImportedBufferCache& operator=(const ImportedBufferCache&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_IMPORTED_BUFFER_CACHE_H_
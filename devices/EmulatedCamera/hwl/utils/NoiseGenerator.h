@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_NOISE_GENERATOR_H_
+#define EMULATOR_CAMERA_HAL_HWL_NOISE_GENERATOR_H_
+
+#include <stdint.h>
+
+namespace android {
+
+// Counter-based noise source built on the SplitMix64 mixing function. Every
+// sample is a pure function of the generator key and the sample index, so
+// samples can be drawn in any order and from any number of threads with
+// identical results.
+class NoiseGenerator {
+ public:
+  explicit NoiseGenerator(uint64_t key) : key_(Mix(key)) {
+  }
+
+  uint64_t GetRandom(uint64_t index) const {
+    return Mix(key_ + (index + 1) * kGamma);
+  }
+
+  // Approximately normal sample with zero mean and unit variance, computed as
+  // the sum of the four low bytes of a random value (Irwin-Hall).
+  float GetGaussian(uint64_t index) const {
+    uint64_t value = GetRandom(index);
+    int32_t sum = (value & 0xFF) + ((value >> 8) & 0xFF) +
+                  ((value >> 16) & 0xFF) + ((value >> 24) & 0xFF);
+    return (sum - kGaussianMean) * kGaussianScale;
+  }
+
+ private:
+  static const uint64_t kGamma = 0x9E3779B97F4A7C15ULL;
+  static const int32_t kGaussianMean = 4 * 255 / 2;
+  // 1 / sqrt(4 * (256^2 - 1) / 12)
+  static constexpr float kGaussianScale = 0.0067658751f;
+
+  static uint64_t Mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t key_;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_NOISE_GENERATOR_H_
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RenderCache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace android {
+
+RenderCache::RenderCache(size_t max_size_bytes) {
+  stats_.max_size_bytes = max_size_bytes;
+}
+
+RenderCache::Entry RenderCache::Get(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entry_map_.find(key);
+  if (it == entry_map_.end()) {
+    stats_.misses++;
+    return nullptr;
+  }
+
+  stats_.hits++;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void RenderCache::Put(const std::string& key, Entry entry) {
+  if ((entry.get() == nullptr) || (entry->size() > stats_.max_size_bytes)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entry_map_.find(key);
+  if (it != entry_map_.end()) {
+    stats_.size_bytes -= it->second->second->size();
+    entries_.erase(it->second);
+    entry_map_.erase(it);
+  }
+
+  while (!entries_.empty() &&
+         (stats_.size_bytes + entry->size() > stats_.max_size_bytes)) {
+    stats_.size_bytes -= entries_.back().second->size();
+    entry_map_.erase(entries_.back().first);
+    entries_.pop_back();
+    stats_.evictions++;
+  }
+
+  stats_.size_bytes += entry->size();
+  entries_.emplace_front(key, std::move(entry));
+  entry_map_.emplace(key, entries_.begin());
+}
+
+void RenderCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  entry_map_.clear();
+  stats_.size_bytes = 0;
+}
+
+RenderCache::Statistics RenderCache::GetStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto stats = stats_;
+  stats.entry_count = entries_.size();
+  return stats;
+}
+
+void RenderCache::Dump(int fd) const {
+  auto stats = GetStatistics();
+  dprintf(fd,
+          "  Render cache: hits: %" PRIu64 " misses: %" PRIu64
+          " evictions: %" PRIu64 "\n",
+          stats.hits, stats.misses, stats.evictions);
+  dprintf(fd, "    entries: %zu size: %zu/%zu bytes\n", stats.entry_count,
+          stats.size_bytes, stats.max_size_bytes);
+}
+
+}  // namespace android
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_RENDER_CACHE_H_
+#define EMULATOR_CAMERA_HAL_HWL_RENDER_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+
+// Least recently used cache of rendered sensor output. Keys are opaque byte
+// strings that must capture everything the rendered pixels depend on; values
+// are immutable and can be read while other threads insert new entries.
+class RenderCache {
+ public:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Entry;
+
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entry_count = 0;
+    size_t size_bytes = 0;
+    size_t max_size_bytes = 0;
+  };
+
+  // Entries are evicted once their combined size exceeds 'max_size_bytes'.
+  explicit RenderCache(size_t max_size_bytes);
+
+  // Returns nullptr in case 'key' is not cached.
+  Entry Get(const std::string& key);
+
+  // Entries larger than the cache capacity are silently dropped.
+  void Put(const std::string& key, Entry entry);
+
+  void Clear();
+
+  Statistics GetStatistics() const;
+
+  void Dump(int fd) const;
+
+ private:
+  typedef std::list<std::pair<std::string, Entry>> EntryList;
+
+  mutable std::mutex mutex_;
+  // Most recently used entries are kept at the front
+  EntryList entries_;
+  std::unordered_map<std::string, EntryList::iterator> entry_map_;
+  Statistics stats_;
+
+  RenderCache(const RenderCache&) = delete;
+  RenderCache& operator=(const RenderCache&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_RENDER_CACHE_H_
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "RequestValidator"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+
+#include "RequestValidator.h"
+
+#include <log/log.h>
+#include <utils/Trace.h>
+
+namespace android {
+
+status_t RequestValidator::AddSlot(uint32_t tag, Slot** slot /*out*/) {
+  uint32_t section = tag >> 16;
+  uint32_t index = tag & 0xFFFF;
+  // Vendor tags are not supported, their sections would blow up the table
+  if ((section >= VENDOR_SECTION) || (get_camera_metadata_tag_type(tag) < 0)) {
+    ALOGE("%s: Unsupported tag 0x%x!", __FUNCTION__, tag);
+    return BAD_VALUE;
+  }
+
+  if (IsRegistered(tag)) {
+    *slot = &slots_[GetSlot(tag)];
+    return OK;
+  }
+
+  if (section >= slot_table_.size()) {
+    slot_table_.resize(section + 1);
+  }
+  if (index >= slot_table_[section].size()) {
+    slot_table_[section].resize(index + 1, -1);
+  }
+  slot_table_[section][index] = slots_.size();
+  slots_.push_back({.tag = tag});
+  *slot = &slots_.back();
+
+  return OK;
+}
+
+status_t RequestValidator::AddTag(uint32_t tag) {
+  Slot* slot;
+  return AddSlot(tag, &slot);
+}
+
+status_t RequestValidator::AddTag(uint32_t tag,
+                                  const std::set<uint8_t>& supported_values) {
+  if (get_camera_metadata_tag_type(tag) != TYPE_BYTE) {
+    ALOGE("%s: Tag 0x%x is not of byte type!", __FUNCTION__, tag);
+    return BAD_VALUE;
+  }
+
+  Slot* slot;
+  auto ret = AddSlot(tag, &slot);
+  if (ret != OK) {
+    return ret;
+  }
+
+  slot->validated = true;
+  slot->supported_values.reset();
+  for (auto value : supported_values) {
+    slot->supported_values.set(value);
+  }
+
+  return OK;
+}
+
+void RequestValidator::Clear() {
+  slot_table_.clear();
+  slots_.clear();
+}
+
+bool RequestValidator::IsSupported(uint32_t tag, uint8_t value) const {
+  auto slot = GetSlot(tag);
+  if (slot < 0) {
+    return false;
+  }
+
+  return slots_[slot].validated && slots_[slot].supported_values.test(value);
+}
+
+void RequestValidator::Parse(const HalCameraMetadata& settings,
+                             Entries* entries) const {
+  ATRACE_CALL();
+  entries->resize(slots_.size());
+  for (size_t i = 0; i < slots_.size(); i++) {
+    (*entries)[i] = {.tag = slots_[i].tag, .count = 0};
+  }
+
+  auto metadata = settings.GetRawCameraMetadata();
+  if (metadata == nullptr) {
+    return;
+  }
+
+  size_t entry_count = get_camera_metadata_entry_count(metadata);
+  camera_metadata_ro_entry_t entry;
+  for (size_t i = 0; i < entry_count; i++) {
+    if (get_camera_metadata_ro_entry(metadata, i, &entry) != OK) {
+      continue;
+    }
+
+    auto slot = GetSlot(entry.tag);
+    if (slot >= 0) {
+      (*entries)[slot] = entry;
+    }
+  }
+}
+
+status_t RequestValidator::Get(const Entries& entries, uint32_t tag,
+                               camera_metadata_ro_entry_t* entry) const {
+  auto slot = GetSlot(tag);
+  if ((slot < 0) || (static_cast<size_t>(slot) >= entries.size()) ||
+      (entries[slot].tag != tag)) {
+    return BAD_VALUE;
+  }
+
+  if (entries[slot].count == 0) {
+    return NAME_NOT_FOUND;
+  }
+
+  *entry = entries[slot];
+  return OK;
+}
+
+}  // namespace android
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_REQUEST_VALIDATOR_H_
+#define EMULATOR_CAMERA_HAL_HWL_REQUEST_VALIDATOR_H_
+
+#include <hal_camera_metadata.h>
+
+#include <bitset>
+#include <set>
+#include <vector>
+
+namespace android {
+
+using google_camera_hal::HalCameraMetadata;
+
+// Request settings validator compiled once per session. The tags consumed
+// by the request state are registered up front and mapped to slots through
+// a flat per section lookup table. Enumerated byte tags can additionally
+// carry their supported values, which are kept as a 256 bit map.
+// Parsing walks the settings buffer once and records the entries of all
+// registered tags, so lookups and value checks on the hot path never search
+// the settings or the capability sets.
+//
+//   validator.AddTag(ANDROID_CONTROL_AE_MODE, available_ae_modes);
+//   ...
+//   validator.Parse(*settings, &entries);
+//   validator.Get(entries, ANDROID_CONTROL_AE_MODE, &entry);
+//
+// Registration is not thread safe, parsing and lookups are.
+class RequestValidator {
+ public:
+  // Entries of the registered tags indexed by slot, absent tags have a zero
+  // count.
+  typedef std::vector<camera_metadata_ro_entry_t> Entries;
+
+  RequestValidator() = default;
+
+  status_t AddTag(uint32_t tag);
+  // Only values in 'supported_values' pass 'IsSupported()'. 'tag' must be of
+  // byte type.
+  status_t AddTag(uint32_t tag, const std::set<uint8_t>& supported_values);
+
+  void Clear();
+
+  bool IsRegistered(uint32_t tag) const {
+    return GetSlot(tag) >= 0;
+  }
+
+  // Returns false for unregistered tags and tags without supported values.
+  bool IsSupported(uint32_t tag, uint8_t value) const;
+
+  void Parse(const HalCameraMetadata& settings, Entries* entries) const;
+
+  // Follows 'HalCameraMetadata::Get()'. Returns NAME_NOT_FOUND in case the
+  // tag was absent from the parsed settings and BAD_VALUE in case it is not
+  // registered. 'entries' can come from any validator with the same tag
+  // registration order, mismatching slots also return BAD_VALUE.
+  status_t Get(const Entries& entries, uint32_t tag,
+               camera_metadata_ro_entry_t* entry /*out*/) const;
+
+ private:
+  struct Slot {
+    uint32_t tag = 0;
+    bool validated = false;
+    std::bitset<256> supported_values;
+  };
+
+  int32_t GetSlot(uint32_t tag) const {
+    uint32_t section = tag >> 16;
+    uint32_t index = tag & 0xFFFF;
+    if ((section >= slot_table_.size()) ||
+        (index >= slot_table_[section].size())) {
+      return -1;
+    }
+
+    return slot_table_[section][index];
+  }
+
+  status_t AddSlot(uint32_t tag, Slot** slot /*out*/);
+
+  // Slot of every registered tag indexed by tag section and tag index within
+  // the section, unregistered tags map to -1.
+  std::vector<std::vector<int32_t>> slot_table_;
+  std::vector<Slot> slots_;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_REQUEST_VALIDATOR_H_
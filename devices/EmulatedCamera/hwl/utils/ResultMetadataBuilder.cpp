@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ResultMetadataBuilder"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+
+#include "ResultMetadataBuilder.h"
+
+#include <log/log.h>
+#include <string.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+
+namespace android {
+
+ResultMetadataBuilder::~ResultMetadataBuilder() {
+  if (template_ != nullptr) {
+    free_camera_metadata(template_);
+  }
+}
+
+void ResultMetadataBuilder::SetSpareCapacity(size_t entries, size_t data) {
+  spare_entries_ = entries;
+  spare_data_ = data;
+}
+
+void ResultMetadataBuilder::SetArena(
+    std::shared_ptr<HalCameraMetadataArena> arena) {
+  arena_ = std::move(arena);
+}
+
+void ResultMetadataBuilder::Begin(
+    std::shared_ptr<const HalCameraMetadata> settings) {
+  if (settings != settings_) {
+    settings_changed_ = true;
+    settings_ = std::move(settings);
+  }
+  for (auto& value : values_) {
+    value.reported = false;
+  }
+  next_value_ = 0;
+}
+
+status_t ResultMetadataBuilder::Set(uint32_t tag, const uint8_t* data,
+                                    size_t count) {
+  return SetRaw(tag, TYPE_BYTE, data, count);
+}
+
+status_t ResultMetadataBuilder::Set(uint32_t tag, const int32_t* data,
+                                    size_t count) {
+  return SetRaw(tag, TYPE_INT32, data, count);
+}
+
+status_t ResultMetadataBuilder::Set(uint32_t tag, const float* data,
+                                    size_t count) {
+  return SetRaw(tag, TYPE_FLOAT, data, count);
+}
+
+status_t ResultMetadataBuilder::Set(uint32_t tag, const int64_t* data,
+                                    size_t count) {
+  return SetRaw(tag, TYPE_INT64, data, count);
+}
+
+status_t ResultMetadataBuilder::Set(uint32_t tag, const double* data,
+                                    size_t count) {
+  return SetRaw(tag, TYPE_DOUBLE, data, count);
+}
+
+status_t ResultMetadataBuilder::Set(uint32_t tag,
+                                    const camera_metadata_rational_t* data,
+                                    size_t count) {
+  return SetRaw(tag, TYPE_RATIONAL, data, count);
+}
+
+status_t ResultMetadataBuilder::SetRaw(uint32_t tag, int type,
+                                       const void* data, size_t count) {
+  if ((data == nullptr) && (count > 0)) {
+    return BAD_VALUE;
+  }
+  if (get_camera_metadata_tag_type(tag) != type) {
+    ALOGE("%s: Tag 0x%x does not have the expected type %d", __FUNCTION__, tag,
+          type);
+    return BAD_VALUE;
+  }
+
+  // Values are usually set in the same order as during the previous frame
+  Value* value = nullptr;
+  if ((next_value_ < values_.size()) && (values_[next_value_].tag == tag)) {
+    value = &values_[next_value_];
+  } else {
+    auto it = std::find_if(values_.begin(), values_.end(),
+                           [tag](const Value& v) { return v.tag == tag; });
+    if (it == values_.end()) {
+      values_.push_back({.tag = tag,
+                         .type = type,
+                         .count = 0,
+                         .data = {},
+                         .changed = true,
+                         .reported = false});
+      values_changed_ = true;
+      it = values_.end() - 1;
+    }
+    value = &(*it);
+  }
+  next_value_ = (value - values_.data()) + 1;
+
+  size_t size = count * camera_metadata_type_size[type];
+  if (value->count != count) {
+    // The template entry cannot be updated in place
+    values_changed_ = true;
+    value->changed = true;
+  } else if (!value->changed) {
+    value->changed = memcmp(value->data.data(), data, size) != 0;
+  }
+  if (value->changed) {
+    value->data.assign(static_cast<const uint8_t*>(data),
+                       static_cast<const uint8_t*>(data) + size);
+    value->count = count;
+  }
+  value->reported = true;
+
+  return OK;
+}
+
+status_t ResultMetadataBuilder::RebuildTemplate() {
+  ATRACE_CALL();
+  const camera_metadata_t* settings =
+      (settings_.get() != nullptr) ? settings_->GetRawCameraMetadata()
+                                   : nullptr;
+  size_t entry_capacity = values_.size();
+  size_t data_capacity = 0;
+  if (settings != nullptr) {
+    entry_capacity += get_camera_metadata_entry_count(settings);
+    data_capacity += get_camera_metadata_data_count(settings);
+  }
+  for (const auto& value : values_) {
+    data_capacity +=
+        calculate_camera_metadata_entry_data_size(value.type, value.count);
+  }
+
+  if (template_ != nullptr) {
+    free_camera_metadata(template_);
+  }
+  template_ = allocate_camera_metadata(entry_capacity, data_capacity);
+  if (template_ == nullptr) {
+    ALOGE("%s: Failed to allocate result template", __FUNCTION__);
+    return NO_MEMORY;
+  }
+  if ((settings != nullptr) &&
+      (append_camera_metadata(template_, settings) != OK)) {
+    ALOGE("%s: Failed to copy the request settings", __FUNCTION__);
+    return UNKNOWN_ERROR;
+  }
+
+  for (const auto& value : values_) {
+    camera_metadata_entry_t entry;
+    status_t ret;
+    if (find_camera_metadata_entry(template_, value.tag, &entry) == OK) {
+      ret = update_camera_metadata_entry(template_, entry.index,
+                                         value.data.data(), value.count,
+                                         nullptr);
+    } else {
+      ret = add_camera_metadata_entry(template_, value.tag, value.data.data(),
+                                      value.count);
+    }
+    if (ret != OK) {
+      ALOGE("%s: Failed to write tag 0x%x", __FUNCTION__, value.tag);
+      return ret;
+    }
+  }
+  sort_camera_metadata(template_);
+
+  stats_.rebuilds++;
+  stats_.written_values += values_.size();
+
+  return OK;
+}
+
+status_t ResultMetadataBuilder::PatchTemplate() {
+  for (const auto& value : values_) {
+    if (!value.changed) {
+      stats_.skipped_values++;
+      continue;
+    }
+
+    camera_metadata_entry_t entry;
+    auto ret = find_camera_metadata_entry(template_, value.tag, &entry);
+    if (ret == OK) {
+      ret = update_camera_metadata_entry(template_, entry.index,
+                                         value.data.data(), value.count,
+                                         nullptr);
+    }
+    if (ret != OK) {
+      ALOGE("%s: Failed to update tag 0x%x", __FUNCTION__, value.tag);
+      return ret;
+    }
+    stats_.written_values++;
+  }
+
+  return OK;
+}
+
+std::unique_ptr<HalCameraMetadata> ResultMetadataBuilder::Finish() {
+  auto removed = std::remove_if(values_.begin(), values_.end(),
+                                [](const Value& v) { return !v.reported; });
+  if (removed != values_.end()) {
+    values_.erase(removed, values_.end());
+    values_changed_ = true;
+  }
+
+  status_t ret;
+  if (settings_changed_ || values_changed_ || (template_ == nullptr)) {
+    ret = RebuildTemplate();
+  } else {
+    ret = PatchTemplate();
+  }
+  for (auto& value : values_) {
+    value.changed = false;
+  }
+  if (ret != OK) {
+    // Start over during the next frame
+    values_.clear();
+    values_changed_ = true;
+    return nullptr;
+  }
+  settings_changed_ = values_changed_ = false;
+
+  auto result = HalCameraMetadata::Create(
+      get_camera_metadata_entry_count(template_) + spare_entries_,
+      get_camera_metadata_data_count(template_) + spare_data_, arena_);
+  if (result == nullptr) {
+    ALOGE("%s: Failed to allocate result metadata", __FUNCTION__);
+    return nullptr;
+  }
+  if (result->Append(template_) != OK) {
+    ALOGE("%s: Failed to copy the result template", __FUNCTION__);
+    return nullptr;
+  }
+  stats_.results++;
+
+  return result;
+}
+
+}  // namespace android
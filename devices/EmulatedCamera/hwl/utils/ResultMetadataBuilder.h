@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_RESULT_METADATA_BUILDER_H_
+#define EMULATOR_CAMERA_HAL_HWL_RESULT_METADATA_BUILDER_H_
+
+#include <hal_camera_metadata.h>
+
+#include <memory>
+#include <vector>
+
+namespace android {
+
+using google_camera_hal::HalCameraMetadata;
+using google_camera_hal::HalCameraMetadataArena;
+
+// Builds result metadata out of the request settings and a set of result
+// values. Consecutive results rarely differ, so the previous result is kept
+// as a template. As long as the settings snapshot and the reported tags stay
+// the same, only the values that changed since the previous frame are
+// patched into the template. Every result is a single allocation sized for
+// the template plus spare capacity for values that are added later on, which
+// can be recycled through an arena.
+//
+//   builder.Begin(settings);
+//   builder.Set(ANDROID_CONTROL_AE_STATE, &ae_state, 1);
+//   ...
+//   auto result = builder.Finish();
+//
+// Not thread safe.
+class ResultMetadataBuilder {
+ public:
+  struct Statistics {
+    uint64_t results = 0;
+    // Results that needed a new template due to changed settings or tags
+    uint64_t rebuilds = 0;
+    // Values written to a template
+    uint64_t written_values = 0;
+    // Values identical to the previous result, which were skipped
+    uint64_t skipped_values = 0;
+  };
+
+  ResultMetadataBuilder() = default;
+  ~ResultMetadataBuilder();
+
+  void SetSpareCapacity(size_t entries, size_t data);
+
+  // Allocate the results from 'arena', nullptr allocates them from the heap.
+  void SetArena(std::shared_ptr<HalCameraMetadataArena> arena);
+
+  // Starts a new result based on 'settings', which must not be modified.
+  void Begin(std::shared_ptr<const HalCameraMetadata> settings);
+
+  status_t Set(uint32_t tag, const uint8_t* data, size_t count);
+  status_t Set(uint32_t tag, const int32_t* data, size_t count);
+  status_t Set(uint32_t tag, const float* data, size_t count);
+  status_t Set(uint32_t tag, const int64_t* data, size_t count);
+  status_t Set(uint32_t tag, const double* data, size_t count);
+  status_t Set(uint32_t tag, const camera_metadata_rational_t* data,
+               size_t count);
+
+  // Tags that have been reported by the previous result but not by this one
+  // are dropped. The result is not frozen, the sensor and the HAL still add
+  // and update tags, e.g. the timestamp or the zoom ratio.
+  std::unique_ptr<HalCameraMetadata> Finish();
+
+  Statistics GetStatistics() const {
+    return stats_;
+  }
+
+ private:
+  struct Value {
+    uint32_t tag;
+    int type;
+    size_t count;
+    std::vector<uint8_t> data;
+    bool changed;   // Since the previous result
+    bool reported;  // By the current result
+  };
+
+  status_t SetRaw(uint32_t tag, int type, const void* data, size_t count);
+  status_t RebuildTemplate();
+  status_t PatchTemplate();
+
+  std::shared_ptr<const HalCameraMetadata> settings_;
+  bool settings_changed_ = true;
+  // In the order of the Set() calls, which rarely changes between frames
+  std::vector<Value> values_;
+  size_t next_value_ = 0;
+  bool values_changed_ = true;
+  camera_metadata_t* template_ = nullptr;
+  size_t spare_entries_ = 0;
+  size_t spare_data_ = 0;
+  std::shared_ptr<HalCameraMetadataArena> arena_;
+  Statistics stats_;
+
+  ResultMetadataBuilder(const ResultMetadataBuilder&) = delete;
+  ResultMetadataBuilder& operator=(const ResultMetadataBuilder&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_RESULT_METADATA_BUILDER_H_
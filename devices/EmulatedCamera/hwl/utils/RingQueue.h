@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_RING_QUEUE_H_
+#define EMULATOR_CAMERA_HAL_HWL_RING_QUEUE_H_
+
+#include <stddef.h>
+
+#include <utility>
+#include <vector>
+
+namespace android {
+
+// Bounded FIFO backed by a ring of pre-allocated slots. Items are moved in
+// and out of the slots, the queue itself never allocates after 'Reset()'.
+// Not thread safe, see SPSCQueue for a lock-free variant.
+template <typename T>
+class RingQueue {
+ public:
+  explicit RingQueue(size_t capacity = 0) : slots_(capacity) {
+  }
+
+  // Drops all queued items.
+  void Reset(size_t capacity) {
+    slots_.clear();
+    slots_.resize(capacity);
+    head_ = 0;
+    size_ = 0;
+  }
+
+  // 'item' is left untouched in case the queue is full.
+  bool Push(T&& item) {
+    if (Full()) {
+      return false;
+    }
+
+    slots_[(head_ + size_) % slots_.size()] = std::move(item);
+    size_++;
+    return true;
+  }
+
+  T& Front() {
+    return slots_[head_];
+  }
+
+  const T& Front() const {
+    return slots_[head_];
+  }
+
+  // Releases the front item, the slot is reset to a default constructed
+  // value.
+  void Pop() {
+    if (Empty()) {
+      return;
+    }
+
+    slots_[head_] = T();
+    head_ = (head_ + 1) % slots_.size();
+    size_--;
+  }
+
+  // Items in queue order, 'index' must be smaller than 'Size()'.
+  T& operator[](size_t index) {
+    return slots_[(head_ + index) % slots_.size()];
+  }
+
+  const T& operator[](size_t index) const {
+    return slots_[(head_ + index) % slots_.size()];
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  bool Empty() const {
+    return size_ == 0;
+  }
+
+  bool Full() const {
+    return size_ == slots_.size();
+  }
+
+  size_t Capacity() const {
+    return slots_.size();
+  }
+
+ private:
+  std::vector<T> slots_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+
+  RingQueue(const RingQueue&) = delete;
+  RingQueue& operator=(const RingQueue&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_RING_QUEUE_H_
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_SPSC_QUEUE_H_
+#define EMULATOR_CAMERA_HAL_HWL_SPSC_QUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace android {
+
+// Bounded lock-free ring buffer with exactly one producer and one consumer
+// thread. Neither side blocks; callers decide how to wait when the queue is
+// full or empty.
+template <typename T>
+class SPSCQueue {
+ public:
+  // 'capacity' is rounded up to the next power of two.
+  explicit SPSCQueue(size_t capacity)
+      : slots_(RoundUpToPowerOfTwo(capacity)), mask_(slots_.size() - 1) {
+  }
+
+  // Producer only. 'item' is left untouched in case the queue is full.
+  bool TryPush(T&& item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - producer_head_ == slots_.size()) {
+      producer_head_ = head_.load(std::memory_order_acquire);
+      if (tail - producer_head_ == slots_.size()) {
+        return false;
+      }
+    }
+
+    slots_[tail & mask_] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only.
+  bool TryPop(T* item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == consumer_tail_) {
+      consumer_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == consumer_tail_) {
+        return false;
+      }
+    }
+
+    *item = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Size queries are exact only when called from the producer or the
+  // consumer thread, other threads may observe stale values.
+  size_t Size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  bool Empty() const {
+    return Size() == 0;
+  }
+
+  bool Full() const {
+    return Size() == slots_.size();
+  }
+
+  size_t Capacity() const {
+    return slots_.size();
+  }
+
+ private:
+  static const size_t kCacheLineSize = 64;
+
+  static size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t ret = 1;
+    while (ret < value) {
+      ret <<= 1;
+    }
+    return ret;
+  }
+
+  std::vector<T> slots_;
+  const size_t mask_;
+
+  // Consumer owned, the cached tail avoids touching the producer cache line
+  // while items are available.
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  size_t consumer_tail_ = 0;
+  // Producer owned
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  size_t producer_head_ = 0;
+
+  SPSCQueue(const SPSCQueue&) = delete;
+  SPSCQueue& operator=(const SPSCQueue&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_SPSC_QUEUE_H_
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+namespace android {
+
+WorkerPool::WorkerPool(size_t thread_count) {
+  for (size_t i = 1; i < thread_count; i++) {
+    workers_.emplace_back([this] { this->ThreadLoop(); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+  }
+  task_condition_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void WorkerPool::Enqueue(std::function<void()> task) {
+  if (workers_.empty()) {
+    task();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push(std::move(task));
+    pending_tasks_++;
+  }
+  task_condition_.notify_one();
+}
+
+void WorkerPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (pending_tasks_ > 0) {
+    if (tasks_.empty()) {
+      done_condition_.wait(lock);
+      continue;
+    }
+
+    auto task = std::move(tasks_.front());
+    tasks_.pop();
+    lock.unlock();
+    task();
+    lock.lock();
+    OnTaskDoneLocked();
+  }
+}
+
+void WorkerPool::ParallelFor(size_t count, size_t min_band_size,
+                             const std::function<void(size_t, size_t)>& func) {
+  if (count == 0) {
+    return;
+  }
+
+  // A couple of bands per thread help balancing rows with uneven cost.
+  size_t band_count = GetThreadCount() * 2;
+  if (min_band_size > 0) {
+    band_count = std::min(band_count, count / min_band_size);
+  }
+  if ((band_count <= 1) || workers_.empty()) {
+    func(0, count);
+    return;
+  }
+
+  size_t band_size = (count + band_count - 1) / band_count;
+  for (size_t begin = 0; begin < count; begin += band_size) {
+    size_t end = std::min(begin + band_size, count);
+    Enqueue([&func, begin, end] { func(begin, end); });
+  }
+  Wait();
+}
+
+void WorkerPool::OnTaskDoneLocked() {
+  pending_tasks_--;
+  if (pending_tasks_ == 0) {
+    done_condition_.notify_all();
+  }
+}
+
+void WorkerPool::ThreadLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    task_condition_.wait(lock, [this] { return exit_ || !tasks_.empty(); });
+    if (tasks_.empty()) {
+      // Exit requested and nothing left to run
+      return;
+    }
+
+    auto task = std::move(tasks_.front());
+    tasks_.pop();
+    lock.unlock();
+    task();
+    lock.lock();
+    OnTaskDoneLocked();
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_WORKER_POOL_H_
+#define EMULATOR_CAMERA_HAL_HWL_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace android {
+
+// Fixed size pool of worker threads used to split frame rendering across
+// multiple cores. A pool is meant to be driven by a single client thread
+// which enqueues tasks and then blocks in Wait() until all of them complete.
+class WorkerPool {
+ public:
+  // 'thread_count' is the total parallelism including the client thread that
+  // calls Wait(). A value of 0 or 1 does not spawn any threads and all tasks
+  // run inline during Enqueue().
+  explicit WorkerPool(size_t thread_count);
+  virtual ~WorkerPool();
+
+  size_t GetThreadCount() const {
+    return workers_.size() + 1;
+  }
+
+  void Enqueue(std::function<void()> task);
+
+  // Block until all enqueued tasks complete. The calling thread participates
+  // in draining the task queue.
+  void Wait();
+
+  // Split [0, count) in contiguous bands of at least 'min_band_size' elements
+  // and run 'func(begin, end)' for each band in parallel. Returns once all
+  // bands are done.
+  void ParallelFor(size_t count, size_t min_band_size,
+                   const std::function<void(size_t, size_t)>& func);
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable task_condition_;
+  std::condition_variable done_condition_;
+  std::queue<std::function<void()>> tasks_;
+  size_t pending_tasks_ = 0;
+  bool exit_ = false;
+  std::vector<std::thread> workers_;
+
+  void ThreadLoop();
+  // Must be called with 'mutex_' held.
+  void OnTaskDoneLocked();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_WORKER_POOL_H_
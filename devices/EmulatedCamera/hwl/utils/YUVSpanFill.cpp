@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "YUVSpanFill.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace android {
+
+void FillInterleaved(uint8_t* dst, uint8_t first, uint8_t second,
+                     size_t count) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  uint8x16x2_t pattern = {{vdupq_n_u8(first), vdupq_n_u8(second)}};
+  for (; i + 16 <= count; i += 16) {
+    vst2q_u8(dst + i * 2, pattern);
+  }
+#elif defined(__AVX2__)
+  const __m256i pattern =
+      _mm256_set1_epi16(static_cast<int16_t>((second << 8) | first));
+  for (; i + 16 <= count; i += 16) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2), pattern);
+  }
+#elif defined(__SSE2__)
+  const __m128i pattern =
+      _mm_set1_epi16(static_cast<int16_t>((second << 8) | first));
+  for (; i + 8 <= count; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), pattern);
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i * 2] = first;
+    dst[i * 2 + 1] = second;
+  }
+}
+
+void FillYUV420Span(uint8_t* y_row, uint8_t* cb_row, uint8_t* cr_row,
+                    uint32_t cbcr_step, size_t begin, size_t end,
+                    bool write_chroma, YUV420SpanValue value) {
+  if (end <= begin) {
+    return;
+  }
+
+  memset(y_row + begin, value.y, end - begin);
+  if (!write_chroma) {
+    return;
+  }
+
+  // Chroma sample 'i' is taken from pixel '2 * i'
+  size_t cbcr_begin = (begin + 1) / 2;
+  size_t cbcr_count = (end + 1) / 2 - cbcr_begin;
+  if (cbcr_count == 0) {
+    return;
+  }
+
+  switch (cbcr_step) {
+    case 1:
+      memset(cb_row + cbcr_begin, value.cb, cbcr_count);
+      memset(cr_row + cbcr_begin, value.cr, cbcr_count);
+      break;
+    case 2:
+      if (cb_row < cr_row) {
+        FillInterleaved(cb_row + cbcr_begin * 2, value.cb, value.cr,
+                        cbcr_count);
+      } else {
+        FillInterleaved(cr_row + cbcr_begin * 2, value.cr, value.cb,
+                        cbcr_count);
+      }
+      break;
+    default:
+      for (size_t i = cbcr_begin; i < cbcr_begin + cbcr_count; i++) {
+        cb_row[i * cbcr_step] = value.cb;
+        cr_row[i * cbcr_step] = value.cr;
+      }
+  }
+}
+
+}  // namespace android
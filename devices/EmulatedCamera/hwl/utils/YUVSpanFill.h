@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_YUV_SPAN_FILL_H_
+#define EMULATOR_CAMERA_HAL_HWL_YUV_SPAN_FILL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+struct YUV420SpanValue {
+  uint8_t y = 0;
+  uint8_t cb = 0;
+  uint8_t cr = 0;
+};
+
+// Fill the pixels [begin, end) of a YUV420 output row with a constant value.
+// 'cb_row' and 'cr_row' point to the start of the chroma row that belongs to
+// the luma row and are only written when 'write_chroma' is set. Chroma
+// samples are taken from the even pixels, matching the 2x2 subsampling of
+// the per-pixel capture path.
+void FillYUV420Span(uint8_t* y_row, uint8_t* cb_row, uint8_t* cr_row,
+                    uint32_t cbcr_step, size_t begin, size_t end,
+                    bool write_chroma, YUV420SpanValue value);
+
+// Write 'count' consecutive {first, second} byte pairs starting at 'dst'.
+// Used for interleaved (NV12/NV21) chroma planes.
+void FillInterleaved(uint8_t* dst, uint8_t first, uint8_t second,
+                     size_t count);
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_YUV_SPAN_FILL_H_